@@ -1,74 +1,360 @@
 //author: Marek Kozumplik, xkozum08
 #include "arg_parser.hpp"
 
+static const struct option long_options[] = {
+	{"batch", required_argument, NULL, 'b'},
+	{"window", required_argument, NULL, 'w'},
+	{"stats", optional_argument, NULL, OPT_STATS},
+	{"backend", required_argument, NULL, OPT_BACKEND},
+	{"threads", required_argument, NULL, OPT_THREADS},
+	{"cache", no_argument, NULL, OPT_CACHE},
+	{"cache-file", required_argument, NULL, OPT_CACHE_FILE},
+	{"cache-size", required_argument, NULL, OPT_CACHE_SIZE},
+	{"tcp", no_argument, NULL, OPT_TCP},
+	{"edns", optional_argument, NULL, OPT_EDNS},
+	{"hedge", optional_argument, NULL, OPT_HEDGE},
+	{"iterative", no_argument, NULL, OPT_ITERATIVE},
+	{"root-hints", required_argument, NULL, OPT_ROOT_HINTS},
+	{"listen", required_argument, NULL, OPT_LISTEN},
+	{"format", required_argument, NULL, OPT_FORMAT},
+	{"record", required_argument, NULL, OPT_RECORD},
+	{"replay", required_argument, NULL, OPT_REPLAY},
+	{"counters", required_argument, NULL, OPT_COUNTERS},
+	{"table", required_argument, NULL, OPT_TABLE},
+	{"help", no_argument, NULL, 'h'},
+	{NULL, 0, NULL, 0}};
+
+/// @brief fills arguments with the defaults of the command line
+/// @param args
+void init_arguments(struct parsed_arguments *args)
+{
+	args->port = DNS_PORT;
+	args->recursion = 0;
+	args->address_type = 0;
+	args->reverse = 0;
+	args->ip6 = 0;
+	args->qtype_cnt = 0;
+	args->server[0] = '\0';
+	args->hostname[0] = '\0';
+	args->batch_file[0] = '\0';
+	args->sweep = 0;
+	args->window = DEFAULT_WINDOW;
+	args->stats = 0;
+	args->stats_interval = 0;
+	args->server_cnt = 0;
+	args->backend = BACKEND_EPOLL;
+	args->threads = 1;
+	args->cache = 0;
+	args->tcp = 0;
+	args->edns = 0;
+	args->hedge = 0;
+	args->iterative = 0;
+	args->root_hints[0] = '\0';
+	args->listen[0] = '\0';
+	args->format = FORMAT_TEXT;
+	args->record[0] = '\0';
+	args->replay[0] = '\0';
+	args->counters[0] = '\0';
+	args->table[0] = '\0';
+	args->cache_file[0] = '\0';
+	args->cache_size = DEFAULT_CACHE_SIZE;
+}
+
+/// @brief parses the whole text as decimal number
+/// @param text
+/// @param value
+/// @return 0 on success, -1 if the text is not a number or it is out of range
+static int parse_number(const char *text, long *value)
+{
+	char *end;
+	errno = 0;
+	*value = strtol(text, &end, 10);
+	return (end == text || *end != '\0' || errno == ERANGE) ? -1 : 0;
+}
+
 /// @brief parses arguments and stores them into the allocated struct
 /// @param argc
 /// @param argv
 /// @param args
-void parse_arguments(int argc, char *argv[], struct parsed_arguments *args)
+/// @return 0 on success, -1 on invalid arguments (error is printed), 1 if help was printed
+int parse_arguments(int argc, char *argv[], struct parsed_arguments *args)
 {
 	int opt;
 	int non_opt_argc = 0;
-	while (optind < argc)
+	long number;
+	while ((opt = getopt_long(argc, argv, "rx6t:s:p:b:w:h", long_options, NULL)) != -1)
 	{
-		if ((opt = getopt(argc, argv, "rx6s:p:h")) != -1)
+		switch (opt)
 		{
-			switch (opt)
+		case 'r':
+			args->recursion = 1;
+			break;
+		case 'x':
+			args->reverse = 1;
+			break;
+		case '6':
+			args->ip6 = 1;
+			break;
+		case 't':
+			// comma separated list of types, all are sent at once
+			for (char *type = strtok(optarg, ","); type != NULL; type = strtok(NULL, ","))
 			{
-			case 'r':
-				args->recursion = 1;
-				break;
-			case 'x':
-				args->reverse = 1;
-				break;
-			case '6':
-				args->ip6 = 1;
-				break;
-			case 's':
-				strncpy(args->server, optarg, sizeof(args->server));
-				// args->server = (unsigned char*)optarg;
-				break;
-			case 'p':
-				args->port = std::stoi(optarg);
-				break;
-			case '?':
-				free(args);
-				exit(1);
-				break;
-			case 'h':
-				// TODO print help
-				std::cout << "Usage: dns [-r] [-x] [-6] -s server [-p port] address" << std::endl;
-				free(args);
-				exit(0);
-				break;
-			default:
-				break;
+				if (args->qtype_cnt == MAX_QTYPES)
+				{
+					std::cerr << "Too many types, maximum is " << MAX_QTYPES << std::endl;
+					return -1;
+				}
+				args->qtypes[args->qtype_cnt] = parse_qtype(type);
+				if (args->qtypes[args->qtype_cnt] < 0)
+				{
+					std::cerr << "Unknown type " << type << std::endl;
+					return -1;
+				}
+				args->qtype_cnt++;
 			}
-		}
-		else
-		{
-			// optind - index of next argument to be parsed
-			// we have only 1 non option argument - address
-			non_opt_argc += 1;
-			strncpy(args->hostname, argv[optind], sizeof(args->hostname) - 1);
-			// args->hostname = argv[optind];
-			if (non_opt_argc > 1)
+			break;
+		case 's':
+			// comma separated list of servers, -s can also be repeated
+			for (char *server = strtok(optarg, ","); server != NULL; server = strtok(NULL, ","))
+			{
+				if (args->server_cnt == MAX_SERVERS)
+				{
+					std::cerr << "Too many servers, maximum is " << MAX_SERVERS << std::endl;
+					return -1;
+				}
+				strncpy(args->servers[args->server_cnt], server, sizeof(args->servers[0]) - 1);
+				args->servers[args->server_cnt][sizeof(args->servers[0]) - 1] = '\0';
+				args->server_cnt++;
+			}
+			break;
+		case 'p':
+			if (parse_number(optarg, &number) < 0 || number < 1 || number > 65535)
+			{
+				std::cerr << "Port must be between 1 and 65535" << std::endl;
+				return -1;
+			}
+			args->port = number;
+			break;
+		case 'b':
+			strncpy(args->batch_file, optarg, sizeof(args->batch_file) - 1);
+			args->batch_file[sizeof(args->batch_file) - 1] = '\0';
+			break;
+		case 'w':
+			if (parse_number(optarg, &number) < 0 || number < 1 || number > MAX_WINDOW)
+			{
+				std::cerr << "Window must be between 1 and " << MAX_WINDOW << std::endl;
+				return -1;
+			}
+			args->window = number;
+			break;
+		case OPT_STATS:
+			args->stats = 1;
+			args->stats_interval = 0;
+			if (optarg != NULL)
+			{
+				if (parse_number(optarg, &number) < 0 || number < 1 || number > INT_MAX)
+				{
+					std::cerr << "Statistics interval must be at least 1 second" << std::endl;
+					return -1;
+				}
+				args->stats_interval = number;
+			}
+			break;
+		case OPT_BACKEND:
+			args->backend = parse_backend(optarg);
+			if (args->backend < 0)
+			{
+				std::cerr << "Unknown backend " << optarg << ", use epoll or uring" << std::endl;
+				return -1;
+			}
+			break;
+		case OPT_THREADS:
+			if (parse_number(optarg, &number) < 0 || number < 1 || number > MAX_THREADS)
+			{
+				std::cerr << "Threads must be between 1 and " << MAX_THREADS << std::endl;
+				return -1;
+			}
+			args->threads = number;
+			break;
+		case OPT_CACHE:
+			args->cache = 1;
+			break;
+		case OPT_CACHE_FILE:
+			args->cache = 1;
+			strncpy(args->cache_file, optarg, sizeof(args->cache_file) - 1);
+			args->cache_file[sizeof(args->cache_file) - 1] = '\0';
+			break;
+		case OPT_CACHE_SIZE:
+			if (parse_number(optarg, &number) < 0 || number < 1)
+			{
+				std::cerr << "Cache size must be positive" << std::endl;
+				return -1;
+			}
+			args->cache_size = number;
+			break;
+		case OPT_TCP:
+			args->tcp = 1;
+			break;
+		case OPT_EDNS:
+			number = EDNS_DEFAULT_SIZE;
+			if (optarg != NULL && parse_number(optarg, &number) < 0)
+			{
+				number = -1;
+			}
+			if (number < 512 || number > 65535)
+			{
+				std::cerr << "EDNS payload size must be between 512 and 65535" << std::endl;
+				return -1;
+			}
+			args->edns = number;
+			break;
+		case OPT_HEDGE:
+			number = HEDGE_DEFAULT_PERCENTILE;
+			if (optarg != NULL && parse_number(optarg, &number) < 0)
+			{
+				number = -1;
+			}
+			if (number < 1 || number > 99)
+			{
+				std::cerr << "Hedge percentile must be between 1 and 99" << std::endl;
+				return -1;
+			}
+			args->hedge = number;
+			break;
+		case OPT_ITERATIVE:
+			args->iterative = 1;
+			break;
+		case OPT_ROOT_HINTS:
+			args->iterative = 1;
+			strncpy(args->root_hints, optarg, sizeof(args->root_hints) - 1);
+			args->root_hints[sizeof(args->root_hints) - 1] = '\0';
+			break;
+		case OPT_FORMAT:
+			args->format = parse_format(optarg);
+			if (args->format < 0)
 			{
-				std::cerr << "Too many arguments" << std::endl;
-				free(args);
-				exit(1);
+				std::cerr << "Unknown format " << optarg << ", use text, jsonl or csv" << std::endl;
+				return -1;
 			}
-			optind++;
+			break;
+		case OPT_LISTEN:
+			strncpy(args->listen, optarg, sizeof(args->listen) - 1);
+			args->listen[sizeof(args->listen) - 1] = '\0';
+			break;
+		case OPT_RECORD:
+			strncpy(args->record, optarg, sizeof(args->record) - 1);
+			args->record[sizeof(args->record) - 1] = '\0';
+			break;
+		case OPT_REPLAY:
+			strncpy(args->replay, optarg, sizeof(args->replay) - 1);
+			args->replay[sizeof(args->replay) - 1] = '\0';
+			break;
+		case OPT_COUNTERS:
+			strncpy(args->counters, optarg, sizeof(args->counters) - 1);
+			args->counters[sizeof(args->counters) - 1] = '\0';
+			break;
+		case OPT_TABLE:
+			strncpy(args->table, optarg, sizeof(args->table) - 1);
+			args->table[sizeof(args->table) - 1] = '\0';
+			break;
+		case '?':
+			return -1;
+			break;
+		case 'h':
+			// TODO print help
+			std::cout << "Usage: dns [-r] [-x] [-6] -s server[,server...] [-p port] [--tcp] [--edns[=size]] address" << std::endl;
+			std::cout << "       dns [-r] -t type[,type...] -s server[,server...] [-p port] address" << std::endl;
+			std::cout << "       dns [-r] [-x] [-6] -s server [-p port] -b file [-w window] [--stats[=seconds]] [--backend epoll|uring] [--threads N]" << std::endl;
+			std::cout << "       dns [-r] -x -s server [-p port] prefix/length [-w window] [--stats[=seconds]] [--backend epoll|uring] [--threads N]" << std::endl;
+			std::cout << "Cache: [--cache] [--cache-file file] [--cache-size N]" << std::endl;
+			std::cout << "TCP: [--tcp] sends all queries over TCP, truncated UDP answers are always retried over TCP" << std::endl;
+			std::cout << "EDNS0: [--edns[=size]] adds OPT record with UDP payload size (default " << EDNS_DEFAULT_SIZE << ") to queries" << std::endl;
+			std::cout << "Hedging: [--hedge[=percentile]] sends the query also to second server when it is not answered in the percentile of RTT (default "
+					  << HEDGE_DEFAULT_PERCENTILE << ")" << std::endl;
+			std::cout << "Iterative: [--iterative] [--root-hints addr[:port],...] follows referrals from the root servers, -s is not used" << std::endl;
+			std::cout << "Output: [--format text|jsonl|csv] text sections (default), one JSON object per query or one CSV row per record" << std::endl;
+			std::cout << "Statistics: [--stats[=seconds]] prints counters and RTT percentiles at the end, with seconds also qps and percentiles of every interval" << std::endl;
+			std::cout << "Capture: [--record file] appends queries and their responses to the capture file" << std::endl;
+			std::cout << "Replay: dns --replay file [--format text|jsonl|csv] prints the captured responses and parser throughput, no queries are sent" << std::endl;
+			std::cout << "Counters: [--counters name] publishes live counters of batch or forwarder run in shared memory, read them with dnsstat name" << std::endl;
+			std::cout << "Table: [--table file] answers names of the table compiled by dnstable (blocked, static addresses) without querying" << std::endl;
+			std::cout << "Forwarder: dns -s server[,server...] --listen [address:]port [--cache-file file] [--cache-size N] [--stats[=seconds]]" << std::endl;
+			std::cout << "           answers UDP and TCP clients from cache, misses go to the servers (or --iterative)" << std::endl;
+			return 1;
+		default:
+			break;
 		}
 	}
 
+	if (args->qtype_cnt > 0 && (args->reverse || args->ip6 || args->batch_file[0] != '\0' || args->listen[0] != '\0' ||
+								args->replay[0] != '\0'))
+	{
+		// batch lines have their own type, the forwarder asks for the types of its clients
+		std::cerr << "-t cannot be used with -x, -6, -b, --listen and --replay" << std::endl;
+		return -1;
+	}
+
+	// getopt moved the non option arguments behind the options
+	for (; optind < argc; optind++)
+	{
+		// we have only 1 non option argument - address
+		non_opt_argc += 1;
+		strncpy(args->hostname, argv[optind], sizeof(args->hostname) - 1);
+		// args->hostname = argv[optind];
+		if (non_opt_argc > 1)
+		{
+			std::cerr << "Too many arguments" << std::endl;
+			return -1;
+		}
+	}
+
+	if (args->replay[0] != '\0')
+	{
+		// responses are read from the capture
+		if (non_opt_argc != 0 || args->batch_file[0] != '\0' || args->listen[0] != '\0')
+		{
+			std::cerr << "Address argument, -b and --listen cannot be used with --replay" << std::endl;
+			return -1;
+		}
+		return 0;
+	}
+
+	if (args->listen[0] != '\0')
+	{
+		// forwarder answers names asked by its clients
+		if (non_opt_argc != 0 || args->batch_file[0] != '\0')
+		{
+			std::cerr << "Address argument and -b cannot be used with --listen" << std::endl;
+			return -1;
+		}
+		return 0;
+	}
+
+	if (args->batch_file[0] != '\0')
+	{
+		// names are read from the batch file, address argument is not allowed
+		if (non_opt_argc != 0)
+		{
+			std::cerr << "Address argument cannot be used with -b" << std::endl;
+			return -1;
+		}
+		return 0;
+	}
+
+	if (non_opt_argc == 1 && args->reverse && strchr(args->hostname, '/') != NULL)
+	{
+		// -x with prefix, all its addresses are resolved like batch
+		args->sweep = 1;
+		return 0;
+	}
+
 	if (non_opt_argc != 1)
 	{
 		std::cerr << "Missing address argument" << std::endl;
-		free(args);
-		exit(1);
+		return -1;
 	}
 	// optind - index of next argument to be parsed
 	// we have only 1 non option argument - address
+	return 0;
 }
 
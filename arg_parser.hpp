@@ -1,11 +1,21 @@
 //author: Marek Kozumplik, xkozum08
 #pragma once
 #include "dns.hpp"
+#include <getopt.h>
+#include "event_loop.hpp"
+#include "workers.hpp"
+#include "printer.hpp"
+#include "encoder.hpp"
+
+/// @brief fills arguments with the defaults of the command line
+/// @param args
+void init_arguments(struct parsed_arguments *args);
 
 /// @brief parses arguments and stores them into the allocated struct
 /// @param argc 
 /// @param argv 
 /// @param args 
-void parse_arguments(int argc, char *argv[], struct parsed_arguments *args);
+/// @return 0 on success, -1 on invalid arguments (error is printed), 1 if help was printed
+int parse_arguments(int argc, char *argv[], struct parsed_arguments *args);
 
 
@@ -0,0 +1,416 @@
+// author: Marek Kozumplik, xkozum08
+#include "batch.hpp"
+#include "iterative.hpp"
+
+/// @brief reads next request from the batch file. Line format: name [type] [-x] [-6], # starts a comment
+/// @param file
+/// @param req
+/// @param args default flags from command line
+/// @param line_no number of read lines, updated
+/// @return 1 if request was read, 0 at the end of the file
+int read_batch_request(FILE *file, struct dns_query_request *req, struct parsed_arguments *args, unsigned long *line_no)
+{
+	char line[1024];
+	while (fgets(line, sizeof(line), file) != NULL)
+	{
+		(*line_no)++;
+		char *comment = strchr(line, '#');
+		if (comment != NULL)
+		{
+			*comment = '\0';
+		}
+
+		char *saveptr;
+		char *token = strtok_r(line, " \t\r\n", &saveptr);
+		if (token == NULL)
+		{
+			continue; // empty line
+		}
+		strncpy(req->name, token, sizeof(req->name) - 1);
+		req->name[sizeof(req->name) - 1] = '\0';
+		req->reverse = args->reverse;
+		req->qtype = (args->ip6) ? QTYPE_AAAA : QTYPE_A;
+		req->tag = *line_no;
+		req->qname_len = 0;
+
+		bool valid = true;
+		while ((token = strtok_r(NULL, " \t\r\n", &saveptr)) != NULL)
+		{
+			if (strcmp(token, "-x") == 0)
+			{
+				req->reverse = 1;
+			}
+			else if (strcmp(token, "-6") == 0)
+			{
+				req->qtype = QTYPE_AAAA;
+			}
+			else if ((req->qtype = parse_qtype(token)) < 0)
+			{
+				std::cerr << "Line " << *line_no << ": Unknown query type " << token << std::endl;
+				valid = false;
+				break;
+			}
+		}
+		if (valid)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/// @brief opens the batch file or prepares the sweep of the prefix
+/// @param src
+/// @param args
+/// @return 0 on success, -1 on error (error is printed)
+int source_open(struct query_source *src, struct parsed_arguments *args)
+{
+	src->line_no = 0;
+	src->file = NULL;
+	if (args->sweep)
+	{
+		src->kind = SOURCE_SWEEP;
+		return sweep_init(&src->sweep, args->hostname);
+	}
+	src->kind = SOURCE_FILE;
+	src->file = stdin;
+	if (strcmp(args->batch_file, "-") != 0)
+	{
+		src->file = fopen(args->batch_file, "r");
+		if (src->file == NULL)
+		{
+			perror("Error opening batch file");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/// @brief reads the next request from the source
+/// @param src
+/// @param req
+/// @param args
+/// @return 1 if the request was read, 0 at the end of the source
+int source_next(struct query_source *src, struct dns_query_request *req, struct parsed_arguments *args)
+{
+	if (src->kind == SOURCE_SWEEP)
+	{
+		return sweep_next(&src->sweep, req);
+	}
+	return read_batch_request(src->file, req, args, &src->line_no);
+}
+
+/// @brief closes the batch file
+/// @param src
+void source_close(struct query_source *src)
+{
+	if (src->file != NULL && src->file != stdin)
+	{
+		fclose(src->file);
+	}
+}
+
+/// @brief prints result of one batch query, used as resolver callback
+/// @param ctx batch_context
+/// @param req
+/// @param status
+/// @param msg
+/// @param msg_len
+/// @param view parsed msg
+void print_batch_result(void *ctx, struct dns_query_request *req, int status, unsigned char *msg, int msg_len,
+						const struct dns_message_view *view)
+{
+	struct batch_context *batch = (struct batch_context *)ctx;
+	bool text = batch->args->format == FORMAT_TEXT;
+	if (!text && status != QUERY_OK)
+	{
+		static const char *statuses[] = {"NOERROR", "TIMEOUT", "BAD_NAME", "CONNECTION_FAILED", "ITERATION_FAILED"};
+		if (format_failure(batch->out, batch->args, req, statuses[status]) < 0)
+		{
+			*batch->err << req->name << ": Error: Out of memory" << std::endl;
+		}
+		batch->failed++;
+		return;
+	}
+	switch (status)
+	{
+	case QUERY_OK:
+	{
+		int rcode = view->rcode;
+		if (rcode != 0 && text)
+		{
+			*batch->err << req->name << ": ";
+			print_rcode(rcode, *batch->err);
+			batch->failed++;
+			return;
+		}
+		if (view->parse_error != PARSE_OK)
+		{
+			if (text)
+			{
+				*batch->err << req->name << ": Error: Malformed response (" << parse_error_string(view->parse_error) << ")" << std::endl;
+			}
+			else if (format_failure(batch->out, batch->args, req, "MALFORMED") < 0)
+			{
+				*batch->err << req->name << ": Error: Out of memory" << std::endl;
+			}
+			batch->failed++;
+			return;
+		}
+		if (format_answer(batch->out, view, batch->args, req) < 0)
+		{
+			*batch->err << req->name << ": Error: Out of memory" << std::endl;
+			batch->failed++;
+			return;
+		}
+		if (rcode != 0)
+		{
+			batch->failed++;
+			return;
+		}
+		batch->answered++;
+		return;
+	}
+	case QUERY_TIMEOUT:
+		*batch->err << req->name << ": Error: No response from server" << std::endl;
+		break;
+	case QUERY_CONNECTION_FAILED:
+		*batch->err << req->name << ": Error: TCP connection to server failed" << std::endl;
+		break;
+	case QUERY_ITERATION_FAILED:
+		*batch->err << req->name << ": Error: Iterative resolution failed, no name server answered" << std::endl;
+		break;
+	default:
+		*batch->err << req->name << ": " << (req->reverse ? "Address is not IP type" : "Address is not domain type") << std::endl;
+		break;
+	}
+	batch->failed++;
+}
+
+/// @brief adds counters of the batch context and its resolver to stats
+/// @param stats
+/// @param batch
+/// @param res
+void collect_batch_stats(struct batch_stats *stats, struct batch_context *batch, struct resolver *res)
+{
+	unsigned long sent, received, syscalls;
+	resolver_io_stats(res, &sent, &received, &syscalls);
+	stats->answered += batch->answered;
+	stats->failed += batch->failed;
+	stats->timeouts += res->timeouts;
+	stats->retransmits += res->retransmits;
+	stats->hedged += res->hedged;
+	stats->hedge_wins += res->hedge_wins;
+	stats->submitted += res->submitted;
+	stats->coalesced += res->coalesced;
+	stats->table_hits += res->table_hits;
+	stats->sent += sent;
+	stats->received += received;
+	stats->syscalls += syscalls;
+	unsigned long tcp_queries, truncated, tcp_connects;
+	resolver_tcp_stats(res, &tcp_queries, &truncated, &tcp_connects);
+	stats->tcp_queries += tcp_queries;
+	stats->truncated += truncated;
+	stats->tcp_connects += tcp_connects;
+	// upstreams of iterative mode are authoritative servers, they are not listed
+	for (int i = 0; i < res->server_cnt && res->iter == NULL; i++)
+	{
+		stats->server_queries[i] += res->servers[i].queries;
+		stats->server_answered[i] += res->servers[i].answered;
+		stats->server_timeouts[i] += res->servers[i].timeouts;
+		stats->server_retransmits[i] += res->servers[i].retransmits;
+		if (res->servers[i].srtt_us > 0)
+		{
+			stats->server_srtt_us[i] += res->servers[i].srtt_us;
+			stats->server_srtt_cnt[i]++;
+		}
+	}
+	if (res->iter != NULL)
+	{
+		stats->referrals += res->iter->referrals;
+		stats->delegation_hits += res->iter->delegation_hits;
+		stats->glueless += res->iter->glueless;
+		stats->lame += res->iter->lame;
+	}
+	if (res->cache != NULL)
+	{
+		struct cache_shard *shard = &res->cache->shards[res->cache_shard];
+		stats->cache_hits += shard->hits;
+		stats->cache_negative_hits += shard->negative_hits;
+		stats->cache_misses += shard->misses;
+	}
+	if (res->latency != NULL)
+	{
+		latency_merge(&stats->latency, res->latency);
+	}
+}
+
+/// @brief prints summary of the batch run to stderr
+/// @param stats
+/// @param args
+void print_batch_stats(struct batch_stats *stats, struct parsed_arguments *args)
+{
+	unsigned long queries = stats->answered + stats->failed;
+	std::cerr << "Queries: " << queries << ", Answered: " << stats->answered << ", Failed: " << stats->failed
+			  << ", Timeouts: " << stats->timeouts << ", Retransmits: " << stats->retransmits << std::endl;
+	std::cerr << "Datagrams sent: " << stats->sent << ", received: " << stats->received
+			  << ", Syscalls: " << stats->syscalls << ", Syscalls per query: " << std::fixed << std::setprecision(3)
+			  << ((queries > 0) ? (double)stats->syscalls / queries : 0.0) << std::endl;
+	std::cerr << "Queries sent: " << stats->submitted << ", Coalesced: " << stats->coalesced << std::endl;
+	if (args->cache)
+	{
+		std::cerr << "Cache hits: " << stats->cache_hits << " (negative " << stats->cache_negative_hits
+				  << "), misses: " << stats->cache_misses << std::endl;
+	}
+	if (args->table[0] != '\0')
+	{
+		std::cerr << "Table hits: " << stats->table_hits << std::endl;
+	}
+	if (args->hedge)
+	{
+		std::cerr << "Hedged: " << stats->hedged << " (" << ((queries > 0) ? 100.0 * stats->hedged / queries : 0.0)
+				  << " % of queries), Won by hedge: " << stats->hedge_wins << std::endl;
+	}
+	if (args->tcp || stats->tcp_queries > 0)
+	{
+		std::cerr << "TCP queries: " << stats->tcp_queries << ", Truncated UDP answers: " << stats->truncated
+				  << ", Connections: " << stats->tcp_connects << std::endl;
+	}
+	if (args->iterative)
+	{
+		std::cerr << "Referrals: " << stats->referrals << ", Delegation cache hits: " << stats->delegation_hits
+				  << ", Glueless lookups: " << stats->glueless << ", Lame answers: " << stats->lame << std::endl;
+	}
+	for (int i = 0; i < args->server_cnt && args->server_cnt > 1; i++)
+	{
+		std::cerr << "  Server " << args->servers[i] << ": Queries: " << stats->server_queries[i]
+				  << ", Answered: " << stats->server_answered[i] << ", Timeouts: " << stats->server_timeouts[i]
+				  << ", Retransmits: " << stats->server_retransmits[i] << ", SRTT: ";
+		if (stats->server_srtt_cnt[i] > 0)
+		{
+			std::cerr << (double)stats->server_srtt_us[i] / stats->server_srtt_cnt[i] / 1000 << " ms" << std::endl;
+		}
+		else
+		{
+			std::cerr << "-" << std::endl;
+		}
+	}
+	print_latency(&stats->latency, args, queries, stats->elapsed_us, std::cerr);
+}
+
+/// @brief resolves all names from args->batch_file (or the -x prefix) with at most args->window queries in flight
+/// @param args
+/// @return 0 if all queries were answered, 1 otherwise
+int run_batch(struct parsed_arguments *args)
+{
+	struct query_source src;
+	if (source_open(&src, args) < 0)
+	{
+		return 1;
+	}
+
+	struct output_buffer out;
+	if (output_init(&out, OUTPUT_BUFFER_SIZE, STDOUT_FILENO) < 0 || format_header(&out, args) < 0)
+	{
+		std::cerr << "Error: Out of memory" << std::endl;
+		output_free(&out);
+		source_close(&src);
+		return 1;
+	}
+
+	struct batch_context batch;
+	batch.args = args;
+	batch.out = &out;
+	batch.err = &std::cerr;
+	batch.answered = 0;
+	batch.failed = 0;
+
+	struct dns_cache *cache = cache_open(args, 1);
+	struct resolver *res = (struct resolver *)malloc(sizeof(struct resolver));
+	if (res == NULL || resolver_init(res, args, print_batch_result, &batch) < 0)
+	{
+		free(res);
+		output_free(&out);
+		cache_close(cache, args);
+		source_close(&src);
+		return 1;
+	}
+	if (cache != NULL)
+	{
+		resolver_set_cache(res, cache, 0);
+	}
+
+	struct counters_segment counters;
+	counters.header = NULL;
+	if (args->counters[0] != '\0' && counters_create(&counters, args, 1, COUNTERS_BATCH) < 0)
+	{
+		resolver_free(res);
+		free(res);
+		output_free(&out);
+		cache_close(cache, args);
+		source_close(&src);
+		return 1;
+	}
+	struct latency_report report;
+	latency_report_init(&report, args->stats_interval);
+	bool input_left = true;
+	bool held = false; // req was refused by the full resolver, it is submitted again after the poll
+	struct dns_query_request req;
+	while (input_left || held || resolver_inflight(res) > 0)
+	{
+		// keep the window full, responses are matched by transaction id
+		while ((held || input_left) && resolver_inflight(res) < res->window)
+		{
+			if (!held && !source_next(&src, &req, args))
+			{
+				input_left = false;
+				break;
+			}
+			// -2: transmit queue or waiters are full
+			held = resolver_submit(res, &req) == -2;
+			if (held)
+			{
+				break;
+			}
+		}
+		if (resolver_inflight(res) > 0)
+		{
+			resolver_poll(res, held ? 1 : QUERY_TIMEOUT_MS);
+		}
+		else if (held)
+		{
+			resolver_flush(res);
+		}
+		if (res->latency != NULL)
+		{
+			latency_report_tick(&report, res->latency, batch.answered + batch.failed, "", std::cerr);
+		}
+		if (counters.header != NULL)
+		{
+			counters_publish(&counters.slots[0], res, batch.answered, batch.failed);
+		}
+	}
+	if (counters.header != NULL)
+	{
+		counters_publish(&counters.slots[0], res, batch.answered, batch.failed);
+		counters_close(&counters);
+	}
+	output_flush(&out);
+	output_free(&out);
+
+	if (args->stats)
+	{
+		struct batch_stats stats;
+		std::memset(&stats, 0, sizeof(stats));
+		collect_batch_stats(&stats, &batch, res);
+		stats.elapsed_us = now_us() - report.start_us;
+		print_batch_stats(&stats, args);
+		latency_free(&stats.latency);
+	}
+
+	resolver_free(res);
+	free(res);
+	cache_close(cache, args);
+	source_close(&src);
+	return (batch.failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,114 @@
+// author: Marek Kozumplik, xkozum08
+#pragma once
+#include "dns.hpp"
+#include "resolver.hpp"
+#include "printer.hpp"
+#include "sweep.hpp"
+#include "counters.hpp"
+
+#define SOURCE_FILE 0
+#define SOURCE_SWEEP 1
+
+// where the names of the batch come from: lines of the batch file or addresses of the -x prefix
+struct query_source
+{
+	int kind;
+	FILE *file;
+	unsigned long line_no;
+	struct reverse_sweep sweep;
+};
+
+struct batch_context
+{
+	struct parsed_arguments *args;
+	struct output_buffer *out; // results
+	std::ostream *err;		   // errors of single queries in text format, other formats have them in out
+	unsigned long answered; // responses with rcode 0
+	unsigned long failed;	// error rcode, timeout or invalid name
+};
+
+// counters of the whole run, summed over all resolvers
+struct batch_stats
+{
+	unsigned long answered;
+	unsigned long failed;
+	unsigned long timeouts;
+	unsigned long retransmits;
+	unsigned long hedged;
+	unsigned long hedge_wins;
+	unsigned long submitted; // queries sent to servers
+	unsigned long coalesced; // requests which waited for a query in flight instead of sending their own
+	unsigned long sent;
+	unsigned long received;
+	unsigned long syscalls;
+	unsigned long tcp_queries;
+	unsigned long truncated;
+	unsigned long tcp_connects;
+	unsigned long cache_hits;
+	unsigned long cache_negative_hits;
+	unsigned long cache_misses;
+	unsigned long table_hits;
+	unsigned long referrals;
+	unsigned long delegation_hits;
+	unsigned long glueless;
+	unsigned long lame;
+	unsigned long server_queries[MAX_SERVERS];
+	unsigned long server_answered[MAX_SERVERS];
+	unsigned long server_timeouts[MAX_SERVERS];
+	unsigned long server_retransmits[MAX_SERVERS];
+	long long server_srtt_us[MAX_SERVERS]; // sum over resolvers with RTT sample
+	int server_srtt_cnt[MAX_SERVERS];
+	struct latency_stats latency; // RTT histograms of all resolvers, freed by latency_free
+	long long elapsed_us;		  // duration of the run
+};
+
+/// @brief reads next request from the batch file. Line format: name [type] [-x] [-6], # starts a comment
+/// @param file
+/// @param req
+/// @param args default flags from command line
+/// @param line_no number of read lines, updated
+/// @return 1 if request was read, 0 at the end of the file
+int read_batch_request(FILE *file, struct dns_query_request *req, struct parsed_arguments *args, unsigned long *line_no);
+
+/// @brief opens the batch file or prepares the sweep of the prefix
+/// @param src
+/// @param args
+/// @return 0 on success, -1 on error (error is printed)
+int source_open(struct query_source *src, struct parsed_arguments *args);
+
+/// @brief reads the next request from the source
+/// @param src
+/// @param req
+/// @param args
+/// @return 1 if the request was read, 0 at the end of the source
+int source_next(struct query_source *src, struct dns_query_request *req, struct parsed_arguments *args);
+
+/// @brief closes the batch file
+/// @param src
+void source_close(struct query_source *src);
+
+/// @brief prints result of one batch query, used as resolver callback
+/// @param ctx batch_context
+/// @param req
+/// @param status
+/// @param msg
+/// @param msg_len
+/// @param view parsed msg
+void print_batch_result(void *ctx, struct dns_query_request *req, int status, unsigned char *msg, int msg_len,
+						const struct dns_message_view *view);
+
+/// @brief adds counters of the batch context and its resolver to stats
+/// @param stats
+/// @param batch
+/// @param res
+void collect_batch_stats(struct batch_stats *stats, struct batch_context *batch, struct resolver *res);
+
+/// @brief prints summary of the batch run to stderr
+/// @param stats
+/// @param args
+void print_batch_stats(struct batch_stats *stats, struct parsed_arguments *args);
+
+/// @brief resolves all names from args->batch_file (or the -x prefix) with at most args->window queries in flight
+/// @param args
+/// @return 0 if all queries were answered, 1 otherwise
+int run_batch(struct parsed_arguments *args);
@@ -0,0 +1,601 @@
+// author: Marek Kozumplik, xkozum08
+// Benchmarks of the hot paths and of the whole resolver against loopback responder, run with make bench
+#include "client.hpp"
+#include "encoder.hpp"
+#include "printer.hpp"
+#include "table.hpp"
+#include <regex>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <array>
+#include <thread>
+#include <fstream>
+
+#define BENCH_CORPUS 1024		  // responses in the parse and format benchmarks
+#define BENCH_E2E_QUERIES 200000  // queries of the end-to-end run with window
+#define BENCH_E2E_WINDOW 100
+#define BENCH_LATENCY_QUERIES 20000 // queries of the end-to-end run one by one
+#define BENCH_TOLERANCE 10		  // default -t, percent slower than the baseline which is a regression
+
+// result of one benchmark, written as one JSON line with -o
+struct bench_result
+{
+	std::string name;
+	long count;
+	double ns_per_op;
+	// end-to-end runs only
+	double qps;
+	double p50_us;
+	double p99_us;
+	double max_us;
+};
+
+static std::vector<struct bench_result> results;
+
+/// @brief original classifier with regex patterns, kept for comparison
+/// @param addr
+/// @return
+static int regex_address_type(const char *addr)
+{
+	std::regex ipv4Pattern(R"((\d{1,3}\.){3}\d{1,3})");
+	std::regex ipv6Pattern(R"(([0-9a-fA-F]{1,4}:){7,7}[0-9a-fA-F]{1,4}|([0-9a-fA-F]{1,4}:){1,7}(:[0-9a-fA-F]{1,4}){1,7}|([0-9a-fA-F]{1,4}:){1,7}:|::)");
+	std::regex domainPattern(R"(([a-zA-Z0-9](?:[a-zA-Z0-9-]{0,61}[a-zA-Z0-9])?\.)+[a-zA-Z]{2,})");
+	std::string server_str(addr);
+
+	if (std::regex_match(server_str, ipv4Pattern))
+	{
+		return TYPE_IP4;
+	}
+	else if (std::regex_match(server_str, ipv6Pattern))
+	{
+		return TYPE_IP6;
+	}
+	else if (std::regex_match(server_str, domainPattern))
+	{
+		return TYPE_DOMAIN;
+	}
+	return -1;
+}
+
+/// @brief creates inputs similar to batch files: mostly domain names, some addresses
+/// @param count
+/// @return
+static std::vector<std::string> make_inputs(int count)
+{
+	static const char *words[] = {"www", "mail", "api", "cdn", "static", "login", "example", "google", "vutbr", "fit", "my-shop", "img01"};
+	static const char *tlds[] = {"com", "cz", "net", "org", "info"};
+	std::vector<std::string> inputs;
+	unsigned int x = 12345;
+	for (int i = 0; i < count; i++)
+	{
+		x = x * 1103515245 + 12345;
+		std::string s;
+		switch (x % 10)
+		{
+		case 0:
+			s = std::to_string(x >> 24) + "." + std::to_string((x >> 16) & 255) + "." + std::to_string((x >> 8) & 255) + ".1";
+			break;
+		case 1:
+			s = "2001:db8::" + std::to_string(x % 10000);
+			break;
+		default:
+			for (unsigned int l = 0; l < 1 + (x >> 8) % 3; l++)
+			{
+				s += std::string(words[(x >> (12 + 4 * l)) % 12]) + ".";
+			}
+			s += tlds[(x >> 28) % 5];
+			if (x & 0x100)
+			{
+				s[0] = toupper(s[0]);
+			}
+			break;
+		}
+		inputs.push_back(s);
+	}
+	return inputs;
+}
+
+/// @brief calls the function count times with the call number and prints time per call
+/// @param name
+/// @param count
+/// @param fn
+/// @return sum of results, so the calls are not optimized out
+template <typename F>
+static long run(const char *name, long count, F fn)
+{
+	long sum = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (long i = 0; i < count; i++)
+	{
+		sum += fn(i);
+	}
+	double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+	std::cout << std::left << std::setw(28) << name << std::right << std::setw(10) << count << " inputs " << std::fixed << std::setprecision(1) << std::setw(10) << ns << " ns/input" << std::endl;
+	results.push_back({name, count, ns, 0, 0, 0, 0});
+	return sum;
+}
+
+/// @brief builds response to the query with address records of its name (AAAA for AAAA query, A otherwise)
+/// @param query query without OPT record
+/// @param query_len
+/// @param buf
+/// @param answers number of records
+/// @return length of the response
+static int make_response(const unsigned char *query, int query_len, unsigned char *buf, int answers)
+{
+	std::memcpy(buf, query, query_len);
+	int qtype = read_u16(&query[query_len - 4]);
+	int rdlen = (qtype == QTYPE_AAAA) ? 16 : 4;
+	buf[2] |= 0x80; // QR
+	buf[3] |= 0x80; // RA
+	buf[6] = 0;
+	buf[7] = answers;
+	int len = query_len;
+	for (int i = 0; i < answers; i++)
+	{
+		unsigned char rr[10] = {0xc0, 0x0c, 0, (unsigned char)(rdlen == 16 ? QTYPE_AAAA : QTYPE_A), 0, 1, 0, 0, 0x0e, 0x10};
+		std::memcpy(&buf[len], rr, sizeof(rr));
+		buf[len + 10] = 0;
+		buf[len + 11] = rdlen;
+		std::memset(&buf[len + 12], 0, rdlen);
+		buf[len + 12] = 10;
+		buf[len + 12 + rdlen - 1] = i + 1;
+		len += 12 + rdlen;
+	}
+	return len;
+}
+
+/// @brief answers every query on the socket until an empty datagram comes, runs in its own thread
+/// @param sock bound UDP socket
+static void loopback_responder(int sock)
+{
+	static unsigned char rx[64][MAX_QUERY_LEN];
+	static unsigned char tx[64][MAX_QUERY_LEN + 64];
+	struct mmsghdr rx_msgs[64];
+	struct mmsghdr tx_msgs[64];
+	struct iovec rx_iov[64];
+	struct iovec tx_iov[64];
+	struct sockaddr_storage peers[64];
+	for (int i = 0; i < 64; i++)
+	{
+		rx_iov[i] = {rx[i], sizeof(rx[i])};
+		std::memset(&rx_msgs[i], 0, sizeof(rx_msgs[i]));
+		rx_msgs[i].msg_hdr.msg_iov = &rx_iov[i];
+		rx_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	while (true)
+	{
+		for (int i = 0; i < 64; i++)
+		{
+			rx_msgs[i].msg_hdr.msg_name = &peers[i];
+			rx_msgs[i].msg_hdr.msg_namelen = sizeof(peers[i]);
+		}
+		int got = recvmmsg(sock, rx_msgs, 64, MSG_WAITFORONE, NULL);
+		if (got <= 0)
+		{
+			continue;
+		}
+		int cnt = 0;
+		for (int i = 0; i < got; i++)
+		{
+			int len = rx_msgs[i].msg_len;
+			if (len == 0)
+			{
+				return;
+			}
+			if (len < (int)sizeof(struct dns_header) + 5)
+			{
+				continue;
+			}
+			tx_iov[cnt] = {tx[cnt], (size_t)make_response(rx[i], len, tx[cnt], 1)};
+			std::memset(&tx_msgs[cnt], 0, sizeof(tx_msgs[cnt]));
+			tx_msgs[cnt].msg_hdr.msg_name = &peers[i];
+			tx_msgs[cnt].msg_hdr.msg_namelen = rx_msgs[i].msg_hdr.msg_namelen;
+			tx_msgs[cnt].msg_hdr.msg_iov = &tx_iov[cnt];
+			tx_msgs[cnt].msg_hdr.msg_iovlen = 1;
+			cnt++;
+		}
+		if (cnt > 0)
+		{
+			sendmmsg(sock, tx_msgs, cnt, 0);
+		}
+	}
+}
+
+// latencies of the end-to-end run
+struct e2e_context
+{
+	std::vector<long long> sent_us;
+	std::vector<long long> latency_us;
+	unsigned long failed;
+};
+
+/// @brief resolver callback of the end-to-end run
+/// @param ctx e2e_context
+/// @param req
+/// @param status
+/// @param msg
+/// @param msg_len
+/// @param view
+static void e2e_done(void *ctx, struct dns_query_request *req, int status, unsigned char *msg, int msg_len,
+					 const struct dns_message_view *view)
+{
+	struct e2e_context *e2e = (struct e2e_context *)ctx;
+	if (status != QUERY_OK)
+	{
+		e2e->failed++;
+		return;
+	}
+	e2e->latency_us.push_back(now_us() - e2e->sent_us[req->tag]);
+}
+
+/// @brief resolves unique names through the resolver against the responder and prints qps and latency
+/// @param name
+/// @param port port of the loopback responder
+/// @param count
+/// @param window
+/// @return 0 on success, -1 if the resolver failed
+static int run_e2e(const char *name, int port, long count, int window)
+{
+	struct parsed_arguments *args = new parsed_arguments();
+	args->recursion = 1;
+	args->port = port;
+	strcpy(args->servers[0], "127.0.0.1");
+	strcpy(args->server, args->servers[0]);
+	args->server_types[0] = TYPE_IP4;
+	args->server_cnt = 1;
+	args->backend = BACKEND_EPOLL;
+	args->window = window;
+	args->record[0] = '\0';
+	args->table[0] = '\0';
+
+	struct e2e_context e2e;
+	e2e.sent_us.resize(count);
+	e2e.latency_us.reserve(count);
+	e2e.failed = 0;
+	struct resolver *res = (struct resolver *)malloc(sizeof(struct resolver));
+	if (res == NULL || resolver_init(res, args, e2e_done, &e2e) < 0)
+	{
+		free(res);
+		delete args;
+		return -1;
+	}
+
+	struct dns_query_request req;
+	req.qtype = QTYPE_A;
+	req.reverse = 0;
+	req.qname_len = 0;
+	long next = 0;
+	long long start = now_us();
+	while (next < count || resolver_inflight(res) > 0)
+	{
+		while (next < count && resolver_inflight(res) < window)
+		{
+			// unique names, so nothing is coalesced
+			snprintf(req.name, sizeof(req.name), "n%ld.bench.example", next);
+			req.tag = next;
+			e2e.sent_us[next] = now_us();
+			if (resolver_submit(res, &req) == -2)
+			{
+				break; // transmit queue is full, the name is submitted again after the poll
+			}
+			next++;
+		}
+		resolver_poll(res, QUERY_TIMEOUT_MS);
+	}
+	double elapsed_us = now_us() - start;
+	resolver_free(res);
+	free(res);
+	delete args;
+
+	std::vector<long long> &lat = e2e.latency_us;
+	std::sort(lat.begin(), lat.end());
+	struct bench_result r;
+	r.name = name;
+	r.count = count;
+	r.ns_per_op = elapsed_us * 1000 / count;
+	r.qps = count * 1e6 / elapsed_us;
+	r.p50_us = lat.empty() ? 0 : lat[lat.size() / 2];
+	r.p99_us = lat.empty() ? 0 : lat[lat.size() * 99 / 100];
+	r.max_us = lat.empty() ? 0 : lat.back();
+	std::cout << std::left << std::setw(28) << name << std::right << std::setw(10) << count << " queries " << std::fixed
+			  << std::setprecision(0) << std::setw(9) << r.qps << " qps, p50 " << r.p50_us << " us, p99 " << r.p99_us
+			  << " us, max " << r.max_us << " us, failed " << e2e.failed << std::endl;
+	results.push_back(r);
+	return 0;
+}
+
+/// @brief writes the results as JSON Lines
+/// @param path
+/// @return 0 on success, -1 if the file cannot be written
+static int write_results(const char *path)
+{
+	std::ofstream file(path);
+	if (!file)
+	{
+		std::cerr << "Error: Cannot write " << path << std::endl;
+		return -1;
+	}
+	for (const struct bench_result &r : results)
+	{
+		file << "{\"name\":\"" << r.name << "\",\"count\":" << r.count << ",\"ns_per_op\":" << std::fixed << std::setprecision(2)
+			 << r.ns_per_op;
+		if (r.qps > 0)
+		{
+			file << ",\"qps\":" << r.qps << ",\"p50_us\":" << r.p50_us << ",\"p99_us\":" << r.p99_us << ",\"max_us\":" << r.max_us;
+		}
+		file << "}\n";
+	}
+	return 0;
+}
+
+/// @brief compares ns_per_op with results written by an earlier run
+/// @param path
+/// @param tolerance percent
+/// @return number of regressions, -1 if the baseline cannot be read
+static int compare_results(const char *path, double tolerance)
+{
+	std::ifstream file(path);
+	if (!file)
+	{
+		std::cerr << "Error: Cannot read " << path << std::endl;
+		return -1;
+	}
+	int regressions = 0;
+	std::string line;
+	std::cout << std::endl << std::left << std::setw(28) << "compared to baseline" << std::right << std::setw(12) << "baseline"
+			  << std::setw(12) << "current" << std::setw(10) << "change" << std::endl;
+	while (std::getline(file, line))
+	{
+		size_t name = line.find("\"name\":\"");
+		size_t ns = line.find("\"ns_per_op\":");
+		if (name == std::string::npos || ns == std::string::npos)
+		{
+			continue;
+		}
+		name += 8;
+		std::string key = line.substr(name, line.find('"', name) - name);
+		double before = atof(line.c_str() + ns + 12);
+		for (const struct bench_result &r : results)
+		{
+			if (r.name != key || before <= 0)
+			{
+				continue;
+			}
+			double change = r.ns_per_op / before - 1;
+			bool regression = change * 100 > tolerance;
+			regressions += regression;
+			std::cout << std::left << std::setw(28) << key << std::right << std::fixed << std::setprecision(1) << std::setw(12)
+					  << before << std::setw(12) << r.ns_per_op << std::setw(9) << change * 100 << "%"
+					  << (regression ? "  REGRESSION" : "") << std::endl;
+		}
+	}
+	return regressions;
+}
+
+int main(int argc, char *argv[])
+{
+	long count = 5000000;
+	const char *out_path = NULL;
+	const char *baseline = NULL;
+	double tolerance = BENCH_TOLERANCE;
+	bool e2e = true;
+	int opt;
+	while ((opt = getopt(argc, argv, "n:o:c:t:l")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			count = std::max(1000L, atol(optarg));
+			break;
+		case 'o':
+			out_path = optarg;
+			break;
+		case 'c':
+			baseline = optarg;
+			break;
+		case 't':
+			tolerance = atof(optarg);
+			break;
+		case 'l':
+			e2e = false;
+			break;
+		default:
+			std::cerr << "Usage: bench [-n count] [-o results.jsonl] [-c baseline.jsonl] [-t percent] [-l (no end-to-end runs)]" << std::endl;
+			return 1;
+		}
+	}
+	std::vector<std::string> inputs = make_inputs(100000);
+	unsigned char wire[NAME_WIRE_BUF];
+
+	// every input must be classified the same by the new and the old code
+	for (const std::string &s : inputs)
+	{
+		if (get_address_type(s.c_str()) != regex_address_type(s.c_str()))
+		{
+			std::cerr << "Mismatch: " << s << std::endl;
+			return 1;
+		}
+	}
+	std::vector<std::string> ip4_text;
+	std::vector<std::string> ip6_text;
+	std::vector<std::array<unsigned char, 16>> ip4_bin;
+	std::vector<std::array<unsigned char, 16>> ip6_bin;
+	for (const std::string &s : inputs)
+	{
+		std::array<unsigned char, 16> bin;
+		if (inet_pton(AF_INET, s.c_str(), bin.data()) == 1)
+		{
+			ip4_text.push_back(s);
+			ip4_bin.push_back(bin);
+		}
+		else if (inet_pton(AF_INET6, s.c_str(), bin.data()) == 1)
+		{
+			ip6_text.push_back(s);
+			ip6_bin.push_back(bin);
+		}
+	}
+
+	// responses with 1 to 4 address records, parsed once for the format benchmarks
+	std::vector<std::vector<unsigned char>> corpus;
+	std::vector<struct dns_query_request> corpus_req;
+	for (size_t i = 0; corpus.size() < BENCH_CORPUS && i < inputs.size(); i++)
+	{
+		struct dns_query_request req;
+		strcpy(req.name, inputs[i].c_str());
+		req.qtype = (corpus.size() % 3 == 2) ? QTYPE_AAAA : QTYPE_A;
+		req.reverse = 0;
+		req.tag = corpus.size();
+		req.qname_len = 0;
+		unsigned char query[MAX_QUERY_LEN];
+		unsigned char msg[MAX_QUERY_LEN + 256];
+		int query_len = build_dns_query(query, req.name, 0, req.qtype, 1, htons(i));
+		if (get_address_type(req.name) != TYPE_DOMAIN || query_len < 0)
+		{
+			continue;
+		}
+		int len = make_response(query, query_len, msg, 1 + corpus.size() % 4);
+		corpus.emplace_back(msg, msg + len);
+		corpus_req.push_back(req);
+	}
+	std::vector<struct dns_message_view> views(corpus.size());
+	for (size_t i = 0; i < corpus.size(); i++)
+	{
+		if (parse_dns_message(corpus[i].data(), corpus[i].size(), &views[i]) != PARSE_OK)
+		{
+			std::cerr << "Corpus message " << i << " does not parse" << std::endl;
+			return 1;
+		}
+	}
+
+	long sum = 0;
+	sum += run("regex get_address_type", std::max(1L, count / 1000), [&](long i)
+			   { return regex_address_type(inputs[i % inputs.size()].c_str()); });
+	sum += run("get_address_type", count, [&](long i)
+			   { return get_address_type(inputs[i % inputs.size()].c_str()); });
+	sum += run("convert_domain_scalar", count, [&](long i)
+			   { return convert_domain_to_dns_scalar(inputs[i % inputs.size()].c_str(), wire); });
+#ifdef __SSE2__
+	sum += run("convert_domain_sse2", count, [&](long i)
+			   { return convert_domain_to_dns_sse2(inputs[i % inputs.size()].c_str(), wire); });
+#endif
+	sum += run("encode_ip4_reverse", count, [&](long i)
+			   { return encode_ip4_reverse(ip4_bin[i % ip4_bin.size()].data(), wire); });
+	sum += run("encode_ip6_reverse", count, [&](long i)
+			   { return encode_ip6_reverse(ip6_bin[i % ip6_bin.size()].data(), wire); });
+	sum += run("convert_ip4_to_dns", count, [&](long i)
+			   { return convert_ip4_to_dns(ip4_text[i % ip4_text.size()].c_str(), wire); });
+	sum += run("convert_ip6_to_dns", count, [&](long i)
+			   { return convert_ip6_to_dns(ip6_text[i % ip6_text.size()].c_str(), wire); });
+	static struct dns_message_view view;
+	sum += run("parse_dns_message", count / 4, [&](long i)
+			   {
+				   const std::vector<unsigned char> &msg = corpus[i % corpus.size()];
+				   return parse_dns_message(msg.data(), msg.size(), &view) + view.record_cnt; });
+
+	// every other domain name is in the table, subdomain rules make misses look up also the parent names
+	char list_path[] = "/tmp/bench_table.XXXXXX";
+	int list_fd = mkstemp(list_path);
+	std::string table_path = std::string(list_path) + ".tbl";
+	std::vector<std::vector<unsigned char>> table_names[2];
+	std::ofstream list(list_path);
+	for (const std::string &s : inputs)
+	{
+		int len = convert_domain_to_dns(s.c_str(), wire);
+		if (len > 0)
+		{
+			bool listed = table_names[0].size() <= table_names[1].size();
+			table_names[listed ? 0 : 1].emplace_back(wire, wire + len);
+			list << (listed ? "10.0.0.1 " : "*.sub.") << s << "\n";
+		}
+	}
+	list.close();
+	struct dns_table table;
+	struct table_compile_stats table_stats;
+	if (list_fd < 0 || table_compile({list_path}, TABLE_DEFAULT_TTL, table_path.c_str(), &table_stats) < 0 ||
+		table_open(&table, table_path.c_str()) < 0)
+	{
+		std::cerr << "Error: Cannot compile the table" << std::endl;
+		return 1;
+	}
+	close(list_fd);
+	unlink(list_path);
+	unlink(table_path.c_str());
+	const char *table_runs[] = {"table_lookup_hit", "table_lookup_miss"};
+	for (int k = 0; k < 2; k++)
+	{
+		sum += run(table_runs[k], count, [&](long i)
+				   {
+					   const std::vector<unsigned char> &name = table_names[k][i % table_names[k].size()];
+					   return table_lookup(&table, name.data(), name.size()) != NULL; });
+	}
+	table_close(&table);
+
+	// formatted output goes to /dev/null in full buffers like to stdout
+	struct parsed_arguments *args = new parsed_arguments();
+	struct output_buffer out;
+	int null_fd = open("/dev/null", O_WRONLY);
+	if (null_fd < 0 || output_init(&out, OUTPUT_BUFFER_SIZE, null_fd) < 0)
+	{
+		std::cerr << "Error: Cannot open /dev/null" << std::endl;
+		return 1;
+	}
+	const char *format_names[] = {"format_answer_text", "format_answer_jsonl", "format_answer_csv"};
+	for (int format = FORMAT_TEXT; format <= FORMAT_CSV; format++)
+	{
+		args->format = format;
+		sum += run(format_names[format], count / 4, [&](long i)
+				   {
+					   size_t n = i % corpus.size();
+					   format_answer(&out, &views[n], args, &corpus_req[n]);
+					   return (long)out.len; });
+	}
+	output_flush(&out);
+	output_free(&out);
+	close(null_fd);
+	delete args;
+
+	if (e2e)
+	{
+		int sock = socket(AF_INET, SOCK_DGRAM, 0);
+		struct sockaddr_in addr;
+		socklen_t addr_len = sizeof(addr);
+		std::memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (sock < 0 || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+			getsockname(sock, (struct sockaddr *)&addr, &addr_len) < 0)
+		{
+			perror("Error opening loopback responder");
+			return 1;
+		}
+		std::thread responder(loopback_responder, sock);
+		int port = ntohs(addr.sin_port);
+		int failed = run_e2e("e2e_udp_window", port, BENCH_E2E_QUERIES, BENCH_E2E_WINDOW);
+		failed |= run_e2e("e2e_udp_serial", port, BENCH_LATENCY_QUERIES, 1);
+		// empty datagram stops the responder
+		sendto(sock, "", 0, 0, (struct sockaddr *)&addr, addr_len);
+		responder.join();
+		close(sock);
+		if (failed < 0)
+		{
+			std::cerr << "Error: End-to-end run failed" << std::endl;
+			return 1;
+		}
+	}
+
+	if (out_path != NULL && write_results(out_path) < 0)
+	{
+		return 1;
+	}
+	if (baseline != NULL)
+	{
+		int regressions = compare_results(baseline, tolerance);
+		if (regressions != 0)
+		{
+			return 2;
+		}
+	}
+	return sum == 0 ? 1 : 0;
+}
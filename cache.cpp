@@ -0,0 +1,565 @@
+// author: Marek Kozumplik, xkozum08
+#include "cache.hpp"
+
+
+/// @brief allocates empty cache
+/// @param cache
+/// @param shard_cnt one shard for every thread
+/// @param max_entries limit of the whole cache
+/// @return 0 on success, -1 if out of memory
+int cache_init(struct dns_cache *cache, int shard_cnt, size_t max_entries)
+{
+	cache->shard_cnt = shard_cnt;
+	cache->snapshot = NULL;
+	cache->snapshot_size = 0;
+	cache->shards = (struct cache_shard *)calloc(shard_cnt, sizeof(struct cache_shard));
+	if (cache->shards == NULL)
+	{
+		return -1;
+	}
+
+	size_t per_shard = std::max((size_t)1, max_entries / shard_cnt);
+	size_t bucket_cnt = 1024;
+	while (bucket_cnt < per_shard)
+	{
+		bucket_cnt *= 2;
+	}
+	for (int i = 0; i < shard_cnt; i++)
+	{
+		struct cache_shard *shard = &cache->shards[i];
+		shard->max_entries = per_shard;
+		shard->bucket_cnt = bucket_cnt;
+		shard->buckets = (struct cache_entry **)calloc(bucket_cnt, sizeof(struct cache_entry *));
+		if (shard->buckets == NULL)
+		{
+			cache_free(cache);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/// @brief frees all entries and unmaps the snapshot
+/// @param cache
+void cache_free(struct dns_cache *cache)
+{
+	for (int i = 0; i < cache->shard_cnt; i++)
+	{
+		struct cache_shard *shard = &cache->shards[i];
+		for (size_t b = 0; shard->buckets != NULL && b < shard->bucket_cnt; b++)
+		{
+			struct cache_entry *entry = shard->buckets[b];
+			while (entry != NULL)
+			{
+				struct cache_entry *next = entry->next;
+				free(entry);
+				entry = next;
+			}
+		}
+		free(shard->buckets);
+	}
+	free(cache->shards);
+	if (cache->snapshot != NULL)
+	{
+		munmap((void *)cache->snapshot, cache->snapshot_size);
+	}
+}
+
+/// @brief returns TTL the response may be cached for. Negative responses (NXDOMAIN, NODATA) use
+/// the SOA record from authority section as RFC 2308 describes
+/// @param view parsed response
+/// @return TTL in seconds, 0 if the response must not be cached
+int cacheable_ttl(const struct dns_message_view *view)
+{
+	if (view->parse_error != PARSE_OK || view->tc || (view->rcode != 0 && view->rcode != 3))
+	{
+		return 0;
+	}
+
+	uint32_t min_ttl = CACHE_MAX_TTL;
+	uint32_t negative_ttl = 0;
+	for (int i = 0; i < view->ans_count + view->auth_count; i++)
+	{
+		const struct dns_record_view *record = &view->records[i];
+		if (record->section == SECTION_ANSWER)
+		{
+			min_ttl = std::min(min_ttl, record->ttl);
+		}
+		else if (record->type == QTYPE_SOA && record->rdata_len >= 22)
+		{
+			// negative TTL is the smaller of SOA TTL and SOA MINIMUM (last field of the record)
+			negative_ttl = std::min(record->ttl, read_u32(&view->msg[record->rdata_off + record->rdata_len - 4]));
+		}
+	}
+
+	if (view->rcode == 0 && view->ans_count > 0)
+	{
+		return min_ttl;
+	}
+	// NXDOMAIN or NODATA without SOA must not be cached
+	return std::min(negative_ttl, (uint32_t)CACHE_MAX_TTL);
+}
+
+/// @brief decreases TTLs of all records (except OPT) in the message and in its view by age
+/// @param msg message the view was parsed from
+/// @param view
+/// @param age seconds spent in cache
+static void age_ttls(unsigned char *msg, struct dns_message_view *view, uint32_t age)
+{
+	for (int i = 0; i < view->record_cnt; i++)
+	{
+		struct dns_record_view *record = &view->records[i];
+		if (record->type != QTYPE_OPT)
+		{
+			record->ttl = (record->ttl > age) ? record->ttl - age : 0;
+			unsigned char *p = &msg[record->rdata_off - 6];
+			p[0] = record->ttl >> 24;
+			p[1] = record->ttl >> 16;
+			p[2] = record->ttl >> 8;
+			p[3] = record->ttl;
+		}
+	}
+}
+
+/// @brief copies the question of the query (lower case qname, qtype, qclass) to key
+/// @param query
+/// @param query_len
+/// @param key buffer of at least 260 bytes
+/// @return length of the key or -1 if the query is malformed
+static int question_key(unsigned char *query, int query_len, unsigned char *key)
+{
+	int start = sizeof(struct dns_header);
+	int end = skip_dns_name(query, query_len, start);
+	if (end < 0 || end + (int)sizeof(struct dns_question) > query_len)
+	{
+		return -1;
+	}
+	for (int i = start; i < end; i++)
+	{
+		key[i - start] = tolower(query[i]);
+	}
+	// qtype and qclass are numbers, only the name is case insensitive
+	std::memcpy(&key[end - start], &query[end], sizeof(struct dns_question));
+	return end + sizeof(struct dns_question) - start;
+}
+
+/// @brief FNV-1a hash of the key
+/// @param key
+/// @param key_len
+/// @return
+uint32_t key_hash(const unsigned char *key, int key_len)
+{
+	uint32_t hash = 2166136261u;
+	for (int i = 0; i < key_len; i++)
+	{
+		hash = (hash ^ key[i]) * 16777619u;
+	}
+	return hash;
+}
+
+/// @brief finds the entry with the key in the shard
+/// @param shard
+/// @param hash
+/// @param key
+/// @param key_len
+/// @return pointer to the link pointing to the entry (for removal), the link points to NULL if not found
+static struct cache_entry **find_entry(struct cache_shard *shard, uint32_t hash, const unsigned char *key, int key_len)
+{
+	struct cache_entry **link = &shard->buckets[hash & (shard->bucket_cnt - 1)];
+	while (*link != NULL)
+	{
+		struct cache_entry *entry = *link;
+		if (entry->hash == hash && entry->key_len == key_len && std::memcmp(entry->data, key, key_len) == 0)
+		{
+			break;
+		}
+		link = &entry->next;
+	}
+	return link;
+}
+
+/// @brief finds the record with the key in the mapped snapshot
+/// @param cache
+/// @param hash
+/// @param key
+/// @param key_len
+/// @return record or NULL
+static const struct snapshot_record *find_snapshot_record(struct dns_cache *cache, uint32_t hash, const unsigned char *key, int key_len)
+{
+	if (cache->snapshot == NULL)
+	{
+		return NULL;
+	}
+	const struct snapshot_header *header = (const struct snapshot_header *)cache->snapshot;
+	const uint32_t *buckets = (const uint32_t *)(cache->snapshot + sizeof(struct snapshot_header));
+	uint32_t off = buckets[hash & (header->bucket_cnt - 1)];
+	while (off != 0)
+	{
+		if (off + sizeof(struct snapshot_record) > cache->snapshot_size)
+		{
+			return NULL;
+		}
+		const struct snapshot_record *record = (const struct snapshot_record *)(cache->snapshot + off);
+		if (off + sizeof(struct snapshot_record) + record->key_len + record->msg_len > cache->snapshot_size)
+		{
+			return NULL;
+		}
+		if (record->hash == hash && record->key_len == key_len && std::memcmp(record + 1, key, key_len) == 0)
+		{
+			return record;
+		}
+		off = record->next;
+	}
+	return NULL;
+}
+
+/// @brief copies the cached response to result, sets id of the query, parses it and ages the TTLs
+/// @param result
+/// @param view
+/// @param query
+/// @param msg
+/// @param msg_len
+/// @param stored
+/// @param now
+/// @param shard
+/// @return msg_len
+static int copy_cached(unsigned char *result, struct dns_message_view *view, unsigned char *query, const unsigned char *msg,
+					   int msg_len, int64_t stored, int64_t now, struct cache_shard *shard)
+{
+	unsigned short id = ((struct dns_header *)query)->id; // result may be the query buffer
+	std::memcpy(result, msg, msg_len);
+	struct dns_header *dns = (struct dns_header *)result;
+	dns->id = id;
+	if (parse_dns_message(result, msg_len, view) == PARSE_OK)
+	{
+		age_ttls(result, view, (uint32_t)(now - stored));
+	}
+	if (dns->rcode != 0 || dns->ans_count == 0)
+	{
+		shard->negative_hits++;
+	}
+	shard->hits++;
+	return msg_len;
+}
+
+/// @brief finds the response to the query, TTLs in the result are decreased by the time spent in cache
+/// @param cache
+/// @param shard_index
+/// @param query query message, its id is copied to the result
+/// @param query_len
+/// @param result buffer of 65536 bytes
+/// @param view the response in result is parsed into it
+/// @return length of the response in result, 0 if not found
+int cache_lookup(struct dns_cache *cache, int shard_index, unsigned char *query, int query_len, unsigned char *result,
+				 struct dns_message_view *view)
+{
+	struct cache_shard *shard = &cache->shards[shard_index];
+	unsigned char key[260];
+	int key_len = question_key(query, query_len, key);
+	if (key_len < 0)
+	{
+		return 0;
+	}
+	uint32_t hash = key_hash(key, key_len);
+	int64_t now = time(NULL);
+
+	struct cache_entry **link = find_entry(shard, hash, key, key_len);
+	struct cache_entry *entry = *link;
+	if (entry != NULL)
+	{
+		if (entry->expires > now)
+		{
+			return copy_cached(result, view, query, &entry->data[entry->key_len], entry->msg_len, entry->stored, now, shard);
+		}
+		*link = entry->next;
+		free(entry);
+		shard->entries--;
+	}
+
+	const struct snapshot_record *record = find_snapshot_record(cache, hash, key, key_len);
+	if (record != NULL && record->expires > now)
+	{
+		const unsigned char *msg = (const unsigned char *)(record + 1) + record->key_len;
+		return copy_cached(result, view, query, msg, record->msg_len, record->stored, now, shard);
+	}
+	shard->misses++;
+	return 0;
+}
+
+/// @brief stores the response to the query if it is cacheable
+/// @param cache
+/// @param shard_index
+/// @param query
+/// @param query_len
+/// @param view parsed response
+void cache_store(struct dns_cache *cache, int shard_index, unsigned char *query, int query_len, const struct dns_message_view *view)
+{
+	int ttl = cacheable_ttl(view);
+	int msg_len = view->len;
+	if (ttl <= 0 || msg_len > 65535)
+	{
+		return;
+	}
+	struct cache_shard *shard = &cache->shards[shard_index];
+	unsigned char key[260];
+	int key_len = question_key(query, query_len, key);
+	if (key_len < 0)
+	{
+		return;
+	}
+	uint32_t hash = key_hash(key, key_len);
+
+	struct cache_entry **link = find_entry(shard, hash, key, key_len);
+	if (*link != NULL)
+	{
+		struct cache_entry *old = *link;
+		*link = old->next;
+		free(old);
+		shard->entries--;
+	}
+
+	struct cache_entry *entry = (struct cache_entry *)malloc(sizeof(struct cache_entry) + key_len + msg_len);
+	if (entry == NULL)
+	{
+		return;
+	}
+	entry->hash = hash;
+	entry->stored = time(NULL);
+	entry->expires = entry->stored + ttl;
+	entry->key_len = key_len;
+	entry->msg_len = msg_len;
+	std::memcpy(entry->data, key, key_len);
+	std::memcpy(&entry->data[key_len], view->msg, msg_len);
+	struct cache_entry **bucket = &shard->buckets[hash & (shard->bucket_cnt - 1)];
+	entry->next = *bucket;
+	*bucket = entry;
+	shard->entries++;
+
+	// shard is full, drop chains going around the buckets. The new entry is kept, in its own bucket the entry
+	// behind it goes, so the loop ends even when all entries share the bucket
+	while (shard->entries > shard->max_entries)
+	{
+		struct cache_entry **victim = &shard->buckets[shard->clock_hand++ & (shard->bucket_cnt - 1)];
+		if (*victim == entry)
+		{
+			victim = &entry->next;
+		}
+		if (*victim != NULL)
+		{
+			struct cache_entry *old = *victim;
+			*victim = old->next;
+			free(old);
+			shard->entries--;
+		}
+	}
+}
+
+/// @brief creates the cache when --cache or --cache-file is used and loads the snapshot
+/// @param args
+/// @param shard_cnt
+/// @return cache or NULL if the cache is not used
+struct dns_cache *cache_open(struct parsed_arguments *args, int shard_cnt)
+{
+	if (!args->cache)
+	{
+		return NULL;
+	}
+	struct dns_cache *cache = (struct dns_cache *)malloc(sizeof(struct dns_cache));
+	if (cache == NULL || cache_init(cache, shard_cnt, args->cache_size) < 0)
+	{
+		std::cerr << "Error: Out of memory, cache is not used" << std::endl;
+		free(cache);
+		return NULL;
+	}
+	if (args->cache_file[0] != '\0')
+	{
+		cache_load_snapshot(cache, args->cache_file);
+	}
+	return cache;
+}
+
+/// @brief saves the snapshot (--cache-file) and frees the cache
+/// @param cache may be NULL
+/// @param args
+void cache_close(struct dns_cache *cache, struct parsed_arguments *args)
+{
+	if (cache == NULL)
+	{
+		return;
+	}
+	if (args->cache_file[0] != '\0')
+	{
+		cache_save_snapshot(cache, args->cache_file);
+	}
+	cache_free(cache);
+	free(cache);
+}
+
+/// @brief maps the snapshot file, missing or invalid file is ignored
+/// @param cache
+/// @param path
+/// @return 0 if the snapshot was loaded, -1 otherwise
+int cache_load_snapshot(struct dns_cache *cache, const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return -1;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct snapshot_header))
+	{
+		close(fd);
+		return -1;
+	}
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		return -1;
+	}
+
+	const struct snapshot_header *header = (const struct snapshot_header *)map;
+	if (header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION || header->bucket_cnt == 0 ||
+		(header->bucket_cnt & (header->bucket_cnt - 1)) != 0 ||
+		sizeof(struct snapshot_header) + (size_t)header->bucket_cnt * sizeof(uint32_t) > (size_t)st.st_size)
+	{
+		std::cerr << "Warning: Invalid cache snapshot " << path << std::endl;
+		munmap(map, st.st_size);
+		return -1;
+	}
+	cache->snapshot = (const unsigned char *)map;
+	cache->snapshot_size = st.st_size;
+	return 0;
+}
+
+/// @brief appends the record to the snapshot image
+/// @param image
+/// @param bucket_cnt
+/// @param hash
+/// @param stored
+/// @param expires
+/// @param key
+/// @param key_len
+/// @param msg
+/// @param msg_len
+static void append_record(std::vector<unsigned char> &image, uint32_t bucket_cnt, uint32_t hash, int64_t stored, int64_t expires,
+						  const unsigned char *key, int key_len, const unsigned char *msg, int msg_len)
+{
+	uint32_t off = image.size();
+	struct snapshot_record record;
+	std::memset(&record, 0, sizeof(record));
+	uint32_t *buckets = (uint32_t *)&image[sizeof(struct snapshot_header)];
+	record.next = buckets[hash & (bucket_cnt - 1)];
+	buckets[hash & (bucket_cnt - 1)] = off;
+	record.hash = hash;
+	record.stored = stored;
+	record.expires = expires;
+	record.key_len = key_len;
+	record.msg_len = msg_len;
+
+	size_t size = sizeof(record) + key_len + msg_len;
+	image.resize(off + ((size + 7) & ~(size_t)7));
+	std::memcpy(&image[off], &record, sizeof(record));
+	std::memcpy(&image[off + sizeof(record)], key, key_len);
+	std::memcpy(&image[off + sizeof(record) + key_len], msg, msg_len);
+}
+
+/// @brief writes all valid entries from memory and the loaded snapshot to the file
+/// @param cache
+/// @param path
+/// @return 0 on success, -1 on error
+int cache_save_snapshot(struct dns_cache *cache, const char *path)
+{
+	int64_t now = time(NULL);
+	size_t count = 0;
+	for (int i = 0; i < cache->shard_cnt; i++)
+	{
+		count += cache->shards[i].entries;
+	}
+	if (cache->snapshot != NULL)
+	{
+		count += ((const struct snapshot_header *)cache->snapshot)->record_cnt;
+	}
+	uint32_t bucket_cnt = 16;
+	while (bucket_cnt < count)
+	{
+		bucket_cnt *= 2;
+	}
+
+	std::vector<unsigned char> image(sizeof(struct snapshot_header) + bucket_cnt * sizeof(uint32_t), 0);
+	uint32_t records = 0;
+	for (int i = 0; i < cache->shard_cnt; i++)
+	{
+		struct cache_shard *shard = &cache->shards[i];
+		for (size_t b = 0; b < shard->bucket_cnt; b++)
+		{
+			for (struct cache_entry *entry = shard->buckets[b]; entry != NULL; entry = entry->next)
+			{
+				if (entry->expires > now)
+				{
+					append_record(image, bucket_cnt, entry->hash, entry->stored, entry->expires, entry->data, entry->key_len,
+								  &entry->data[entry->key_len], entry->msg_len);
+					records++;
+				}
+			}
+		}
+	}
+
+	// records of the old snapshot which were not replaced by newer responses
+	if (cache->snapshot != NULL)
+	{
+		const struct snapshot_header *old = (const struct snapshot_header *)cache->snapshot;
+		const uint32_t *buckets = (const uint32_t *)(cache->snapshot + sizeof(struct snapshot_header));
+		for (uint32_t b = 0; b < old->bucket_cnt; b++)
+		{
+			for (uint32_t off = buckets[b]; off != 0;)
+			{
+				const struct snapshot_record *record = (const struct snapshot_record *)(cache->snapshot + off);
+				if (off + sizeof(struct snapshot_record) > cache->snapshot_size ||
+					off + sizeof(struct snapshot_record) + record->key_len + record->msg_len > cache->snapshot_size)
+				{
+					break;
+				}
+				const unsigned char *key = (const unsigned char *)(record + 1);
+				bool in_memory = false;
+				for (int i = 0; i < cache->shard_cnt && !in_memory; i++)
+				{
+					in_memory = *find_entry(&cache->shards[i], record->hash, key, record->key_len) != NULL;
+				}
+				if (!in_memory && record->expires > now)
+				{
+					append_record(image, bucket_cnt, record->hash, record->stored, record->expires, key, record->key_len,
+								  key + record->key_len, record->msg_len);
+					records++;
+				}
+				off = record->next;
+			}
+		}
+	}
+
+	struct snapshot_header *header = (struct snapshot_header *)&image[0];
+	header->magic = SNAPSHOT_MAGIC;
+	header->version = SNAPSHOT_VERSION;
+	header->bucket_cnt = bucket_cnt;
+	header->record_cnt = records;
+	header->created = now;
+
+	// write to temporary file and rename, the old snapshot may still be mapped
+	std::string tmp = std::string(path) + ".tmp";
+	FILE *file = fopen(tmp.c_str(), "wb");
+	if (file == NULL)
+	{
+		perror("Error writing cache snapshot");
+		return -1;
+	}
+	bool ok = fwrite(image.data(), 1, image.size(), file) == image.size();
+	ok = (fclose(file) == 0) && ok;
+	if (!ok || rename(tmp.c_str(), path) < 0)
+	{
+		perror("Error writing cache snapshot");
+		unlink(tmp.c_str());
+		return -1;
+	}
+	return 0;
+}
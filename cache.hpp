@@ -0,0 +1,148 @@
+// author: Marek Kozumplik, xkozum08
+#pragma once
+#include "dns.hpp"
+#include "parser.hpp"
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+#include <string>
+
+#define DEFAULT_CACHE_SIZE 1000000 // max number of entries of the whole cache
+#define CACHE_MAX_TTL 86400		   // longer TTLs are shortened to one day
+
+#define SNAPSHOT_MAGIC 0x43534e44 // "DNSC"
+#define SNAPSHOT_VERSION 1
+
+struct cache_entry
+{
+	struct cache_entry *next; // hash chain
+	uint32_t hash;
+	int64_t stored;	  // unix time when the response was received
+	int64_t expires;  // unix time when the entry must not be used anymore
+	uint16_t key_len; // key is the question: qname in wire format (lower case), qtype, qclass
+	uint16_t msg_len;
+	unsigned char data[]; // key followed by the response
+};
+
+struct cache_shard
+{
+	struct cache_entry **buckets;
+	size_t bucket_cnt;
+	size_t entries;
+	size_t max_entries;
+	size_t clock_hand; // next bucket to evict from when the shard is full
+	unsigned long hits;
+	unsigned long negative_hits;
+	unsigned long misses;
+};
+
+/*
+	Snapshot file, all numbers in host byte order, records are 8 byte aligned, offsets limit the file to 4 GiB
+
+	+------------------------------------------+
+	| snapshot_header                          |
+	+------------------------------------------+
+	| uint32_t buckets[bucket_cnt]             |  offset of the first record of the chain, 0 - empty
+	+------------------------------------------+
+	| snapshot_record, key, response, padding  |
+	| ...                                      |
+	+------------------------------------------+
+
+	The file is mmap'd and searched in place, loading does not depend on the number of records.
+*/
+struct snapshot_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t bucket_cnt;
+	uint32_t record_cnt;
+	int64_t created;
+};
+
+struct snapshot_record
+{
+	uint32_t next; // offset of the next record in the chain, 0 - end
+	uint32_t hash;
+	int64_t stored;
+	int64_t expires;
+	uint16_t key_len;
+	uint16_t msg_len;
+	uint32_t reserved;
+};
+
+// shard i is used only by the worker thread i, so the shards need no locks
+struct dns_cache
+{
+	struct cache_shard *shards;
+	int shard_cnt;
+
+	const unsigned char *snapshot; // read only mapping of the snapshot file, NULL if not loaded
+	size_t snapshot_size;
+};
+
+/// @brief allocates empty cache
+/// @param cache
+/// @param shard_cnt one shard for every thread
+/// @param max_entries limit of the whole cache
+/// @return 0 on success, -1 if out of memory
+int cache_init(struct dns_cache *cache, int shard_cnt, size_t max_entries);
+
+/// @brief frees all entries and unmaps the snapshot
+/// @param cache
+void cache_free(struct dns_cache *cache);
+
+/// @brief returns TTL the response may be cached for. Negative responses (NXDOMAIN, NODATA) use
+/// the SOA record from authority section as RFC 2308 describes
+/// @param view parsed response
+/// @return TTL in seconds, 0 if the response must not be cached
+int cacheable_ttl(const struct dns_message_view *view);
+
+/// @brief FNV-1a hash of the key
+/// @param key
+/// @param key_len
+/// @return
+uint32_t key_hash(const unsigned char *key, int key_len);
+
+/// @brief finds the response to the query, TTLs in the result are decreased by the time spent in cache
+/// @param cache
+/// @param shard_index
+/// @param query query message, its id is copied to the result
+/// @param query_len
+/// @param result buffer of 65536 bytes
+/// @param view the response in result is parsed into it
+/// @return length of the response in result, 0 if not found
+int cache_lookup(struct dns_cache *cache, int shard_index, unsigned char *query, int query_len, unsigned char *result,
+				 struct dns_message_view *view);
+
+/// @brief stores the response to the query if it is cacheable
+/// @param cache
+/// @param shard_index
+/// @param query
+/// @param query_len
+/// @param view parsed response
+void cache_store(struct dns_cache *cache, int shard_index, unsigned char *query, int query_len, const struct dns_message_view *view);
+
+/// @brief creates the cache when --cache or --cache-file is used and loads the snapshot
+/// @param args
+/// @param shard_cnt
+/// @return cache or NULL if the cache is not used
+struct dns_cache *cache_open(struct parsed_arguments *args, int shard_cnt);
+
+/// @brief saves the snapshot (--cache-file) and frees the cache
+/// @param cache may be NULL
+/// @param args
+void cache_close(struct dns_cache *cache, struct parsed_arguments *args);
+
+/// @brief maps the snapshot file, missing or invalid file is ignored
+/// @param cache
+/// @param path
+/// @return 0 if the snapshot was loaded, -1 otherwise
+int cache_load_snapshot(struct dns_cache *cache, const char *path);
+
+/// @brief writes all valid entries from memory and the loaded snapshot to the file
+/// @param cache
+/// @param path
+/// @return 0 on success, -1 on error
+int cache_save_snapshot(struct dns_cache *cache, const char *path);
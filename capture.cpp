@@ -0,0 +1,233 @@
+// author: Marek Kozumplik, xkozum08
+#include "capture.hpp"
+#include "batch.hpp"
+
+/// @brief creates the capture file with header, existing capture is kept and appended to
+/// @param path
+/// @return 0 on success, -1 if the file cannot be created or is not a capture (error is printed)
+int capture_create(const char *path)
+{
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+	{
+		perror("Error opening capture file");
+		return -1;
+	}
+	struct capture_header header;
+	ssize_t got = read(fd, &header, sizeof(header));
+	if (got == 0)
+	{
+		header.magic = CAPTURE_MAGIC;
+		header.version = CAPTURE_VERSION;
+		got = write(fd, &header, sizeof(header));
+		close(fd);
+		return (got == (ssize_t)sizeof(header)) ? 0 : -1;
+	}
+	close(fd);
+	if (got != (ssize_t)sizeof(header) || header.magic != CAPTURE_MAGIC || header.version != CAPTURE_VERSION)
+	{
+		std::cerr << "Error: " << path << " is not a capture file" << std::endl;
+		return -1;
+	}
+	return 0;
+}
+
+/// @brief opens the capture created by capture_create for appending
+/// @param w
+/// @param path
+/// @return 0 on success, -1 on error
+int capture_open(struct capture_writer *w, const char *path)
+{
+	w->fd = open(path, O_WRONLY | O_APPEND);
+	w->buf = (unsigned char *)malloc(CAPTURE_BUFFER);
+	w->len = 0;
+	w->records = 0;
+	if (w->fd < 0 || w->buf == NULL)
+	{
+		perror("Error opening capture file");
+		if (w->fd >= 0)
+		{
+			close(w->fd);
+		}
+		free(w->buf);
+		return -1;
+	}
+	return 0;
+}
+
+/// @brief writes the buffered records with one append
+/// @param w
+static void capture_flush(struct capture_writer *w)
+{
+	if (w->len > 0 && write(w->fd, w->buf, w->len) != (ssize_t)w->len)
+	{
+		perror("Error writing capture file");
+	}
+	w->len = 0;
+}
+
+/// @brief appends the message to the capture
+/// @param w
+/// @param kind CAPTURE_QUERY, CAPTURE_RESPONSE
+/// @param transport TRANSPORT_UDP, TRANSPORT_TCP
+/// @param msg
+/// @param len
+void capture_write(struct capture_writer *w, int kind, int transport, const unsigned char *msg, int len)
+{
+	if (w->len + sizeof(struct capture_record) + len > CAPTURE_BUFFER)
+	{
+		capture_flush(w);
+	}
+	struct capture_record record;
+	record.len = len;
+	record.kind = kind;
+	record.transport = transport;
+	std::memcpy(&w->buf[w->len], &record, sizeof(record));
+	std::memcpy(&w->buf[w->len + sizeof(record)], msg, len);
+	w->len += sizeof(record) + len;
+	w->records++;
+}
+
+/// @brief writes buffered records and closes the capture
+/// @param w
+void capture_close(struct capture_writer *w)
+{
+	capture_flush(w);
+	close(w->fd);
+	free(w->buf);
+}
+
+/// @brief fills the request from the captured query, like a batch line with its name and type
+/// @param req
+/// @param msg
+/// @param len
+/// @return 0 on success, -1 if the question cannot be read
+static int request_from_query(struct dns_query_request *req, const unsigned char *msg, int len)
+{
+	char text[MAX_NAME_TEXT];
+	int off = sizeof(struct dns_header);
+	int name_len = dns_name_to_text(msg, len, off, text);
+	int qname_len = (name_len < 0) ? -1 : dns_name_to_wire(msg, len, off, req->qname);
+	if (qname_len < 0 || off + qname_len + 4 > len || name_len >= (int)sizeof(req->name))
+	{
+		return -1;
+	}
+	if (name_len > 1)
+	{
+		name_len--; // batch names have no trailing dot
+	}
+	std::memcpy(req->name, text, name_len);
+	req->name[name_len] = '\0';
+	req->qname_len = qname_len;
+	req->qtype = read_u16(&msg[off + qname_len]);
+	req->reverse = 0;
+	return 0;
+}
+
+/// @brief runs every captured response through parsing and printing of the batch mode without sockets and
+/// prints the throughput to stderr
+/// @param args args->replay is the capture
+/// @return 0 on success, 1 if the capture cannot be read
+int run_replay(struct parsed_arguments *args)
+{
+	int fd = open(args->replay, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0)
+	{
+		perror("Error opening capture file");
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return 1;
+	}
+	size_t size = st.st_size;
+	const struct capture_header *header = NULL;
+	void *map = MAP_FAILED;
+	if (size >= sizeof(struct capture_header))
+	{
+		map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	header = (const struct capture_header *)map;
+	if (map == MAP_FAILED || header->magic != CAPTURE_MAGIC || header->version != CAPTURE_VERSION)
+	{
+		std::cerr << "Error: " << args->replay << " is not a capture file" << std::endl;
+		if (map != MAP_FAILED)
+		{
+			munmap(map, size);
+		}
+		return 1;
+	}
+	madvise(map, size, MADV_SEQUENTIAL);
+
+	struct output_buffer out;
+	if (output_init(&out, OUTPUT_BUFFER_SIZE, STDOUT_FILENO) < 0 || format_header(&out, args) < 0)
+	{
+		std::cerr << "Error: Out of memory" << std::endl;
+		output_free(&out);
+		munmap(map, size);
+		return 1;
+	}
+	struct batch_context batch;
+	batch.args = args;
+	batch.out = &out;
+	batch.err = &std::cerr;
+	batch.answered = 0;
+	batch.failed = 0;
+
+	// responses are copied out of the read-only mapping, the printer takes a mutable message
+	static unsigned char msg[65536];
+	static struct dns_message_view view;
+	struct dns_query_request req;
+	req.name[0] = '\0';
+	req.qtype = 0;
+	req.reverse = 0;
+	req.tag = 0;
+	req.qname_len = 0;
+	unsigned long queries = 0;
+	unsigned long responses = 0;
+	size_t bytes = 0;
+	const unsigned char *data = (const unsigned char *)map;
+	size_t off = sizeof(struct capture_header);
+	long long start = now_us();
+	while (off + sizeof(struct capture_record) <= size)
+	{
+		struct capture_record record;
+		std::memcpy(&record, &data[off], sizeof(record));
+		off += sizeof(record);
+		if (off + record.len > size)
+		{
+			break; // cut by a crash of the recording run
+		}
+		if (record.kind == CAPTURE_QUERY)
+		{
+			queries++;
+			if (request_from_query(&req, &data[off], record.len) < 0)
+			{
+				req.name[0] = '\0';
+			}
+		}
+		else if (record.kind == CAPTURE_RESPONSE)
+		{
+			responses++;
+			bytes += record.len;
+			std::memcpy(msg, &data[off], record.len);
+			parse_dns_message(msg, record.len, &view);
+			print_batch_result(&batch, &req, QUERY_OK, msg, record.len, &view);
+			req.tag++;
+		}
+		off += record.len;
+	}
+	output_flush(&out);
+	long long elapsed_us = std::max(now_us() - start, 1LL);
+	output_free(&out);
+	munmap(map, size);
+
+	std::cerr << "Replayed: " << responses << " responses (" << queries << " queries), " << bytes << " bytes in "
+			  << std::fixed << std::setprecision(3) << elapsed_us / 1000.0 << " ms" << std::endl;
+	std::cerr << "Throughput: " << std::setprecision(0) << responses * 1e6 / elapsed_us << " msgs/sec, "
+			  << std::setprecision(1) << bytes / (double)elapsed_us << " MB/s, Answered: " << batch.answered
+			  << ", Failed: " << batch.failed << std::endl;
+	return 0;
+}
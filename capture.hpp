@@ -0,0 +1,77 @@
+// author: Marek Kozumplik, xkozum08
+#pragma once
+#include "dns.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CAPTURE_MAGIC 0x50414344 // "DCAP"
+#define CAPTURE_VERSION 1
+#define CAPTURE_BUFFER (1 << 18) // records are written in blocks of whole records
+
+// kind of the captured message
+#define CAPTURE_QUERY 1
+#define CAPTURE_RESPONSE 2
+
+/*
+	Capture file, all numbers in host byte order, records follow each other without padding
+
+	+------------------------------------------+
+	| capture_header                           |
+	+------------------------------------------+
+	| capture_record, message                  |  query, then the response matched to it
+	| ...                                      |
+	+------------------------------------------+
+
+	Every resolver appends its own blocks with O_APPEND, so threads never split a record. Record cut
+	by a crash at the end of the file is ignored by the replay.
+*/
+struct capture_header
+{
+	uint32_t magic;
+	uint32_t version;
+};
+
+struct capture_record
+{
+	uint16_t len; // length of the message
+	uint8_t kind; // CAPTURE_QUERY, CAPTURE_RESPONSE
+	uint8_t transport; // TRANSPORT_UDP, TRANSPORT_TCP
+};
+
+struct capture_writer
+{
+	int fd;
+	unsigned char *buf;
+	size_t len;
+	unsigned long records;
+};
+
+/// @brief creates the capture file with header, existing capture is kept and appended to
+/// @param path
+/// @return 0 on success, -1 if the file cannot be created or is not a capture (error is printed)
+int capture_create(const char *path);
+
+/// @brief opens the capture created by capture_create for appending
+/// @param w
+/// @param path
+/// @return 0 on success, -1 on error
+int capture_open(struct capture_writer *w, const char *path);
+
+/// @brief appends the message to the capture
+/// @param w
+/// @param kind CAPTURE_QUERY, CAPTURE_RESPONSE
+/// @param transport TRANSPORT_UDP, TRANSPORT_TCP
+/// @param msg
+/// @param len
+void capture_write(struct capture_writer *w, int kind, int transport, const unsigned char *msg, int len);
+
+/// @brief writes buffered records and closes the capture
+/// @param w
+void capture_close(struct capture_writer *w);
+
+/// @brief runs every captured response through parsing and printing of the batch mode without sockets and
+/// prints the throughput to stderr
+/// @param args args->replay is the capture
+/// @return 0 on success, 1 if the capture cannot be read
+int run_replay(struct parsed_arguments *args);
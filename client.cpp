@@ -0,0 +1,337 @@
+// author: Marek Kozumplik, xkozum08
+#include "client.hpp"
+#include "encoder.hpp"
+#include "arg_parser.hpp"
+
+/// @brief returns address type: TYPE_IP4, TYPE_IP6, TYPE_DOMAIN
+/// @param addr
+/// @return
+int get_address_type(const char *addr)
+{
+	if (is_ip4_address(addr))
+	{
+		return TYPE_IP4;
+	}
+	else if (is_ip6_address(addr))
+	{
+		return TYPE_IP6;
+	}
+	unsigned char wire[NAME_WIRE_BUF];
+	if (convert_domain_to_dns(addr, wire) > 0)
+	{
+		return TYPE_DOMAIN;
+	}
+	return -1;
+}
+
+// fills the dns header with data
+void fill_dns_header(struct dns_header *dns, int recursion, unsigned short id)
+{
+	dns->id = id;
+	dns->qr = 0;			   // query
+	dns->opcode = 0;		   // normal query
+	dns->aa = 0;			   // not authoritive
+	dns->tc = 0;			   // not truncated
+	dns->rd = recursion;	   // Recursion Desired
+	dns->ra = 0;			   // Recursion Available
+	dns->z = 0;
+	dns->ad = 0;
+	dns->cd = 0;
+	dns->rcode = 0;			 // No error
+	dns->q_count = htons(1); // 1 question
+	dns->ans_count = 0;
+	dns->auth_count = 0;
+	dns->add_count = 0;
+}
+
+/// @brief rewrites the host name to IPv4 address using gethostbyname. Only when -s argument is host name
+/// @param server
+/// @return 0 on success, -1 if the name has no address
+int domain_to_address(char *server)
+{
+	struct hostent *host_info;
+	struct in_addr **addr_list;
+	host_info = gethostbyname(server);
+	if (host_info == nullptr)
+	{
+		std::cerr << "Error: Failed to get server address" << std::endl;
+		return -1;
+	}
+
+	addr_list = reinterpret_cast<struct in_addr **>(host_info->h_addr_list);
+	strcpy(server, inet_ntoa(*addr_list[0]));
+	return 0;
+}
+
+/// @brief checks the servers of args and resolves their host names, in iterative mode the servers are dropped
+/// @param args
+/// @return 0 on success, -1 if some server is invalid (error is printed)
+int prepare_servers(struct parsed_arguments *args)
+{
+	for (int i = 0; i < args->server_cnt; i++)
+	{
+		int server_type = get_address_type(args->servers[i]);
+		switch (server_type)
+		{
+		case TYPE_DOMAIN:
+			// if -s is domain name, we need the find the ip4 address
+			if (domain_to_address(args->servers[i]) < 0) // this converts domain to ip4
+			{
+				return -1;
+			}
+			args->server_types[i] = 0;
+			break;
+		case TYPE_IP4:
+			args->server_types[i] = 0;
+			break;
+		case TYPE_IP6:
+			args->server_types[i] = 1;
+			break;
+		default:
+			std::cerr << "Error: Invalid server address\n";
+			return -1;
+		}
+	}
+	if (args->iterative)
+	{
+		// authoritative servers do not recurse, the names are followed from the root instead
+		args->recursion = 0;
+		args->server_cnt = 0;
+	}
+	else
+	{
+		strcpy(args->server, args->servers[0]);
+		args->address_type = args->server_types[0];
+	}
+	return 0;
+}
+
+/// @brief fills the configuration with defaults, servers must be set by the caller unless iterative
+/// @param cfg
+void dns_client_config_init(struct dns_client_config *cfg)
+{
+	cfg->servers = NULL;
+	cfg->port = DNS_PORT;
+	cfg->recursion = 1;
+	cfg->tcp = 0;
+	cfg->edns = 0;
+	cfg->window = DEFAULT_WINDOW;
+	cfg->cache = 0;
+	cfg->cache_size = DEFAULT_CACHE_SIZE;
+	cfg->iterative = 0;
+	cfg->root_hints = NULL;
+	cfg->backend = BACKEND_EPOLL;
+	cfg->table = NULL;
+}
+
+/// @brief opens the sockets of the servers from the configuration
+/// @param client allocated by the caller, it is large
+/// @param cfg
+/// @return CLIENT_OK or CLIENT_ERROR
+int dns_client_init(struct dns_client *client, const struct dns_client_config *cfg)
+{
+	struct parsed_arguments *args = &client->args;
+	init_arguments(args);
+	args->port = cfg->port;
+	args->recursion = cfg->recursion;
+	args->tcp = cfg->tcp;
+	args->edns = cfg->edns;
+	args->window = cfg->window;
+	args->cache = cfg->cache;
+	args->cache_size = cfg->cache_size;
+	args->iterative = cfg->iterative;
+	args->backend = cfg->backend;
+	if (cfg->port < 1 || cfg->port > 65535 || cfg->window < 1 || cfg->window > MAX_WINDOW || cfg->cache_size < 1 ||
+		(cfg->edns != 0 && (cfg->edns < 512 || cfg->edns > 65535)))
+	{
+		std::cerr << "Error: Invalid client configuration" << std::endl;
+		return CLIENT_ERROR;
+	}
+	if (cfg->root_hints != NULL)
+	{
+		strncpy(args->root_hints, cfg->root_hints, sizeof(args->root_hints) - 1);
+		args->root_hints[sizeof(args->root_hints) - 1] = '\0';
+	}
+	if (cfg->table != NULL)
+	{
+		strncpy(args->table, cfg->table, sizeof(args->table) - 1);
+		args->table[sizeof(args->table) - 1] = '\0';
+	}
+	if (cfg->servers != NULL && !cfg->iterative)
+	{
+		// same list as -s
+		const char *p = cfg->servers;
+		while (*p != '\0')
+		{
+			size_t len = strcspn(p, ",");
+			if (args->server_cnt == MAX_SERVERS || len >= sizeof(args->servers[0]))
+			{
+				std::cerr << "Error: Too many servers or too long server name" << std::endl;
+				return CLIENT_ERROR;
+			}
+			if (len > 0)
+			{
+				std::memcpy(args->servers[args->server_cnt], p, len);
+				args->servers[args->server_cnt][len] = '\0';
+				args->server_cnt++;
+			}
+			p += len + (p[len] == ',');
+		}
+	}
+	if (args->server_cnt == 0 && !args->iterative)
+	{
+		std::cerr << "Error: No server given" << std::endl;
+		return CLIENT_ERROR;
+	}
+	if (prepare_servers(args) < 0)
+	{
+		return CLIENT_ERROR;
+	}
+	return dns_client_init_args(client, args);
+}
+
+/// @brief passes the answer of the resolver request to the callback of the caller, used as resolver callback
+/// @param ctx dns_client
+/// @param req
+/// @param status
+/// @param msg
+/// @param msg_len
+/// @param view parsed msg
+static void client_complete(void *ctx, struct dns_query_request *req, int status, unsigned char *msg, int msg_len,
+							const struct dns_message_view *view)
+{
+	struct dns_client *client = (struct dns_client *)ctx;
+	struct client_request request = client->requests[req->tag];
+	// the entry is free before the callback, so the callback can submit the next query
+	client->free_requests[client->free_cnt++] = req->tag;
+
+	struct dns_result result;
+	result.status = status;
+	result.rcode = -1;
+	result.name = req->name;
+	result.qtype = req->reverse ? QTYPE_PTR : req->qtype;
+	result.msg = NULL;
+	result.msg_len = 0;
+	result.view = NULL;
+	result.parse_error = PARSE_OK;
+	if (status == QUERY_OK)
+	{
+		result.msg = msg;
+		result.msg_len = msg_len;
+		result.rcode = view->rcode;
+		result.parse_error = view->parse_error;
+		result.view = (view->parse_error == PARSE_OK) ? view : NULL;
+	}
+	request.callback(request.user, &result);
+}
+
+/// @brief opens the client with arguments of the command line, servers must already be checked by prepare_servers
+/// @param client allocated by the caller
+/// @param args copied, also stats, cache file and capture options are used
+/// @return CLIENT_OK or CLIENT_ERROR
+int dns_client_init_args(struct dns_client *client, struct parsed_arguments *args)
+{
+	if (&client->args != args)
+	{
+		client->args = *args;
+	}
+	args = &client->args;
+	client->requests = (struct client_request *)malloc(args->window * sizeof(struct client_request));
+	client->free_requests = (int *)malloc(args->window * sizeof(int));
+	if (client->requests == NULL || client->free_requests == NULL)
+	{
+		std::cerr << "Error: Out of memory" << std::endl;
+		free(client->requests);
+		free(client->free_requests);
+		return CLIENT_ERROR;
+	}
+	client->free_cnt = 0;
+	for (int i = args->window - 1; i >= 0; i--)
+	{
+		client->free_requests[client->free_cnt++] = i;
+	}
+	if (resolver_init(&client->res, args, client_complete, client) < 0)
+	{
+		free(client->requests);
+		free(client->free_requests);
+		return CLIENT_ERROR;
+	}
+	client->cache = cache_open(args, 1);
+	if (client->cache != NULL)
+	{
+		resolver_set_cache(&client->res, client->cache, 0);
+	}
+	return CLIENT_OK;
+}
+
+/// @brief closes the sockets and saves the cache file, queries in flight are dropped without callback
+/// @param client
+void dns_client_free(struct dns_client *client)
+{
+	resolver_free(&client->res);
+	cache_close(client->cache, &client->args);
+	free(client->requests);
+	free(client->free_requests);
+}
+
+/// @brief queues the query, it is sent by the next dns_client_poll. QTYPE_PTR with IPv4 or IPv6 address
+/// asks for its reverse name
+/// @param client
+/// @param name domain name or address
+/// @param qtype
+/// @param callback
+/// @param user passed to the callback
+/// @return CLIENT_OK (the callback may already have been called), CLIENT_BUSY or CLIENT_ERROR if the name is too long
+int dns_client_submit(struct dns_client *client, const char *name, int qtype, dns_client_callback callback, void *user)
+{
+	struct dns_query_request req;
+	size_t len = strlen(name);
+	if (len >= sizeof(req.name))
+	{
+		return CLIENT_ERROR;
+	}
+	if (client->free_cnt == 0)
+	{
+		return CLIENT_BUSY;
+	}
+	std::memcpy(req.name, name, len + 1);
+	req.reverse = qtype == QTYPE_PTR && (is_ip4_address(name) || is_ip6_address(name));
+	req.qtype = qtype;
+	req.qname_len = 0;
+	req.tag = client->free_requests[--client->free_cnt];
+	client->requests[req.tag].callback = callback;
+	client->requests[req.tag].user = user;
+	if (resolver_submit(&client->res, &req) == -2)
+	{
+		client->free_requests[client->free_cnt++] = req.tag;
+		return CLIENT_BUSY;
+	}
+	return CLIENT_OK;
+}
+
+/// @brief sends queued queries, waits at most timeout_ms for answers and calls callbacks of completed queries
+/// @param client
+/// @param timeout_ms -1 - until the next answer or timeout
+/// @return number of completed queries
+int dns_client_poll(struct dns_client *client, int timeout_ms)
+{
+	return resolver_poll(&client->res, timeout_ms);
+}
+
+/// @brief returns number of submitted queries without callback yet
+/// @param client
+/// @return
+int dns_client_pending(struct dns_client *client)
+{
+	return client->args.window - client->free_cnt;
+}
+
+/// @brief returns descriptor which is readable when answers wait, for the event loop of the caller. Poll the
+/// client with timeout 0 when it is readable and at least every RTO_MIN_MS, so timeouts and retransmissions
+/// are on time
+/// @param client
+/// @return descriptor, -1 with the io_uring backend
+int dns_client_fd(struct dns_client *client)
+{
+	return (client->res.loop.backend == BACKEND_EPOLL) ? client->res.loop.epfd : -1;
+}
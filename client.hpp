@@ -0,0 +1,136 @@
+// author: Marek Kozumplik, xkozum08
+#pragma once
+#include "dns.hpp"
+#include "resolver.hpp"
+#include "parser.hpp"
+#include "cache.hpp"
+
+/*
+	Asynchronous resolver API of libdns (make lib builds libdns.a and libdns.so), nothing in it exits the process.
+
+		struct dns_client_config cfg;
+		dns_client_config_init(&cfg);
+		cfg.servers = "127.0.0.1";
+		struct dns_client *client = (struct dns_client *)malloc(sizeof(struct dns_client));
+		dns_client_init(client, &cfg);
+		dns_client_submit(client, "example.com", QTYPE_A, on_result, NULL);
+		while (dns_client_pending(client) > 0)
+			dns_client_poll(client, -1);
+		dns_client_free(client);
+
+	Callbacks are called from dns_client_submit (cache or table hit, invalid name) or dns_client_poll, they may submit
+	new queries. The client is not thread safe, every thread uses its own.
+*/
+
+// return codes of the client functions
+#define CLIENT_OK 0
+#define CLIENT_ERROR -1 // invalid configuration, name or socket error, the error is printed to stderr
+#define CLIENT_BUSY -2	// window is full, poll for some answers first
+
+struct dns_client_config
+{
+	const char *servers;	// comma separated IPv4, IPv6 addresses or host names, not used with iterative
+	int port;				// default DNS_PORT
+	int recursion;			// RD flag, default 1
+	int tcp;				// all queries over TCP
+	int edns;				// UDP payload size in OPT record, 0 - no OPT (default)
+	int window;				// max number of queries in flight, default DEFAULT_WINDOW
+	int cache;				// answers are cached for their TTL
+	long cache_size;		// max number of cached answers
+	int iterative;			// names are resolved from the root servers
+	const char *root_hints; // comma separated addr[:port] of root servers, NULL - IANA root servers
+	int backend;			// BACKEND_EPOLL, BACKEND_URING
+	const char *table;		// table file compiled by dnstable, its names are answered without queries, NULL - none
+};
+
+// completed query passed to the callback, pointers are valid only during the callback
+struct dns_result
+{
+	int status; // QUERY_OK, QUERY_TIMEOUT, QUERY_BAD_NAME, QUERY_CONNECTION_FAILED, QUERY_ITERATION_FAILED
+	int rcode;	// rcode of the answer extended by its OPT record, -1 without answer
+	const char *name;
+	int qtype;
+	const unsigned char *msg; // answer in wire format, NULL without answer
+	int msg_len;
+	const struct dns_message_view *view; // parsed answer, NULL without answer or if it is malformed
+	int parse_error;					 // PARSE_OK or why the answer could not be parsed
+};
+
+/// @brief called once for every submitted query
+/// @param user pointer given to dns_client_submit
+/// @param result
+typedef void (*dns_client_callback)(void *user, const struct dns_result *result);
+
+struct client_request
+{
+	dns_client_callback callback;
+	void *user;
+};
+
+struct dns_client
+{
+	struct parsed_arguments args;
+	struct resolver res;
+	struct dns_cache *cache; // NULL without cache
+	struct client_request *requests; // window entries, the tag of the resolver request is the index
+	int *free_requests;				 // stack of unused entries
+	int free_cnt;
+};
+
+/// @brief rewrites the host name to IPv4 address using gethostbyname. Only when -s argument is host name
+/// @param server
+/// @return 0 on success, -1 if the name has no address
+int domain_to_address(char *server);
+
+/// @brief checks the servers of args and resolves their host names, in iterative mode the servers are dropped
+/// @param args
+/// @return 0 on success, -1 if some server is invalid (error is printed)
+int prepare_servers(struct parsed_arguments *args);
+
+/// @brief fills the configuration with defaults, servers must be set by the caller unless iterative
+/// @param cfg
+void dns_client_config_init(struct dns_client_config *cfg);
+
+/// @brief opens the sockets of the servers from the configuration
+/// @param client allocated by the caller, it is large
+/// @param cfg
+/// @return CLIENT_OK or CLIENT_ERROR
+int dns_client_init(struct dns_client *client, const struct dns_client_config *cfg);
+
+/// @brief opens the client with arguments of the command line, servers must already be checked by prepare_servers
+/// @param client allocated by the caller
+/// @param args copied, also stats, cache file and capture options are used
+/// @return CLIENT_OK or CLIENT_ERROR
+int dns_client_init_args(struct dns_client *client, struct parsed_arguments *args);
+
+/// @brief closes the sockets and saves the cache file, queries in flight are dropped without callback
+/// @param client
+void dns_client_free(struct dns_client *client);
+
+/// @brief queues the query, it is sent by the next dns_client_poll. QTYPE_PTR with IPv4 or IPv6 address
+/// asks for its reverse name
+/// @param client
+/// @param name domain name or address
+/// @param qtype
+/// @param callback
+/// @param user passed to the callback
+/// @return CLIENT_OK (the callback may already have been called), CLIENT_BUSY or CLIENT_ERROR if the name is too long
+int dns_client_submit(struct dns_client *client, const char *name, int qtype, dns_client_callback callback, void *user);
+
+/// @brief sends queued queries, waits at most timeout_ms for answers and calls callbacks of completed queries
+/// @param client
+/// @param timeout_ms -1 - until the next answer or timeout
+/// @return number of completed queries
+int dns_client_poll(struct dns_client *client, int timeout_ms);
+
+/// @brief returns number of submitted queries without callback yet
+/// @param client
+/// @return
+int dns_client_pending(struct dns_client *client);
+
+/// @brief returns descriptor which is readable when answers wait, for the event loop of the caller. Poll the
+/// client with timeout 0 when it is readable and at least every RTO_MIN_MS, so timeouts and retransmissions
+/// are on time
+/// @param client
+/// @return descriptor, -1 with the io_uring backend
+int dns_client_fd(struct dns_client *client);
@@ -0,0 +1,286 @@
+// author: Marek Kozumplik, xkozum08
+#include "coro.hpp"
+
+// pool of the thread, frees its slabs when the thread ends
+struct frame_pool_holder
+{
+	struct frame_pool pool = {};
+	~frame_pool_holder()
+	{
+		while (pool.slabs != NULL)
+		{
+			char *next = *(char **)pool.slabs;
+			free(pool.slabs);
+			pool.slabs = next;
+		}
+	}
+};
+
+static thread_local struct frame_pool_holder frame_pool_of_thread;
+
+/// @brief allocates the coroutine frame from the pool of the thread
+/// @param size
+/// @return frame, throws std::bad_alloc if out of memory
+void *frame_alloc(size_t size)
+{
+	struct frame_pool *pool = &frame_pool_of_thread.pool;
+	if (size > FRAME_POOL_MAX)
+	{
+		pool->fallback++;
+		return ::operator new(size);
+	}
+	int cls = (size + FRAME_POOL_GRANULE - 1) / FRAME_POOL_GRANULE - 1;
+	pool->allocated++;
+	pool->live++;
+	pool->peak = std::max(pool->peak, pool->live);
+	void *frame = pool->free_lists[cls];
+	if (frame != NULL)
+	{
+		pool->free_lists[cls] = *(void **)frame;
+		pool->reused++;
+		return frame;
+	}
+	size_t rounded = (cls + 1) * FRAME_POOL_GRANULE;
+	if (pool->slabs == NULL || pool->slab_used + rounded > FRAME_POOL_SLAB)
+	{
+		// the first granule of the slab links the slabs, the rest of the old slab stays unused
+		char *slab = (char *)aligned_alloc(FRAME_POOL_GRANULE, FRAME_POOL_SLAB);
+		if (slab == NULL)
+		{
+			pool->allocated--;
+			pool->live--;
+			throw std::bad_alloc();
+		}
+		*(char **)slab = pool->slabs;
+		pool->slabs = slab;
+		pool->slab_used = FRAME_POOL_GRANULE;
+		pool->slab_cnt++;
+	}
+	frame = pool->slabs + pool->slab_used;
+	pool->slab_used += rounded;
+	return frame;
+}
+
+/// @brief returns the frame to the pool of the thread
+/// @param frame
+/// @param size the size it was allocated with
+void frame_free(void *frame, size_t size)
+{
+	if (size > FRAME_POOL_MAX)
+	{
+		::operator delete(frame);
+		return;
+	}
+	struct frame_pool *pool = &frame_pool_of_thread.pool;
+	int cls = (size + FRAME_POOL_GRANULE - 1) / FRAME_POOL_GRANULE - 1;
+	*(void **)frame = pool->free_lists[cls];
+	pool->free_lists[cls] = frame;
+	pool->live--;
+}
+
+/// @brief returns the pool of the calling thread, for statistics
+/// @return
+const struct frame_pool *frame_pool_stats()
+{
+	return &frame_pool_of_thread.pool;
+}
+
+/// @brief stores the result of the lookup and resumes its coroutine, used as client callback
+/// @param user resolve_awaitable
+/// @param result
+static void resolve_complete(void *user, const struct dns_result *result)
+{
+	struct resolve_awaitable *a = (struct resolve_awaitable *)user;
+	a->result = *result;
+	if (a->state != RESOLVE_SUBMITTING)
+	{
+		// the coroutine reads the result before it suspends again, while the client still has the answer
+		a->handle.resume();
+		return;
+	}
+	// completed inside dns_client_submit, the coroutine is resumed after it returns, so the answer is copied
+	static thread_local unsigned char msg[65536];
+	static thread_local struct dns_message_view view;
+	if (result->msg != NULL)
+	{
+		std::memcpy(msg, result->msg, result->msg_len);
+		a->result.msg = msg;
+		if (result->view != NULL)
+		{
+			// the offsets of the view are the same in the copy
+			view = *result->view;
+			view.msg = msg;
+			a->result.view = &view;
+		}
+	}
+	a->state = RESOLVE_DONE;
+}
+
+/// @brief submits the lookup to the client
+/// @param a
+/// @return RESOLVE_SUSPENDED, RESOLVE_DONE or CLIENT_BUSY
+static int resolve_submit(struct resolve_awaitable *a)
+{
+	a->state = RESOLVE_SUBMITTING;
+	int ret = dns_client_submit(&a->resolver->client, a->name, a->qtype, resolve_complete, a);
+	if (ret == CLIENT_BUSY)
+	{
+		return CLIENT_BUSY;
+	}
+	if (ret == CLIENT_ERROR)
+	{
+		// too long name, the callback was not called
+		a->result.status = QUERY_BAD_NAME;
+		a->result.rcode = -1;
+		a->result.name = a->name;
+		a->result.qtype = a->qtype;
+		a->result.msg = NULL;
+		a->result.msg_len = 0;
+		a->result.view = NULL;
+		a->result.parse_error = PARSE_OK;
+		a->state = RESOLVE_DONE;
+	}
+	if (a->state == RESOLVE_DONE)
+	{
+		return RESOLVE_DONE;
+	}
+	// the callback comes from the poll, not sooner
+	a->state = RESOLVE_SUSPENDED;
+	return RESOLVE_SUSPENDED;
+}
+
+/// @brief sends the lookup or queues it when the window is full
+/// @param h
+/// @return false if the lookup already completed and the coroutine continues
+bool resolve_awaitable::await_suspend(std::coroutine_handle<> h)
+{
+	handle = h;
+	next = NULL;
+	struct coro_resolver *r = resolver;
+	// queued lookups go first, so the order of co_await is kept
+	if (r->wait_head == NULL)
+	{
+		int ret = resolve_submit(this);
+		if (ret == RESOLVE_DONE)
+		{
+			return false;
+		}
+		if (ret == RESOLVE_SUSPENDED)
+		{
+			return true;
+		}
+	}
+	state = RESOLVE_WAITING;
+	if (r->wait_tail != NULL)
+	{
+		r->wait_tail->next = this;
+	}
+	else
+	{
+		r->wait_head = this;
+	}
+	r->wait_tail = this;
+	r->waiting++;
+	return true;
+}
+
+/// @brief submits queued lookups while the window has free entries
+/// @param r
+/// @return number of lookups completed and resumed at once
+static int submit_waiting(struct coro_resolver *r)
+{
+	int resumed = 0;
+	while (r->wait_head != NULL)
+	{
+		struct resolve_awaitable *a = r->wait_head;
+		int ret = resolve_submit(a);
+		if (ret == CLIENT_BUSY)
+		{
+			a->state = RESOLVE_WAITING;
+			break;
+		}
+		r->wait_head = a->next;
+		if (r->wait_head == NULL)
+		{
+			r->wait_tail = NULL;
+		}
+		r->waiting--;
+		if (ret == RESOLVE_DONE)
+		{
+			// may queue new lookups behind the rest
+			a->handle.resume();
+			resumed++;
+		}
+	}
+	return resumed;
+}
+
+/// @brief opens the client of the resolver
+/// @param r allocated by the caller, it is large
+/// @param cfg
+/// @return CLIENT_OK or CLIENT_ERROR
+int coro_resolver_init(struct coro_resolver *r, const struct dns_client_config *cfg)
+{
+	r->wait_head = NULL;
+	r->wait_tail = NULL;
+	r->waiting = 0;
+	return dns_client_init(&r->client, cfg);
+}
+
+/// @brief closes the client, suspended lookups are never resumed and their frames are lost, run them to the end first
+/// @param r
+void coro_resolver_free(struct coro_resolver *r)
+{
+	dns_client_free(&r->client);
+}
+
+/// @brief returns the lookup which suspends the coroutine until the answer or timeout, use with co_await
+/// @param r
+/// @param name domain name, or IPv4 or IPv6 address with QTYPE_PTR
+/// @param qtype
+/// @return
+struct resolve_awaitable resolve(struct coro_resolver *r, const char *name, int qtype)
+{
+	struct resolve_awaitable a;
+	a.resolver = r;
+	a.name = name;
+	a.qtype = qtype;
+	a.state = RESOLVE_SUBMITTING;
+	a.next = NULL;
+	return a;
+}
+
+/// @brief returns number of lookups which were not resumed yet, sent and waiting
+/// @param r
+/// @return
+int coro_resolver_pending(struct coro_resolver *r)
+{
+	return dns_client_pending(&r->client) + r->waiting;
+}
+
+/// @brief sends waiting lookups, waits at most timeout_ms for answers and resumes coroutines of completed lookups
+/// @param r
+/// @param timeout_ms -1 - until the next answer or timeout
+/// @return number of resumed lookups
+int coro_resolver_poll(struct coro_resolver *r, int timeout_ms)
+{
+	int resumed = submit_waiting(r);
+	if (dns_client_pending(&r->client) == 0)
+	{
+		return resumed;
+	}
+	resumed += dns_client_poll(&r->client, (resumed > 0) ? 0 : timeout_ms);
+	// answers freed entries of the window
+	resumed += submit_waiting(r);
+	return resumed;
+}
+
+/// @brief polls until no lookup is pending
+/// @param r
+void coro_resolver_run(struct coro_resolver *r)
+{
+	while (coro_resolver_pending(r) > 0)
+	{
+		coro_resolver_poll(r, -1);
+	}
+}
@@ -0,0 +1,138 @@
+// author: Marek Kozumplik, xkozum08
+#pragma once
+#include "client.hpp"
+#include <coroutine>
+#include <exception>
+
+/*
+	C++20 coroutine interface of libdns, lookups suspend on the client and resume from its poll.
+
+		static dns_task lookup(struct coro_resolver *r, const char *name)
+		{
+			struct dns_result result = co_await resolve(r, name, QTYPE_A);
+			...
+		}
+
+		coro_resolver_init(r, &cfg);
+		for (every name)
+			lookup(r, name); // runs until its first co_await
+		coro_resolver_run(r); // polls until every lookup ended
+		coro_resolver_free(r);
+
+	The message and view the result of co_await points to are valid until the next co_await of the coroutine.
+	Lookups beyond the window of the client wait in a queue without sending anything. Frames of dns_task come
+	from a pool of the thread, so a fan-out of many lookups does not call malloc per lookup. A coroutine must end
+	on the thread which started it.
+*/
+
+#define FRAME_POOL_GRANULE 64		 // frame sizes are rounded up to this
+#define FRAME_POOL_CLASSES 64		 // frames up to 4 KiB are pooled, larger use operator new
+#define FRAME_POOL_SLAB (256 * 1024) // frames are carved from slabs of this size
+#define FRAME_POOL_MAX (FRAME_POOL_GRANULE * FRAME_POOL_CLASSES)
+
+// free lists of frames of the thread, memory of the slabs is freed at the end of the thread
+struct frame_pool
+{
+	void *free_lists[FRAME_POOL_CLASSES]; // freed frames of every size class, linked through their first bytes
+	char *slabs;						  // slabs linked through their first bytes, the newest one is carved
+	size_t slab_used;
+	unsigned long slab_cnt;
+	unsigned long allocated; // frames taken from the pool
+	unsigned long reused;	 // of them taken from the free lists
+	unsigned long fallback;	 // frames larger than FRAME_POOL_MAX
+	unsigned long live;		 // frames not freed yet
+	unsigned long peak;		 // max of live
+};
+
+/// @brief allocates the coroutine frame from the pool of the thread
+/// @param size
+/// @return frame, throws std::bad_alloc if out of memory
+void *frame_alloc(size_t size);
+
+/// @brief returns the frame to the pool of the thread
+/// @param frame
+/// @param size the size it was allocated with
+void frame_free(void *frame, size_t size);
+
+/// @brief returns the pool of the calling thread, for statistics
+/// @return
+const struct frame_pool *frame_pool_stats();
+
+// fire and forget coroutine, it runs until its first suspension when called and its frame is freed at its end
+struct dns_task
+{
+	struct promise_type
+	{
+		dns_task get_return_object() { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		// nobody awaits the task, so nobody could catch it
+		void unhandled_exception() { std::terminate(); }
+		static void *operator new(size_t size) { return frame_alloc(size); }
+		static void operator delete(void *frame, size_t size) { frame_free(frame, size); }
+	};
+};
+
+struct resolve_awaitable;
+
+struct coro_resolver
+{
+	struct dns_client client;
+	struct resolve_awaitable *wait_head; // lookups waiting for a free entry of the window, in order of co_await
+	struct resolve_awaitable *wait_tail;
+	int waiting;
+};
+
+// state of resolve_awaitable
+#define RESOLVE_SUBMITTING 0 // inside dns_client_submit, callback does not resume the coroutine
+#define RESOLVE_SUSPENDED 1	 // sent, resumed by the callback
+#define RESOLVE_DONE 2		 // completed inside dns_client_submit (cache or table hit, invalid name)
+#define RESOLVE_WAITING 3	 // in the queue of the resolver
+
+struct resolve_awaitable
+{
+	struct coro_resolver *resolver;
+	const char *name; // must be valid until the lookup ends
+	int qtype;
+	int state;
+	std::coroutine_handle<> handle;
+	struct dns_result result;
+	struct resolve_awaitable *next; // queue of the resolver
+
+	bool await_ready() { return false; }
+	bool await_suspend(std::coroutine_handle<> h);
+	struct dns_result await_resume() { return result; }
+};
+
+/// @brief opens the client of the resolver
+/// @param r allocated by the caller, it is large
+/// @param cfg
+/// @return CLIENT_OK or CLIENT_ERROR
+int coro_resolver_init(struct coro_resolver *r, const struct dns_client_config *cfg);
+
+/// @brief closes the client, suspended lookups are never resumed and their frames are lost, run them to the end first
+/// @param r
+void coro_resolver_free(struct coro_resolver *r);
+
+/// @brief returns the lookup which suspends the coroutine until the answer or timeout, use with co_await
+/// @param r
+/// @param name domain name, or IPv4 or IPv6 address with QTYPE_PTR
+/// @param qtype
+/// @return
+struct resolve_awaitable resolve(struct coro_resolver *r, const char *name, int qtype);
+
+/// @brief returns number of lookups which were not resumed yet, sent and waiting
+/// @param r
+/// @return
+int coro_resolver_pending(struct coro_resolver *r);
+
+/// @brief sends waiting lookups, waits at most timeout_ms for answers and resumes coroutines of completed lookups
+/// @param r
+/// @param timeout_ms -1 - until the next answer or timeout
+/// @return number of resumed lookups
+int coro_resolver_poll(struct coro_resolver *r, int timeout_ms);
+
+/// @brief polls until no lookup is pending
+/// @param r
+void coro_resolver_run(struct coro_resolver *r);
@@ -0,0 +1,169 @@
+// author: Marek Kozumplik, xkozum08
+// Example of the coroutine interface, resolves every name of the file concurrently from one thread with one
+// coroutine per name. Built with make coro_example
+#include "coro.hpp"
+#include "encoder.hpp"
+#include "printer.hpp"
+#include "arg_parser.hpp"
+#include <vector>
+#include <string>
+#include <fstream>
+
+// shared by all lookups, only one of them runs at a time
+struct lookup_run
+{
+	struct coro_resolver *resolver;
+	struct parsed_arguments *args; // output format for format_answer
+	struct output_buffer *out;	   // NULL - results are not printed
+	unsigned long answered;
+	unsigned long failed;
+};
+
+/// @brief resolves one name and prints the result
+/// @param run
+/// @param name valid until the run ends
+/// @param qtype
+/// @return
+static dns_task lookup(struct lookup_run *run, const char *name, int qtype)
+{
+	struct dns_result result = co_await resolve(run->resolver, name, qtype);
+	if (result.status == QUERY_OK && result.rcode == 0)
+	{
+		run->answered++;
+	}
+	else
+	{
+		run->failed++;
+	}
+	if (run->out == NULL)
+	{
+		co_return;
+	}
+	struct dns_query_request req;
+	strncpy(req.name, name, sizeof(req.name) - 1);
+	req.name[sizeof(req.name) - 1] = '\0';
+	req.qtype = qtype;
+	req.reverse = qtype == QTYPE_PTR && (is_ip4_address(name) || is_ip6_address(name));
+	req.tag = 0;
+	req.qname_len = 0;
+	int error;
+	if (result.view != NULL)
+	{
+		error = format_answer(run->out, result.view, run->args, &req);
+	}
+	else
+	{
+		static const char *statuses[] = {"NOERROR", "TIMEOUT", "BAD_NAME", "CONNECTION_FAILED", "ITERATION_FAILED"};
+		error = format_failure(run->out, run->args, &req, (result.status == QUERY_OK) ? "MALFORMED" : statuses[result.status]);
+	}
+	if (error < 0)
+	{
+		std::cerr << name << ": Error: Out of memory" << std::endl;
+	}
+}
+
+/// @brief prints usage of the example
+static void print_usage()
+{
+	std::cerr << "Usage: coro_example -s server[,server...] [-p port] [-t type] [-w window] [-c] [-q] file" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	struct dns_client_config cfg;
+	dns_client_config_init(&cfg);
+	int qtype = QTYPE_A;
+	bool quiet = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "s:p:t:w:cqh")) != -1)
+	{
+		switch (opt)
+		{
+		case 's':
+			cfg.servers = optarg;
+			break;
+		case 'p':
+			cfg.port = atoi(optarg);
+			break;
+		case 't':
+			qtype = parse_qtype(optarg);
+			break;
+		case 'w':
+			cfg.window = atoi(optarg);
+			break;
+		case 'c':
+			// repeated names are answered from the cache inside co_await
+			cfg.cache = 1;
+			break;
+		case 'q':
+			quiet = true;
+			break;
+		default:
+			print_usage();
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (optind != argc - 1 || cfg.servers == NULL || qtype < 0)
+	{
+		print_usage();
+		return 1;
+	}
+
+	// names stay in memory until every lookup ended, one coroutine per name
+	std::vector<std::string> names;
+	std::ifstream file(argv[optind]);
+	if (!file)
+	{
+		std::cerr << "Error: Cannot open " << argv[optind] << std::endl;
+		return 1;
+	}
+	std::string line;
+	while (std::getline(file, line))
+	{
+		size_t start = line.find_first_not_of(" \t");
+		if (start == std::string::npos || line[start] == '#')
+		{
+			continue;
+		}
+		names.push_back(line.substr(start, line.find_first_of(" \t\r", start) - start));
+	}
+
+	struct coro_resolver *resolver = (struct coro_resolver *)malloc(sizeof(struct coro_resolver));
+	if (resolver == NULL || coro_resolver_init(resolver, &cfg) != CLIENT_OK)
+	{
+		free(resolver);
+		return 1;
+	}
+	struct parsed_arguments args;
+	init_arguments(&args);
+	args.format = FORMAT_JSONL;
+	struct output_buffer out;
+	if (output_init(&out, OUTPUT_BUFFER_SIZE, STDOUT_FILENO) < 0)
+	{
+		std::cerr << "Error: Out of memory" << std::endl;
+		coro_resolver_free(resolver);
+		free(resolver);
+		return 1;
+	}
+	struct lookup_run run = {resolver, &args, quiet ? NULL : &out, 0, 0};
+
+	long long start = now_us();
+	for (const std::string &name : names)
+	{
+		lookup(&run, name.c_str(), qtype);
+	}
+	coro_resolver_run(resolver);
+	long long elapsed = std::max(now_us() - start, 1LL);
+	output_flush(&out);
+	output_free(&out);
+
+	const struct frame_pool *pool = frame_pool_stats();
+	std::cerr << "Lookups: " << names.size() << ", Answered: " << run.answered << ", Failed: " << run.failed
+			  << std::fixed << std::setprecision(3) << ", Elapsed: " << elapsed / 1e6 << " s, Lookups per second: "
+			  << std::setprecision(0) << names.size() * 1e6 / elapsed << std::endl;
+	std::cerr << "Coroutine frames: " << pool->allocated << ", at once: " << pool->peak << ", reused: " << pool->reused
+			  << ", slabs: " << pool->slab_cnt << " (" << pool->slab_cnt * FRAME_POOL_SLAB / 1024 << " KiB)" << std::endl;
+	coro_resolver_free(resolver);
+	free(resolver);
+	return run.failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,156 @@
+// author: Marek Kozumplik, xkozum08
+#include "counters.hpp"
+#include "resolver.hpp"
+
+/// @brief creates the shared memory segment with a zeroed slot for every thread
+/// @param seg
+/// @param args args->counters is the name of the segment, server names are copied to the header
+/// @param slot_cnt
+/// @param mode COUNTERS_BATCH, COUNTERS_FORWARDER
+/// @return 0 on success, -1 on error (error is printed)
+int counters_create(struct counters_segment *seg, struct parsed_arguments *args, int slot_cnt, int mode)
+{
+	seg->header = NULL;
+	seg->slots = NULL;
+	snprintf(seg->name, sizeof(seg->name), "%s%s", (args->counters[0] == '/') ? "" : "/", args->counters);
+	seg->size = sizeof(struct counters_header) + slot_cnt * sizeof(struct counters_slot);
+	// a segment left by a killed run is replaced
+	int fd = shm_open(seg->name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0 || ftruncate(fd, seg->size) < 0)
+	{
+		perror("Error creating counters segment");
+		if (fd >= 0)
+		{
+			close(fd);
+			shm_unlink(seg->name);
+		}
+		return -1;
+	}
+	void *map = mmap(NULL, seg->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		perror("Error mapping counters segment");
+		shm_unlink(seg->name);
+		return -1;
+	}
+	// ftruncate filled the segment with zeros
+	struct counters_header *header = (struct counters_header *)map;
+	header->version = COUNTERS_VERSION;
+	header->size = seg->size;
+	header->slot_cnt = slot_cnt;
+	header->server_cnt = args->iterative ? 0 : args->server_cnt;
+	header->mode = mode;
+	header->pid = getpid();
+	header->finished = 0;
+	header->start_us = now_us();
+	for (unsigned i = 0; i < header->server_cnt; i++)
+	{
+		strncpy(header->servers[i], args->servers[i], COUNTERS_NAME_LEN - 1);
+	}
+	// readers check the magic, so it is written after the rest of the header
+	__atomic_store_n(&header->magic, COUNTERS_MAGIC, __ATOMIC_RELEASE);
+	seg->header = header;
+	seg->slots = (struct counters_slot *)(header + 1);
+	return 0;
+}
+
+/// @brief marks the counters as final, unmaps and removes the segment
+/// @param seg
+void counters_close(struct counters_segment *seg)
+{
+	if (seg->header == NULL)
+	{
+		return;
+	}
+	__atomic_store_n(&seg->header->finished, 1, __ATOMIC_RELEASE);
+	munmap(seg->header, seg->size);
+	// readers which have it mapped keep the final counters
+	shm_unlink(seg->name);
+	seg->header = NULL;
+}
+
+/// @brief stores the counter without tearing, the slot has only one writer
+/// @param counter
+/// @param value
+static inline void counter_set(uint64_t *counter, uint64_t value)
+{
+	__atomic_store_n(counter, value, __ATOMIC_RELAXED);
+}
+
+/// @brief copies the counters of the resolver into the slot of its thread
+/// @param slot
+/// @param res
+/// @param answered requests answered with rcode 0 (or answers sent to clients)
+/// @param failed requests with error rcode, timeout or invalid name
+void counters_publish(struct counters_slot *slot, struct resolver *res, unsigned long answered, unsigned long failed)
+{
+	counter_set(&slot->requests, answered + failed);
+	counter_set(&slot->answered, answered);
+	counter_set(&slot->failed, failed);
+	counter_set(&slot->submitted, res->submitted);
+	counter_set(&slot->timeouts, res->timeouts);
+	counter_set(&slot->retransmits, res->retransmits);
+	counter_set(&slot->coalesced, res->coalesced);
+	if (res->cache != NULL)
+	{
+		struct cache_shard *shard = &res->cache->shards[res->cache_shard];
+		counter_set(&slot->cache_hits, shard->hits);
+		counter_set(&slot->cache_misses, shard->misses);
+	}
+	counter_set(&slot->inflight, resolver_inflight(res));
+	for (int i = 0; i < COUNTERS_RCODES; i++)
+	{
+		counter_set(&slot->rcodes[i], res->rcodes[i]);
+	}
+	// servers of iterative mode are not in the header, upstreams beyond -s are not published
+	for (int i = 0; i < res->server_cnt && i < MAX_SERVERS && res->iter == NULL; i++)
+	{
+		counter_set(&slot->servers[i].queries, res->servers[i].queries);
+		counter_set(&slot->servers[i].answered, res->servers[i].answered);
+		counter_set(&slot->servers[i].timeouts, res->servers[i].timeouts);
+		counter_set(&slot->servers[i].retransmits, res->servers[i].retransmits);
+	}
+	counter_set(&slot->updated_us, now_us());
+}
+
+/// @brief maps the segment of another process read only and checks its layout
+/// @param name
+/// @param size size of the mapping, for munmap
+/// @return header followed by the slots, NULL on error (error is printed)
+const struct counters_header *counters_attach(const char *name, size_t *size)
+{
+	char path[256];
+	snprintf(path, sizeof(path), "%s%s", (name[0] == '/') ? "" : "/", name);
+	int fd = shm_open(path, O_RDONLY, 0);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) < 0)
+	{
+		perror("Error opening counters segment");
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return NULL;
+	}
+	*size = st.st_size;
+	void *map = MAP_FAILED;
+	if (*size >= sizeof(struct counters_header))
+	{
+		map = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+	const struct counters_header *header = (const struct counters_header *)map;
+	if (map == MAP_FAILED || __atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != COUNTERS_MAGIC ||
+		header->version != COUNTERS_VERSION || header->size > *size ||
+		header->size != sizeof(struct counters_header) + header->slot_cnt * sizeof(struct counters_slot))
+	{
+		std::cerr << "Error: " << path << " is not a counters segment of this version" << std::endl;
+		if (map != MAP_FAILED)
+		{
+			munmap(map, *size);
+		}
+		return NULL;
+	}
+	return header;
+}
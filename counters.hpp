@@ -0,0 +1,103 @@
+// author: Marek Kozumplik, xkozum08
+#pragma once
+#include "dns.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define COUNTERS_MAGIC 0x53544e44 // "DNTS"
+#define COUNTERS_VERSION 1
+#define COUNTERS_RCODES 16 // 4 bit rcode of the header
+#define COUNTERS_NAME_LEN 64
+
+// what the counted process is doing
+#define COUNTERS_BATCH 0
+#define COUNTERS_FORWARDER 1
+
+/*
+	Shared memory segment of --counters (shm_open), all numbers in host byte order
+
+	+------------------------------------------+
+	| counters_header                          |  written once at start, finished at exit
+	+------------------------------------------+
+	| counters_slot of thread 0                |  every slot has its own cache lines and one writer,
+	| ...                                      |  counters are totals since the start
+	+------------------------------------------+
+
+	Writers copy the counters of their resolver into the slot with relaxed atomic stores after every poll,
+	so the hot path only keeps the plain counters it already has. Readers sum the slots and compute rates
+	from two samples, a sample may mix counters from two polls of the same thread.
+*/
+struct alignas(64) counters_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;		 // whole segment
+	uint32_t slot_cnt;	 // threads
+	uint32_t server_cnt; // servers from -s, 0 in iterative mode
+	uint32_t mode;		 // COUNTERS_BATCH, COUNTERS_FORWARDER
+	int32_t pid;
+	uint32_t finished;	 // 1 when the run ended, the counters are final
+	uint64_t start_us;	 // CLOCK_MONOTONIC of the start
+	char servers[MAX_SERVERS][COUNTERS_NAME_LEN];
+};
+
+struct counters_server
+{
+	uint64_t queries; // queries sent to the server, retransmissions included
+	uint64_t answered;
+	uint64_t timeouts;
+	uint64_t retransmits;
+};
+
+struct alignas(64) counters_slot
+{
+	uint64_t updated_us; // CLOCK_MONOTONIC of the last update
+	uint64_t requests;	 // finished requests (answered and failed)
+	uint64_t answered;
+	uint64_t failed;
+	uint64_t submitted; // queries sent to servers
+	uint64_t timeouts;
+	uint64_t retransmits;
+	uint64_t coalesced;
+	uint64_t cache_hits;
+	uint64_t cache_misses;
+	uint64_t inflight; // requests waiting for answer now
+	uint64_t rcodes[COUNTERS_RCODES];
+	struct counters_server servers[MAX_SERVERS];
+};
+
+struct counters_segment
+{
+	struct counters_header *header; // NULL if counters are not published
+	struct counters_slot *slots;
+	size_t size;
+	char name[257]; // "/" and the name of --counters
+};
+
+struct resolver;
+
+/// @brief creates the shared memory segment with a zeroed slot for every thread
+/// @param seg
+/// @param args args->counters is the name of the segment, server names are copied to the header
+/// @param slot_cnt
+/// @param mode COUNTERS_BATCH, COUNTERS_FORWARDER
+/// @return 0 on success, -1 on error (error is printed)
+int counters_create(struct counters_segment *seg, struct parsed_arguments *args, int slot_cnt, int mode);
+
+/// @brief marks the counters as final, unmaps and removes the segment
+/// @param seg
+void counters_close(struct counters_segment *seg);
+
+/// @brief copies the counters of the resolver into the slot of its thread
+/// @param slot
+/// @param res
+/// @param answered requests answered with rcode 0 (or answers sent to clients)
+/// @param failed requests with error rcode, timeout or invalid name
+void counters_publish(struct counters_slot *slot, struct resolver *res, unsigned long answered, unsigned long failed);
+
+/// @brief maps the segment of another process read only and checks its layout
+/// @param name
+/// @param size size of the mapping, for munmap
+/// @return header followed by the slots, NULL on error (error is printed)
+const struct counters_header *counters_attach(const char *name, size_t *size);
@@ -1,189 +1,188 @@
 // author: Marek Kozumplik, xkozum08
 #include "dns.hpp"
-#include "arg_parser.cpp"
-#include "encoder.cpp"
-#include "printer.cpp"
-
-/// @brief returns address type: TYPE_IP4, TYPE_IP6, TYPE_DOMAIN using regex patterns
-/// @param addr
-/// @return
-int get_address_type(char *addr)
+#include "arg_parser.hpp"
+#include "client.hpp"
+#include "batch.hpp"
+#include "workers.hpp"
+#include "capture.hpp"
+#include "forwarder.hpp"
+
+/// @brief stores the answer of the single query, used as client callback
+/// @param user single_answer
+/// @param result
+static void store_single_answer(void *user, const struct dns_result *result)
 {
-	std::regex ipv4Pattern(R"((\d{1,3}\.){3}\d{1,3})");
-	std::regex ipv6Pattern(R"(([0-9a-fA-F]{1,4}:){7,7}[0-9a-fA-F]{1,4}|([0-9a-fA-F]{1,4}:){1,7}(:[0-9a-fA-F]{1,4}){1,7}|([0-9a-fA-F]{1,4}:){1,7}:|::)");
-	std::regex domainPattern(R"(([a-zA-Z0-9](?:[a-zA-Z0-9-]{0,61}[a-zA-Z0-9])?\.)+[a-zA-Z]{2,})");
-	std::string server_str(reinterpret_cast<const char *>(addr));
-
-	if (std::regex_match(server_str, ipv4Pattern))
+	struct single_answer *answer = (struct single_answer *)user;
+	answer->status = result->status;
+	if (result->status == QUERY_OK)
 	{
-		return TYPE_IP4;
-	}
-	else if (std::regex_match(server_str, ipv6Pattern))
-	{
-		return TYPE_IP6;
-	}
-	else if (std::regex_match(server_str, domainPattern))
-	{
-		return TYPE_DOMAIN;
+		std::memcpy(answer->msg, result->msg, result->msg_len);
+		answer->len = result->msg_len;
+		answer->rcode = result->rcode;
+		answer->parse_error = result->parse_error;
+		if (result->view != NULL)
+		{
+			// the offsets of the view are the same in the copy
+			*answer->view = *result->view;
+			answer->view->msg = answer->msg;
+		}
 	}
-	return -1;
 }
 
-// fills the dns header with data
-void fill_dns_header(struct dns_header *dns, struct parsed_arguments *args)
-{
-	dns->id = (unsigned short)htons(getpid());
-	dns->qr = 0;			   // query
-	dns->opcode = 0;		   // normal query
-	dns->aa = 0;			   // not authoritive
-	dns->tc = 0;			   // not truncated
-	dns->rd = args->recursion; // Recursion Desired
-	dns->ra = 0;			   // Recursion Available
-	dns->z = 0;
-	dns->ad = 0;
-	dns->cd = 0;
-	dns->rcode = 0;			 // No error
-	dns->q_count = htons(1); // 1 question
-	dns->ans_count = 0;
-	dns->auth_count = 0;
-	dns->add_count = 0;
-}
-
-/// @brief rewrites the domain name to ipv4 address using gethostbyname. Only when -s argument is domain name
+/// @brief prints why the query got no answer
 /// @param args
-void domain_to_address(struct parsed_arguments *args)
+/// @param status QUERY_TIMEOUT, ...
+static void print_query_error(struct parsed_arguments *args, int status)
 {
-	struct hostent *host_info;
-	struct in_addr **addr_list;
-	host_info = gethostbyname(args->server);
-	if (host_info == nullptr)
+	switch (status)
 	{
-		std::cerr << "Error: Failed to get server address" << std::endl;
-		free(args);
-		exit(1);
+	case QUERY_BAD_NAME:
+		std::cerr << (args->reverse ? "Address is not IP type\n" : "Address is not domain type\n");
+		break;
+	case QUERY_CONNECTION_FAILED:
+		std::cerr << "Error: TCP connection to server failed" << std::endl;
+		break;
+	case QUERY_ITERATION_FAILED:
+		std::cerr << "Error: Iterative resolution failed, no name server answered" << std::endl;
+		break;
+	default:
+		std::cerr << "Error: No response from server" << std::endl;
+		break;
 	}
-
-	addr_list = reinterpret_cast<struct in_addr **>(host_info->h_addr_list);
-	strcpy(args->server, inet_ntoa(*addr_list[0]));
 }
 
-/// @brief sends and receives datagram using sendto and recvfrom, UDP only
-/// @param buf
-/// @param sock
-/// @param dest
-/// @param qname
-/// @param dest_size
-void send_and_receive(unsigned char *buf, int sock, struct sockaddr *dest, unsigned char *qname, int dest_size, struct parsed_arguments *args)
+/// @brief Main function for communication with the server. The queries go through the client of the library,
+/// so they are retransmitted to the fastest of the servers and retried over TCP like in batch mode. All types
+/// of -t are sent at once on the same sockets and their answers are merged into one result
+/// @param args parsed arguments, servers checked by prepare_servers
+/// @return exit code of the program
+int send_dns_query(struct parsed_arguments *args)
 {
-	// set timeout at 5 seconds
-	struct timeval tv;
-	tv.tv_sec = 5;
-	tv.tv_usec = 0;
-	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char *)&tv, sizeof tv);
-
-	if (sendto(sock, (char *)buf, sizeof(struct dns_header) + (strlen((const char *)qname) + 1) + 4, 0, dest, dest_size) < 0)
+	if (args->reverse && !is_ip4_address(args->hostname) && !is_ip6_address(args->hostname))
+	{
+		std::cerr << "Address is not IP type\n";
+		return 1;
+	}
+	struct dns_query_request req;
+	strncpy(req.name, args->hostname, sizeof(req.name) - 1);
+	req.name[sizeof(req.name) - 1] = '\0';
+	req.qtype = (args->ip6) ? QTYPE_AAAA : QTYPE_A; // type of the query, 1-A, 28-AAAA, 12 - PTR
+	req.reverse = args->reverse;
+	req.tag = 0;
+	req.qname_len = 0;
+
+	int qtypes[MAX_QTYPES];
+	int qtype_cnt = args->qtype_cnt;
+	std::memcpy(qtypes, args->qtypes, sizeof(qtypes));
+	if (qtype_cnt == 0)
 	{
-		perror("Error sending datagram");
+		qtypes[qtype_cnt++] = req.reverse ? QTYPE_PTR : req.qtype;
 	}
-	if (recvfrom(sock, (char *)buf, 65536, 0, dest, (socklen_t *)&dest_size) < 0)
+	req.qtype = req.reverse ? req.qtype : qtypes[0];
+
+	// answers and their views are large, one of each per type
+	struct single_answer answers[MAX_QTYPES];
+	unsigned char *bufs = (unsigned char *)malloc(qtype_cnt * 65536);
+	struct dns_message_view *parsed = (struct dns_message_view *)malloc(qtype_cnt * sizeof(struct dns_message_view));
+	struct dns_client *client = (struct dns_client *)malloc(sizeof(struct dns_client));
+	if (bufs == NULL || parsed == NULL || client == NULL || dns_client_init_args(client, args) != CLIENT_OK)
 	{
-		perror("Error receiving datagram");
-		free(args);
-		exit(1);
+		free(bufs);
+		free(parsed);
+		free(client);
+		return 1;
 	}
-}
-
-/// @brief Main function for communication with the server
-/// @param args parsed arguments
-void send_dns_query(struct parsed_arguments *args)
-{
-	int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP); // UDP packet for DNS queries
-
-	struct dns_header *dns = NULL;
-	struct dns_question *question = NULL;
-	unsigned char buf[65536];
-	dns = (struct dns_header *)&buf;
-	fill_dns_header(dns, args);
-
-	unsigned char *qname;
-	qname = (unsigned char *)&buf[sizeof(struct dns_header)];
-	if (args->reverse == 0)
+	for (int k = 0; k < qtype_cnt; k++)
 	{
-		if (get_address_type(args->hostname) == TYPE_DOMAIN)
+		answers[k].status = -1;
+		answers[k].msg = bufs + k * 65536;
+		answers[k].len = 0;
+		answers[k].view = &parsed[k];
+		int ret;
+		while ((ret = dns_client_submit(client, req.name, qtypes[k], store_single_answer, &answers[k])) == CLIENT_BUSY)
 		{
-			convert_domain_to_dns(args->hostname, qname);
+			// window or transmit queue is full, the answers of earlier types free it
+			dns_client_poll(client, -1);
 		}
-		else
+		if (ret == CLIENT_ERROR)
 		{
-			std::cerr << "Address is not domain type\n";
-			free(args);
-			exit(1);
+			answers[k].status = QUERY_BAD_NAME; // name too long for the request
 		}
 	}
-	else
+	// one round trip for all types
+	while (dns_client_pending(client) > 0)
 	{
-		int addr_type = get_address_type(args->hostname);
-		if (addr_type == TYPE_IP4)
+		dns_client_poll(client, -1);
+	}
+	// saves the cache file
+	dns_client_free(client);
+	free(client);
+
+	// Check error codes, JSON Lines and CSV print the answer with its rcode
+	const struct dns_message_view *views[MAX_QTYPES];
+	int view_cnt = 0;
+	int ret = 0;
+	uint32_t printed_rcode = 0; // NXDOMAIN of the name comes in the answer of every type
+	for (int k = 0; k < qtype_cnt; k++)
+	{
+		if (answers[k].status != QUERY_OK)
 		{
-			convert_ip4_to_dns(args->hostname, qname);
+			print_query_error(args, answers[k].status);
+			ret = 1;
+			continue;
 		}
-		else if (addr_type == TYPE_IP6)
+		uint32_t rcode = answers[k].rcode;
+		if (rcode != 0)
 		{
-			convert_ip6_to_dns(args->hostname, qname);
+			ret = 1;
+			if (args->format == FORMAT_TEXT)
+			{
+				if (rcode != printed_rcode)
+				{
+					print_rcode(rcode);
+				}
+				printed_rcode = rcode;
+				continue;
+			}
 		}
-		else
+		if (answers[k].parse_error != PARSE_OK)
 		{
-			std::cerr << "Address is not IP type\n";
-			free(args);
-			exit(1);
+			std::cerr << "Error: Malformed response (" << parse_error_string(answers[k].parse_error) << ")" << std::endl;
+			ret = 1;
+			continue;
 		}
+		views[view_cnt++] = &parsed[k];
 	}
 
-	question = (struct dns_question *)&buf[sizeof(dns_header) + strlen((const char *)qname) + 1]; // +1 because of 0 at the end of string
-
-	if (args->reverse == 0)
-	{
-		question->q_type = (args->ip6) ? htons(28) : htons(1); // type of the query, 1-A, 28-AAAA, 12 - PTR
-	}
-	else
-	{
-		question->q_type = htons(12); // PTR
-	}
-
-	question->q_class = htons(1); // type IN
-
-	if (args->address_type == 0)
-	{
-		// Send to IPv4
-		struct sockaddr_in dest;
-		dest.sin_family = AF_INET;
-		dest.sin_port = htons(args->port);
-		dest.sin_addr.s_addr = inet_addr(args->server);
-		send_and_receive(buf, sock, (struct sockaddr *)&dest, qname, sizeof(dest), args);
-	}
-	else
+	// print every section of answer and information
+	struct output_buffer out;
+	if (view_cnt > 0 && output_init(&out, OUTPUT_BUFFER_SIZE, STDOUT_FILENO) < 0)
 	{
-		// Send to IPv6
-		struct sockaddr_in6 dest;
-		std::memset(&dest, 0, sizeof(dest));
-		dest.sin6_port = htons(args->port);
-		dest.sin6_family = AF_INET6;
-		std::cout << args->server << std::endl;
-		inet_pton(AF_INET6, args->server, &dest.sin6_addr);
-		send_and_receive(buf, sock, (struct sockaddr *)&dest, qname, sizeof(dest), args);
+		std::cerr << "Error: Out of memory" << std::endl;
+		ret = 1;
 	}
-
-	// Check error codes
-	uint32_t rcode = (dns->rcode);
-	if (rcode != 0)
+	else if (view_cnt > 0)
 	{
-		print_rcode(rcode);
-		free(args);
-		exit(1);
+		int error = format_header(&out, args);
+		if (error == 0 && view_cnt == 1 && args->qtype_cnt <= 1)
+		{
+			error = format_answer(&out, views[0], args, &req);
+		}
+		else if (error == 0)
+		{
+			error = format_merged(&out, views, view_cnt, args, &req);
+		}
+		if (error < 0)
+		{
+			std::cerr << "Error: Out of memory" << std::endl;
+			ret = 1;
+		}
+		output_flush(&out);
+		output_free(&out);
 	}
-
-	// print every section of answer and information
-	print_all_sections(buf, args);
+	free(bufs);
+	free(parsed);
+	return ret;
 }
 
 /// @brief Main function of application
@@ -193,46 +192,58 @@ void send_dns_query(struct parsed_arguments *args)
 int main(int argc, char *argv[])
 {
 	struct parsed_arguments *args = (struct parsed_arguments *)malloc(sizeof(struct parsed_arguments));
-	args->port = DNS_PORT;
-	args->recursion = 0;
-	args->address_type = 0;
-	args->reverse = 0;
-	args->ip6 = 0;
+	init_arguments(args);
 
-	parse_arguments(argc, argv, args);
+	int parsed = parse_arguments(argc, argv, args);
+	if (parsed != 0)
+	{
+		free(args);
+		return (parsed < 0) ? 1 : 0;
+	}
 
-	if (args->server[0] == '\0')
+	if (args->replay[0] != '\0')
+	{
+		int ret = run_replay(args);
+		free(args);
+		return ret;
+	}
+	if (args->record[0] != '\0' && capture_create(args->record) < 0)
 	{
-		std::cerr << "-s argument is missing" << std::endl;
 		free(args);
 		return 1;
 	}
 
-	int server_type = get_address_type(args->server);
-	switch (server_type)
-	{
-	case TYPE_DOMAIN:
-		// if -s is domain name, we need the find the ip4 address
-		domain_to_address(args); // this converts domain to ip4
-		send_dns_query(args);
-		args->address_type = 0;
-		break;
-	case TYPE_IP4:
-		send_dns_query(args);
-		args->address_type = 0;
-		break;
-	case TYPE_IP6:
-		args->address_type = 1;
-		send_dns_query(args);
-		break;
-	default:
-		std::cerr << "Error: Invalid server address\n";
+	if (args->server_cnt == 0 && !args->iterative)
+	{
+		std::cerr << "-s argument is missing" << std::endl;
+		free(args);
+		return 1;
+	}
+	if (prepare_servers(args) < 0)
+	{
 		free(args);
 		return 1;
-		break;
+	}
+
+	int ret = 0;
+	bool batch = args->batch_file[0] != '\0' || args->sweep;
+	if (args->listen[0] != '\0')
+	{
+		ret = run_forwarder(args);
+	}
+	else if (batch && args->threads > 1)
+	{
+		ret = run_threaded_batch(args);
+	}
+	else if (batch)
+	{
+		ret = run_batch(args);
+	}
+	else
+	{
+		ret = send_dns_query(args);
 	}
 
 	free(args);
-	return 0;
+	return ret;
 }
-
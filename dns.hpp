@@ -9,7 +9,6 @@
 #include <sys/socket.h>
 #include <unistd.h>
 #include <bitset>
-#include <regex>
 #include <iomanip>
 
 #define DNS_PORT 53
@@ -17,17 +16,80 @@
 #define TYPE_IP6 1
 #define TYPE_DOMAIN 2
 
+#define QTYPE_A 1
+#define QTYPE_NS 2
+#define QTYPE_CNAME 5
+#define QTYPE_SOA 6
+#define QTYPE_PTR 12
+#define QTYPE_MX 15
+#define QTYPE_TXT 16
+#define QTYPE_AAAA 28
+#define QTYPE_OPT 41 // EDNS0 pseudo-record (RFC 6891)
+#define QCLASS_IN 1
+
+#define DEFAULT_WINDOW 256
+#define MAX_WINDOW 65535
+#define MAX_SERVERS 16
+#define MAX_QTYPES 8 // types of -t
+
+// long options without short form
+#define OPT_STATS 256
+#define OPT_BACKEND 257
+#define OPT_THREADS 258
+#define OPT_CACHE 259
+#define OPT_CACHE_FILE 260
+#define OPT_CACHE_SIZE 261
+#define OPT_TCP 262
+#define OPT_EDNS 263
+#define OPT_HEDGE 264
+#define OPT_ITERATIVE 265
+#define OPT_ROOT_HINTS 266
+#define OPT_LISTEN 267
+#define OPT_FORMAT 268
+#define OPT_RECORD 269
+#define OPT_REPLAY 270
+#define OPT_COUNTERS 271
+#define OPT_TABLE 272
+
 struct parsed_arguments
 {
 	int recursion = 0;
 	int reverse = 0;
 	int ip6 = 0;
+	int qtypes[MAX_QTYPES]; // -t, types asked at once in single mode and merged into one result
+	int qtype_cnt = 0;		// 0 - A, or AAAA with -6
 	int port = DNS_PORT;
 	int address_type;
 	char server[256];
 	char hostname[256];
+	char servers[MAX_SERVERS][256]; // every -s in batch mode, servers[0] is the same as server
+	int server_types[MAX_SERVERS];	// address_type of every server
+	int server_cnt = 0;
+	int backend = 0; // --backend, event loop used in batch mode: BACKEND_EPOLL, BACKEND_URING
+	char batch_file[256]; // -b, file with names to resolve ("-" is stdin)
+	int sweep = 0;		  // -x with prefix (address/length), reverse names of the whole prefix are resolved like batch
+	int window = DEFAULT_WINDOW; // -w, max number of queries in flight in batch mode
+	int stats = 0;				 // --stats, print statistics at the end of the run
+	int stats_interval = 0;		 // --stats=N, seconds between periodic latency reports, 0 - only at the end
+	int threads = 1;			 // --threads, number of worker threads in batch mode
+	int cache = 0;				 // --cache, answers are cached for their TTL
+	char cache_file[256];		 // --cache-file, snapshot of the cache loaded at start and saved at exit
+	long cache_size;			 // --cache-size, max number of cached answers
+	int tcp = 0;				 // --tcp, queries are sent over TCP instead of UDP
+	int edns = 0;				 // --edns, UDP payload size advertised in OPT record, 0 - queries without OPT
+	int hedge = 0;				 // --hedge, RTT percentile after which the query goes also to second server, 0 - off
+	int iterative = 0;			 // --iterative, names are resolved from the root servers without -s
+	char root_hints[1024];		 // --root-hints, comma separated addr[:port] of root servers, empty - IANA root servers
+	char listen[256];			 // --listen, [address:]port the forwarder answers clients on, empty - no forwarder
+	int format = 0;				 // --format, FORMAT_TEXT, FORMAT_JSONL, FORMAT_CSV
+	char record[256];			 // --record, capture file the queries and responses are appended to, empty - off
+	char replay[256];			 // --replay, capture file parsed and printed without sending queries
+	char counters[256];			 // --counters, shared memory segment the live counters are published in, empty - off
+	char table[256];			 // --table, compiled table of blocked names and static answers, empty - off
 };
 
+struct dns_cache;
+
 struct dns_header
 {
 	/*
@@ -98,29 +160,30 @@ struct dns_answer
 	// data
 };
 
-/// @brief returns address type: TYPE_IP4, TYPE_IP6, TYPE_DOMAIN using regex patterns
+/// @brief returns address type: TYPE_IP4, TYPE_IP6, TYPE_DOMAIN
 /// @param addr
 /// @return
-int get_address_type(char *addr);
+int get_address_type(const char *addr);
 
 /// @brief fills the dns header with data
 /// @param dns
-/// @param args
-void fill_dns_header(struct dns_header *dns, struct parsed_arguments *args);
-
-/// @brief rewrites the domain name to ipv4 address using gethostbyname. Only when -s argument is domain name
-/// @param args
-void domain_to_address(struct parsed_arguments *args);
-
-/// @brief sends and receives datagram using sendto and recvfrom, UDP only
-/// @param buf
-/// @param sock
-/// @param dest
-/// @param qname
-/// @param dest_size
-/// @param args
-void send_and_receive(unsigned char *buf, int sock, struct sockaddr *dest, unsigned char *qname, int dest_size, struct parsed_arguments *args);
-
-/// @brief Main function for communication with the server
-/// @param args
-void send_dns_query(struct parsed_arguments *args);
+/// @param recursion recursion desired flag
+/// @param id transaction id in network byte order
+void fill_dns_header(struct dns_header *dns, int recursion, unsigned short id);
+
+// result of the query in single mode, filled by the client callback
+struct single_answer
+{
+	int status; // QUERY_OK, QUERY_TIMEOUT, ...
+	unsigned char *msg;
+	int len;
+	int rcode;						// rcode of the answer, extended by OPT
+	int parse_error;				// PARSE_OK or the parse error of the answer
+	struct dns_message_view *view;	// msg parsed by the client, valid only without parse_error
+};
+
+/// @brief Main function for communication with the server. The query goes through the client of the library,
+/// so it is retransmitted to the fastest of the servers and retried over TCP like in batch mode
+/// @param args parsed arguments, servers checked by prepare_servers
+/// @return exit code of the program
+int send_dns_query(struct parsed_arguments *args);
@@ -0,0 +1,203 @@
+// author: Marek Kozumplik, xkozum08
+// Reader of the live counters published by dns --counters name, prints rates of every interval by sampling
+// the shared memory segment. Built with make dnsstat
+#include "counters.hpp"
+#include "resolver.hpp"
+#include <signal.h>
+
+#define STAT_DEFAULT_INTERVAL_MS 1000
+
+static volatile sig_atomic_t stat_stop = 0;
+
+// sum of all slots at one moment
+struct stat_sample
+{
+	long long time_us;
+	long long updated_us; // last update of any slot
+	uint64_t requests;
+	uint64_t answered;
+	uint64_t failed;
+	uint64_t submitted;
+	uint64_t timeouts;
+	uint64_t retransmits;
+	uint64_t coalesced;
+	uint64_t cache_hits;
+	uint64_t cache_misses;
+	uint64_t inflight;
+	uint64_t rcodes[COUNTERS_RCODES];
+	struct counters_server servers[MAX_SERVERS];
+};
+
+/// @brief stops the sampling loop
+/// @param sig
+static void stop_stat(int sig)
+{
+	(void)sig;
+	stat_stop = 1;
+}
+
+/// @brief reads the counter written by another process
+/// @param counter
+/// @return
+static inline uint64_t counter_get(const uint64_t *counter)
+{
+	return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+/// @brief sums the counters of all slots
+/// @param header
+/// @param s
+static void take_sample(const struct counters_header *header, struct stat_sample *s)
+{
+	std::memset(s, 0, sizeof(*s));
+	s->time_us = now_us();
+	const struct counters_slot *slots = (const struct counters_slot *)(header + 1);
+	for (unsigned i = 0; i < header->slot_cnt; i++)
+	{
+		const struct counters_slot *slot = &slots[i];
+		s->updated_us = std::max(s->updated_us, (long long)counter_get(&slot->updated_us));
+		s->requests += counter_get(&slot->requests);
+		s->answered += counter_get(&slot->answered);
+		s->failed += counter_get(&slot->failed);
+		s->submitted += counter_get(&slot->submitted);
+		s->timeouts += counter_get(&slot->timeouts);
+		s->retransmits += counter_get(&slot->retransmits);
+		s->coalesced += counter_get(&slot->coalesced);
+		s->cache_hits += counter_get(&slot->cache_hits);
+		s->cache_misses += counter_get(&slot->cache_misses);
+		s->inflight += counter_get(&slot->inflight);
+		for (int r = 0; r < COUNTERS_RCODES; r++)
+		{
+			s->rcodes[r] += counter_get(&slot->rcodes[r]);
+		}
+		for (unsigned k = 0; k < header->server_cnt && k < MAX_SERVERS; k++)
+		{
+			s->servers[k].queries += counter_get(&slot->servers[k].queries);
+			s->servers[k].answered += counter_get(&slot->servers[k].answered);
+			s->servers[k].timeouts += counter_get(&slot->servers[k].timeouts);
+			s->servers[k].retransmits += counter_get(&slot->servers[k].retransmits);
+		}
+	}
+}
+
+/// @brief prints rates between two samples, with prev NULL the totals since the start of the run
+/// @param header
+/// @param prev
+/// @param cur
+static void print_sample(const struct counters_header *header, const struct stat_sample *prev, const struct stat_sample *cur)
+{
+	static const char *rcode_names[] = {"NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED"};
+	struct stat_sample zero;
+	std::memset(&zero, 0, sizeof(zero));
+	zero.time_us = header->start_us;
+	const struct stat_sample *base = (prev != NULL) ? prev : &zero;
+	// totals are rated by the time the run was counting, not by the time it was watched
+	long long end_us = (prev != NULL) ? cur->time_us : std::max(cur->updated_us, base->time_us);
+	double seconds = std::max(end_us - base->time_us, 1LL) / 1e6;
+
+	std::cout << std::fixed << std::setprecision(1) << "[" << (end_us - (long long)header->start_us) / 1e6 << " s] "
+			  << ((prev != NULL) ? "" : "Total: ") << std::setprecision(0)
+			  << "Requests: " << cur->requests - base->requests << " (" << (cur->requests - base->requests) / seconds
+			  << "/s), Failed: " << cur->failed - base->failed << ", Sent: " << (cur->submitted - base->submitted) / seconds
+			  << "/s, Timeouts: " << (cur->timeouts - base->timeouts) / seconds
+			  << "/s, Retransmits: " << (cur->retransmits - base->retransmits) / seconds
+			  << "/s, Coalesced: " << cur->coalesced - base->coalesced << ", In flight: " << cur->inflight;
+	uint64_t lookups = cur->cache_hits - base->cache_hits + cur->cache_misses - base->cache_misses;
+	if (lookups > 0)
+	{
+		std::cout << std::setprecision(1) << ", Cache hits: " << 100.0 * (cur->cache_hits - base->cache_hits) / lookups << " %";
+	}
+	std::cout << std::endl;
+
+	uint64_t answers = 0;
+	for (int r = 0; r < COUNTERS_RCODES; r++)
+	{
+		answers += cur->rcodes[r] - base->rcodes[r];
+	}
+	if (answers > 0)
+	{
+		std::cout << "  Rcodes:";
+		for (int r = 0; r < COUNTERS_RCODES; r++)
+		{
+			uint64_t cnt = cur->rcodes[r] - base->rcodes[r];
+			if (cnt > 0)
+			{
+				std::cout << " " << ((r < 6) ? rcode_names[r] : "RCODE") << ((r < 6) ? "" : std::to_string(r)) << " "
+						  << std::setprecision(1) << 100.0 * cnt / answers << " %";
+			}
+		}
+		std::cout << std::endl;
+	}
+	for (unsigned k = 0; k < header->server_cnt && header->server_cnt > 1; k++)
+	{
+		const struct counters_server *c = &cur->servers[k];
+		const struct counters_server *b = &base->servers[k];
+		std::cout << "  Server " << header->servers[k] << ": Queries: " << std::setprecision(0)
+				  << (c->queries - b->queries) / seconds << "/s, Answered: " << (c->answered - b->answered) / seconds
+				  << "/s, Timeouts: " << (c->timeouts - b->timeouts) / seconds
+				  << "/s, Retransmits: " << (c->retransmits - b->retransmits) / seconds << "/s" << std::endl;
+	}
+}
+
+/// @brief prints the usage to stderr
+static void print_usage()
+{
+	std::cerr << "Usage: dnsstat [-i interval_ms] [-c count] name" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	int interval_ms = STAT_DEFAULT_INTERVAL_MS;
+	long count = 0; // 0 - until the run ends
+	int opt;
+	while ((opt = getopt(argc, argv, "i:c:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'i':
+			interval_ms = atoi(optarg);
+			break;
+		case 'c':
+			count = atol(optarg);
+			break;
+		default:
+			print_usage();
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (optind != argc - 1 || interval_ms < 1 || count < 0)
+	{
+		print_usage();
+		return 1;
+	}
+	size_t size;
+	const struct counters_header *header = counters_attach(argv[optind], &size);
+	if (header == NULL)
+	{
+		return 1;
+	}
+	std::cout << ((header->mode == COUNTERS_FORWARDER) ? "Forwarder" : "Batch") << " pid " << header->pid << ", "
+			  << header->slot_cnt << " threads" << std::endl;
+
+	signal(SIGINT, stop_stat);
+	signal(SIGTERM, stop_stat);
+	struct stat_sample prev, cur;
+	take_sample(header, &prev);
+	for (long i = 0; (count == 0 || i < count) && !stat_stop; i++)
+	{
+		usleep(interval_ms * 1000);
+		// the segment is removed at the end of the run, a killed run leaves the counters unfinished
+		bool finished = __atomic_load_n(&header->finished, __ATOMIC_ACQUIRE) ||
+						(kill(header->pid, 0) < 0 && errno == ESRCH);
+		take_sample(header, &cur);
+		print_sample(header, &prev, &cur);
+		prev = cur;
+		if (finished)
+		{
+			break;
+		}
+	}
+	print_sample(header, NULL, &prev);
+	munmap((void *)header, size);
+	return 0;
+}
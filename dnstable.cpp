@@ -0,0 +1,106 @@
+// author: Marek Kozumplik, xkozum08
+// Compiler of hosts files and block lists into the table file of dns --table, and lookups in the compiled
+// table. Built with make dnstable
+#include "table.hpp"
+#include "encoder.hpp"
+#include "resolver.hpp"
+
+/// @brief prints usage of the tool
+static void print_usage()
+{
+	std::cerr << "Usage: dnstable [-t ttl] -o table file..." << std::endl;
+	std::cerr << "       dnstable -l table name..." << std::endl;
+}
+
+/// @brief prints what the table answers for the names
+/// @param path
+/// @param names
+/// @param cnt
+/// @return 0 on success, 1 if the table cannot be opened
+static int lookup_names(const char *path, char **names, int cnt)
+{
+	struct dns_table table;
+	if (table_open(&table, path) < 0)
+	{
+		return 1;
+	}
+	for (int i = 0; i < cnt; i++)
+	{
+		unsigned char wire[NAME_WIRE_BUF];
+		int len = convert_domain_to_dns(names[i], wire);
+		const struct table_entry *entry = (len > 0) ? table_lookup(&table, wire, len) : NULL;
+		std::cout << names[i];
+		if (entry == NULL)
+		{
+			std::cout << " not in table" << std::endl;
+			continue;
+		}
+		std::cout << (entry->suffix ? " (subdomain)" : "");
+		if (entry->action == TABLE_BLOCK)
+		{
+			std::cout << " blocked" << std::endl;
+			continue;
+		}
+		const unsigned char *addr = table.data + entry->addr_off;
+		char text[INET6_ADDRSTRLEN];
+		for (int k = 0; k < entry->a_cnt; k++, addr += 4)
+		{
+			std::cout << " A " << inet_ntop(AF_INET, addr, text, sizeof(text));
+		}
+		for (int k = 0; k < entry->aaaa_cnt; k++, addr += 16)
+		{
+			std::cout << " AAAA " << inet_ntop(AF_INET6, addr, text, sizeof(text));
+		}
+		std::cout << std::endl;
+	}
+	table_close(&table);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *output = NULL;
+	const char *lookup = NULL;
+	int ttl = TABLE_DEFAULT_TTL;
+	int opt;
+	while ((opt = getopt(argc, argv, "o:l:t:h")) != -1)
+	{
+		switch (opt)
+		{
+		case 'o':
+			output = optarg;
+			break;
+		case 'l':
+			lookup = optarg;
+			break;
+		case 't':
+			ttl = atoi(optarg);
+			break;
+		default:
+			print_usage();
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if ((output == NULL) == (lookup == NULL) || optind == argc || ttl < 0)
+	{
+		print_usage();
+		return 1;
+	}
+	if (lookup != NULL)
+	{
+		return lookup_names(lookup, &argv[optind], argc - optind);
+	}
+
+	std::vector<std::string> inputs(&argv[optind], &argv[argc]);
+	struct table_compile_stats stats;
+	long long start = now_us();
+	if (table_compile(inputs, ttl, output, &stats) < 0)
+	{
+		return 1;
+	}
+	std::cerr << "Lines: " << stats.lines << ", Blocked: " << stats.blocked << ", Answered: " << stats.answered
+			  << ", Subdomain rules: " << stats.suffixes << ", Skipped: " << stats.skipped << std::endl;
+	std::cerr << "Size: " << stats.size / 1024 << " KiB, Seeds tried: " << stats.attempts << std::fixed
+			  << std::setprecision(3) << ", Elapsed: " << (now_us() - start) / 1e6 << " s" << std::endl;
+	return 0;
+}
@@ -1,99 +1,490 @@
 // author: Marek Kozumplik, xkozum08
 #include "encoder.hpp"
 
-/// @brief Converts domain name to dns format. Example: www.example.com to 3www7example3com0
-/// @param hostname
+/// @brief returns true if addr is IPv4 address in dotted decimal form (without leading zeros, like inet_pton)
+/// @param addr
+/// @return
+bool is_ip4_address(const char *addr)
+{
+    int parts = 0;
+    while (true)
+    {
+        int value = 0;
+        int digits = 0;
+        while (*addr >= '0' && *addr <= '9')
+        {
+            if (digits == 1 && value == 0)
+            {
+                return false; // leading zero
+            }
+            value = value * 10 + (*addr - '0');
+            if (value > 255)
+            {
+                return false;
+            }
+            digits++;
+            addr++;
+        }
+        if (digits == 0)
+        {
+            return false;
+        }
+        parts++;
+        if (*addr == '\0')
+        {
+            return parts == 4;
+        }
+        if (*addr != '.' || parts == 4)
+        {
+            return false;
+        }
+        addr++;
+    }
+}
+
+/// @brief returns true if addr is IPv6 address in any form (full, compressed with ::, IPv4 in last 32 bits)
+/// @param addr
+/// @return
+bool is_ip6_address(const char *addr)
+{
+    int groups = 0;
+    bool compressed = false;
+    if (addr[0] == ':')
+    {
+        if (addr[1] != ':')
+        {
+            return false;
+        }
+        compressed = true;
+        addr += 2;
+        if (*addr == '\0')
+        {
+            return true; // ::
+        }
+    }
+    while (true)
+    {
+        const char *group = addr;
+        int digits = 0;
+        while (isxdigit((unsigned char)*addr) && digits <= 4)
+        {
+            addr++;
+            digits++;
+        }
+        if (*addr == '.')
+        {
+            // IPv4 address must be the last part and it takes 2 groups
+            if (groups > 6 || !is_ip4_address(group))
+            {
+                return false;
+            }
+            groups += 2;
+            break;
+        }
+        if (digits == 0 || digits > 4)
+        {
+            return false;
+        }
+        groups++;
+        if (*addr == '\0')
+        {
+            break;
+        }
+        if (*addr != ':')
+        {
+            return false;
+        }
+        addr++;
+        if (*addr == ':')
+        {
+            if (compressed)
+            {
+                return false; // only one :: is allowed
+            }
+            compressed = true;
+            addr++;
+            if (*addr == '\0')
+            {
+                break;
+            }
+        }
+    }
+    // :: stands for at least one group of zeros
+    return compressed ? groups <= 7 : groups == 8;
+}
+
+/// @brief terminates the encoded name and checks the whole name
 /// @param result
-void convert_domain_to_dns(char *hostname, unsigned char *result)
+/// @param len number of characters of the name
+/// @param label_start index of the last label in the name
+/// @param labels number of labels terminated by dot
+/// @return length of the name in dns format or ENCODE_NOT_DOMAIN
+static int finish_domain(unsigned char *result, int len, int label_start, int labels)
+{
+    int last_len = len - label_start;
+    int wire_len;
+    if (last_len == 0)
+    {
+        // name ends with dot, the length byte of the empty label is the terminating 0
+        result[label_start] = 0;
+        wire_len = len + 1;
+    }
+    else
+    {
+        if (last_len > 63)
+        {
+            return ENCODE_NOT_DOMAIN;
+        }
+        result[label_start] = last_len;
+        result[len + 1] = 0;
+        wire_len = len + 2;
+        labels++;
+    }
+    if (labels < 2 || wire_len > 255)
+    {
+        return ENCODE_NOT_DOMAIN;
+    }
+
+    // top level domain has at least 2 characters and only letters
+    int tld = 0;
+    while (result[tld + 1 + result[tld]] != 0)
+    {
+        tld += 1 + result[tld];
+    }
+    if (result[tld] < 2)
+    {
+        return ENCODE_NOT_DOMAIN;
+    }
+    for (int i = tld + 1; i <= tld + result[tld]; i++)
+    {
+        if (result[i] < 'a' || result[i] > 'z')
+        {
+            return ENCODE_NOT_DOMAIN;
+        }
+    }
+    return wire_len;
+}
+
+/// @brief Converts domain name to dns format one character at a time. Example: www.Example.com to 3www7example3com0
+/// @param hostname
+/// @param result buffer of NAME_WIRE_BUF bytes
+/// @return length of the name in dns format or ENCODE_NOT_DOMAIN
+int convert_domain_to_dns_scalar(const char *hostname, unsigned char *result)
 {
-    int last_dot_pos = 0;
-    int char_cnt = 0;
+    int label_start = 0; // the length byte of the label is result[label_start]
+    int labels = 0;
     int i = 0;
-    while (hostname[i] != '\0')
+    for (; hostname[i] != '\0'; i++)
+    {
+        if (i >= 255)
+        {
+            return ENCODE_NOT_DOMAIN;
+        }
+        unsigned char c = hostname[i];
+        if (c == '.')
+        {
+            int len = i - label_start;
+            if (len == 0 || len > 63 || hostname[i - 1] == '-')
+            {
+                return ENCODE_NOT_DOMAIN;
+            }
+            result[label_start] = len;
+            label_start = i + 1;
+            labels++;
+            continue;
+        }
+        if (c >= 'A' && c <= 'Z')
+        {
+            c |= 0x20;
+        }
+        if (!((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || (c == '-' && i != label_start)))
+        {
+            return ENCODE_NOT_DOMAIN;
+        }
+        result[i + 1] = c;
+    }
+    return finish_domain(result, i, label_start, labels);
+}
+
+#ifdef __SSE2__
+/// @brief Converts domain name to dns format 16 characters at a time with SSE2
+/// @param hostname
+/// @param result buffer of NAME_WIRE_BUF bytes
+/// @return length of the name in dns format or ENCODE_NOT_DOMAIN
+__attribute__((no_sanitize_address)) // 16 byte loads may read behind the string, but never to the next page
+int convert_domain_to_dns_sse2(const char *hostname, unsigned char *result)
+{
+    int label_start = 0;
+    int labels = 0;
+    unsigned prev_dot = 1; // name must not start with dot or hyphen
+    unsigned prev_hyphen = 0;
+    for (int pos = 0; pos < 256; pos += 16)
     {
-        if (hostname[i] == '.')
+        const char *p = hostname + pos;
+        __m128i v;
+        if (((uintptr_t)p & 4095) <= 4096 - 16)
         {
-            result[last_dot_pos] = char_cnt;
-            char_cnt = 0;
-            last_dot_pos = i + 1;
+            v = _mm_loadu_si128((const __m128i *)p);
         }
         else
         {
-            char_cnt += 1;
-            result[i + 1] = hostname[i];
+            // the load would cross to the next page which may not be mapped
+            char tail[16] = {0};
+            for (int k = 0; k < 16 && p[k] != '\0'; k++)
+            {
+                tail[k] = p[k];
+            }
+            v = _mm_loadu_si128((const __m128i *)tail);
+        }
+
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+        __m128i lower = _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+        __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+        __m128i hyphen = _mm_cmpeq_epi8(v, _mm_set1_epi8('-'));
+        __m128i dot = _mm_cmpeq_epi8(v, _mm_set1_epi8('.'));
+
+        unsigned zeros = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()));
+        unsigned end = zeros ? __builtin_ctz(zeros) : 16;
+        unsigned in = (1u << end) - 1;
+        unsigned valid = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(letter, digit), _mm_or_si128(hyphen, dot)));
+        unsigned dots = _mm_movemask_epi8(dot) & in;
+        unsigned hyphens = _mm_movemask_epi8(hyphen) & in;
+        if ((valid & in) != in)
+        {
+            return ENCODE_NOT_DOMAIN;
+        }
+        // empty label, hyphen at the start or at the end of label
+        if ((dots & ((dots << 1) | prev_dot)) || (hyphens & ((dots << 1) | prev_dot)) || (dots & ((hyphens << 1) | prev_hyphen)))
+        {
+            return ENCODE_NOT_DOMAIN;
+        }
+        prev_dot = (dots >> 15) & 1;
+        prev_hyphen = (hyphens >> 15) & 1;
+
+        _mm_storeu_si128((__m128i *)&result[pos + 1], lower);
+        while (dots != 0)
+        {
+            int i = pos + __builtin_ctz(dots);
+            if (i - label_start > 63)
+            {
+                return ENCODE_NOT_DOMAIN;
+            }
+            result[label_start] = i - label_start;
+            label_start = i + 1;
+            labels++;
+            dots &= dots - 1;
+        }
+        if (end < 16)
+        {
+            return finish_domain(result, pos + end, label_start, labels);
         }
-        i++;
     }
-    result[last_dot_pos] = char_cnt;
-    result[i + 1] = '\0';
+    return ENCODE_NOT_DOMAIN;
 }
+#endif
 
-/// @brief Converts IPv4 to dns format for reverse query. Example: 8.8.4.4 to 4.4.8.8.in-addr.arpa but numbers instead of '.'
-/// @param ip4
+/// @brief Converts domain name to dns format and checks it. Letters are converted to lower case. Example: www.Example.com to 3www7example3com0
+/// @param hostname
+/// @param result buffer of NAME_WIRE_BUF bytes
+/// @return length of the name in dns format or ENCODE_NOT_DOMAIN
+int convert_domain_to_dns(const char *hostname, unsigned char *result)
+{
+#ifdef __SSE2__
+    return convert_domain_to_dns_sse2(hostname, result);
+#else
+    return convert_domain_to_dns_scalar(hostname, result);
+#endif
+}
+
+/// @brief writes reverse name of the address in dns format. Example: 8.8.4.4 to 1 4 1 4 1 8 1 8 7 in-addr 4 arpa 0
+/// @param addr 4 bytes of the address
 /// @param result
-void convert_ip4_to_dns(char *ip4, unsigned char *result)
+/// @return length of the name in dns format
+int encode_ip4_reverse(const unsigned char *addr, unsigned char *result)
 {
-    char *all_parts = (char *)malloc(16);
-    char *part = std::strtok(ip4, ".");
-    int i = 0;
-    while (part)
+    int index = 0;
+    for (int i = 3; i >= 0; i--)
     {
-        // std::cout << part << std::endl;
-        strcpy(&all_parts[i], part);
-        part = std::strtok(NULL, ".");
-        i += 4;
+        unsigned char octet = addr[i];
+        int len = (octet >= 100) ? 3 : (octet >= 10) ? 2 : 1;
+        result[index] = len;
+        for (int d = len; d > 0; d--)
+        {
+            result[index + d] = '0' + octet % 10;
+            octet /= 10;
+        }
+        index += len + 1;
     }
+    std::memcpy(&result[index], "\7in-addr\4arpa", 14); // with the terminating 0
+    return index + 14;
+}
 
+/// @brief writes reverse name of the address in dns format, one label for every nibble. Example: 2001:db8::1 to 1 1 1 0 ... 1 2 3 ip6 4 arpa 0
+/// @param addr 16 bytes of the address
+/// @param result
+/// @return length of the name in dns format
+int encode_ip6_reverse(const unsigned char *addr, unsigned char *result)
+{
+    static const char hex[] = "0123456789abcdef";
     int index = 0;
-    for (i = 0; i < 4; i++)
-    {
-        result[index] = strlen(&all_parts[(3 - i) * 4]);
-        index++;
-        strcpy((char *)&result[index], &all_parts[(3 - i) * 4]);
-        index += strlen(&all_parts[(3 - i) * 4]);
-    }
-
-    result[index] = 7;
-    index++;
-    strcpy((char *)&result[index], "in-addr");
-    index += strlen("in-addr");
-    result[index] = char(4);
-    index++;
-    strcpy((char *)&result[index], "arpa");
-    free(all_parts);
+    for (int i = 15; i >= 0; i--)
+    {
+        result[index] = 1;
+        result[index + 1] = hex[addr[i] & 0x0F];
+        result[index + 2] = 1;
+        result[index + 3] = hex[addr[i] >> 4];
+        index += 4;
+    }
+    std::memcpy(&result[index], "\3ip6\4arpa", 10); // with the terminating 0
+    return index + 10;
 }
 
-/// @brief Converts IPv6 to dns format for reverse query. Only works for full IPv6
+/// @brief Converts IPv4 to dns format for reverse query. Example: 8.8.4.4 to 4.4.8.8.in-addr.arpa but numbers instead of '.'
+/// @param ip4
+/// @param result
+/// @return length of the name in dns format or ENCODE_NOT_IP
+int convert_ip4_to_dns(const char *ip4, unsigned char *result)
+{
+    unsigned char addr[4];
+    if (inet_pton(AF_INET, ip4, addr) != 1)
+    {
+        return ENCODE_NOT_IP;
+    }
+    return encode_ip4_reverse(addr, result);
+}
+
+/// @brief Converts IPv6 in any form accepted by inet_pton to dns format for reverse query
 /// @param ip6
 /// @param result
-void convert_ip6_to_dns(char *ip6, unsigned char *result)
+/// @return length of the name in dns format or ENCODE_NOT_IP
+int convert_ip6_to_dns(const char *ip6, unsigned char *result)
 {
-    unsigned char without_semicolons[32];
-    int i = 0;
-    int j = 0;
-    while (ip6[i] != '\0')
+    unsigned char addr[16];
+    if (inet_pton(AF_INET6, ip6, addr) != 1)
     {
-        if (ip6[i] != ':')
+        return ENCODE_NOT_IP;
+    }
+    return encode_ip6_reverse(addr, result);
+}
+
+/// @brief returns query type number for its name (A, AAAA, PTR, ...) or TYPEnnn form
+/// @param name
+/// @return type number or -1 if unknown
+int parse_qtype(const char *name)
+{
+    static const struct
+    {
+        const char *name;
+        int type;
+    } types[] = {{"A", QTYPE_A}, {"NS", QTYPE_NS}, {"CNAME", QTYPE_CNAME}, {"SOA", QTYPE_SOA}, {"PTR", QTYPE_PTR}, {"MX", QTYPE_MX}, {"TXT", QTYPE_TXT}, {"AAAA", QTYPE_AAAA}};
+
+    for (const auto &t : types)
+    {
+        if (strcasecmp(name, t.name) == 0)
+        {
+            return t.type;
+        }
+    }
+    if (strncasecmp(name, "TYPE", 4) == 0 && name[4] != '\0')
+    {
+        char *end;
+        long type = strtol(&name[4], &end, 10);
+        if (*end == '\0' && type > 0 && type <= 65535)
         {
-            without_semicolons[j] = ip6[i];
-            j++;
+            return type;
         }
-        i++;
     }
+    return -1;
+}
+
+/// @brief writes type and class of the question behind its name
+/// @param buf query with header and name
+/// @param qname_len length of the name in dns format
+/// @param qtype
+/// @return length of the query
+static int finish_question(unsigned char *buf, int qname_len, int qtype)
+{
+    struct dns_question *question = (struct dns_question *)&buf[sizeof(struct dns_header) + qname_len];
+    question->q_type = htons(qtype);
+    question->q_class = htons(QCLASS_IN);
 
-    j = 1;
-    for (int i = 31; i >= 0; i--)
+    return sizeof(struct dns_header) + qname_len + sizeof(struct dns_question);
+}
+
+/// @brief builds whole query (header and question) into buf
+/// @param buf
+/// @param name domain name or IP address (for reverse query)
+/// @param reverse 1 if PTR query for IP address should be built
+/// @param qtype type of the query, ignored for reverse query
+/// @param recursion recursion desired flag
+/// @param id transaction id in network byte order
+/// @return length of the query, ENCODE_NOT_DOMAIN or ENCODE_NOT_IP when name does not fit the query
+int build_dns_query(unsigned char *buf, const char *name, int reverse, int qtype, int recursion, unsigned short id)
+{
+    fill_dns_header((struct dns_header *)buf, recursion, id);
+
+    unsigned char *qname = &buf[sizeof(struct dns_header)];
+    int qname_len;
+    if (reverse == 0)
     {
-        result[j] = without_semicolons[i];
-        result[j - 1] = 1;
-        j += 2;
+        // checks the name and encodes it in one pass
+        qname_len = convert_domain_to_dns(name, qname);
+        if (qname_len < 0)
+        {
+            return ENCODE_NOT_DOMAIN;
+        }
     }
+    else
+    {
+        qname_len = convert_ip4_to_dns(name, qname);
+        if (qname_len < 0)
+        {
+            qname_len = convert_ip6_to_dns(name, qname);
+        }
+        if (qname_len < 0)
+        {
+            return ENCODE_NOT_IP;
+        }
+        qtype = QTYPE_PTR;
+    }
+    return finish_question(buf, qname_len, qtype);
+}
 
-    result[j - 1] = 3;
+/// @brief builds whole query (header and question) for the name already in dns format
+/// @param buf
+/// @param qname name in dns format
+/// @param qname_len
+/// @param qtype
+/// @param recursion recursion desired flag
+/// @param id transaction id in network byte order
+/// @return length of the query
+int build_dns_query_wire(unsigned char *buf, const unsigned char *qname, int qname_len, int qtype, int recursion, unsigned short id)
+{
+    fill_dns_header((struct dns_header *)buf, recursion, id);
+    std::memcpy(&buf[sizeof(struct dns_header)], qname, qname_len);
+    return finish_question(buf, qname_len, qtype);
+}
+
+/// @brief appends OPT pseudo-record (EDNS0, RFC 6891) to the additional section of the built query
+/// @param buf query built by build_dns_query or build_dns_query_wire
+/// @param query_len
+/// @param udp_size advertised UDP payload size
+/// @return length of the query with the OPT record
+int append_edns_opt(unsigned char *buf, int query_len, int udp_size)
+{
+    /*
+        root name | type OPT | class = UDP payload size | extended RCODE, version, DO, Z | RDLENGTH 0
+    */
+    unsigned char *opt = &buf[query_len];
+    opt[0] = 0;
+    opt[1] = QTYPE_OPT >> 8;
+    opt[2] = QTYPE_OPT & 0xFF;
+    opt[3] = udp_size >> 8;
+    opt[4] = udp_size & 0xFF;
+    std::memset(&opt[5], 0, 6);
 
-    strcpy((char *)&result[j], "ip6");
-    j += strlen("ip6");
-    result[j] = char(4);
-    j++;
-    strcpy((char *)&result[j], "arpa");
+    struct dns_header *dns = (struct dns_header *)buf;
+    dns->add_count = htons(ntohs(dns->add_count) + 1);
+    return query_len + EDNS_OPT_LEN;
 }
@@ -1,18 +1,100 @@
 // author: Marek Kozumplik, xkozum08
 #pragma once
 #include "dns.hpp"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-/// @brief Converts domain name to dns format. Example: www.example.com to 3www7example3com0
+#define ENCODE_NOT_DOMAIN -1
+#define ENCODE_NOT_IP -2
+
+#define NAME_WIRE_BUF 272 // longest name in dns format (255) and space for 16 byte stores
+
+#define EDNS_OPT_LEN 11        // OPT record without options
+#define EDNS_DEFAULT_SIZE 1232 // UDP payload size which avoids IP fragmentation (DNS flag day 2020)
+
+/// @brief returns true if addr is IPv4 address in dotted decimal form (without leading zeros, like inet_pton)
+/// @param addr
+/// @return
+bool is_ip4_address(const char *addr);
+
+/// @brief returns true if addr is IPv6 address in any form (full, compressed with ::, IPv4 in last 32 bits)
+/// @param addr
+/// @return
+bool is_ip6_address(const char *addr);
+
+/// @brief Converts domain name to dns format one character at a time. Example: www.Example.com to 3www7example3com0
+/// @param hostname
+/// @param result buffer of NAME_WIRE_BUF bytes
+/// @return length of the name in dns format or ENCODE_NOT_DOMAIN
+int convert_domain_to_dns_scalar(const char *hostname, unsigned char *result);
+
+#ifdef __SSE2__
+/// @brief Converts domain name to dns format 16 characters at a time with SSE2
+/// @param hostname
+/// @param result buffer of NAME_WIRE_BUF bytes
+/// @return length of the name in dns format or ENCODE_NOT_DOMAIN
+int convert_domain_to_dns_sse2(const char *hostname, unsigned char *result);
+#endif
+
+/// @brief Converts domain name to dns format and checks it. Letters are converted to lower case. Example: www.Example.com to 3www7example3com0
 /// @param hostname
+/// @param result buffer of NAME_WIRE_BUF bytes
+/// @return length of the name in dns format or ENCODE_NOT_DOMAIN
+int convert_domain_to_dns(const char *hostname, unsigned char *result);
+
+/// @brief writes reverse name of the address in dns format. Example: 8.8.4.4 to 1 4 1 4 1 8 1 8 7 in-addr 4 arpa 0
+/// @param addr 4 bytes of the address
+/// @param result
+/// @return length of the name in dns format
+int encode_ip4_reverse(const unsigned char *addr, unsigned char *result);
+
+/// @brief writes reverse name of the address in dns format, one label for every nibble. Example: 2001:db8::1 to 1 1 1 0 ... 1 2 3 ip6 4 arpa 0
+/// @param addr 16 bytes of the address
 /// @param result
-void convert_domain_to_dns(char *hostname, unsigned char *result);
+/// @return length of the name in dns format
+int encode_ip6_reverse(const unsigned char *addr, unsigned char *result);
 
-/// @brief converts IPv4 address to dns format. For -x
+/// @brief Converts IPv4 to dns format for reverse query. Example: 8.8.4.4 to 4.4.8.8.in-addr.arpa but numbers instead of '.'
 /// @param ip4
 /// @param result
-void convert_ip4_to_dns(char *ip4, unsigned char *result);
+/// @return length of the name in dns format or ENCODE_NOT_IP
+int convert_ip4_to_dns(const char *ip4, unsigned char *result);
 
-/// @brief Converts IPv6 to dns format for reverse query. Only works for full IPv6
+/// @brief Converts IPv6 in any form accepted by inet_pton to dns format for reverse query
 /// @param ip6
 /// @param result
-void convert_ip6_to_dns(char *ip6, unsigned char *result);
\ No newline at end of file
+/// @return length of the name in dns format or ENCODE_NOT_IP
+int convert_ip6_to_dns(const char *ip6, unsigned char *result);
+
+/// @brief returns query type number for its name (A, AAAA, PTR, ...) or TYPEnnn form
+/// @param name
+/// @return type number or -1 if unknown
+int parse_qtype(const char *name);
+
+/// @brief builds whole query (header and question) into buf
+/// @param buf
+/// @param name domain name or IP address (for reverse query)
+/// @param reverse 1 if PTR query for IP address should be built
+/// @param qtype type of the query, ignored for reverse query
+/// @param recursion recursion desired flag
+/// @param id transaction id in network byte order
+/// @return length of the query, ENCODE_NOT_DOMAIN or ENCODE_NOT_IP when name does not fit the query
+int build_dns_query(unsigned char *buf, const char *name, int reverse, int qtype, int recursion, unsigned short id);
+
+/// @brief builds whole query (header and question) for the name already in dns format
+/// @param buf
+/// @param qname name in dns format
+/// @param qname_len
+/// @param qtype
+/// @param recursion recursion desired flag
+/// @param id transaction id in network byte order
+/// @return length of the query
+int build_dns_query_wire(unsigned char *buf, const unsigned char *qname, int qname_len, int qtype, int recursion, unsigned short id);
+
+/// @brief appends OPT pseudo-record (EDNS0, RFC 6891) to the additional section of the built query
+/// @param buf query built by build_dns_query or build_dns_query_wire
+/// @param query_len
+/// @param udp_size advertised UDP payload size
+/// @return length of the query with the OPT record
+int append_edns_opt(unsigned char *buf, int query_len, int udp_size);
@@ -0,0 +1,449 @@
+// author: Marek Kozumplik, xkozum08
+#include "event_loop.hpp"
+
+#define URING_TIMEOUT_TAG (~0ULL)
+#define URING_REMOVE_TAG (~0ULL - 1)
+
+/// @brief parses name of the backend (epoll, uring)
+/// @param name
+/// @return BACKEND_EPOLL, BACKEND_URING or -1
+int parse_backend(const char *name)
+{
+	if (strcmp(name, "epoll") == 0)
+	{
+		return BACKEND_EPOLL;
+	}
+	if (strcmp(name, "uring") == 0 || strcmp(name, "io_uring") == 0)
+	{
+		return BACKEND_URING;
+	}
+	return -1;
+}
+
+/// @brief creates the ring and maps submission and completion queues
+/// @param ring
+/// @return 0 on success, -1 if io_uring is not available
+static int uring_init(struct uring *ring)
+{
+	struct io_uring_params params;
+	std::memset(&params, 0, sizeof(params));
+	std::memset(ring, 0, sizeof(*ring));
+	ring->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+	if (ring->fd < 0)
+	{
+		return -1;
+	}
+
+	ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		ring->sq_size = ring->cq_size = std::max(ring->sq_size, ring->cq_size);
+	}
+	ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ptr == MAP_FAILED)
+	{
+		close(ring->fd);
+		return -1;
+	}
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		ring->cq_ptr = ring->sq_ptr;
+	}
+	else
+	{
+		ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ptr == MAP_FAILED)
+		{
+			munmap(ring->sq_ptr, ring->sq_size);
+			close(ring->fd);
+			return -1;
+		}
+	}
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+	{
+		if (ring->cq_ptr != ring->sq_ptr)
+		{
+			munmap(ring->cq_ptr, ring->cq_size);
+		}
+		munmap(ring->sq_ptr, ring->sq_size);
+		close(ring->fd);
+		return -1;
+	}
+
+	unsigned char *sq = (unsigned char *)ring->sq_ptr;
+	unsigned char *cq = (unsigned char *)ring->cq_ptr;
+	ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+	ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+	ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+	ring->sq_entries = params.sq_entries;
+	ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+	ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+	return 0;
+}
+
+/// @brief unmaps the queues and closes the ring
+/// @param ring
+static void uring_free(struct uring *ring)
+{
+	munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ptr != ring->sq_ptr)
+	{
+		munmap(ring->cq_ptr, ring->cq_size);
+	}
+	munmap(ring->sq_ptr, ring->sq_size);
+	close(ring->fd);
+}
+
+/// @brief passes queued sqes to the kernel and optionally waits for completions
+/// @param loop
+/// @param min_complete
+/// @return result of io_uring_enter
+static int uring_enter(struct event_loop *loop, unsigned min_complete)
+{
+	struct uring *ring = &loop->ring;
+	int ret;
+	do
+	{
+		loop->syscalls++;
+		ret = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, min_complete, (min_complete > 0) ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	} while (ret < 0 && errno == EINTR);
+	if (ret >= 0)
+	{
+		ring->to_submit -= std::min((unsigned)ret, ring->to_submit);
+	}
+	return ret;
+}
+
+/// @brief returns zeroed sqe at the tail of the submission queue
+/// @param loop
+/// @return
+static struct io_uring_sqe *uring_get_sqe(struct event_loop *loop)
+{
+	struct uring *ring = &loop->ring;
+	unsigned tail = *ring->sq_tail;
+	if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) == ring->sq_entries)
+	{
+		uring_enter(loop, 0);
+	}
+	unsigned index = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+	std::memset(sqe, 0, sizeof(*sqe));
+	ring->sq_array[index] = index;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->to_submit++;
+	return sqe;
+}
+
+/// @brief queues one-shot poll of the i-th registered descriptor
+/// @param loop
+/// @param i
+static void uring_arm_poll(struct event_loop *loop, int i)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(loop);
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = loop->fds[i];
+	sqe->poll32_events = loop->events[i];
+	sqe->user_data = ((unsigned long long)loop->gen[i] << 32) | i;
+}
+
+/// @brief cancels the armed poll of the i-th registered descriptor and starts new generation of the entry
+/// @param loop
+/// @param i
+static void uring_cancel_poll(struct event_loop *loop, int i)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(loop);
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->addr = ((unsigned long long)loop->gen[i] << 32) | i;
+	sqe->user_data = URING_REMOVE_TAG;
+	loop->gen[i]++;
+}
+
+/// @brief returns index of the registered descriptor
+/// @param loop
+/// @param fd
+/// @return index or -1
+static int find_fd(struct event_loop *loop, int fd)
+{
+	for (int i = 0; i < loop->fd_cnt; i++)
+	{
+		if (loop->fds[i] == fd)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+/// @brief initializes the loop with the backend, io_uring falls back to epoll when the kernel does not allow it
+/// @param loop
+/// @param backend
+/// @return 0 on success, -1 on error
+int loop_init(struct event_loop *loop, int backend)
+{
+	loop->fd_cnt = 0;
+	loop->syscalls = 0;
+	loop->epfd = -1;
+	loop->backend = backend;
+	if (backend == BACKEND_URING)
+	{
+		if (uring_init(&loop->ring) == 0)
+		{
+			return 0;
+		}
+		std::cerr << "io_uring is not available, using epoll" << std::endl;
+		loop->backend = BACKEND_EPOLL;
+	}
+
+	loop->epfd = epoll_create1(0);
+	if (loop->epfd < 0)
+	{
+		perror("Error creating epoll");
+		return -1;
+	}
+	return 0;
+}
+
+/// @brief frees the loop, registered descriptors are not closed
+/// @param loop
+void loop_free(struct event_loop *loop)
+{
+	if (loop->backend == BACKEND_URING)
+	{
+		uring_free(&loop->ring);
+	}
+	else
+	{
+		close(loop->epfd);
+	}
+}
+
+/// @brief watches the descriptor for readability until loop_remove or until the loop is freed
+/// @param loop
+/// @param fd
+/// @param data returned by loop_wait when fd is readable
+/// @return 0 on success, -1 on error
+int loop_add(struct event_loop *loop, int fd, void *data)
+{
+	// entries of removed descriptors are reused
+	int i = find_fd(loop, -1);
+	if (i < 0)
+	{
+		if (loop->fd_cnt == LOOP_MAX_FDS)
+		{
+			return -1;
+		}
+		i = loop->fd_cnt++;
+		loop->gen[i] = 0;
+	}
+	loop->fds[i] = fd;
+	loop->data[i] = data;
+	loop->events[i] = POLLIN;
+
+	if (loop->backend == BACKEND_URING)
+	{
+		uring_arm_poll(loop, i);
+		return 0;
+	}
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.u32 = i;
+	return epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/// @brief changes the events the descriptor is watched for
+/// @param loop
+/// @param fd registered descriptor
+/// @param events POLLIN or POLLIN | POLLOUT
+/// @return 0 on success, -1 on error
+int loop_modify(struct event_loop *loop, int fd, unsigned events)
+{
+	int i = find_fd(loop, fd);
+	if (i < 0)
+	{
+		return -1;
+	}
+	if (loop->events[i] == events)
+	{
+		return 0;
+	}
+	loop->events[i] = events;
+	if (loop->backend == BACKEND_URING)
+	{
+		// poll readiness is level triggered, the new poll reports what the cancelled one would
+		uring_cancel_poll(loop, i);
+		uring_arm_poll(loop, i);
+		return 0;
+	}
+	struct epoll_event ev;
+	ev.events = events;
+	ev.data.u32 = i;
+	return epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+/// @brief stops watching the descriptor, must be called before the descriptor is closed
+/// @param loop
+/// @param fd
+void loop_remove(struct event_loop *loop, int fd)
+{
+	int i = find_fd(loop, fd);
+	if (i < 0)
+	{
+		return;
+	}
+	if (loop->backend == BACKEND_URING)
+	{
+		uring_cancel_poll(loop, i);
+		uring_enter(loop, 0); // the kernel must see the cancel before the descriptor number is reused
+	}
+	else
+	{
+		epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+	}
+	loop->fds[i] = -1;
+}
+
+/// @brief waits at most timeout_ms for readable descriptors
+/// @param loop
+/// @param timeout_ms -1 waits without limit
+/// @param ready data of readable (or writable if watched for POLLOUT) descriptors
+/// @param max size of ready
+/// @return number of readable descriptors
+int loop_wait(struct event_loop *loop, int timeout_ms, void **ready, int max)
+{
+	if (loop->backend == BACKEND_EPOLL)
+	{
+		struct epoll_event events[LOOP_MAX_FDS];
+		loop->syscalls++;
+		int cnt = epoll_wait(loop->epfd, events, std::min(max, LOOP_MAX_FDS), timeout_ms);
+		for (int i = 0; i < cnt; i++)
+		{
+			ready[i] = loop->data[events[i].data.u32];
+		}
+		return std::max(cnt, 0);
+	}
+
+	// io_uring: timeout completes after the first poll completion or when it expires
+	struct uring *ring = &loop->ring;
+	if (timeout_ms > 0)
+	{
+		ring->timeout.tv_sec = timeout_ms / 1000;
+		ring->timeout.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+		struct io_uring_sqe *sqe = uring_get_sqe(loop);
+		sqe->opcode = IORING_OP_TIMEOUT;
+		sqe->addr = (unsigned long)&ring->timeout;
+		sqe->len = 1;
+		sqe->off = 1;
+		sqe->user_data = URING_TIMEOUT_TAG;
+	}
+	uring_enter(loop, (timeout_ms == 0) ? 0 : 1);
+
+	int cnt = 0;
+	unsigned head = *ring->cq_head;
+	while (cnt < max && head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+	{
+		struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+		head++;
+		if (cqe->user_data == URING_TIMEOUT_TAG || cqe->user_data == URING_REMOVE_TAG)
+		{
+			continue;
+		}
+		int i = (int)(cqe->user_data & 0xFFFFFFFF);
+		if (loop->fds[i] < 0 || (unsigned)(cqe->user_data >> 32) != loop->gen[i])
+		{
+			continue; // poll cancelled by loop_modify or loop_remove
+		}
+		ready[cnt++] = loop->data[i];
+		uring_arm_poll(loop, i);
+	}
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	return cnt;
+}
+
+/// @brief initializes empty heap
+/// @param heap
+/// @return 0 on success, -1 if out of memory
+int timer_init(struct timer_heap *heap)
+{
+	heap->size = 0;
+	heap->capacity = 1024;
+	heap->entries = (struct timer_entry *)malloc(heap->capacity * sizeof(struct timer_entry));
+	return (heap->entries == NULL) ? -1 : 0;
+}
+
+/// @brief frees the heap
+/// @param heap
+void timer_free(struct timer_heap *heap)
+{
+	free(heap->entries);
+}
+
+/// @brief adds the deadline of the slot
+/// @param heap
+/// @param deadline_ms
+/// @param slot
+/// @param seq
+/// @return 0 on success, -1 if out of memory
+int timer_push(struct timer_heap *heap, long long deadline_ms, int slot, unsigned int seq)
+{
+	if (heap->size == heap->capacity)
+	{
+		struct timer_entry *bigger = (struct timer_entry *)realloc(heap->entries, 2 * heap->capacity * sizeof(struct timer_entry));
+		if (bigger == NULL)
+		{
+			return -1;
+		}
+		heap->entries = bigger;
+		heap->capacity *= 2;
+	}
+
+	// sift up
+	int i = heap->size++;
+	while (i > 0 && heap->entries[(i - 1) / 2].deadline_ms > deadline_ms)
+	{
+		heap->entries[i] = heap->entries[(i - 1) / 2];
+		i = (i - 1) / 2;
+	}
+	heap->entries[i].deadline_ms = deadline_ms;
+	heap->entries[i].slot = slot;
+	heap->entries[i].seq = seq;
+	return 0;
+}
+
+/// @brief returns the earliest entry or NULL if the heap is empty
+/// @param heap
+/// @return
+struct timer_entry *timer_top(struct timer_heap *heap)
+{
+	return (heap->size > 0) ? &heap->entries[0] : NULL;
+}
+
+/// @brief removes the earliest entry
+/// @param heap
+void timer_pop(struct timer_heap *heap)
+{
+	struct timer_entry last = heap->entries[--heap->size];
+
+	// sift down
+	int i = 0;
+	while (2 * i + 1 < heap->size)
+	{
+		int child = 2 * i + 1;
+		if (child + 1 < heap->size && heap->entries[child + 1].deadline_ms < heap->entries[child].deadline_ms)
+		{
+			child++;
+		}
+		if (heap->entries[child].deadline_ms >= last.deadline_ms)
+		{
+			break;
+		}
+		heap->entries[i] = heap->entries[child];
+		i = child;
+	}
+	heap->entries[i] = last;
+}
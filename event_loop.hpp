@@ -0,0 +1,137 @@
+// author: Marek Kozumplik, xkozum08
+#pragma once
+#include "dns.hpp"
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#define BACKEND_EPOLL 0
+#define BACKEND_URING 1
+
+#define LOOP_MAX_FDS 128
+#define URING_ENTRIES 128
+
+struct uring
+{
+	int fd;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned sq_entries;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ptr;
+	size_t sq_size;
+	void *cq_ptr;
+	size_t cq_size;
+	size_t sqes_size;
+
+	unsigned to_submit;				   // queued sqes not yet passed to the kernel
+	struct __kernel_timespec timeout; // read by the kernel when the timeout sqe is submitted
+};
+
+struct event_loop
+{
+	int backend;
+	int epfd;
+	struct uring ring;
+
+	// registered descriptors, io_uring polls are one-shot and re-armed from here
+	int fds[LOOP_MAX_FDS]; // -1 if the entry is unused
+	void *data[LOOP_MAX_FDS];
+	unsigned events[LOOP_MAX_FDS]; // POLLIN, POLLOUT
+	unsigned gen[LOOP_MAX_FDS];	   // changed by loop_modify and loop_remove, completions of older polls are ignored
+	int fd_cnt;
+
+	unsigned long syscalls; // epoll_wait / io_uring_enter calls
+};
+
+struct timer_entry
+{
+	long long deadline_ms;
+	int slot;		   // index of the query in the resolver
+	unsigned int seq; // use count of the slot, entries of finished queries are skipped
+};
+
+// binary min-heap of deadlines, finished queries are not removed, they are skipped when popped
+struct timer_heap
+{
+	struct timer_entry *entries;
+	int size;
+	int capacity;
+};
+
+/// @brief parses name of the backend (epoll, uring)
+/// @param name
+/// @return BACKEND_EPOLL, BACKEND_URING or -1
+int parse_backend(const char *name);
+
+/// @brief initializes the loop with the backend, io_uring falls back to epoll when the kernel does not allow it
+/// @param loop
+/// @param backend
+/// @return 0 on success, -1 on error
+int loop_init(struct event_loop *loop, int backend);
+
+/// @brief frees the loop, registered descriptors are not closed
+/// @param loop
+void loop_free(struct event_loop *loop);
+
+/// @brief watches the descriptor for readability until loop_remove or until the loop is freed
+/// @param loop
+/// @param fd
+/// @param data returned by loop_wait when fd is readable
+/// @return 0 on success, -1 on error
+int loop_add(struct event_loop *loop, int fd, void *data);
+
+/// @brief changes the events the descriptor is watched for
+/// @param loop
+/// @param fd registered descriptor
+/// @param events POLLIN or POLLIN | POLLOUT
+/// @return 0 on success, -1 on error
+int loop_modify(struct event_loop *loop, int fd, unsigned events);
+
+/// @brief stops watching the descriptor, must be called before the descriptor is closed
+/// @param loop
+/// @param fd
+void loop_remove(struct event_loop *loop, int fd);
+
+/// @brief waits at most timeout_ms for readable descriptors
+/// @param loop
+/// @param timeout_ms -1 waits without limit
+/// @param ready data of readable (or writable if watched for POLLOUT) descriptors
+/// @param max size of ready
+/// @return number of readable descriptors
+int loop_wait(struct event_loop *loop, int timeout_ms, void **ready, int max);
+
+/// @brief initializes empty heap
+/// @param heap
+/// @return 0 on success, -1 if out of memory
+int timer_init(struct timer_heap *heap);
+
+/// @brief frees the heap
+/// @param heap
+void timer_free(struct timer_heap *heap);
+
+/// @brief adds the deadline of the slot
+/// @param heap
+/// @param deadline_ms
+/// @param slot
+/// @param seq
+/// @return 0 on success, -1 if out of memory
+int timer_push(struct timer_heap *heap, long long deadline_ms, int slot, unsigned int seq);
+
+/// @brief returns the earliest entry or NULL if the heap is empty
+/// @param heap
+/// @return
+struct timer_entry *timer_top(struct timer_heap *heap);
+
+/// @brief removes the earliest entry
+/// @param heap
+void timer_pop(struct timer_heap *heap);
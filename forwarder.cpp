@@ -0,0 +1,682 @@
+// author: Marek Kozumplik, xkozum08
+#include "forwarder.hpp"
+
+static volatile sig_atomic_t forwarder_stop = 0;
+
+/// @brief signal handler of SIGINT and SIGTERM, the loop finishes after the current poll
+/// @param sig
+static void stop_forwarder(int sig)
+{
+	(void)sig;
+	forwarder_stop = 1;
+}
+
+/// @brief parses --listen: port, address:port or [IPv6]:port
+/// @param text
+/// @param addr
+/// @return length of the address, 0 if the text is invalid
+socklen_t parse_listen_address(const char *text, struct sockaddr_storage *addr)
+{
+	char host[256];
+	const char *port = strrchr(text, ':');
+	if (port == NULL)
+	{
+		strcpy(host, FWD_DEFAULT_ADDRESS);
+		port = text;
+	}
+	else
+	{
+		int len = port - text;
+		if (len >= (int)sizeof(host))
+		{
+			return 0;
+		}
+		if (text[0] == '[' && len >= 2 && text[len - 1] == ']')
+		{
+			text++;
+			len -= 2;
+		}
+		std::memcpy(host, text, len);
+		host[len] = '\0';
+		port++;
+	}
+	char *end;
+	long number = strtol(port, &end, 10);
+	if (*port == '\0' || *end != '\0' || number < 1 || number > 65535)
+	{
+		return 0;
+	}
+	std::memset(addr, 0, sizeof(*addr));
+	if (is_ip4_address(host))
+	{
+		return fill_server_address(addr, host, TYPE_IP4, (int)number);
+	}
+	if (is_ip6_address(host))
+	{
+		return fill_server_address(addr, host, TYPE_IP6, (int)number);
+	}
+	return 0;
+}
+
+/// @brief creates non-blocking socket bound to the address, TCP socket also listens
+/// @param addr
+/// @param addr_len
+/// @param type SOCK_DGRAM or SOCK_STREAM
+/// @return the socket, -1 on error
+static int open_listener(struct sockaddr_storage *addr, socklen_t addr_len, int type)
+{
+	int sock = socket(addr->ss_family, type | SOCK_NONBLOCK, 0);
+	if (sock < 0)
+	{
+		perror("Error creating socket");
+		return -1;
+	}
+	int one = 1;
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (type == SOCK_DGRAM)
+	{
+		// bursts of client queries must not overflow the default receive buffer
+		int rcvbuf = 4 * 1024 * 1024;
+		setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	}
+	if (bind(sock, (struct sockaddr *)addr, addr_len) < 0 || (type == SOCK_STREAM && listen(sock, SOMAXCONN) < 0))
+	{
+		perror("Error binding listening socket");
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+/// @brief sends queued answers to UDP clients with sendmmsg. Answers which do not fit into the full socket
+/// buffer are dropped, the clients ask again
+/// @param fwd
+static void flush_udp(struct forwarder *fwd)
+{
+	int total = 0;
+	while (total < fwd->tx_cnt)
+	{
+		int sent = sendmmsg(fwd->udp_sock, &fwd->tx_msgs[total], fwd->tx_cnt - total, 0);
+		if (sent < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				total++; // unreachable client must not block the others
+				continue;
+			}
+			break;
+		}
+		total += sent;
+	}
+	fwd->tx_cnt = 0;
+}
+
+/// @brief queues the answer to the UDP client
+/// @param fwd
+/// @param addr
+/// @param addr_len
+/// @param msg
+/// @param len at most FWD_UDP_SLOT
+static void udp_send(struct forwarder *fwd, struct sockaddr_storage *addr, socklen_t addr_len, unsigned char *msg, int len)
+{
+	if (fwd->tx_cnt == FWD_BATCH)
+	{
+		flush_udp(fwd);
+	}
+	int i = fwd->tx_cnt++;
+	std::memcpy(&fwd->tx_slots[i * FWD_UDP_SLOT], msg, len);
+	fwd->tx_iov[i].iov_len = len;
+	std::memcpy(&fwd->tx_addr[i], addr, addr_len);
+	fwd->tx_msgs[i].msg_hdr.msg_namelen = addr_len;
+}
+
+/// @brief closes the TCP client, answers of its pending queries are dropped
+/// @param fwd
+/// @param i
+static void close_tcp_client(struct forwarder *fwd, int i)
+{
+	struct fwd_tcp_client *c = &fwd->tcp[i];
+	if (c->events != 0)
+	{
+		resolver_unwatch(fwd->res, c->conn.sock);
+	}
+	stream_close(&c->conn);
+	c->used = 0;
+	c->gen++;
+	c->events = 0;
+}
+
+/// @brief watches the TCP client for queries and for writability while it has unsent answers. Client which closed
+/// its side is closed when all its answers are written
+/// @param fwd
+/// @param i
+static void update_tcp_client(struct forwarder *fwd, int i)
+{
+	struct fwd_tcp_client *c = &fwd->tcp[i];
+	bool writing = stream_wants_write(&c->conn);
+	if (c->eof && c->pending == 0 && !writing)
+	{
+		close_tcp_client(fwd, i);
+		return;
+	}
+	// readability at the end of the stream is level triggered, so closed client is watched only for writing
+	unsigned events = (c->eof ? 0 : POLLIN) | (writing ? POLLOUT : 0);
+	if (events == c->events)
+	{
+		return;
+	}
+	if (events == 0)
+	{
+		resolver_unwatch(fwd->res, c->conn.sock);
+	}
+	else if (c->events == 0)
+	{
+		resolver_watch(fwd->res, c->conn.sock, &c->token);
+		resolver_watch_events(fwd->res, c->conn.sock, events);
+	}
+	else
+	{
+		resolver_watch_events(fwd->res, c->conn.sock, events);
+	}
+	c->events = events;
+}
+
+/// @brief writes the answer to the TCP client
+/// @param fwd
+/// @param i
+/// @param msg
+/// @param len
+static void tcp_send(struct forwarder *fwd, int i, unsigned char *msg, int len)
+{
+	struct fwd_tcp_client *c = &fwd->tcp[i];
+	if (stream_queue(&c->conn, msg, len) < 0 || stream_flush(&c->conn) < 0)
+	{
+		close_tcp_client(fwd, i);
+	}
+}
+
+/// @brief writes answer with the rcode and the question of the client only
+/// @param p
+/// @param rcode
+/// @param out
+/// @return length of the answer
+static int error_answer(struct fwd_pending *p, int rcode, unsigned char *out)
+{
+	struct dns_header *dns = (struct dns_header *)out;
+	std::memset(dns, 0, sizeof(*dns));
+	dns->id = p->id;
+	dns->qr = 1;
+	dns->rd = p->rd;
+	dns->ra = 1;
+	dns->rcode = rcode;
+	dns->q_count = htons((p->question_len > 0) ? 1 : 0);
+	std::memcpy(&out[sizeof(struct dns_header)], p->question, p->question_len);
+	return sizeof(struct dns_header) + p->question_len;
+}
+
+/// @brief sends the answer to the UDP or TCP client of the query
+/// @param fwd
+/// @param p
+/// @param msg
+/// @param len
+static void send_answer(struct forwarder *fwd, struct fwd_pending *p, unsigned char *msg, int len)
+{
+	fwd->answered++;
+	if (p->tcp_client < 0)
+	{
+		udp_send(fwd, &p->addr, p->addr_len, msg, len);
+		return;
+	}
+	struct fwd_tcp_client *c = &fwd->tcp[p->tcp_client];
+	if (c->used && c->gen == p->tcp_gen)
+	{
+		tcp_send(fwd, p->tcp_client, msg, len);
+	}
+}
+
+/// @brief returns the pending query to the free stack
+/// @param fwd
+/// @param index
+static void release_pending(struct forwarder *fwd, int index)
+{
+	struct fwd_pending *p = &fwd->pending[index];
+	if (p->tcp_client >= 0)
+	{
+		struct fwd_tcp_client *c = &fwd->tcp[p->tcp_client];
+		if (c->used && c->gen == p->tcp_gen)
+		{
+			c->pending--;
+			update_tcp_client(fwd, p->tcp_client);
+		}
+	}
+	p->used = 0;
+	fwd->free_pending[fwd->free_cnt++] = index;
+}
+
+/// @brief resolver callback, the answer gets transaction id, RD flag and question case of the client.
+/// OPT record is removed for clients without EDNS0, UDP answer larger than the client accepts is truncated
+/// @param ctx forwarder
+/// @param req req->tag is the pending query
+/// @param status
+/// @param msg
+/// @param msg_len
+/// @param view parsed msg
+static void forward_result(void *ctx, struct dns_query_request *req, int status, unsigned char *msg, int msg_len,
+						   const struct dns_message_view *view)
+{
+	struct forwarder *fwd = (struct forwarder *)ctx;
+	struct fwd_pending *p = &fwd->pending[req->tag];
+	static unsigned char out[65536];
+	int len;
+	if (status == QUERY_OK && msg_len >= (int)sizeof(struct dns_header) + p->question_len)
+	{
+		std::memcpy(out, msg, msg_len);
+		len = msg_len;
+		struct dns_header *dns = (struct dns_header *)out;
+		dns->id = p->id;
+		dns->rd = p->rd;
+		if (fwd->args->iterative)
+		{
+			// the answer came from authoritative server, for the client it is a recursive answer
+			dns->aa = 0;
+			dns->ra = 1;
+		}
+		// the question of the answer was matched case insensitively, so it has the same length and the offsets
+		// of the view are the same in out
+		std::memcpy(&out[sizeof(struct dns_header)], p->question, p->question_len);
+		if (!p->edns && view->parse_error == PARSE_OK && view->opt_index >= 0 && view->opt_index == view->record_cnt - 1)
+		{
+			len = view->records[view->opt_index].name_off;
+			dns->add_count = htons(ntohs(dns->add_count) - 1);
+		}
+		if (p->tcp_client < 0 && len > p->max_len)
+		{
+			// the client asks again over TCP
+			len = sizeof(struct dns_header) + p->question_len;
+			dns->tc = 1;
+			dns->ans_count = 0;
+			dns->auth_count = 0;
+			dns->add_count = 0;
+			fwd->truncated++;
+		}
+	}
+	else
+	{
+		len = error_answer(p, (status == QUERY_BAD_NAME) ? 1 : 2, out);
+		fwd->servfail += (status != QUERY_BAD_NAME);
+		fwd->formerr += (status == QUERY_BAD_NAME);
+	}
+	send_answer(fwd, p, out, len);
+	release_pending(fwd, req->tag);
+}
+
+/// @brief validates the client query and submits it to the resolver with a new transaction id,
+/// cached answer is sent right away
+/// @param fwd
+/// @param msg
+/// @param len
+/// @param tcp_client index of the TCP client, -1 for UDP
+/// @param addr UDP client
+/// @param addr_len
+static void handle_query(struct forwarder *fwd, unsigned char *msg, int len, int tcp_client, struct sockaddr_storage *addr, socklen_t addr_len)
+{
+	if (len < (int)sizeof(struct dns_header))
+	{
+		return;
+	}
+	struct dns_header client;
+	std::memcpy(&client, msg, sizeof(client)); // TCP messages follow the 2 byte length, so they can be misaligned
+	if (client.qr)
+	{
+		return; // answers are never answered, so two forwarders cannot loop
+	}
+	fwd->queries++;
+	struct fwd_pending query;
+	query.tcp_client = tcp_client;
+	query.tcp_gen = (tcp_client >= 0) ? fwd->tcp[tcp_client].gen : 0;
+	if (addr != NULL)
+	{
+		std::memcpy(&query.addr, addr, addr_len);
+	}
+	query.addr_len = addr_len;
+	query.id = client.id;
+	query.rd = client.rd;
+	query.edns = 0;
+	query.max_len = 512;
+	query.question_len = 0;
+
+	struct dns_message_view *view = &fwd->view;
+	int error = parse_dns_message(msg, len, view);
+	if (error == PARSE_OK)
+	{
+		query.question_len = view->qname_len + 4;
+		std::memcpy(query.question, &msg[sizeof(struct dns_header)], query.question_len);
+		if (view->opt_index >= 0)
+		{
+			query.edns = 1;
+			query.max_len = std::min(std::max((int)view->udp_size, 512), FWD_UDP_SLOT);
+		}
+	}
+	unsigned char out[sizeof(struct dns_header) + MAX_QUERY_LEN];
+	if (error != PARSE_OK || view->opcode != 0 || view->qclass != QCLASS_IN)
+	{
+		// FORMERR, NOTIMP for other opcodes, REFUSED for other classes
+		int rcode = (error != PARSE_OK) ? 1 : (view->opcode != 0) ? 4 : 5;
+		fwd->formerr += (rcode == 1);
+		send_answer(fwd, &query, out, error_answer(&query, rcode, out));
+		return;
+	}
+
+	struct dns_query_request req;
+	req.name[0] = '\0';
+	req.qname_len = dns_name_to_wire(msg, len, sizeof(struct dns_header), req.qname);
+	req.qtype = view->qtype;
+	req.reverse = 0;
+	if (fwd->free_cnt == 0)
+	{
+		fwd->servfail++;
+		send_answer(fwd, &query, out, error_answer(&query, 2, out));
+		return;
+	}
+	int index = fwd->free_pending[--fwd->free_cnt];
+	fwd->pending[index] = query;
+	fwd->pending[index].used = 1;
+	if (tcp_client >= 0)
+	{
+		fwd->tcp[tcp_client].pending++;
+	}
+	req.tag = index;
+	if (resolver_submit(fwd->res, &req) == -2)
+	{
+		// window of the resolver is full, the query is not kept waiting
+		fwd->servfail++;
+		send_answer(fwd, &fwd->pending[index], out, error_answer(&fwd->pending[index], 2, out));
+		release_pending(fwd, index);
+	}
+}
+
+/// @brief reads all waiting client datagrams in batches, io handler of the UDP socket
+/// @param ctx forwarder
+/// @param token
+static void udp_ready(void *ctx, struct io_token *token)
+{
+	(void)token;
+	struct forwarder *fwd = (struct forwarder *)ctx;
+	int cnt;
+	do
+	{
+		for (int i = 0; i < FWD_BATCH; i++)
+		{
+			fwd->rx_msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+		}
+		cnt = recvmmsg(fwd->udp_sock, fwd->rx_msgs, FWD_BATCH, MSG_DONTWAIT, NULL);
+		for (int i = 0; i < cnt; i++)
+		{
+			if (fwd->rx_msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+			{
+				continue;
+			}
+			handle_query(fwd, &fwd->rx_slots[i * FWD_UDP_SLOT], fwd->rx_msgs[i].msg_len, -1, &fwd->rx_addr[i],
+						 fwd->rx_msgs[i].msg_hdr.msg_namelen);
+		}
+	} while (cnt == FWD_BATCH);
+}
+
+/// @brief writes pending answers and reads queries of the TCP client, io handler of the client socket
+/// @param ctx the client
+/// @param token
+static void tcp_client_ready(void *ctx, struct io_token *token)
+{
+	(void)token;
+	struct fwd_tcp_client *c = (struct fwd_tcp_client *)ctx;
+	struct forwarder *fwd = c->fwd;
+	int i = c - fwd->tcp;
+	if (!c->used)
+	{
+		return; // closed by earlier event of the same wait
+	}
+	if (stream_flush(&c->conn) < 0)
+	{
+		close_tcp_client(fwd, i);
+		return;
+	}
+	int status = c->eof ? 0 : stream_receive(&c->conn);
+	int len;
+	unsigned char *msg;
+	while (c->used && (msg = stream_next_msg(&c->conn, &len)) != NULL)
+	{
+		c->last_ms = now_ms();
+		handle_query(fwd, msg, len, i, NULL, 0);
+	}
+	if (!c->used)
+	{
+		return;
+	}
+	if (status < 0)
+	{
+		c->eof = 1;
+	}
+	update_tcp_client(fwd, i);
+}
+
+/// @brief accepts all waiting TCP clients, io handler of the listening socket
+/// @param ctx forwarder
+/// @param token
+static void tcp_accept_ready(void *ctx, struct io_token *token)
+{
+	(void)token;
+	struct forwarder *fwd = (struct forwarder *)ctx;
+	int sock;
+	while ((sock = accept4(fwd->tcp_sock, NULL, NULL, SOCK_NONBLOCK)) >= 0)
+	{
+		int i = 0;
+		while (i < FWD_MAX_TCP_CLIENTS && fwd->tcp[i].used)
+		{
+			i++;
+		}
+		struct fwd_tcp_client *c = &fwd->tcp[i];
+		if (i == FWD_MAX_TCP_CLIENTS || stream_accept(&c->conn, sock) < 0)
+		{
+			fwd->tcp_refused++;
+			close(sock);
+			continue;
+		}
+		if (resolver_watch(fwd->res, sock, &c->token) < 0)
+		{
+			fwd->tcp_refused++;
+			stream_close(&c->conn);
+			continue;
+		}
+		c->used = 1;
+		c->eof = 0;
+		c->events = POLLIN;
+		c->pending = 0;
+		c->last_ms = now_ms();
+		fwd->tcp_clients++;
+	}
+}
+
+/// @brief closes TCP clients which sent nothing in FWD_TCP_IDLE_MS and wait for no answer
+/// @param fwd
+static void close_idle_clients(struct forwarder *fwd)
+{
+	long long now = now_ms();
+	for (int i = 0; i < FWD_MAX_TCP_CLIENTS; i++)
+	{
+		struct fwd_tcp_client *c = &fwd->tcp[i];
+		if (c->used && c->pending == 0 && now - c->last_ms > FWD_TCP_IDLE_MS)
+		{
+			close_tcp_client(fwd, i);
+		}
+	}
+}
+
+/// @brief prints counters of the forwarder and RTTs of the forwarded queries to stderr
+/// @param fwd
+/// @param elapsed_us time the forwarder was running
+static void print_forwarder_stats(struct forwarder *fwd, long long elapsed_us)
+{
+	struct cache_shard *shard = &fwd->cache->shards[0];
+	std::cerr << "Queries: " << fwd->queries << ", Answered: " << fwd->answered << ", Cache hits: " << shard->hits
+			  << " (negative " << shard->negative_hits << "), Forwarded: " << fwd->res->submitted
+			  << ", Coalesced: " << fwd->res->coalesced << ", Table hits: " << fwd->res->table_hits
+			  << ", Servfail: " << fwd->servfail << ", Formerr: " << fwd->formerr << ", Truncated: " << fwd->truncated << std::endl;
+	std::cerr << "TCP clients: " << fwd->tcp_clients << ", Refused: " << fwd->tcp_refused << std::endl;
+	print_latency(fwd->res->latency, fwd->args, fwd->queries, elapsed_us, std::cerr);
+}
+
+/// @brief closes the listeners and TCP clients and frees the forwarder, the cache is saved by cache_close
+/// @param fwd
+static void free_forwarder(struct forwarder *fwd)
+{
+	for (int i = 0; i < FWD_MAX_TCP_CLIENTS; i++)
+	{
+		stream_free(&fwd->tcp[i].conn);
+	}
+	if (fwd->udp_sock >= 0)
+	{
+		close(fwd->udp_sock);
+	}
+	if (fwd->tcp_sock >= 0)
+	{
+		close(fwd->tcp_sock);
+	}
+	if (fwd->res != NULL)
+	{
+		resolver_free(fwd->res);
+		free(fwd->res);
+	}
+	cache_close(fwd->cache, fwd->args);
+	free(fwd->pending);
+	free(fwd->free_pending);
+	free(fwd->rx_slots);
+	free(fwd->tx_slots);
+	delete fwd;
+}
+
+/// @brief answers UDP and TCP clients on the --listen address from the cache, misses are forwarded to the servers
+/// with new transaction ids. Runs until SIGINT or SIGTERM
+/// @param args
+/// @return 0 on clean exit, 1 if the forwarder cannot start
+int run_forwarder(struct parsed_arguments *args)
+{
+	struct sockaddr_storage addr;
+	socklen_t addr_len = parse_listen_address(args->listen, &addr);
+	if (addr_len == 0)
+	{
+		std::cerr << "Invalid listen address " << args->listen << std::endl;
+		return 1;
+	}
+	if (!args->iterative)
+	{
+		args->recursion = 1; // clients expect recursive service from the servers behind the forwarder
+	}
+	args->cache = 1;
+
+	struct forwarder *fwd = new forwarder();
+	fwd->args = args;
+	fwd->udp_sock = -1;
+	fwd->tcp_sock = -1;
+	fwd->cache = cache_open(args, 1);
+	fwd->res = (struct resolver *)malloc(sizeof(struct resolver));
+	if (fwd->res == NULL || resolver_init(fwd->res, args, forward_result, fwd) < 0)
+	{
+		free(fwd->res);
+		fwd->res = NULL;
+		free_forwarder(fwd);
+		return 1;
+	}
+	fwd->window = fwd->res->window;
+	fwd->pending = (struct fwd_pending *)calloc(fwd->window, sizeof(struct fwd_pending));
+	fwd->free_pending = (int *)malloc(fwd->window * sizeof(int));
+	fwd->rx_slots = (unsigned char *)malloc(FWD_BATCH * FWD_UDP_SLOT);
+	fwd->tx_slots = (unsigned char *)malloc(FWD_BATCH * FWD_UDP_SLOT);
+	if (fwd->cache == NULL || resolver_set_cache(fwd->res, fwd->cache, 0) < 0 || fwd->pending == NULL ||
+		fwd->free_pending == NULL || fwd->rx_slots == NULL || fwd->tx_slots == NULL)
+	{
+		std::cerr << "Error: Out of memory" << std::endl;
+		free_forwarder(fwd);
+		return 1;
+	}
+	for (int i = fwd->window - 1; i >= 0; i--)
+	{
+		fwd->free_pending[fwd->free_cnt++] = i;
+	}
+	for (int i = 0; i < FWD_BATCH; i++)
+	{
+		fwd->rx_iov[i].iov_base = &fwd->rx_slots[i * FWD_UDP_SLOT];
+		fwd->rx_iov[i].iov_len = FWD_UDP_SLOT;
+		fwd->rx_msgs[i].msg_hdr.msg_iov = &fwd->rx_iov[i];
+		fwd->rx_msgs[i].msg_hdr.msg_iovlen = 1;
+		fwd->rx_msgs[i].msg_hdr.msg_name = &fwd->rx_addr[i];
+		fwd->tx_iov[i].iov_base = &fwd->tx_slots[i * FWD_UDP_SLOT];
+		fwd->tx_msgs[i].msg_hdr.msg_iov = &fwd->tx_iov[i];
+		fwd->tx_msgs[i].msg_hdr.msg_iovlen = 1;
+		fwd->tx_msgs[i].msg_hdr.msg_name = &fwd->tx_addr[i];
+	}
+	for (int i = 0; i < FWD_MAX_TCP_CLIENTS; i++)
+	{
+		struct fwd_tcp_client *c = &fwd->tcp[i];
+		stream_init(&c->conn);
+		c->fwd = fwd;
+		c->token.up = NULL;
+		c->token.transport = TRANSPORT_EXTERNAL;
+		c->token.handler = tcp_client_ready;
+		c->token.ctx = c;
+	}
+
+	fwd->udp_sock = open_listener(&addr, addr_len, SOCK_DGRAM);
+	fwd->tcp_sock = open_listener(&addr, addr_len, SOCK_STREAM);
+	fwd->udp_token = {NULL, TRANSPORT_EXTERNAL, udp_ready, fwd};
+	fwd->tcp_token = {NULL, TRANSPORT_EXTERNAL, tcp_accept_ready, fwd};
+	if (fwd->udp_sock < 0 || fwd->tcp_sock < 0 || resolver_watch(fwd->res, fwd->udp_sock, &fwd->udp_token) < 0 ||
+		resolver_watch(fwd->res, fwd->tcp_sock, &fwd->tcp_token) < 0)
+	{
+		free_forwarder(fwd);
+		return 1;
+	}
+
+	struct sigaction action;
+	std::memset(&action, 0, sizeof(action));
+	action.sa_handler = stop_forwarder; // without SA_RESTART, so the wait of the loop is interrupted
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	// periodic report counts client queries, percentiles are RTTs of the forwarded ones
+	struct counters_segment counters;
+	counters.header = NULL;
+	if (args->counters[0] != '\0' && counters_create(&counters, args, 1, COUNTERS_FORWARDER) < 0)
+	{
+		free_forwarder(fwd);
+		return 1;
+	}
+	struct latency_report report;
+	latency_report_init(&report, args->stats_interval);
+	while (!forwarder_stop)
+	{
+		resolver_poll(fwd->res, FWD_POLL_MS);
+		flush_udp(fwd);
+		close_idle_clients(fwd);
+		if (fwd->res->latency != NULL)
+		{
+			latency_report_tick(&report, fwd->res->latency, fwd->queries, "", std::cerr);
+		}
+		if (counters.header != NULL)
+		{
+			// requests are client queries, failed ones got SERVFAIL or FORMERR
+			counters_publish(&counters.slots[0], fwd->res, fwd->answered, fwd->servfail + fwd->formerr);
+		}
+	}
+	counters_close(&counters);
+
+	if (args->stats)
+	{
+		print_forwarder_stats(fwd, now_us() - report.start_us);
+	}
+	free_forwarder(fwd);
+	return 0;
+}
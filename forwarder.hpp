@@ -0,0 +1,102 @@
+// author: Marek Kozumplik, xkozum08
+#pragma once
+#include "dns.hpp"
+#include "parser.hpp"
+#include "resolver.hpp"
+#include "cache.hpp"
+#include "counters.hpp"
+#include <signal.h>
+
+#define FWD_DEFAULT_ADDRESS "127.0.0.1"
+#define FWD_BATCH 64			 // client datagrams received or sent by one syscall
+#define FWD_UDP_SLOT 4096		 // max size of client query and of UDP answer, larger answers are truncated
+#define FWD_MAX_TCP_CLIENTS 24	 // more connections are closed right after accept, all fit into the loop next to upstreams
+#define FWD_TCP_IDLE_MS 10000	 // idle TCP client without pending queries is closed (RFC 7766)
+#define FWD_POLL_MS 1000		 // longest wait of the loop, idle clients and the stop flag are checked after it
+
+// client query waiting for the upstream answer
+struct fwd_pending
+{
+	int used;
+	int tcp_client;	  // index of the TCP client, -1 for UDP client
+	unsigned tcp_gen; // generation of the TCP client, answer is dropped when the connection was closed meanwhile
+	struct sockaddr_storage addr; // UDP client
+	socklen_t addr_len;
+	unsigned short id; // transaction id of the client (network byte order)
+	int rd;			   // RD flag of the client, copied to the answer
+	int edns;		   // client sent OPT record
+	int max_len;	   // max size of UDP answer: 512 or payload size from OPT of the client
+	unsigned char question[MAX_QUERY_LEN]; // question of the client, answer gets its case back
+	int question_len;
+};
+
+// TCP connection of a client, queries are pipelined and answered in any order
+struct forwarder;
+
+struct fwd_tcp_client
+{
+	struct forwarder *fwd;
+	int used;
+	unsigned gen; // incremented when the connection is closed
+	int eof;	  // client closed its side, connection is closed after the last answer
+	struct stream_conn conn;
+	struct io_token token;
+	unsigned events;
+	int pending; // queries of the client waiting for the upstream
+	long long last_ms;
+};
+
+struct forwarder
+{
+	struct parsed_arguments *args;
+	struct resolver *res;
+	struct dns_cache *cache;
+
+	int udp_sock;
+	int tcp_sock;
+	struct io_token udp_token;
+	struct io_token tcp_token;
+
+	// client datagrams, slot i is at rx_slots[i * FWD_UDP_SLOT]
+	unsigned char *rx_slots;
+	struct mmsghdr rx_msgs[FWD_BATCH];
+	struct iovec rx_iov[FWD_BATCH];
+	struct sockaddr_storage rx_addr[FWD_BATCH];
+
+	// answers to UDP clients, sent together after every poll
+	unsigned char *tx_slots;
+	struct mmsghdr tx_msgs[FWD_BATCH];
+	struct iovec tx_iov[FWD_BATCH];
+	struct sockaddr_storage tx_addr[FWD_BATCH];
+	int tx_cnt;
+
+	// one entry for every query in the resolver window, more queries are answered SERVFAIL
+	struct fwd_pending *pending;
+	int *free_pending;
+	int free_cnt;
+	int window;
+
+	struct fwd_tcp_client tcp[FWD_MAX_TCP_CLIENTS];
+
+	struct dns_message_view view; // parsed client query
+
+	unsigned long queries;	   // client queries
+	unsigned long answered;	   // answers sent to clients, cached ones included
+	unsigned long servfail;	   // upstream failed or the window was full
+	unsigned long formerr;	   // malformed client queries
+	unsigned long truncated;   // UDP answers larger than the client accepts
+	unsigned long tcp_clients; // accepted connections
+	unsigned long tcp_refused; // connections closed because all TCP clients were used
+};
+
+/// @brief parses --listen: port, address:port or [IPv6]:port
+/// @param text
+/// @param addr
+/// @return length of the address, 0 if the text is invalid
+socklen_t parse_listen_address(const char *text, struct sockaddr_storage *addr);
+
+/// @brief answers UDP and TCP clients on the --listen address from the cache, misses are forwarded to the servers
+/// with new transaction ids. Runs until SIGINT or SIGTERM
+/// @param args
+/// @return 0 on clean exit, 1 if the forwarder cannot start
+int run_forwarder(struct parsed_arguments *args);
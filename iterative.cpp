@@ -0,0 +1,691 @@
+// author: Marek Kozumplik, xkozum08
+#include "iterative.hpp"
+
+/// @brief parses one root hint: addr, addr:port or [addr]:port
+/// @param hint modified in place
+/// @param port used when the hint has no port
+/// @param out
+/// @return 0 on success, -1 if the hint is invalid
+static int parse_root_hint(char *hint, int port, struct iter_address *out)
+{
+	char *addr = hint;
+	char *colon = strrchr(hint, ':');
+	if (hint[0] == '[')
+	{
+		char *end = strchr(hint, ']');
+		if (end == NULL || (end[1] != '\0' && end[1] != ':'))
+		{
+			return -1;
+		}
+		*end = '\0';
+		addr = hint + 1;
+		colon = (end[1] == ':') ? end + 1 : NULL;
+	}
+	else if (colon != NULL && strchr(hint, ':') != colon)
+	{
+		colon = NULL; // IPv6 address without port
+	}
+	if (colon != NULL)
+	{
+		*colon = '\0';
+		port = atoi(colon + 1);
+		if (port <= 0 || port > 65535)
+		{
+			return -1;
+		}
+	}
+	std::memset(out, 0, sizeof(*out));
+	if (is_ip4_address(addr))
+	{
+		out->len = fill_server_address(&out->addr, addr, TYPE_IP4, port);
+	}
+	else if (is_ip6_address(addr))
+	{
+		out->len = fill_server_address(&out->addr, addr, TYPE_IP6, port);
+	}
+	else
+	{
+		return -1;
+	}
+	return 0;
+}
+
+/// @brief parses root hints and allocates the tasks for resolver in iterative mode
+/// @param res
+/// @param args
+/// @return 0 on success, -1 on error
+int iterative_init(struct resolver *res, struct parsed_arguments *args)
+{
+	struct iterative_state *iter = new iterative_state();
+	iter->port = args->port;
+	char hints[sizeof(args->root_hints)];
+	strncpy(hints, (args->root_hints[0] != '\0') ? args->root_hints : ITER_ROOT_HINTS, sizeof(hints) - 1);
+	hints[sizeof(hints) - 1] = '\0';
+	char *save;
+	for (char *hint = strtok_r(hints, ",", &save); hint != NULL; hint = strtok_r(NULL, ",", &save))
+	{
+		std::string text = hint;
+		if (iter->hint_cnt == ITER_MAX_CANDIDATES)
+		{
+			std::cerr << "Too many root hints, maximum is " << ITER_MAX_CANDIDATES << std::endl;
+			delete iter;
+			return -1;
+		}
+		if (parse_root_hint(hint, args->port, &iter->hints[iter->hint_cnt]) < 0)
+		{
+			std::cerr << "Invalid root hint " << text << std::endl;
+			delete iter;
+			return -1;
+		}
+		if (iter->hints[iter->hint_cnt].addr.ss_family == AF_INET6)
+		{
+			iter->ip6_glue = 1;
+		}
+		iter->hint_cnt++;
+	}
+	if (iter->hint_cnt == 0)
+	{
+		std::cerr << "Root hints are empty" << std::endl;
+		delete iter;
+		return -1;
+	}
+
+	// every query in flight belongs to one task
+	iter->task_cnt = res->slot_cnt;
+	iter->tasks = (struct iter_task *)calloc(iter->task_cnt, sizeof(struct iter_task));
+	iter->free_tasks = (int *)malloc(iter->task_cnt * sizeof(int));
+	if (iter->tasks == NULL || iter->free_tasks == NULL)
+	{
+		std::cerr << "Error: Out of memory" << std::endl;
+		free(iter->tasks);
+		free(iter->free_tasks);
+		delete iter;
+		return -1;
+	}
+	for (int i = iter->task_cnt - 1; i >= 0; i--)
+	{
+		iter->free_tasks[iter->free_cnt++] = i;
+	}
+	res->iter = iter;
+	return 0;
+}
+
+/// @brief frees the iterative state of the resolver, NULL state is ignored
+/// @param res
+void iterative_free(struct resolver *res)
+{
+	if (res->iter == NULL)
+	{
+		return;
+	}
+	free(res->iter->tasks);
+	free(res->iter->free_tasks);
+	delete res->iter;
+	res->iter = NULL;
+}
+
+/// @brief returns number of submitted names which are not resolved yet
+/// @param res
+/// @return
+int iterative_inflight(struct resolver *res)
+{
+	return res->iter->active;
+}
+
+/// @brief returns true if the name is the zone or lies below it, both in lower case wire format
+/// @param name
+/// @param name_len
+/// @param zone
+/// @param zone_len
+/// @return
+static bool in_zone(const unsigned char *name, int name_len, const unsigned char *zone, int zone_len)
+{
+	// labels of the name are skipped until the rest is as long as the zone
+	int off = 0;
+	while (name_len - off > zone_len)
+	{
+		off += name[off] + 1;
+	}
+	return name_len - off == zone_len && std::memcmp(&name[off], zone, zone_len) == 0;
+}
+
+/// @brief drops expired entries when the cache is full, all entries if none expired
+/// @param map delegations or addresses
+/// @param now
+template <typename T>
+static void bound_cache(std::unordered_map<std::string, T> &map, long long now)
+{
+	if (map.size() < ITER_CACHE_ENTRIES)
+	{
+		return;
+	}
+	for (auto it = map.begin(); it != map.end();)
+	{
+		it = (it->second.expires_ms <= now) ? map.erase(it) : std::next(it);
+	}
+	if (map.size() >= ITER_CACHE_ENTRIES)
+	{
+		map.clear();
+	}
+}
+
+/// @brief returns expiration time of infrastructure record. TTL is at least one second, so the referral
+/// being followed can use its own glue
+/// @param ttl
+/// @param now
+/// @return
+static long long infra_expires(uint32_t ttl, long long now)
+{
+	return now + (long long)std::min(std::max(ttl, 1u), (uint32_t)CACHE_MAX_TTL) * 1000;
+}
+
+/// @brief returns true if the record is address of a name server which can be used
+/// @param iter
+/// @param rr
+/// @return
+static bool is_address_record(struct iterative_state *iter, const struct dns_record_view *rr)
+{
+	return (rr->type == QTYPE_A && rr->rdata_len == 4) || (iter->ip6_glue && rr->type == QTYPE_AAAA && rr->rdata_len == 16);
+}
+
+/// @brief converts A or AAAA record to address of the name server, port is the -p port
+/// @param iter
+/// @param msg
+/// @param rr
+/// @param out
+static void record_address(struct iterative_state *iter, const unsigned char *msg, const struct dns_record_view *rr,
+						   struct iter_address *out)
+{
+	std::memset(out, 0, sizeof(*out));
+	if (rr->type == QTYPE_A)
+	{
+		struct sockaddr_in *sin = (struct sockaddr_in *)&out->addr;
+		sin->sin_family = AF_INET;
+		sin->sin_port = htons(iter->port);
+		std::memcpy(&sin->sin_addr, &msg[rr->rdata_off], 4);
+		out->len = sizeof(struct sockaddr_in);
+	}
+	else
+	{
+		struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&out->addr;
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_port = htons(iter->port);
+		std::memcpy(&sin6->sin6_addr, &msg[rr->rdata_off], 16);
+		out->len = sizeof(struct sockaddr_in6);
+	}
+}
+
+/// @brief adds address of the name server to the address cache
+/// @param iter
+/// @param name name server in wire format
+/// @param addr
+/// @param ttl
+/// @param now
+static void cache_address(struct iterative_state *iter, const std::string &name, struct iter_address *addr, uint32_t ttl, long long now)
+{
+	bound_cache(iter->addresses, now);
+	struct address_set &set = iter->addresses[name];
+	long long expires = infra_expires(ttl, now);
+	if (set.expires_ms <= now)
+	{
+		set.addrs.clear(); // new or expired entry
+		set.expires_ms = expires;
+	}
+	set.expires_ms = std::min(set.expires_ms, expires);
+	for (struct iter_address &known : set.addrs)
+	{
+		if (known.len == addr->len && std::memcmp(&known.addr, &addr->addr, addr->len) == 0)
+		{
+			return;
+		}
+	}
+	if (set.addrs.size() < ITER_MAX_CANDIDATES)
+	{
+		set.addrs.push_back(*addr);
+	}
+}
+
+/// @brief appends the address to the candidates of the task, duplicates are skipped
+/// @param t
+/// @param addr
+static void add_candidate(struct iter_task *t, struct iter_address *addr)
+{
+	for (int i = 0; i < t->cand_cnt; i++)
+	{
+		if (t->cand[i].len == addr->len && std::memcmp(&t->cand[i].addr, &addr->addr, addr->len) == 0)
+		{
+			return;
+		}
+	}
+	if (t->cand_cnt < ITER_MAX_CANDIDATES)
+	{
+		t->cand[t->cand_cnt++] = *addr;
+	}
+}
+
+/// @brief returns rank of the name server by the RTT the resolver measured, lower is better.
+/// Server without RTT sample is tried first like in server selection of the resolver, skipped servers are last
+/// @param res
+/// @param addr
+/// @param now
+/// @return
+static long long candidate_rank(struct resolver *res, struct iter_address *addr, long long now)
+{
+	for (int i = 0; i < res->server_cnt; i++)
+	{
+		struct upstream *up = &res->servers[i];
+		if (up->sock < 0 || up->addr_len != addr->len || std::memcmp(&up->addr, &addr->addr, addr->len) != 0)
+		{
+			continue;
+		}
+		if (up->down_until_ms > now)
+		{
+			return (long long)RTO_MAX_MS * 1000 * 1000 + up->down_until_ms - now;
+		}
+		return up->srtt_us;
+	}
+	return 0;
+}
+
+/// @brief makes the zone the current zone cut of the task. Name servers with known address become the candidates
+/// (fastest first), the others are looked up when the candidates do not answer
+/// @param res
+/// @param t
+/// @param zone
+/// @param zone_len
+/// @param ns name servers of the zone, NULL for the root zone
+/// @param now
+static void enter_zone(struct resolver *res, struct iter_task *t, const unsigned char *zone, int zone_len,
+					   const std::vector<std::string> *ns, long long now)
+{
+	struct iterative_state *iter = res->iter;
+	std::memcpy(t->zone, zone, zone_len);
+	t->zone_len = zone_len;
+	t->cand_cnt = 0;
+	t->cand_next = 0;
+	t->pass = 0;
+	t->ns_cnt = 0;
+	t->ns_next = 0;
+	if (ns == NULL)
+	{
+		for (int i = 0; i < iter->hint_cnt; i++)
+		{
+			add_candidate(t, &iter->hints[i]);
+		}
+	}
+	else
+	{
+		for (const std::string &name : *ns)
+		{
+			auto known = iter->addresses.find(name);
+			if (known != iter->addresses.end() && known->second.expires_ms > now)
+			{
+				for (struct iter_address &addr : known->second.addrs)
+				{
+					add_candidate(t, &addr);
+				}
+			}
+			else if (t->ns_cnt < ITER_MAX_NS)
+			{
+				std::memcpy(t->ns[t->ns_cnt], name.data(), name.size());
+				t->ns_len[t->ns_cnt++] = name.size();
+			}
+		}
+	}
+
+	// insertion sort, there are only a few candidates
+	long long rank[ITER_MAX_CANDIDATES];
+	for (int i = 0; i < t->cand_cnt; i++)
+	{
+		rank[i] = candidate_rank(res, &t->cand[i], now);
+	}
+	for (int i = 1; i < t->cand_cnt; i++)
+	{
+		struct iter_address addr = t->cand[i];
+		long long r = rank[i];
+		int j = i - 1;
+		for (; j >= 0 && rank[j] > r; j--)
+		{
+			t->cand[j + 1] = t->cand[j];
+			rank[j + 1] = rank[j];
+		}
+		t->cand[j + 1] = addr;
+		rank[j + 1] = r;
+	}
+}
+
+/// @brief starts the task at the closest zone cut of its name found in the delegation cache, at the root otherwise
+/// @param res
+/// @param t
+/// @param now
+static void start_task(struct resolver *res, struct iter_task *t, long long now)
+{
+	struct iterative_state *iter = res->iter;
+	for (int off = 0; off < t->qname_len - 1; off += t->qname[off] + 1)
+	{
+		auto cut = iter->delegations.find(std::string((const char *)&t->qname[off], t->qname_len - off));
+		if (cut != iter->delegations.end() && cut->second.expires_ms > now)
+		{
+			iter->delegation_hits++;
+			enter_zone(res, t, &t->qname[off], t->qname_len - off, &cut->second.ns, now);
+			return;
+		}
+	}
+	static const unsigned char root = 0;
+	enter_zone(res, t, &root, 1, NULL, now);
+}
+
+static void iterative_callback(void *ctx, struct dns_query_request *req, int status, unsigned char *msg, int msg_len,
+							   const struct dns_message_view *view);
+static void step_task(struct resolver *res, int index);
+
+/// @brief finishes the task. Submitted name is passed to the resolver callback (and cached), parent of the name
+/// server lookup continues with the addresses it got
+/// @param res
+/// @param index
+/// @param status
+/// @param msg
+/// @param msg_len
+/// @param view parsed msg, NULL without response
+static void finish_task(struct resolver *res, int index, int status, unsigned char *msg, int msg_len,
+						const struct dns_message_view *view)
+{
+	struct iterative_state *iter = res->iter;
+	struct iter_task *t = &iter->tasks[index];
+	int parent = t->parent;
+	if (parent < 0)
+	{
+		iter->active--;
+		if (status == QUERY_OK && res->cache != NULL && !((struct dns_header *)msg)->tc)
+		{
+			unsigned char query[MAX_QUERY_LEN];
+			int len = build_dns_query_wire(query, t->qname, t->qname_len, t->qtype, 0, 0);
+			cache_store(res->cache, res->cache_shard, query, len, view);
+		}
+		res->callback(res->ctx, &t->req, status, msg, msg_len, view);
+	}
+	else
+	{
+		iter->tasks[parent].steps = t->steps;
+	}
+	t->used = 0;
+	iter->free_tasks[iter->free_cnt++] = index;
+	if (parent >= 0)
+	{
+		step_task(res, parent);
+	}
+}
+
+/// @brief sends the name to the next candidate of the task. When all candidates failed, name server without
+/// glue is looked up by a child task. The task fails when nothing is left or it used ITER_MAX_STEPS queries
+/// @param res
+/// @param index
+static void step_task(struct resolver *res, int index)
+{
+	struct iterative_state *iter = res->iter;
+	struct iter_task *t = &iter->tasks[index];
+	while (t->steps < ITER_MAX_STEPS)
+	{
+		if (t->cand_next == t->cand_cnt && t->ns_next == t->ns_cnt && t->cand_cnt > 0 && t->pass + 1 < ITER_MAX_PASSES)
+		{
+			t->pass++;
+			t->cand_next = 0;
+		}
+		if (t->cand_next < t->cand_cnt)
+		{
+			struct iter_address *addr = &t->cand[t->cand_next++];
+			int server = resolver_server_for(res, &addr->addr, addr->len);
+			if (server < 0)
+			{
+				continue;
+			}
+			struct dns_query_request req;
+			req.name[0] = '\0';
+			req.qtype = t->qtype;
+			req.reverse = 0;
+			req.tag = index;
+			std::memcpy(req.qname, t->qname, t->qname_len);
+			req.qname_len = t->qname_len;
+			t->steps++;
+			// on -1 the callback already moved the task to the next candidate
+			if (resolver_submit_to(res, &req, server, iterative_callback, res) != -2)
+			{
+				return;
+			}
+			continue;
+		}
+		if (t->ns_next < t->ns_cnt && t->depth < ITER_MAX_DEPTH && iter->free_cnt > 0)
+		{
+			int child = iter->free_tasks[--iter->free_cnt];
+			struct iter_task *c = &iter->tasks[child];
+			c->used = 1;
+			c->parent = index;
+			c->depth = t->depth + 1;
+			c->steps = t->steps;
+			c->req = t->req;
+			std::memcpy(c->qname, t->ns[t->ns_next], t->ns_len[t->ns_next]);
+			c->qname_len = t->ns_len[t->ns_next];
+			c->qtype = QTYPE_A;
+			t->ns_next++;
+			iter->glueless++;
+			start_task(res, c, now_ms());
+			step_task(res, child);
+			return;
+		}
+		break;
+	}
+	finish_task(res, index, QUERY_ITERATION_FAILED, NULL, 0, NULL);
+}
+
+/// @brief finishes the task with the final answer. Lookup of a name server passes its addresses to the parent
+/// @param res
+/// @param index
+/// @param msg
+/// @param msg_len
+/// @param view parsed msg
+static void answer_task(struct resolver *res, int index, unsigned char *msg, int msg_len, const struct dns_message_view *view)
+{
+	struct iterative_state *iter = res->iter;
+	struct iter_task *t = &iter->tasks[index];
+	if (t->parent < 0)
+	{
+		finish_task(res, index, QUERY_OK, msg, msg_len, view);
+		return;
+	}
+	struct iter_task *parent = &iter->tasks[t->parent];
+	std::string name((const char *)t->qname, t->qname_len);
+	long long now = now_ms();
+	int found = 0;
+	for (int i = 0; i < view->record_cnt; i++)
+	{
+		const struct dns_record_view *rr = &view->records[i];
+		if (rr->section == SECTION_ANSWER && is_address_record(iter, rr))
+		{
+			struct iter_address addr;
+			record_address(iter, msg, rr, &addr);
+			cache_address(iter, name, &addr, rr->ttl, now);
+			add_candidate(parent, &addr);
+			found++;
+		}
+	}
+	finish_task(res, index, (found > 0) ? QUERY_OK : QUERY_ITERATION_FAILED, NULL, 0, NULL);
+}
+
+/// @brief classifies the response of the name server: final answer (data, NXDOMAIN, no data), referral
+/// to a zone closer to the name, or lame answer after which the next candidate is tried
+/// @param res
+/// @param index
+/// @param msg
+/// @param msg_len
+/// @param view msg parsed by the resolver
+static void handle_answer(struct resolver *res, int index, unsigned char *msg, int msg_len, const struct dns_message_view *view)
+{
+	struct iterative_state *iter = res->iter;
+	struct iter_task *t = &iter->tasks[index];
+	if (view->parse_error != PARSE_OK || (view->rcode != 0 && view->rcode != 3))
+	{
+		iter->lame++; // SERVFAIL, REFUSED or malformed answer
+		step_task(res, index);
+		return;
+	}
+	if (view->rcode == 3 || view->aa || view->ans_count > 0)
+	{
+		answer_task(res, index, msg, msg_len, view);
+		return;
+	}
+
+	unsigned char zone[256];
+	int zone_len = 0;
+	uint32_t ttl = UINT32_MAX;
+	std::vector<std::string> ns;
+	bool soa = false;
+	for (int i = 0; i < view->record_cnt; i++)
+	{
+		const struct dns_record_view *rr = &view->records[i];
+		if (rr->section != SECTION_AUTHORITY)
+		{
+			continue;
+		}
+		if (rr->type == QTYPE_SOA)
+		{
+			soa = true;
+		}
+		if (rr->type != QTYPE_NS)
+		{
+			continue;
+		}
+		unsigned char owner[256];
+		unsigned char target[256];
+		int owner_len = dns_name_to_wire(msg, msg_len, rr->name_off, owner);
+		int target_len = dns_name_to_wire(msg, msg_len, rr->rdata_off, target);
+		if (owner_len < 0 || target_len < 0)
+		{
+			continue;
+		}
+		if (zone_len == 0)
+		{
+			// referral must lead below the current zone cut towards the name, so the resolution cannot loop
+			if (owner_len <= t->zone_len || !in_zone(owner, owner_len, t->zone, t->zone_len) ||
+				!in_zone(t->qname, t->qname_len, owner, owner_len))
+			{
+				continue;
+			}
+			std::memcpy(zone, owner, owner_len);
+			zone_len = owner_len;
+		}
+		else if (owner_len != zone_len || std::memcmp(owner, zone, zone_len) != 0)
+		{
+			continue;
+		}
+		ns.push_back(std::string((const char *)target, target_len));
+		ttl = std::min(ttl, rr->ttl);
+	}
+	if (zone_len == 0)
+	{
+		if (soa)
+		{
+			answer_task(res, index, msg, msg_len, view); // name exists, but has no data of the type
+			return;
+		}
+		iter->lame++;
+		step_task(res, index);
+		return;
+	}
+
+	iter->referrals++;
+	long long now = now_ms();
+	for (int i = 0; i < view->record_cnt; i++)
+	{
+		const struct dns_record_view *rr = &view->records[i];
+		if (rr->section != SECTION_ADDITIONAL || !is_address_record(iter, rr))
+		{
+			continue;
+		}
+		unsigned char owner[256];
+		int owner_len = dns_name_to_wire(msg, msg_len, rr->name_off, owner);
+		std::string name((const char *)owner, std::max(owner_len, 0));
+		if (owner_len > 0 && std::find(ns.begin(), ns.end(), name) != ns.end())
+		{
+			struct iter_address addr;
+			record_address(iter, msg, rr, &addr);
+			cache_address(iter, name, &addr, rr->ttl, now);
+		}
+	}
+	bound_cache(iter->delegations, now);
+	struct delegation &cut = iter->delegations[std::string((const char *)zone, zone_len)];
+	cut.expires_ms = infra_expires(ttl, now);
+	cut.ns = ns;
+	enter_zone(res, t, zone, zone_len, &ns, now);
+	step_task(res, index);
+}
+
+/// @brief resolver callback of queries sent to the name servers, req->tag is the task
+/// @param ctx the resolver
+/// @param req
+/// @param status
+/// @param msg
+/// @param msg_len
+static void iterative_callback(void *ctx, struct dns_query_request *req, int status, unsigned char *msg, int msg_len,
+							   const struct dns_message_view *view)
+{
+	struct resolver *res = (struct resolver *)ctx;
+	if (status != QUERY_OK)
+	{
+		step_task(res, (int)req->tag);
+		return;
+	}
+	handle_answer(res, (int)req->tag, msg, msg_len, view);
+}
+
+/// @brief starts resolution of the name from the closest cached zone cut or from the root servers
+/// @param res
+/// @param req
+/// @return 0 if the name is in flight, 1 if it was answered from cache, -1 if it already finished with error,
+/// -2 if the window is full
+int iterative_submit(struct resolver *res, struct dns_query_request *req)
+{
+	struct iterative_state *iter = res->iter;
+	if (iter->active == res->window || iter->free_cnt == 0)
+	{
+		return -2;
+	}
+	unsigned char query[MAX_QUERY_LEN];
+	int len;
+	if (req->qname_len > 0)
+	{
+		len = build_dns_query_wire(query, req->qname, req->qname_len, req->qtype, 0, 0);
+	}
+	else
+	{
+		len = build_dns_query(query, req->name, req->reverse, req->qtype, 0, 0);
+	}
+	if (len < 0)
+	{
+		res->callback(res->ctx, req, QUERY_BAD_NAME, NULL, 0, NULL);
+		return -1;
+	}
+	if (res->cache != NULL)
+	{
+		int cached = cache_lookup(res->cache, res->cache_shard, query, len, res->cache_result, res->cache_view);
+		if (cached > 0)
+		{
+			res->callback(res->ctx, req, QUERY_OK, res->cache_result, cached, res->cache_view);
+			return 1;
+		}
+	}
+
+	int index = iter->free_tasks[--iter->free_cnt];
+	struct iter_task *t = &iter->tasks[index];
+	t->used = 1;
+	t->parent = -1;
+	t->depth = 0;
+	t->steps = 0;
+	t->req = *req;
+	// the name is taken from the encoded question, so reverse names and names given in wire format are the same
+	t->qname_len = dns_name_to_wire(query, len, sizeof(struct dns_header), t->qname);
+	t->qtype = read_u16(&query[sizeof(struct dns_header) + t->qname_len]);
+	iter->active++;
+	start_task(res, t, now_ms());
+	step_task(res, index);
+	return 0;
+}
@@ -0,0 +1,112 @@
+// author: Marek Kozumplik, xkozum08
+#pragma once
+#include "dns.hpp"
+#include "parser.hpp"
+#include "resolver.hpp"
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// a.root-servers.net - m.root-servers.net (IANA root hints)
+#define ITER_ROOT_HINTS "198.41.0.4,170.247.170.2,192.33.4.12,199.7.91.13,192.203.230.10,192.5.5.241,192.112.36.4," \
+						"198.97.190.53,192.36.148.17,192.58.128.30,193.0.14.129,199.7.83.42,202.12.27.33"
+
+#define ITER_MAX_DEPTH 3		// nested lookups of name server addresses which came without glue
+#define ITER_MAX_STEPS 24		// queries sent for one name, lookups of its name servers included
+#define ITER_MAX_CANDIDATES 16	// addresses of name servers of the zone tried for one step
+#define ITER_MAX_NS 8			// name servers without address looked up for one zone
+#define ITER_MAX_PASSES 2		// every candidate is asked at most twice before the name fails
+#define ITER_CACHE_ENTRIES 100000 // max number of delegations and of name server addresses kept
+
+// address of a name server
+struct iter_address
+{
+	struct sockaddr_storage addr;
+	socklen_t len;
+};
+
+// zone cut learnt from a referral, the key is the zone name in wire format
+struct delegation
+{
+	long long expires_ms;
+	std::vector<std::string> ns; // names of the name servers in wire format
+};
+
+// glue or looked up addresses of one name server, the key is its name in wire format
+struct address_set
+{
+	long long expires_ms;
+	std::vector<struct iter_address> addrs;
+};
+
+/*
+	One name being resolved. Submitted names are top level tasks, a name server without glue is looked
+	up by a child task while its parent waits. Task has at most one query in flight.
+*/
+struct iter_task
+{
+	int used;
+	int parent; // task waiting for the address of this name server, -1 for submitted name
+	int depth;	// 0 for submitted name
+	int steps;	// queries sent, shared with the children
+	struct dns_query_request req; // submitted request, passed to the resolver callback
+	unsigned char qname[256];	  // lower case wire format
+	int qname_len;
+	int qtype;
+
+	unsigned char zone[256]; // closest known zone cut of qname
+	int zone_len;
+	struct iter_address cand[ITER_MAX_CANDIDATES]; // name servers of the zone, fastest first
+	int cand_cnt;
+	int cand_next;
+	int pass;
+	unsigned char ns[ITER_MAX_NS][256]; // name servers of the zone without known address
+	int ns_len[ITER_MAX_NS];
+	int ns_cnt;
+	int ns_next;
+};
+
+struct iterative_state
+{
+	struct iter_task *tasks;
+	int task_cnt;
+	int *free_tasks;
+	int free_cnt;
+	int active; // submitted names in flight
+
+	struct iter_address hints[ITER_MAX_CANDIDATES];
+	int hint_cnt;
+	int ip6_glue; // IPv6 glue is used only when some root hint is IPv6
+	int port;	  // port of the name servers learnt from glue, -p
+
+	// infrastructure cache, servers of the zones with their TTLs, so next names skip the upper levels
+	std::unordered_map<std::string, struct delegation> delegations;
+	std::unordered_map<std::string, struct address_set> addresses;
+
+	unsigned long referrals;	   // answers which delegated the name to a deeper zone
+	unsigned long delegation_hits; // names started below the root thanks to the cache
+	unsigned long glueless;		   // lookups of name servers without glue
+	unsigned long lame;			   // answers which neither answered nor delegated the name
+};
+
+/// @brief parses root hints and allocates the tasks for resolver in iterative mode
+/// @param res
+/// @param args
+/// @return 0 on success, -1 on error
+int iterative_init(struct resolver *res, struct parsed_arguments *args);
+
+/// @brief frees the iterative state of the resolver, NULL state is ignored
+/// @param res
+void iterative_free(struct resolver *res);
+
+/// @brief returns number of submitted names which are not resolved yet
+/// @param res
+/// @return
+int iterative_inflight(struct resolver *res);
+
+/// @brief starts resolution of the name from the closest cached zone cut or from the root servers
+/// @param res
+/// @param req
+/// @return 0 if the name is in flight, 1 if it was answered from cache, -1 if it already finished with error,
+/// -2 if the window is full
+int iterative_submit(struct resolver *res, struct dns_query_request *req);
@@ -0,0 +1,313 @@
+// author: Marek Kozumplik, xkozum08
+#include "latency.hpp"
+#include "resolver.hpp"
+
+/// @brief returns the bucket of the value
+/// @param us
+/// @return
+static int hist_bucket(long long us)
+{
+	if (us < LAT_SUB_BUCKETS)
+	{
+		return (us < 0) ? 0 : (int)us;
+	}
+	if (us >= LAT_MAX_US)
+	{
+		return LAT_BUCKETS - 1;
+	}
+	// highest bit 7 and more, the top 7 bits of the value select the bucket in its power of two
+	int shift = 63 - __builtin_clzll(us) - 6;
+	return LAT_SUB_BUCKETS + (shift - 1) * (LAT_SUB_BUCKETS / 2) + (int)(us >> shift) - LAT_SUB_BUCKETS / 2;
+}
+
+/// @brief returns the highest value of the bucket
+/// @param bucket
+/// @return
+static long long hist_bucket_value(int bucket)
+{
+	if (bucket < LAT_SUB_BUCKETS)
+	{
+		return bucket;
+	}
+	int shift = (bucket - LAT_SUB_BUCKETS) / (LAT_SUB_BUCKETS / 2) + 1;
+	long long sub = (bucket - LAT_SUB_BUCKETS) % (LAT_SUB_BUCKETS / 2) + LAT_SUB_BUCKETS / 2;
+	return ((sub + 1) << shift) - 1;
+}
+
+/// @brief adds the value to the histogram
+/// @param h
+/// @param us
+void hist_record(struct latency_histogram *h, long long us)
+{
+	h->counts[hist_bucket(us)]++;
+	h->total++;
+	h->sum_us += us;
+	h->max_us = std::max(h->max_us, us);
+}
+
+/// @brief adds all values of src to dst
+/// @param dst
+/// @param src
+void hist_merge(struct latency_histogram *dst, const struct latency_histogram *src)
+{
+	if (src->total == 0)
+	{
+		return;
+	}
+	for (int i = 0; i < LAT_BUCKETS; i++)
+	{
+		dst->counts[i] += src->counts[i];
+	}
+	dst->total += src->total;
+	dst->sum_us += src->sum_us;
+	dst->max_us = std::max(dst->max_us, src->max_us);
+}
+
+/// @brief returns the value below which the percentile of the values is
+/// @param h
+/// @param percentile 0 to 100
+/// @return microseconds, 0 if the histogram is empty
+long long hist_percentile(const struct latency_histogram *h, double percentile)
+{
+	if (h->total == 0)
+	{
+		return 0;
+	}
+	unsigned long rank = (unsigned long)(percentile / 100.0 * h->total + 0.5);
+	rank = std::max(rank, 1UL);
+	unsigned long seen = 0;
+	for (int i = 0; i < LAT_BUCKETS; i++)
+	{
+		seen += h->counts[i];
+		if (seen >= rank)
+		{
+			// upper bound of the bucket, never above the largest recorded value
+			return std::min(hist_bucket_value(i), h->max_us);
+		}
+	}
+	return h->max_us;
+}
+
+/// @brief allocates empty stats
+/// @param stats
+/// @param server_cnt number of servers with own histogram
+/// @return 0 on success, -1 if out of memory
+int latency_init(struct latency_stats *stats, int server_cnt)
+{
+	std::memset(stats, 0, sizeof(*stats));
+	if (server_cnt > 0)
+	{
+		stats->servers = (struct latency_histogram *)calloc(server_cnt, sizeof(struct latency_histogram));
+		if (stats->servers == NULL)
+		{
+			return -1;
+		}
+	}
+	stats->server_cnt = server_cnt;
+	return 0;
+}
+
+/// @brief frees the histograms of the servers
+/// @param stats
+void latency_free(struct latency_stats *stats)
+{
+	free(stats->servers);
+	stats->servers = NULL;
+	stats->server_cnt = 0;
+}
+
+/// @brief returns the histogram index of the query type
+/// @param qtype
+/// @return
+static int latency_qtype_index(int qtype)
+{
+	switch (qtype)
+	{
+	case QTYPE_A:
+		return 0;
+	case QTYPE_NS:
+		return 1;
+	case QTYPE_CNAME:
+		return 2;
+	case QTYPE_SOA:
+		return 3;
+	case QTYPE_PTR:
+		return 4;
+	case QTYPE_MX:
+		return 5;
+	case QTYPE_TXT:
+		return 6;
+	case QTYPE_AAAA:
+		return 7;
+	default:
+		return 8;
+	}
+}
+
+/// @brief records RTT of the answered query
+/// @param stats
+/// @param server index of the server which answered, -1 if the time is not its RTT (retransmitted or hedged query)
+/// @param qtype
+/// @param rcode
+/// @param us
+/// @param kernel 1 if the receive time is the kernel timestamp
+void latency_record(struct latency_stats *stats, int server, int qtype, int rcode, long long us, int kernel)
+{
+	hist_record(&stats->all, us);
+	if (server >= 0 && server < stats->server_cnt)
+	{
+		hist_record(&stats->servers[server], us);
+	}
+	hist_record(&stats->qtypes[latency_qtype_index(qtype)], us);
+	hist_record(&stats->rcodes[(rcode >= 0 && rcode < LAT_RCODES - 1) ? rcode : LAT_RCODES - 1], us);
+	stats->kernel_samples += kernel;
+}
+
+/// @brief adds all histograms of src to dst, dst gets histograms of src servers it does not have yet
+/// @param dst
+/// @param src
+/// @return 0 on success, -1 if out of memory
+int latency_merge(struct latency_stats *dst, const struct latency_stats *src)
+{
+	if (src->server_cnt > dst->server_cnt)
+	{
+		struct latency_histogram *servers = (struct latency_histogram *)realloc(
+			dst->servers, src->server_cnt * sizeof(struct latency_histogram));
+		if (servers == NULL)
+		{
+			return -1;
+		}
+		std::memset(&servers[dst->server_cnt], 0, (src->server_cnt - dst->server_cnt) * sizeof(struct latency_histogram));
+		dst->servers = servers;
+		dst->server_cnt = src->server_cnt;
+	}
+	hist_merge(&dst->all, &src->all);
+	for (int i = 0; i < src->server_cnt; i++)
+	{
+		hist_merge(&dst->servers[i], &src->servers[i]);
+	}
+	for (int i = 0; i < LAT_QTYPES; i++)
+	{
+		hist_merge(&dst->qtypes[i], &src->qtypes[i]);
+	}
+	for (int i = 0; i < LAT_RCODES; i++)
+	{
+		hist_merge(&dst->rcodes[i], &src->rcodes[i]);
+	}
+	dst->kernel_samples += src->kernel_samples;
+	return 0;
+}
+
+/// @brief prints count and percentiles of the histogram in milliseconds
+/// @param h
+/// @param out
+static void print_histogram(const struct latency_histogram *h, std::ostream &out)
+{
+	out << h->total << ", p50: " << hist_percentile(h, 50) / 1000.0 << ", p90: " << hist_percentile(h, 90) / 1000.0
+		<< ", p99: " << hist_percentile(h, 99) / 1000.0 << ", p99.9: " << hist_percentile(h, 99.9) / 1000.0
+		<< ", max: " << h->max_us / 1000.0 << " ms" << std::endl;
+}
+
+/// @brief prints percentiles of all RTTs and of every server, qtype and rcode
+/// @param stats
+/// @param args server names
+/// @param queries finished queries (answered and failed)
+/// @param elapsed_us duration of the run, for qps
+/// @param out
+void print_latency(const struct latency_stats *stats, struct parsed_arguments *args, unsigned long queries,
+				   long long elapsed_us, std::ostream &out)
+{
+	static const char *qtype_names[LAT_QTYPES] = {"A", "NS", "CNAME", "SOA", "PTR", "MX", "TXT", "AAAA", "other"};
+	static const char *rcode_names[LAT_RCODES] = {"NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED", "other"};
+	elapsed_us = std::max(elapsed_us, 1LL);
+	out << std::fixed << std::setprecision(3) << "Elapsed: " << elapsed_us / 1e6
+		<< " s, Queries per second: " << std::setprecision(0) << queries * 1e6 / elapsed_us << std::endl;
+	out << std::setprecision(3) << "RTT: ";
+	print_histogram(&stats->all, out);
+	if (stats->all.total == 0)
+	{
+		return;
+	}
+	out << "  Kernel receive timestamps: " << stats->kernel_samples << " of " << stats->all.total << std::endl;
+	for (int i = 0; i < stats->server_cnt && stats->server_cnt > 1 && i < args->server_cnt; i++)
+	{
+		out << "  Server " << args->servers[i] << ": ";
+		print_histogram(&stats->servers[i], out);
+	}
+	for (int i = 0; i < LAT_QTYPES; i++)
+	{
+		if (stats->qtypes[i].total > 0)
+		{
+			out << "  Type " << qtype_names[i] << ": ";
+			print_histogram(&stats->qtypes[i], out);
+		}
+	}
+	for (int i = 0; i < LAT_RCODES; i++)
+	{
+		if (stats->rcodes[i].total > 0)
+		{
+			out << "  Rcode " << rcode_names[i] << ": ";
+			print_histogram(&stats->rcodes[i], out);
+		}
+	}
+}
+
+/// @brief starts the periodic report
+/// @param r
+/// @param interval_s seconds, 0 - no periodic report
+void latency_report_init(struct latency_report *r, int interval_s)
+{
+	r->interval_us = interval_s * 1000000LL;
+	r->start_us = now_us();
+	r->next_us = r->start_us + r->interval_us;
+	r->last_done = 0;
+	std::memset(&r->base, 0, sizeof(r->base));
+}
+
+/// @brief prints qps and percentiles of the last interval when the interval has passed
+/// @param r
+/// @param stats
+/// @param done queries finished since the start
+/// @param label printed before the counters, for example thread number
+/// @param out
+void latency_report_tick(struct latency_report *r, const struct latency_stats *stats, unsigned long done,
+						 const char *label, std::ostream &out)
+{
+	if (r->interval_us == 0)
+	{
+		return;
+	}
+	long long now = now_us();
+	if (now < r->next_us)
+	{
+		return;
+	}
+	// RTTs of the interval are the difference of the histogram against the previous report
+	struct latency_histogram *interval = (struct latency_histogram *)malloc(sizeof(struct latency_histogram));
+	if (interval == NULL)
+	{
+		return;
+	}
+	interval->total = stats->all.total - r->base.total;
+	interval->sum_us = stats->all.sum_us - r->base.sum_us;
+	interval->max_us = 0;
+	for (int i = 0; i < LAT_BUCKETS; i++)
+	{
+		interval->counts[i] = stats->all.counts[i] - r->base.counts[i];
+		if (interval->counts[i] > 0)
+		{
+			interval->max_us = hist_bucket_value(i);
+		}
+	}
+	interval->max_us = std::min(interval->max_us, stats->all.max_us);
+	long long elapsed_us = now - (r->next_us - r->interval_us);
+	out << std::fixed << std::setprecision(1) << "[" << (now - r->start_us) / 1e6 << " s] " << label
+		<< "Queries: " << done - r->last_done << ", Queries per second: " << std::setprecision(0)
+		<< (done - r->last_done) * 1e6 / elapsed_us << std::setprecision(3)
+		<< ", p50: " << hist_percentile(interval, 50) / 1000.0 << ", p99: " << hist_percentile(interval, 99) / 1000.0
+		<< ", p99.9: " << hist_percentile(interval, 99.9) / 1000.0 << " ms" << std::endl;
+	free(interval);
+	r->base = stats->all;
+	r->last_done = done;
+	r->next_us = now + r->interval_us;
+}
@@ -0,0 +1,108 @@
+// author: Marek Kozumplik, xkozum08
+#pragma once
+#include "dns.hpp"
+
+/*
+	Log-linear histogram of microseconds (like HdrHistogram): values below LAT_SUB_BUCKETS have their own
+	bucket, every higher power of two is split into LAT_SUB_BUCKETS / 2 buckets, so the error of a percentile
+	is below 1/64 (1.6 %) at any magnitude. Values above LAT_MAX_US are counted in the last bucket.
+*/
+#define LAT_SUB_BUCKETS 128
+#define LAT_MAX_US (1LL << 26) // 67 s
+#define LAT_BUCKETS (LAT_SUB_BUCKETS + 19 * (LAT_SUB_BUCKETS / 2))
+
+#define LAT_QTYPES 9 // A, NS, CNAME, SOA, PTR, MX, TXT, AAAA, other
+#define LAT_RCODES 7 // NOERROR, FORMERR, SERVFAIL, NXDOMAIN, NOTIMP, REFUSED, other
+
+struct latency_histogram
+{
+	uint32_t counts[LAT_BUCKETS];
+	unsigned long total;
+	long long sum_us;
+	long long max_us;
+};
+
+// latency of answered queries from their first transmission, split by qtype and rcode, and RTT of servers from -s
+struct latency_stats
+{
+	struct latency_histogram all;
+	struct latency_histogram *servers; // only answers to a single transmission (Karn), not retransmitted or hedged ones
+	int server_cnt;
+	struct latency_histogram qtypes[LAT_QTYPES];
+	struct latency_histogram rcodes[LAT_RCODES];
+	unsigned long kernel_samples; // RTTs measured with kernel receive timestamp
+};
+
+// periodic report of --stats=N
+struct latency_report
+{
+	long long interval_us; // 0 - no periodic report
+	long long start_us;
+	long long next_us;
+	unsigned long last_done;
+	struct latency_histogram base; // all at the last report, the report shows the difference
+};
+
+/// @brief adds the value to the histogram
+/// @param h
+/// @param us
+void hist_record(struct latency_histogram *h, long long us);
+
+/// @brief adds all values of src to dst
+/// @param dst
+/// @param src
+void hist_merge(struct latency_histogram *dst, const struct latency_histogram *src);
+
+/// @brief returns the value below which the percentile of the values is
+/// @param h
+/// @param percentile 0 to 100
+/// @return microseconds, 0 if the histogram is empty
+long long hist_percentile(const struct latency_histogram *h, double percentile);
+
+/// @brief allocates empty stats
+/// @param stats
+/// @param server_cnt number of servers with own histogram
+/// @return 0 on success, -1 if out of memory
+int latency_init(struct latency_stats *stats, int server_cnt);
+
+/// @brief frees the histograms of the servers
+/// @param stats
+void latency_free(struct latency_stats *stats);
+
+/// @brief records RTT of the answered query
+/// @param stats
+/// @param server index of the server which answered, -1 if the time is not its RTT (retransmitted or hedged query)
+/// @param qtype
+/// @param rcode
+/// @param us
+/// @param kernel 1 if the receive time is the kernel timestamp
+void latency_record(struct latency_stats *stats, int server, int qtype, int rcode, long long us, int kernel);
+
+/// @brief adds all histograms of src to dst, dst gets histograms of src servers it does not have yet
+/// @param dst
+/// @param src
+/// @return 0 on success, -1 if out of memory
+int latency_merge(struct latency_stats *dst, const struct latency_stats *src);
+
+/// @brief prints percentiles of all RTTs and of every server, qtype and rcode
+/// @param stats
+/// @param args server names
+/// @param queries finished queries (answered and failed)
+/// @param elapsed_us duration of the run, for qps
+/// @param out
+void print_latency(const struct latency_stats *stats, struct parsed_arguments *args, unsigned long queries,
+				   long long elapsed_us, std::ostream &out);
+
+/// @brief starts the periodic report
+/// @param r
+/// @param interval_s seconds, 0 - no periodic report
+void latency_report_init(struct latency_report *r, int interval_s);
+
+/// @brief prints qps and percentiles of the last interval when the interval has passed
+/// @param r
+/// @param stats
+/// @param done queries finished since the start
+/// @param label printed before the counters, for example thread number
+/// @param out
+void latency_report_tick(struct latency_report *r, const struct latency_stats *stats, unsigned long done,
+						 const char *label, std::ostream &out);
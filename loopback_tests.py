@@ -0,0 +1,80 @@
+#author: Marek Kozumplik, xkozum08
+# Tests without network: responder instances on loopback addresses serve the zones of tests/loopback, the root
+# (127.0.0.1), the TLD test (127.0.0.2) and example.test (127.0.0.3, also on 127.0.0.4 with every UDP answer
+# truncated), 127.0.0.5 answers every name. Run with make loopback_test
+import subprocess
+import re
+import sys
+
+test_folder = "tests/loopback/"
+port = "5390"
+servers = [["127.0.0.1", "root.zone", []],
+           ["127.0.0.2", "test.zone", []],
+           ["127.0.0.3", "example.zone", []],
+           ["127.0.0.4", "example.zone", ["-t", "100"]],
+           ["127.0.0.5", None, []]]
+test_names = ["referral1", "iter1", "iter2", "iter3", "iter4", "batch1", "types1", "types2", "cache1",
+              "sweep1", "tcp1", "tcp2", "edns1", "table1", "window1", "window2"]  # tests/loopback/<name>.in and <name>.out
+
+test_cases = []
+for name in test_names:
+    with open(test_folder+name+".in", 'r') as f:
+        input_data = f.read().strip()  # Read input from file
+
+    with open(test_folder+name+".out", 'r') as f:
+        expected_output = f.read().strip()  # Read expected output from file
+
+    test_cases.append({"input": input_data, "expected_output": expected_output})
+
+# table1 uses the table compiled from the hosts file
+subprocess.run(["./dnstable", "-o", test_folder+"hosts.tbl", test_folder+"hosts.txt"],
+               stderr=subprocess.DEVNULL, check=True)
+# window1 and window2 keep more queries in flight than one sendmmsg batch, every name must get one result
+with open(test_folder+"many.txt", 'w') as f:
+    for n in range(5000):
+        f.write("n"+str(n)+".example.test\n")
+
+running = []
+for address, zone, options in servers:
+    command = ["./responder", "-l", address+":"+port, "-j", "1"] + options
+    if zone is not None:
+        command += ["-z", test_folder+zone]
+    process = subprocess.Popen(command, stderr=subprocess.PIPE, text=True)
+    process.stderr.readline()  # "Responder on ..." when it listens
+    running.append(process)
+
+i = 0
+test_cnt = len(test_cases)
+for case in test_cases:
+    command = ["./dns"] + case["input"].split()  # Command to run your app with input arguments
+    process = subprocess.Popen(command, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+    try:
+        output, _ = process.communicate(timeout=10)
+    except subprocess.TimeoutExpired:
+        process.kill()
+        output, _ = process.communicate()
+        output += "\n<timeout>"
+
+    # Check if the output matches the expected output pattern
+    expected_output_re = re.compile(re.escape(case["expected_output"]))
+    output2 = re.sub(r'TTL: \d+,', 'TTL: <number>,', output) # Replace TTL
+    if expected_output_re.search(output2):
+        print(f"Test Passed: ./dns '{case['input']}'")
+        i += 1
+    else:
+        print(f"Test Failed: Input '{case['input']}'")
+        print()
+        print("Test output: ")
+        print(output2)
+        print()
+        print("Expected output: ")
+        print(case["expected_output"])
+        print()
+        print()
+
+for process in running:
+    process.terminate()
+    process.communicate()
+
+print(str(i)+"/"+str(test_cnt)+" tests passed")
+sys.exit(0 if i == test_cnt else 1)
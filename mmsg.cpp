@@ -0,0 +1,221 @@
+// author: Marek Kozumplik, xkozum08
+#include "mmsg.hpp"
+
+/// @brief allocates the slot arrays for the connected socket
+/// @param eng
+/// @param sock connected non-blocking UDP socket
+/// @param rx_slot_size max size of received datagram
+/// @return 0 on success, -1 if out of memory
+int dgram_init(struct dgram_engine *eng, int sock, int rx_slot_size)
+{
+	eng->sock = sock;
+	eng->tx_cnt = 0;
+	eng->rx_slot_size = rx_slot_size;
+	eng->syscalls = 0;
+	eng->sent = 0;
+	eng->received = 0;
+	eng->timestamps = 0;
+	eng->clock_offset_us = 0;
+	eng->tx_slots = (unsigned char *)malloc(DGRAM_BATCH * DGRAM_TX_SLOT);
+	eng->rx_slots = (unsigned char *)malloc(DGRAM_BATCH * rx_slot_size);
+	if (eng->tx_slots == NULL || eng->rx_slots == NULL)
+	{
+		free(eng->tx_slots);
+		free(eng->rx_slots);
+		return -1;
+	}
+
+	std::memset(eng->tx_msgs, 0, sizeof(eng->tx_msgs));
+	std::memset(eng->rx_msgs, 0, sizeof(eng->rx_msgs));
+	for (int i = 0; i < DGRAM_BATCH; i++)
+	{
+		eng->tx_iov[i].iov_base = &eng->tx_slots[i * DGRAM_TX_SLOT];
+		eng->tx_msgs[i].msg_hdr.msg_iov = &eng->tx_iov[i];
+		eng->tx_msgs[i].msg_hdr.msg_iovlen = 1;
+
+		eng->rx_iov[i].iov_base = &eng->rx_slots[i * rx_slot_size];
+		eng->rx_iov[i].iov_len = rx_slot_size;
+		eng->rx_msgs[i].msg_hdr.msg_iov = &eng->rx_iov[i];
+		eng->rx_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	return 0;
+}
+
+/// @brief frees the slot arrays, socket is not closed
+/// @param eng
+void dgram_free(struct dgram_engine *eng)
+{
+	free(eng->tx_slots);
+	free(eng->rx_slots);
+}
+
+/// @brief asks the kernel for software receive timestamps of the datagrams (SO_TIMESTAMPING, SO_TIMESTAMPNS
+/// on older kernels)
+/// @param eng
+/// @return 0 on success, -1 if the socket supports neither
+int dgram_enable_timestamps(struct dgram_engine *eng)
+{
+	int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+	int on = 1;
+	if (setsockopt(eng->sock, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0)
+	{
+		eng->timestamps = SO_TIMESTAMPING;
+	}
+	else if (setsockopt(eng->sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == 0)
+	{
+		eng->timestamps = SO_TIMESTAMPNS;
+	}
+	else
+	{
+		return -1;
+	}
+	for (int i = 0; i < DGRAM_BATCH; i++)
+	{
+		eng->rx_msgs[i].msg_hdr.msg_control = eng->rx_ctrl[i];
+	}
+	return 0;
+}
+
+/// @brief returns next free transmit slot of DGRAM_TX_SLOT bytes, flushes the queue when it is full
+/// @param eng
+/// @return pointer to the slot or NULL if the socket cannot take more datagrams now
+unsigned char *dgram_tx_slot(struct dgram_engine *eng)
+{
+	if (eng->tx_cnt == DGRAM_BATCH)
+	{
+		dgram_flush(eng);
+		if (eng->tx_cnt == DGRAM_BATCH)
+		{
+			return NULL;
+		}
+	}
+	return &eng->tx_slots[eng->tx_cnt * DGRAM_TX_SLOT];
+}
+
+/// @brief queues the datagram written to the slot returned by dgram_tx_slot
+/// @param eng
+/// @param len length of the datagram
+void dgram_tx_commit(struct dgram_engine *eng, int len)
+{
+	eng->tx_iov[eng->tx_cnt].iov_len = len;
+	eng->tx_cnt++;
+}
+
+/// @brief sends all queued datagrams with sendmmsg
+/// @param eng
+/// @return number of sent datagrams, -1 on socket error (queue is dropped)
+int dgram_flush(struct dgram_engine *eng)
+{
+	int total = 0;
+	while (total < eng->tx_cnt)
+	{
+		eng->syscalls++;
+		int sent = sendmmsg(eng->sock, &eng->tx_msgs[total], eng->tx_cnt - total, 0);
+		if (sent < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				break; // send buffer is full, rest stays queued for the next flush
+			}
+			perror("Error sending datagram");
+			eng->tx_cnt = 0;
+			return -1;
+		}
+		total += sent;
+	}
+	eng->sent += total;
+
+	// move datagrams that were not sent to the front of the queue
+	int left = eng->tx_cnt - total;
+	for (int i = 0; i < left; i++)
+	{
+		std::memcpy(&eng->tx_slots[i * DGRAM_TX_SLOT], &eng->tx_slots[(total + i) * DGRAM_TX_SLOT], eng->tx_iov[total + i].iov_len);
+		eng->tx_iov[i].iov_len = eng->tx_iov[total + i].iov_len;
+	}
+	eng->tx_cnt = left;
+	return total;
+}
+
+/// @brief receives up to DGRAM_BATCH datagrams with one recvmmsg into the receive ring
+/// @param eng
+/// @return number of received datagrams, 0 if there is nothing to read
+int dgram_receive(struct dgram_engine *eng)
+{
+	if (eng->timestamps)
+	{
+		// recvmmsg overwrites the lengths with the control data it wrote
+		for (int i = 0; i < DGRAM_BATCH; i++)
+		{
+			eng->rx_msgs[i].msg_hdr.msg_controllen = DGRAM_RX_CTRL;
+		}
+	}
+	while (true)
+	{
+		eng->syscalls++;
+		int cnt = recvmmsg(eng->sock, eng->rx_msgs, DGRAM_BATCH, MSG_DONTWAIT, NULL);
+		if (cnt < 0)
+		{
+			if (errno == EINTR || errno == ECONNREFUSED)
+			{
+				continue; // ICMP errors are reported on connected socket, queries time out
+			}
+			return 0;
+		}
+		eng->received += cnt;
+		if (eng->timestamps && cnt > 0)
+		{
+			struct timespec real, mono;
+			clock_gettime(CLOCK_REALTIME, &real);
+			clock_gettime(CLOCK_MONOTONIC, &mono);
+			eng->clock_offset_us = (real.tv_sec - mono.tv_sec) * 1000000LL + (real.tv_nsec - mono.tv_nsec) / 1000;
+		}
+		return cnt;
+	}
+}
+
+/// @brief returns i-th datagram received by the last dgram_receive
+/// @param eng
+/// @param i
+/// @param len length of the datagram, -1 if it did not fit into the slot
+/// @return pointer into the receive ring
+unsigned char *dgram_rx_msg(struct dgram_engine *eng, int i, int *len)
+{
+	*len = (eng->rx_msgs[i].msg_hdr.msg_flags & MSG_TRUNC) ? -1 : (int)eng->rx_msgs[i].msg_len;
+	return &eng->rx_slots[i * eng->rx_slot_size];
+}
+
+/// @brief returns the kernel receive time of the i-th datagram received by the last dgram_receive
+/// @param eng
+/// @param i
+/// @return monotonic time in microseconds (like now_us), 0 if the datagram has no timestamp
+long long dgram_rx_time(struct dgram_engine *eng, int i)
+{
+	if (!eng->timestamps)
+	{
+		return 0;
+	}
+	struct msghdr *hdr = &eng->rx_msgs[i].msg_hdr;
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(hdr, cmsg))
+	{
+		if (cmsg->cmsg_level != SOL_SOCKET)
+		{
+			continue;
+		}
+		// software timestamp is the first of the three of SO_TIMESTAMPING
+		if (cmsg->cmsg_type == SCM_TIMESTAMPING || cmsg->cmsg_type == SCM_TIMESTAMPNS)
+		{
+			struct timespec ts;
+			std::memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+			if (ts.tv_sec == 0 && ts.tv_nsec == 0)
+			{
+				return 0;
+			}
+			return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000 - eng->clock_offset_us;
+		}
+	}
+	return 0;
+}
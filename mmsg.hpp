@@ -0,0 +1,86 @@
+// author: Marek Kozumplik, xkozum08
+#pragma once
+#include "dns.hpp"
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+
+#define DGRAM_BATCH 64		// datagrams sent/received by one syscall
+#define DGRAM_TX_SLOT 512	// queries are small, slot size is the classic UDP limit
+#define DGRAM_RX_SLOT 4096	// default size of the receive slot
+#define DGRAM_RX_CTRL 128	// control data of one received datagram, holds the receive timestamp
+
+struct dgram_engine
+{
+	int sock;
+
+	// queued queries, slot i is at tx_slots[i * DGRAM_TX_SLOT]
+	unsigned char *tx_slots;
+	struct mmsghdr tx_msgs[DGRAM_BATCH];
+	struct iovec tx_iov[DGRAM_BATCH];
+	int tx_cnt;
+
+	// reusable ring of receive slots, refilled by every dgram_receive
+	unsigned char *rx_slots;
+	int rx_slot_size;
+	struct mmsghdr rx_msgs[DGRAM_BATCH];
+	struct iovec rx_iov[DGRAM_BATCH];
+
+	// kernel receive timestamps, wall clock of the kernel is shifted to CLOCK_MONOTONIC of now_us
+	int timestamps; // 0 - off, SO_TIMESTAMPING or SO_TIMESTAMPNS
+	alignas(struct cmsghdr) unsigned char rx_ctrl[DGRAM_BATCH][DGRAM_RX_CTRL];
+	long long clock_offset_us; // CLOCK_REALTIME - CLOCK_MONOTONIC at the last dgram_receive
+
+	unsigned long syscalls; // sendmmsg, recvmmsg and poll calls
+	unsigned long sent;
+	unsigned long received;
+};
+
+/// @brief allocates the slot arrays for the connected socket
+/// @param eng
+/// @param sock connected non-blocking UDP socket
+/// @param rx_slot_size max size of received datagram
+/// @return 0 on success, -1 if out of memory
+int dgram_init(struct dgram_engine *eng, int sock, int rx_slot_size);
+
+/// @brief frees the slot arrays, socket is not closed
+/// @param eng
+void dgram_free(struct dgram_engine *eng);
+
+/// @brief asks the kernel for software receive timestamps of the datagrams (SO_TIMESTAMPING, SO_TIMESTAMPNS
+/// on older kernels)
+/// @param eng
+/// @return 0 on success, -1 if the socket supports neither
+int dgram_enable_timestamps(struct dgram_engine *eng);
+
+/// @brief returns next free transmit slot of DGRAM_TX_SLOT bytes, flushes the queue when it is full
+/// @param eng
+/// @return pointer to the slot or NULL if the socket cannot take more datagrams now
+unsigned char *dgram_tx_slot(struct dgram_engine *eng);
+
+/// @brief queues the datagram written to the slot returned by dgram_tx_slot
+/// @param eng
+/// @param len length of the datagram
+void dgram_tx_commit(struct dgram_engine *eng, int len);
+
+/// @brief sends all queued datagrams with sendmmsg
+/// @param eng
+/// @return number of sent datagrams, -1 on socket error (queue is dropped)
+int dgram_flush(struct dgram_engine *eng);
+
+/// @brief receives up to DGRAM_BATCH datagrams with one recvmmsg into the receive ring
+/// @param eng
+/// @return number of received datagrams, 0 if there is nothing to read
+int dgram_receive(struct dgram_engine *eng);
+
+/// @brief returns i-th datagram received by the last dgram_receive
+/// @param eng
+/// @param i
+/// @param len length of the datagram, -1 if it did not fit into the slot
+/// @return pointer into the receive ring
+unsigned char *dgram_rx_msg(struct dgram_engine *eng, int i, int *len);
+
+/// @brief returns the kernel receive time of the i-th datagram received by the last dgram_receive
+/// @param eng
+/// @param i
+/// @return monotonic time in microseconds (like now_us), 0 if the datagram has no timestamp
+long long dgram_rx_time(struct dgram_engine *eng, int i);
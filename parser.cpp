@@ -0,0 +1,279 @@
+// author: Marek Kozumplik, xkozum08
+#include "parser.hpp"
+
+/// @brief checks the name at offset off. Compression pointers must point backwards, so they cannot loop
+/// @param msg
+/// @param msg_len
+/// @param off
+/// @return offset behind the name (behind the first pointer if compressed) or PARSE_BAD_NAME
+int skip_dns_name(const unsigned char *msg, int msg_len, int off)
+{
+	int end = -1;		// offset behind the name in its original place
+	int limit = off;	// pointer must point before the start of the current label sequence
+	int wire_len = 0; // length of the uncompressed name
+	while (off < msg_len)
+	{
+		unsigned char len = msg[off];
+		if (len == 0)
+		{
+			return (end < 0) ? off + 1 : end;
+		}
+		if ((len & 0xC0) == 0xC0)
+		{
+			if (off + 2 > msg_len)
+			{
+				return PARSE_BAD_NAME;
+			}
+			int target = ((len & 0x3F) << 8) | msg[off + 1];
+			if (target >= limit)
+			{
+				return PARSE_BAD_NAME;
+			}
+			if (end < 0)
+			{
+				end = off + 2;
+			}
+			off = limit = target;
+			continue;
+		}
+		if (len & 0xC0)
+		{
+			return PARSE_BAD_NAME; // reserved label types
+		}
+		wire_len += len + 1;
+		if (wire_len > 254)
+		{
+			return PARSE_BAD_NAME;
+		}
+		off += len + 1;
+	}
+	return PARSE_BAD_NAME;
+}
+
+/// @brief parses the message in one pass, see parse_dns_message
+/// @param msg
+/// @param msg_len
+/// @param view
+/// @return PARSE_OK or parse error
+static int parse_message(const unsigned char *msg, int msg_len, struct dns_message_view *view)
+{
+	view->msg = msg;
+	view->len = msg_len;
+	view->record_cnt = 0;
+	view->opt_index = -1;
+	if (msg_len < (int)sizeof(struct dns_header))
+	{
+		return PARSE_SHORT;
+	}
+
+	view->id = read_u16(&msg[0]);
+	view->qr = msg[2] >> 7;
+	view->opcode = (msg[2] >> 3) & 0x0F;
+	view->aa = (msg[2] >> 2) & 1;
+	view->tc = (msg[2] >> 1) & 1;
+	view->rd = msg[2] & 1;
+	view->ra = msg[3] >> 7;
+	view->rcode = msg[3] & 0x0F;
+	view->q_count = read_u16(&msg[4]);
+	view->ans_count = read_u16(&msg[6]);
+	view->auth_count = read_u16(&msg[8]);
+	view->add_count = read_u16(&msg[10]);
+	if (view->q_count != 1)
+	{
+		return PARSE_NO_QUESTION;
+	}
+
+	int off = sizeof(struct dns_header);
+	int end = skip_dns_name(msg, msg_len, off);
+	if (end < 0)
+	{
+		return end;
+	}
+	if (end + 4 > msg_len)
+	{
+		return PARSE_SHORT;
+	}
+	view->qname_off = off;
+	view->qname_len = end - off;
+	view->qtype = read_u16(&msg[end]);
+	view->qclass = read_u16(&msg[end + 2]);
+	off = end + 4;
+
+	int total = view->ans_count + view->auth_count + view->add_count;
+	if (total > MAX_PARSED_RECORDS)
+	{
+		return PARSE_TOO_MANY;
+	}
+	for (int i = 0; i < total; i++)
+	{
+		struct dns_record_view *record = &view->records[i];
+		record->name_off = off;
+		off = skip_dns_name(msg, msg_len, off);
+		if (off < 0)
+		{
+			return off;
+		}
+		if (off + 10 > msg_len)
+		{
+			return PARSE_SHORT;
+		}
+		record->type = read_u16(&msg[off]);
+		record->rclass = read_u16(&msg[off + 2]);
+		record->ttl = read_u32(&msg[off + 4]);
+		record->rdata_len = read_u16(&msg[off + 8]);
+		record->rdata_off = off + 10;
+		if (record->rdata_off + record->rdata_len > msg_len)
+		{
+			return PARSE_SHORT;
+		}
+		record->section = (i < view->ans_count) ? SECTION_ANSWER : (i < view->ans_count + view->auth_count) ? SECTION_AUTHORITY : SECTION_ADDITIONAL;
+		if (record->type == QTYPE_OPT)
+		{
+			// only one OPT with root name in additional section, class is the payload size and TTL the flags
+			if (view->opt_index >= 0 || record->section != SECTION_ADDITIONAL || msg[record->name_off] != 0)
+			{
+				return PARSE_BAD_OPT;
+			}
+			view->opt_index = i;
+			view->udp_size = record->rclass;
+			view->rcode |= (record->ttl >> 24) << 4;
+			view->edns_version = (record->ttl >> 16) & 0xFF;
+			view->edns_do = (record->ttl >> 15) & 1;
+		}
+		off = record->rdata_off + record->rdata_len;
+		view->record_cnt++;
+	}
+	return PARSE_OK;
+}
+
+/// @brief parses the message in one pass. Nothing is allocated or copied, all data stays in msg
+/// @param msg
+/// @param msg_len
+/// @param view
+/// @return PARSE_OK or parse error, it is also stored in view->parse_error
+int parse_dns_message(const unsigned char *msg, int msg_len, struct dns_message_view *view)
+{
+	view->parse_error = parse_message(msg, msg_len, view);
+	if (view->parse_error != PARSE_OK)
+	{
+		// the OPT record may be malformed, only the header rcode is known
+		view->rcode = (msg_len >= (int)sizeof(struct dns_header)) ? msg[3] & 0x0F : 0;
+	}
+	return view->parse_error;
+}
+
+/// @brief writes the name at offset off as text with dot at the end, for example "www.example.com."
+/// @param msg
+/// @param msg_len
+/// @param off
+/// @param text buffer of at least MAX_NAME_TEXT bytes
+/// @return length of the text or PARSE_BAD_NAME
+int dns_name_to_text(const unsigned char *msg, int msg_len, int off, char *text)
+{
+	int limit = off;
+	int pos = 0;
+	while (off < msg_len)
+	{
+		unsigned char len = msg[off];
+		if (len == 0)
+		{
+			if (pos == 0)
+			{
+				text[pos++] = '.'; // root
+			}
+			text[pos] = '\0';
+			return pos;
+		}
+		if ((len & 0xC0) == 0xC0)
+		{
+			if (off + 2 > msg_len)
+			{
+				return PARSE_BAD_NAME;
+			}
+			int target = ((len & 0x3F) << 8) | msg[off + 1];
+			if (target >= limit)
+			{
+				return PARSE_BAD_NAME;
+			}
+			off = limit = target;
+			continue;
+		}
+		if ((len & 0xC0) || off + 1 + len > msg_len || pos + len + 2 > MAX_NAME_TEXT)
+		{
+			return PARSE_BAD_NAME;
+		}
+		std::memcpy(&text[pos], &msg[off + 1], len);
+		pos += len;
+		text[pos++] = '.';
+		off += len + 1;
+	}
+	return PARSE_BAD_NAME;
+}
+
+/// @brief copies the name at offset off in uncompressed wire format with lower case letters
+/// @param msg
+/// @param msg_len
+/// @param off
+/// @param wire buffer of at least 255 bytes
+/// @return length of the name including the root label or PARSE_BAD_NAME
+int dns_name_to_wire(const unsigned char *msg, int msg_len, int off, unsigned char *wire)
+{
+	int limit = off;
+	int pos = 0;
+	while (off < msg_len)
+	{
+		unsigned char len = msg[off];
+		if (len == 0)
+		{
+			wire[pos++] = 0;
+			return pos;
+		}
+		if ((len & 0xC0) == 0xC0)
+		{
+			if (off + 2 > msg_len)
+			{
+				return PARSE_BAD_NAME;
+			}
+			int target = ((len & 0x3F) << 8) | msg[off + 1];
+			if (target >= limit)
+			{
+				return PARSE_BAD_NAME;
+			}
+			off = limit = target;
+			continue;
+		}
+		if ((len & 0xC0) || off + 1 + len > msg_len || pos + len + 2 > 255)
+		{
+			return PARSE_BAD_NAME;
+		}
+		wire[pos++] = len;
+		for (int i = 0; i < len; i++)
+		{
+			wire[pos++] = tolower(msg[off + 1 + i]);
+		}
+		off += len + 1;
+	}
+	return PARSE_BAD_NAME;
+}
+
+/// @brief returns description of the parse error
+/// @param error
+/// @return
+const char *parse_error_string(int error)
+{
+	switch (error)
+	{
+	case PARSE_SHORT:
+		return "Message is too short";
+	case PARSE_BAD_NAME:
+		return "Invalid domain name";
+	case PARSE_TOO_MANY:
+		return "Too many records";
+	case PARSE_NO_QUESTION:
+		return "Message does not contain one question";
+	case PARSE_BAD_OPT:
+		return "Invalid OPT record";
+	default:
+		return "OK";
+	}
+}
@@ -0,0 +1,116 @@
+// author: Marek Kozumplik, xkozum08
+#pragma once
+#include "dns.hpp"
+
+#define MAX_PARSED_RECORDS 1024
+#define MAX_NAME_TEXT 1024 // enough for 255 byte name with every byte printed
+
+#define SECTION_ANSWER 0
+#define SECTION_AUTHORITY 1
+#define SECTION_ADDITIONAL 2
+
+// parse errors
+#define PARSE_OK 0
+#define PARSE_SHORT -1		  // message ends in the middle of header, question or record
+#define PARSE_BAD_NAME -2	  // label or compression pointer is invalid
+#define PARSE_TOO_MANY -3	  // more than MAX_PARSED_RECORDS records
+#define PARSE_NO_QUESTION -4 // question count is not 1
+#define PARSE_BAD_OPT -5	  // more OPT records, OPT outside of additional section or with non-root name
+
+// one resource record, all offsets point into the parsed message
+struct dns_record_view
+{
+	uint16_t name_off; // owner name, may start with compression pointer
+	uint16_t type;
+	uint16_t rclass;
+	uint16_t rdata_len;
+	uint32_t ttl;
+	uint16_t rdata_off; // TTL is at rdata_off - 6
+	uint8_t section;	// SECTION_ANSWER, SECTION_AUTHORITY, SECTION_ADDITIONAL
+};
+
+// whole message, the view does not own or copy the message
+struct dns_message_view
+{
+	const unsigned char *msg;
+	int len;
+
+	uint16_t id;
+	uint8_t qr;
+	uint8_t opcode;
+	uint8_t aa;
+	uint8_t tc;
+	uint8_t rd;
+	uint8_t ra;
+	uint16_t rcode; // 12 bits, upper 8 bits are taken from the OPT record, only the header rcode if parse_error is set
+
+	uint16_t q_count;
+	uint16_t ans_count;
+	uint16_t auth_count;
+	uint16_t add_count;
+
+	uint16_t qname_off;	 // always sizeof(struct dns_header)
+	uint16_t qname_len;	 // length of the question name in wire format
+	uint16_t qtype;
+	uint16_t qclass;
+
+	int opt_index;		   // index of the OPT record in records, -1 if the message has none
+	uint16_t udp_size;	   // UDP payload size advertised by the sender of OPT
+	uint8_t edns_version;
+	uint8_t edns_do;	   // DNSSEC OK flag
+
+	int parse_error; // PARSE_OK or the parse error, on error only the header fields are valid
+	int record_cnt;	 // ans_count + auth_count + add_count
+	struct dns_record_view records[MAX_PARSED_RECORDS];
+};
+
+/// @brief reads big endian 16 bit number
+/// @param p
+/// @return
+static inline uint16_t read_u16(const unsigned char *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+/// @brief reads big endian 32 bit number
+/// @param p
+/// @return
+static inline uint32_t read_u32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/// @brief checks the name at offset off. Compression pointers must point backwards, so they cannot loop
+/// @param msg
+/// @param msg_len
+/// @param off
+/// @return offset behind the name (behind the first pointer if compressed) or PARSE_BAD_NAME
+int skip_dns_name(const unsigned char *msg, int msg_len, int off);
+
+/// @brief parses the message in one pass. Nothing is allocated or copied, all data stays in msg
+/// @param msg
+/// @param msg_len
+/// @param view
+/// @return PARSE_OK or parse error, it is also stored in view->parse_error
+int parse_dns_message(const unsigned char *msg, int msg_len, struct dns_message_view *view);
+
+/// @brief writes the name at offset off as text with dot at the end, for example "www.example.com."
+/// @param msg
+/// @param msg_len
+/// @param off
+/// @param text buffer of at least MAX_NAME_TEXT bytes
+/// @return length of the text or PARSE_BAD_NAME
+int dns_name_to_text(const unsigned char *msg, int msg_len, int off, char *text);
+
+/// @brief copies the name at offset off in uncompressed wire format with lower case letters
+/// @param msg
+/// @param msg_len
+/// @param off
+/// @param wire buffer of at least 255 bytes
+/// @return length of the name including the root label or PARSE_BAD_NAME
+int dns_name_to_wire(const unsigned char *msg, int msg_len, int off, unsigned char *wire);
+
+/// @brief returns description of the parse error
+/// @param error
+/// @return
+const char *parse_error_string(int error);
@@ -1,261 +1,1183 @@
 // author: Marek Kozumplik, xkozum08
 #include "printer.hpp"
 
-/// @brief returns true if name is compressed
+/// @brief parses name of the output format (text, jsonl, csv)
 /// @param name
-/// @return
-bool is_name_compressed(unsigned char *name)
+/// @return FORMAT_TEXT, FORMAT_JSONL, FORMAT_CSV or -1
+int parse_format(const char *name)
 {
-	return (name[0] == 0b11000000);
+	if (strcmp(name, "text") == 0)
+	{
+		return FORMAT_TEXT;
+	}
+	if (strcmp(name, "jsonl") == 0 || strcmp(name, "json") == 0)
+	{
+		return FORMAT_JSONL;
+	}
+	if (strcmp(name, "csv") == 0)
+	{
+		return FORMAT_CSV;
+	}
+	return -1;
 }
 
-/// @brief returns the offset of compressed name (14 last bits)
-/// @param name
-/// @return
-int get_compressed_offset(unsigned char *name)
+/// @brief allocates empty buffer
+/// @param out
+/// @param cap
+/// @param fd descriptor the buffer is flushed to, -1 if the owner takes the data
+/// @return 0 on success, -1 if out of memory
+int output_init(struct output_buffer *out, size_t cap, int fd)
+{
+	out->data = (char *)malloc(cap);
+	out->len = 0;
+	out->cap = cap;
+	out->fd = fd;
+	out->error = 0;
+	return (out->data == NULL) ? -1 : 0;
+}
+
+/// @brief frees the buffer, the data are not flushed
+/// @param out
+void output_free(struct output_buffer *out)
+{
+	free(out->data);
+	out->data = NULL;
+	out->len = 0;
+	out->cap = 0;
+}
+
+/// @brief writes the buffered data to the descriptor of the buffer
+/// @param out
+/// @return 0 on success, -1 on write error (the data are dropped)
+int output_flush(struct output_buffer *out)
+{
+	size_t done = 0;
+	while (done < out->len)
+	{
+		ssize_t written = write(out->fd, out->data + done, out->len - done);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			out->len = 0;
+			return -1;
+		}
+		done += written;
+	}
+	out->len = 0;
+	return 0;
+}
+
+/// @brief makes room for n more bytes, full buffer is flushed or grows
+/// @param out
+/// @param n
+/// @return pointer to the end of the data, NULL if out of memory (out->error is set)
+static char *output_room(struct output_buffer *out, size_t n)
 {
-	return ((name[0] & 0x3F) << 8) + name[1];
-	// last 6 bits of first byte and all of second byte
+	if (out->len + n > out->cap && out->fd >= 0)
+	{
+		output_flush(out);
+	}
+	if (out->len + n > out->cap)
+	{
+		size_t cap = std::max(out->cap * 2, out->len + n);
+		char *data = (char *)realloc(out->data, cap);
+		if (data == NULL)
+		{
+			out->error = 1;
+			return NULL;
+		}
+		out->data = data;
+		out->cap = cap;
+	}
+	return out->data + out->len;
+}
+
+/// @brief appends n bytes
+/// @param out
+/// @param text
+/// @param n
+static void out_write(struct output_buffer *out, const char *text, size_t n)
+{
+	char *p = output_room(out, n);
+	if (p == NULL)
+	{
+		return;
+	}
+	std::memcpy(p, text, n);
+	out->len += n;
+}
+
+/// @brief appends null terminated string
+/// @param out
+/// @param text
+static void out_str(struct output_buffer *out, const char *text)
+{
+	out_write(out, text, strlen(text));
 }
 
-/// @brief Prints domain at the pointer
-/// @param buf_pointer
-void print_domain(unsigned char buf[65536], unsigned char *buf_pointer)
+/// @brief appends one character
+/// @param out
+/// @param c
+static void out_char(struct output_buffer *out, char c)
 {
-	if (is_name_compressed(buf_pointer))
+	char *p = output_room(out, 1);
+	if (p == NULL)
 	{
-		buf_pointer = &buf[get_compressed_offset(buf_pointer)];
-		print_domain(buf, buf_pointer);
 		return;
 	}
-	int i = 1;
-	int letters = buf_pointer[0];
-	while (buf_pointer[i] != '\0')
+	*p = c;
+	out->len++;
+}
+
+/// @brief appends decimal number
+/// @param out
+/// @param value
+static void out_uint(struct output_buffer *out, unsigned long value)
+{
+	char *p = output_room(out, 20);
+	if (p == NULL)
 	{
-		if (is_name_compressed(&buf_pointer[i]))
+		return;
+	}
+	out->len += std::to_chars(p, p + 20, value).ptr - p;
+}
+
+/// @brief appends the ip4 address at the pointer
+/// @param out
+/// @param addr
+static void out_ip4(struct output_buffer *out, const unsigned char *addr)
+{
+	char *start = output_room(out, 15);
+	if (start == NULL)
+	{
+		return;
+	}
+	char *p = start;
+	for (int i = 0; i < 4; i++)
+	{
+		unsigned byte = addr[i];
+		if (byte >= 100)
 		{
-			buf_pointer = &buf[get_compressed_offset(&buf_pointer[i])];
-			print_domain(buf, &buf_pointer[i]);
-			return;
+			*p++ = '0' + byte / 100;
 		}
-		if (letters == 0)
+		if (byte >= 10)
 		{
-			std::cout << '.';
-			letters = buf_pointer[i];
+			*p++ = '0' + byte / 10 % 10;
 		}
-		else
+		*p++ = '0' + byte % 10;
+		if (i < 3)
 		{
-			std::cout << buf_pointer[i];
-			letters--;
+			*p++ = '.';
 		}
-		i++;
 	}
-	std::cout << '.';
+	out->len += p - start;
 }
 
-/// @brief prints the ip6 address at the pointer
-/// @param buf_pointer
-void print_ip6(unsigned char *buf_pointer)
+/// @brief appends the ip6 address at the pointer, all 8 groups with leading zeros
+/// @param out
+/// @param addr
+static void out_ip6(struct output_buffer *out, const unsigned char *addr)
 {
-	// ipv6 TODO
-	for (int i = 0; i < 16; i += 2)
+	static const char hex[] = "0123456789abcdef";
+	char *p = output_room(out, 39);
+	if (p == NULL)
 	{
-		std::cout << std::setw(2) << std::setfill('0') << std::hex << static_cast<int>(buf_pointer[i]);
-		std::cout << std::setw(2) << std::setfill('0') << std::hex << static_cast<int>(buf_pointer[i + 1]);
-
-		if (i < 14)
+		return;
+	}
+	for (int i = 0; i < 16; i++)
+	{
+		*p++ = hex[addr[i] >> 4];
+		*p++ = hex[addr[i] & 15];
+		if (i % 2 == 1 && i < 15)
 		{
-			std::cout << ":";
+			*p++ = ':';
 		}
 	}
+	out->len += 39;
 }
 
-/// @brief prints the ip4 address at the pointer
-/// @param buf_pointer
-void print_ip4(unsigned char *buf_pointer)
+/// @brief appends domain at the offset of the parsed message
+/// @param out
+/// @param view
+/// @param off
+/// @return 0 on success, -1 if the name is malformed (nothing is appended)
+static int out_domain(struct output_buffer *out, const struct dns_message_view *view, int off)
 {
-	std::cout << std::dec << (int)buf_pointer[0] << ".";
-	std::cout << std::dec << (int)buf_pointer[1] << ".";
-	std::cout << std::dec << (int)buf_pointer[2] << ".";
-	std::cout << std::dec << (int)buf_pointer[3];
+	char text[MAX_NAME_TEXT];
+	int len = dns_name_to_text(view->msg, view->len, off, text);
+	if (len < 0)
+	{
+		return -1;
+	}
+	out_write(out, text, len);
+	return 0;
+}
+
+/// @brief appends name of the type, TYPEnnn for unknown types
+/// @param out
+/// @param type
+static void out_type_name(struct output_buffer *out, int type)
+{
+	switch (type)
+	{
+	case QTYPE_A:
+		out_str(out, "A");
+		break;
+	case QTYPE_NS:
+		out_str(out, "NS");
+		break;
+	case QTYPE_CNAME:
+		out_str(out, "CNAME");
+		break;
+	case QTYPE_SOA:
+		out_str(out, "SOA");
+		break;
+	case QTYPE_PTR:
+		out_str(out, "PTR");
+		break;
+	case QTYPE_MX:
+		out_str(out, "MX");
+		break;
+	case QTYPE_TXT:
+		out_str(out, "TXT");
+		break;
+	case QTYPE_AAAA:
+		out_str(out, "AAAA");
+		break;
+	case QTYPE_OPT:
+		out_str(out, "OPT");
+		break;
+	default:
+		out_str(out, "TYPE");
+		out_uint(out, type);
+		break;
+	}
+}
+
+/// @brief appends name of the rcode, RCODEnnn for unknown ones
+/// @param out
+/// @param rcode
+static void out_rcode_name(struct output_buffer *out, int rcode)
+{
+	static const char *names[] = {"NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED"};
+	if (rcode < 6)
+	{
+		out_str(out, names[rcode]);
+	}
+	else if (rcode == 16)
+	{
+		out_str(out, "BADVERS");
+	}
+	else
+	{
+		out_str(out, "RCODE");
+		out_uint(out, rcode);
+	}
 }
 
 /// @brief prints answer error codes before exiting
 /// @param rcode
-void print_rcode(int rcode)
+/// @param out stream the output is written to
+void print_rcode(int rcode, std::ostream &out)
 {
 	switch (rcode)
 	{
 	case 1:
-		std::cerr << "Error: Format error (1)" << std::endl;
+		out << "Error: Format error (1)" << std::endl;
 		break;
 	case 2:
-		std::cerr << "Error: Server failure (2)" << std::endl;
+		out << "Error: Server failure (2)" << std::endl;
 		break;
 	case 3:
-		std::cerr << "Error: Name error (3)" << std::endl;
+		out << "Error: Name error (3)" << std::endl;
 		break;
 	case 5:
-		std::cerr << "Error: Refused (5)" << std::endl;
+		out << "Error: Refused (5)" << std::endl;
+		break;
+	case 16:
+		out << "Error: Bad OPT version (16)" << std::endl;
 		break;
 	default:
-		std::cerr << "Error          : " << rcode << std::endl;
+		out << "Error          : " << rcode << std::endl;
 		break;
 	}
 }
 
-/// @brief prints type of answer/question
+/// @brief appends type of answer/question in the text layout, other types than A, AAAA, CNAME, NS, PTR,
+/// SOA, MX and TXT are not printed
+/// @param out
 /// @param type
-void print_type(int type)
+static void text_type(struct output_buffer *out, int type)
 {
 	switch (type)
 	{
 	case 1:
-		std::cout << ", Type: A";
+		out_str(out, ", Type: A");
 		break;
 	case 28:
-		std::cout << ", Type: AAAA";
+		out_str(out, ", Type: AAAA");
 		break;
 	case 5:
-		std::cout << ", Type: CNAME";
+		out_str(out, ", Type: CNAME");
 		break;
 	case 2:
-		std::cout << ", Type:NS";
+		out_str(out, ", Type:NS");
 		break;
 	case 12:
-		std::cout << ", Type: PTR";
+		out_str(out, ", Type: PTR");
 		break;
 	case 6:
-		std::cout << ", Type: SOA";
+		out_str(out, ", Type: SOA");
+		break;
+	case 15:
+		out_str(out, ", Type: MX");
+		break;
+	case 16:
+		out_str(out, ", Type: TXT");
 		break;
 	default:
 		break;
 	}
 }
 
-/// @brief prints the question section. Always only once because we can only ask 1 question
-/// @param buf
-/// @param offset
-/// @param args
-void print_question_section(unsigned char buf[65536], int *offset, struct parsed_arguments *args)
+// formats record data of JSON Lines and CSV, defined below
+static void out_rdata(struct output_buffer *out, const struct dns_message_view *view, const struct dns_record_view *record);
+
+/// @brief appends the i-th answer/authority/additional record in the text layout
+/// @param out
+/// @param view parsed answer
+/// @param i i-th record
+static void text_record(struct output_buffer *out, const struct dns_message_view *view, int i)
 {
-	std::cout << std::endl
-			  << "  ";
-	unsigned char *name_pointer = &buf[sizeof(struct dns_header)]; // Only 1 question is allowed
-	*offset = (strlen((const char *)name_pointer)) + 1;			   // \0 -> +1
+	out_str(out, "\n  ");
+	const struct dns_record_view *record = &view->records[i];
 
-	struct dns_question *question = (struct dns_question *)&buf[sizeof(struct dns_header) + *offset];
+	out_domain(out, view, record->name_off);
+	if (record->type == QTYPE_OPT)
+	{
+		// pseudo-record, class and TTL fields carry EDNS0 data
+		out_str(out, ", Type: OPT, UDP payload size: ");
+		out_uint(out, view->udp_size);
+		out_str(out, ", EDNS version: ");
+		out_uint(out, view->edns_version);
+		out_str(out, ", DO: ");
+		out_str(out, (view->edns_do) ? "Yes" : "No");
+		out_str(out, ", Extended RCODE: ");
+		out_uint(out, view->rcode);
+		return;
+	}
+	text_type(out, record->type);
+
+	out_str(out, ", ");
+	switch (record->rclass)
+	{
+	case 1:
+		out_str(out, "Class: IN");
+		break;
+	default:
+		std::cerr << "Class not supported";
+		break;
+	}
 
-	print_domain(buf, name_pointer);
-	print_type(ntohs(question->q_type));
+	out_str(out, ", TTL: ");
+	out_uint(out, record->ttl);
+	out_str(out, ", Data length: ");
+	out_uint(out, record->rdata_len);
 
-	std::cout << ", Class: ";
-	std::cout << (ntohs(question->q_class) ? "IN" : "Error");
+	out_str(out, ", ");
+	const unsigned char *rdata = &view->msg[record->rdata_off];
+	switch (record->type)
+	{
+	case 1:
+		if (record->rdata_len == 4)
+		{
+			out_ip4(out, rdata);
+		}
+		break;
+	case 28:
+		if (record->rdata_len == 16)
+		{
+			out_ip6(out, rdata);
+		}
+		break;
+	case 15:
+	case 16:
+		// preference and exchange, strings
+		out_rdata(out, view, record);
+		break;
+	default:
+		out_domain(out, view, record->rdata_off);
+		break;
+	}
 }
 
-/// @brief Prints the i-th answer/authority/additional section
-/// @param buf buffer with answer
-/// @param offset current offset (sum of data_len of previous sectoins)
-/// @param args
-/// @param i i-th section
-void print_answer_section(unsigned char buf[65536], int *offset, struct parsed_arguments *args, int i)
+/// @brief follows compression pointers to the labels of the name
+/// @param view
+/// @param off
+/// @return offset of the length byte, -1 if the name is malformed
+static int name_labels(const struct dns_message_view *view, int off)
 {
-	std::cout << std::endl
-			  << "  ";
-	unsigned char *buf_pointer = &buf[sizeof(struct dns_header) + sizeof(struct dns_answer) * i + sizeof(struct dns_question) + *offset];
-
-	struct dns_answer *answer = NULL;
-
-	if (is_name_compressed(buf_pointer))
+	for (int jumps = 0; off < view->len; jumps++)
 	{
-		answer = (struct dns_answer *)(buf_pointer + 2);
-		//*offset += 2;
-		buf_pointer = &buf[get_compressed_offset(buf_pointer)];
+		if ((view->msg[off] & 0xC0) != 0xC0)
+		{
+			return off;
+		}
+		if (off + 1 >= view->len || jumps == 64)
+		{
+			return -1;
+		}
+		off = ((view->msg[off] & 0x3F) << 8) | view->msg[off + 1];
 	}
-	else
+	return -1;
+}
+
+/// @brief compares names of two messages in wire format, case insensitive, compression is followed
+/// @param a
+/// @param a_off
+/// @param b
+/// @param b_off
+/// @return true if the names are equal, false if they differ or are malformed
+static bool names_equal(const struct dns_message_view *a, int a_off, const struct dns_message_view *b, int b_off)
+{
+	// a name has at most 128 labels
+	for (int labels = 0; labels < 128; labels++)
 	{
-		int name_len = strlen((const char *)buf_pointer) + 1;
-		answer = (struct dns_answer *)buf_pointer + name_len;
-		*offset += name_len;
+		a_off = name_labels(a, a_off);
+		b_off = name_labels(b, b_off);
+		if (a_off < 0 || b_off < 0)
+		{
+			return false;
+		}
+		int len = a->msg[a_off];
+		if (len != b->msg[b_off] || len > 63 || a_off + len >= a->len || b_off + len >= b->len)
+		{
+			return false;
+		}
+		if (len == 0)
+		{
+			return true;
+		}
+		for (int i = 1; i <= len; i++)
+		{
+			if (tolower(a->msg[a_off + i]) != tolower(b->msg[b_off + i]))
+			{
+				return false;
+			}
+		}
+		a_off += len + 1;
+		b_off += len + 1;
 	}
+	return false;
+}
 
-	print_domain(buf, buf_pointer);
-	print_type(ntohs(answer->type));
+// defined below
+static int name_end(const unsigned char *msg, int msg_len, int off);
 
-	std::cout << ", ";
-	switch (ntohs(answer->_class))
+/// @brief compares data of two records of the same type, names in the data are compared like owner names
+/// @param a
+/// @param ra
+/// @param b
+/// @param rb
+/// @return
+static bool rdata_equal(const struct dns_message_view *a, const struct dns_record_view *ra, const struct dns_message_view *b,
+						const struct dns_record_view *rb)
+{
+	int prefix = 0; // fixed bytes before the names
+	int names = 0;
+	switch (ra->type)
 	{
-	case 1:
-		std::cout << "Class: IN";
+	case QTYPE_NS:
+	case QTYPE_CNAME:
+	case QTYPE_PTR:
+		names = 1;
 		break;
-	default:
-		std::cerr << "Class not supported";
+	case QTYPE_MX:
+		prefix = 2;
+		names = 1;
 		break;
+	case QTYPE_SOA:
+		names = 2;
+		break;
+	}
+	if (names == 0 || ra->rdata_len < prefix || rb->rdata_len < prefix)
+	{
+		return ra->rdata_len == rb->rdata_len && std::memcmp(&a->msg[ra->rdata_off], &b->msg[rb->rdata_off], ra->rdata_len) == 0;
+	}
+	if (std::memcmp(&a->msg[ra->rdata_off], &b->msg[rb->rdata_off], prefix) != 0)
+	{
+		return false;
 	}
+	int a_off = ra->rdata_off + prefix;
+	int b_off = rb->rdata_off + prefix;
+	for (int n = 0; n < names; n++)
+	{
+		if (!names_equal(a, a_off, b, b_off))
+		{
+			return false;
+		}
+		a_off = name_end(a->msg, a->len, a_off);
+		b_off = name_end(b->msg, b->len, b_off);
+		if (a_off < 0 || b_off < 0)
+		{
+			return false;
+		}
+	}
+	// serial and timers of SOA
+	int a_rest = ra->rdata_off + ra->rdata_len - a_off;
+	int b_rest = rb->rdata_off + rb->rdata_len - b_off;
+	return a_rest == b_rest && a_rest >= 0 && std::memcmp(&a->msg[a_off], &b->msg[b_off], a_rest) == 0;
+}
 
-	std::cout << ", TTL: " << std::dec << ntohl(answer->ttl) << ", Data length: " << ntohs(answer->data_len);
+/// @brief checks if the record of the k-th answer is left out of the merged result, the OPT record is kept
+/// only from the first answer and records already in the section of an earlier answer (CNAME of the name,
+/// SOA of the zone) are not repeated. Records are compared in wire format, nothing is formatted or allocated
+/// @param views
+/// @param k
+/// @param i
+/// @return
+static bool merged_duplicate(const struct dns_message_view *const *views, int k, int i)
+{
+	const struct dns_message_view *view = views[k];
+	if (k == 0)
+	{
+		return false;
+	}
+	if (i == view->opt_index)
+	{
+		return true;
+	}
+	const struct dns_record_view *record = &view->records[i];
+	for (int j = 0; j < k; j++)
+	{
+		for (int r = 0; r < views[j]->record_cnt; r++)
+		{
+			const struct dns_record_view *candidate = &views[j]->records[r];
+			if (candidate->section == record->section && candidate->type == record->type &&
+				candidate->rclass == record->rclass && names_equal(views[j], candidate->name_off, view, record->name_off) &&
+				rdata_equal(views[j], candidate, view, record))
+			{
+				return true;
+			}
+		}
+	}
+	return false;
+}
 
-	// move ahead of the dns header and the query field
-	buf_pointer = &buf[sizeof(struct dns_header) + *offset + sizeof(struct dns_question) + sizeof(struct dns_answer) * (i + 1)];
-	*offset += ntohs(answer->data_len);
+/// @brief appends header flags, the questions and all sections from Answer to Additional in the text layout.
+/// Answers of several types of one name are merged without duplicate records
+/// @param out
+/// @param views
+/// @param view_cnt
+static void format_text(struct output_buffer *out, const struct dns_message_view *const *views, int view_cnt)
+{
+	bool aa = true;
+	bool tc = false;
+	int counts[3] = {0, 0, 0};
+	for (int k = 0; k < view_cnt; k++)
+	{
+		aa = aa && views[k]->aa;
+		tc = tc || views[k]->tc;
+		for (int i = 0; i < views[k]->record_cnt; i++)
+		{
+			counts[views[k]->records[i].section] += merged_duplicate(views, k, i) ? 0 : 1;
+		}
+	}
+	out_str(out, "Authoritative: ");
+	out_str(out, (aa) ? "Yes" : "No");
+	out_str(out, ", Recursive: ");
+	out_str(out, (views[0]->rd) ? "Yes" : "No");
+	out_str(out, ", Truncated: ");
+	out_str(out, (tc) ? "Yes" : "No");
 
-	std::cout << ", ";
-	switch (ntohs(answer->type))
+	// one question per query, every query asks only 1 question
+	int q_count = 0;
+	for (int k = 0; k < view_cnt; k++)
 	{
-	case 1:
-		print_ip4(buf_pointer);
+		q_count += views[k]->q_count;
+	}
+	out_str(out, "\nQuestion section (");
+	out_uint(out, q_count);
+	out_char(out, ')');
+	for (int k = 0; k < view_cnt; k++)
+	{
+		out_str(out, "\n  ");
+		out_domain(out, views[k], views[k]->qname_off);
+		text_type(out, views[k]->qtype);
+		out_str(out, ", Class: ");
+		out_str(out, (views[k]->qclass) ? "IN" : "Error");
+	}
+
+	static const char *sections[] = {"\nAnswer section (", "\nAuthority section (", "\nAdditional section ("};
+	for (int section = 0; section < 3; section++)
+	{
+		out_str(out, sections[section]);
+		out_uint(out, counts[section]);
+		out_char(out, ')');
+		for (int k = 0; k < view_cnt; k++)
+		{
+			const struct dns_message_view *view = views[k];
+			int ends[] = {view->ans_count, view->ans_count + view->auth_count, view->record_cnt};
+			for (int i = (section > 0) ? ends[section - 1] : 0; i < ends[section]; i++)
+			{
+				if (!merged_duplicate(views, k, i))
+				{
+					text_record(out, view, i);
+				}
+			}
+		}
+	}
+	out_char(out, '\n');
+}
+
+/// @brief returns offset behind the name in wire format
+/// @param msg
+/// @param msg_len
+/// @param off
+/// @return offset, -1 if the name does not end in the message
+static int name_end(const unsigned char *msg, int msg_len, int off)
+{
+	while (off < msg_len)
+	{
+		if (msg[off] == 0)
+		{
+			return off + 1;
+		}
+		if ((msg[off] & 0xC0) == 0xC0)
+		{
+			return off + 2;
+		}
+		off += msg[off] + 1;
+	}
+	return -1;
+}
+
+/// @brief appends data of the record in presentation format, unknown types and malformed data
+/// as RFC 3597 hex (\# length hex)
+/// @param out
+/// @param view
+/// @param record
+static void out_rdata(struct output_buffer *out, const struct dns_message_view *view, const struct dns_record_view *record)
+{
+	const unsigned char *rdata = &view->msg[record->rdata_off];
+	int len = record->rdata_len;
+	int end = record->rdata_off + len;
+	switch (record->type)
+	{
+	case QTYPE_A:
+		if (len == 4)
+		{
+			out_ip4(out, rdata);
+			return;
+		}
 		break;
-	case 28:
-		print_ip6(buf_pointer);
+	case QTYPE_AAAA:
+		if (len == 16)
+		{
+			out_ip6(out, rdata);
+			return;
+		}
+		break;
+	case QTYPE_NS:
+	case QTYPE_CNAME:
+	case QTYPE_PTR:
+		if (out_domain(out, view, record->rdata_off) == 0)
+		{
+			return;
+		}
+		break;
+	case QTYPE_MX:
+		if (len > 2)
+		{
+			size_t start = out->len;
+			out_uint(out, read_u16(rdata));
+			out_char(out, ' ');
+			if (out_domain(out, view, record->rdata_off + 2) == 0)
+			{
+				return;
+			}
+			out->len = start;
+		}
+		break;
+	case QTYPE_SOA:
+	{
+		int rname = name_end(view->msg, end, record->rdata_off);
+		int numbers = (rname < 0) ? -1 : name_end(view->msg, end, rname);
+		if (numbers >= 0 && numbers + 20 <= end)
+		{
+			size_t start = out->len;
+			int error = out_domain(out, view, record->rdata_off);
+			out_char(out, ' ');
+			if (error == 0 && out_domain(out, view, rname) == 0)
+			{
+				// serial, refresh, retry, expire, minimum
+				for (int i = 0; i < 5; i++)
+				{
+					out_char(out, ' ');
+					out_uint(out, read_u32(&view->msg[numbers + 4 * i]));
+				}
+				return;
+			}
+			out->len = start;
+		}
 		break;
+	}
+	case QTYPE_TXT:
+	{
+		int off = 0;
+		while (off < len && off + 1 + rdata[off] <= len)
+		{
+			off += 1 + rdata[off];
+		}
+		if (off != len)
+		{
+			break;
+		}
+		// character strings in quotes, separated by space
+		for (off = 0; off < len; off += 1 + rdata[off])
+		{
+			if (off > 0)
+			{
+				out_char(out, ' ');
+			}
+			out_char(out, '"');
+			for (int i = 1; i <= rdata[off]; i++)
+			{
+				if (rdata[off + i] == '"' || rdata[off + i] == '\\')
+				{
+					out_char(out, '\\');
+				}
+				out_char(out, rdata[off + i]);
+			}
+			out_char(out, '"');
+		}
+		return;
+	}
+	case QTYPE_OPT:
+		out_str(out, "udp_size=");
+		out_uint(out, view->udp_size);
+		out_str(out, " version=");
+		out_uint(out, view->edns_version);
+		out_str(out, " do=");
+		out_uint(out, view->edns_do);
+		return;
 	default:
-		print_domain(buf, buf_pointer);
 		break;
 	}
+	static const char hex[] = "0123456789abcdef";
+	out_str(out, "\\# ");
+	out_uint(out, len);
+	if (len > 0)
+	{
+		out_char(out, ' ');
+	}
+	char *p = output_room(out, 2 * len);
+	if (p == NULL)
+	{
+		return;
+	}
+	for (int i = 0; i < len; i++)
+	{
+		*p++ = hex[rdata[i] >> 4];
+		*p++ = hex[rdata[i] & 15];
+	}
+	out->len += 2 * len;
+}
+
+/// @brief appends the text as JSON string
+/// @param out
+/// @param text
+/// @param n
+static void json_string(struct output_buffer *out, const char *text, size_t n)
+{
+	static const char hex[] = "0123456789abcdef";
+	out_char(out, '"');
+	for (size_t i = 0; i < n; i++)
+	{
+		unsigned char c = text[i];
+		if (c == '"' || c == '\\')
+		{
+			out_char(out, '\\');
+			out_char(out, c);
+		}
+		else if (c < 0x20 || c >= 0x7F)
+		{
+			// names are not UTF-8, other bytes are escaped as code points of the same value
+			char *p = output_room(out, 6);
+			if (p == NULL)
+			{
+				return;
+			}
+			std::memcpy(p, "\\u00", 4);
+			p[4] = hex[c >> 4];
+			p[5] = hex[c & 15];
+			out->len += 6;
+		}
+		else
+		{
+			out_char(out, c);
+		}
+	}
+	out_char(out, '"');
 }
 
-/// @brief Prints all sections from Answer to Additional
-/// @param buf
+/// @brief appends the text as CSV field, it is quoted when it contains comma, quote or line break
+/// @param out
+/// @param text
+/// @param n
+static void csv_field(struct output_buffer *out, const char *text, size_t n)
+{
+	bool quote = false;
+	for (size_t i = 0; i < n && !quote; i++)
+	{
+		quote = text[i] == ',' || text[i] == '"' || text[i] == '\n' || text[i] == '\r';
+	}
+	if (!quote)
+	{
+		out_write(out, text, n);
+		return;
+	}
+	out_char(out, '"');
+	for (size_t i = 0; i < n; i++)
+	{
+		if (text[i] == '"')
+		{
+			out_char(out, '"');
+		}
+		out_char(out, text[i]);
+	}
+	out_char(out, '"');
+}
+
+// buffer of one thread, freed when the thread exits
+struct scratch_holder
+{
+	struct output_buffer buf = {NULL, 0, 0, -1, 0};
+	~scratch_holder() { output_free(&buf); }
+};
+
+/// @brief empty scratch buffer of the thread, text of names and record data is formatted into it before escaping
+/// @param out buffer the scratch text is appended to, its error is set if the scratch cannot be allocated
+/// @return scratch buffer or NULL if out of memory
+static struct output_buffer *scratch_buffer(struct output_buffer *out)
+{
+	static thread_local struct scratch_holder scratch;
+	if (scratch.buf.data == NULL && output_init(&scratch.buf, 4096, -1) < 0)
+	{
+		out->error = 1;
+		return NULL;
+	}
+	scratch.buf.len = 0;
+	scratch.buf.error = 0;
+	return &scratch.buf;
+}
+
+/// @brief appends the scratch text in the format of the output, JSON string or CSV field
+/// @param out
 /// @param args
-void print_all_sections(unsigned char buf[65536], struct parsed_arguments *args)
+/// @param scratch
+static void out_escaped(struct output_buffer *out, struct parsed_arguments *args, struct output_buffer *scratch)
 {
-	struct dns_header *dns = (struct dns_header *)buf;
-	std::cout << "Authoritative: " << ((dns->aa) ? "Yes" : "No");
-	std::cout << ", Recursive: " << ((dns->rd) ? "Yes" : "No");
-	std::cout << ", Truncated: " << ((dns->tc) ? "Yes" : "No") << std::endl;
+	if (scratch->error)
+	{
+		// the text is incomplete
+		out->error = 1;
+		return;
+	}
+	if (args->format == FORMAT_JSONL)
+	{
+		json_string(out, scratch->data, scratch->len);
+	}
+	else
+	{
+		csv_field(out, scratch->data, scratch->len);
+	}
+}
 
-	int add_cnt = ntohs(dns->add_count);
-	int q_cnt = ntohs(dns->q_count);
-	int ans_cnt = ntohs(dns->ans_count);
-	int aut_cnt = ntohs(dns->auth_count);
-	int i = 0;
-	int offset = 0;
+/// @brief appends query, qtype and status columns shared by all rows and objects of the query
+/// @param out
+/// @param args
+/// @param req
+/// @param view parsed answer, NULL if the query failed
+/// @param status used when view is NULL
+static void out_query(struct output_buffer *out, struct parsed_arguments *args, const struct dns_query_request *req,
+					  const struct dns_message_view *view, const char *status)
+{
+	struct output_buffer *scratch = scratch_buffer(out);
+	if (scratch == NULL)
+	{
+		return;
+	}
+	out_str(scratch, req->name);
+	if (args->format == FORMAT_JSONL)
+	{
+		out_str(out, "{\"query\":");
+		out_escaped(out, args, scratch);
+		out_str(out, ",\"qtype\":\"");
+	}
+	else
+	{
+		out_escaped(out, args, scratch);
+		out_char(out, ',');
+	}
+	out_type_name(out, req->reverse ? QTYPE_PTR : req->qtype);
+	out_str(out, (args->format == FORMAT_JSONL) ? "\",\"status\":\"" : ",");
+	if (view != NULL)
+	{
+		out_rcode_name(out, view->rcode);
+	}
+	else
+	{
+		out_str(out, status);
+	}
+	if (args->format == FORMAT_JSONL)
+	{
+		out_char(out, '"');
+	}
+}
 
-	std::cout << "Question section (" << q_cnt << ")";
-	print_question_section(buf, &offset, args);
+/// @brief appends one record as JSON object or as CSV row (with the query columns)
+/// @param out
+/// @param view
+/// @param args
+/// @param req
+/// @param i
+static void out_record(struct output_buffer *out, const struct dns_message_view *view, struct parsed_arguments *args,
+					   const struct dns_query_request *req, int i)
+{
+	static const char *sections[] = {"answer", "authority", "additional"};
+	const struct dns_record_view *record = &view->records[i];
+	bool json = args->format == FORMAT_JSONL;
+	if (json)
+	{
+		out_str(out, "{\"name\":");
+	}
+	else
+	{
+		out_query(out, args, req, view, NULL);
+		out_char(out, ',');
+		out_str(out, sections[record->section]);
+		out_char(out, ',');
+	}
+	struct output_buffer *scratch = scratch_buffer(out);
+	if (scratch == NULL)
+	{
+		return;
+	}
+	out_domain(scratch, view, record->name_off);
+	out_escaped(out, args, scratch);
+
+	out_str(out, json ? ",\"type\":\"" : ",");
+	out_type_name(out, record->type);
+	out_str(out, json ? "\",\"class\":\"" : ",");
+	if (record->type == QTYPE_OPT)
+	{
+		out_str(out, json ? "\",\"ttl\":0" : ",0");
+	}
+	else
+	{
+		if (record->rclass == QCLASS_IN)
+		{
+			out_str(out, "IN");
+		}
+		else
+		{
+			out_str(out, "CLASS");
+			out_uint(out, record->rclass);
+		}
+		out_str(out, json ? "\",\"ttl\":" : ",");
+		out_uint(out, record->ttl);
+	}
+	out_str(out, json ? ",\"data\":" : ",");
+	scratch = scratch_buffer(out);
+	out_rdata(scratch, view, record);
+	out_escaped(out, args, scratch);
+	out_str(out, json ? "}" : "\n");
+}
 
-	std::cout << std::endl
-			  << "Answer section (" << ans_cnt << ")";
-	while (i < ans_cnt)
+/// @brief writes CSV header, nothing for the other formats
+/// @param out
+/// @param args
+/// @return 0 on success, -1 if out of memory
+int format_header(struct output_buffer *out, struct parsed_arguments *args)
+{
+	out->error = 0;
+	if (args->format == FORMAT_CSV)
 	{
-		print_answer_section(buf, &offset, args, i);
-		i++;
+		out_str(out, CSV_HEADER);
 	}
+	return out->error ? -1 : 0;
+}
 
-	std::cout << std::endl
-			  << "Authority section (" << aut_cnt << ")";
-	while (i < ans_cnt + aut_cnt)
+/// @brief formats the parsed answer in args->format. Text has header flags and all sections, JSON Lines
+/// and CSV have also the query and the rcode (text is used only for rcode 0)
+/// @param out
+/// @param view parsed answer
+/// @param args
+/// @param req the query
+/// @return 0 on success, -1 if out of memory (the result may be incomplete)
+int format_answer(struct output_buffer *out, const struct dns_message_view *view, struct parsed_arguments *args,
+				  const struct dns_query_request *req)
+{
+	out->error = 0;
+	if (args->format == FORMAT_TEXT)
+	{
+		format_text(out, &view, 1);
+		return out->error ? -1 : 0;
+	}
+	if (args->format == FORMAT_CSV)
+	{
+		for (int i = 0; i < view->record_cnt; i++)
+		{
+			out_record(out, view, args, req, i);
+		}
+		if (view->record_cnt == 0)
+		{
+			// the query has its row also without records, for example NODATA
+			out_query(out, args, req, view, NULL);
+			out_str(out, ",,,,,,\n");
+		}
+		return out->error ? -1 : 0;
+	}
+	out_query(out, args, req, view, NULL);
+	out_str(out, ",\"aa\":");
+	out_str(out, view->aa ? "true" : "false");
+	out_str(out, ",\"tc\":");
+	out_str(out, view->tc ? "true" : "false");
+	out_str(out, ",\"rd\":");
+	out_str(out, view->rd ? "true" : "false");
+	out_str(out, ",\"ra\":");
+	out_str(out, view->ra ? "true" : "false");
+	static const char *sections[] = {",\"answer\":[", "],\"authority\":[", "],\"additional\":["};
+	int i = 0;
+	int ends[] = {view->ans_count, view->ans_count + view->auth_count, view->record_cnt};
+	for (int section = 0; section < 3; section++)
 	{
-		print_answer_section(buf, &offset, args, i);
-		i++;
+		out_str(out, sections[section]);
+		for (int first = i; i < ends[section]; i++)
+		{
+			if (i > first)
+			{
+				out_char(out, ',');
+			}
+			out_record(out, view, args, req, i);
+		}
 	}
+	out_str(out, "]}\n");
+	return out->error ? -1 : 0;
+}
 
-	std::cout << std::endl
-			  << "Additional section (" << add_cnt << ")";
-	while (i < ans_cnt + aut_cnt + add_cnt)
+/// @brief formats answers of several types of one name as one result. Text merges the sections, JSON Lines
+/// has one object with all types in qtype and the first error rcode in status, CSV has the rows of every answer
+/// @param out
+/// @param views parsed answers in the order of the types
+/// @param view_cnt
+/// @param args
+/// @param req the query, its type is not used
+/// @return 0 on success, -1 if out of memory (the result may be incomplete)
+int format_merged(struct output_buffer *out, const struct dns_message_view *const *views, int view_cnt,
+				  struct parsed_arguments *args, const struct dns_query_request *req)
+{
+	out->error = 0;
+	if (args->format == FORMAT_TEXT)
 	{
-		print_answer_section(buf, &offset, args, i);
-		i++;
+		format_text(out, views, view_cnt);
+		return out->error ? -1 : 0;
 	}
-	std::cout << std::endl;
-}
\ No newline at end of file
+	if (args->format == FORMAT_CSV || view_cnt == 1)
+	{
+		int result = 0;
+		for (int k = 0; k < view_cnt; k++)
+		{
+			// the qtype column tells the rows apart
+			struct dns_query_request typed = *req;
+			typed.qtype = views[k]->qtype;
+			typed.reverse = 0;
+			if (format_answer(out, views[k], args, &typed) < 0)
+			{
+				result = -1;
+			}
+		}
+		return result;
+	}
+	struct output_buffer *scratch = scratch_buffer(out);
+	if (scratch == NULL)
+	{
+		return -1;
+	}
+	out_str(scratch, req->name);
+	out_str(out, "{\"query\":");
+	out_escaped(out, args, scratch);
+	out_str(out, ",\"qtype\":\"");
+	const struct dns_message_view *status = views[0];
+	bool aa = true;
+	bool tc = false;
+	for (int k = 0; k < view_cnt; k++)
+	{
+		if (k > 0)
+		{
+			out_char(out, ',');
+		}
+		out_type_name(out, views[k]->qtype);
+		if (status->rcode == 0 && views[k]->rcode != 0)
+		{
+			status = views[k];
+		}
+		aa = aa && views[k]->aa;
+		tc = tc || views[k]->tc;
+	}
+	out_str(out, "\",\"status\":\"");
+	out_rcode_name(out, status->rcode);
+	out_str(out, "\",\"aa\":");
+	out_str(out, aa ? "true" : "false");
+	out_str(out, ",\"tc\":");
+	out_str(out, tc ? "true" : "false");
+	out_str(out, ",\"rd\":");
+	out_str(out, views[0]->rd ? "true" : "false");
+	out_str(out, ",\"ra\":");
+	out_str(out, views[0]->ra ? "true" : "false");
+	static const char *sections[] = {",\"answer\":[", "],\"authority\":[", "],\"additional\":["};
+	for (int section = 0; section < 3; section++)
+	{
+		out_str(out, sections[section]);
+		bool first = true;
+		for (int k = 0; k < view_cnt; k++)
+		{
+			const struct dns_message_view *view = views[k];
+			int ends[] = {view->ans_count, view->ans_count + view->auth_count, view->record_cnt};
+			for (int i = (section > 0) ? ends[section - 1] : 0; i < ends[section]; i++)
+			{
+				if (merged_duplicate(views, k, i))
+				{
+					continue;
+				}
+				if (!first)
+				{
+					out_char(out, ',');
+				}
+				first = false;
+				out_record(out, view, args, req, i);
+			}
+		}
+	}
+	out_str(out, "]}\n");
+	return out->error ? -1 : 0;
+}
+
+/// @brief formats JSON Lines or CSV record of the query which got no usable answer
+/// @param out
+/// @param args
+/// @param req the query
+/// @param status TIMEOUT, MALFORMED, ...
+/// @return 0 on success, -1 if out of memory (the result may be incomplete)
+int format_failure(struct output_buffer *out, struct parsed_arguments *args, const struct dns_query_request *req,
+				   const char *status)
+{
+	out->error = 0;
+	out_query(out, args, req, NULL, status);
+	out_str(out, (args->format == FORMAT_JSONL) ? "}\n" : ",,,,,,\n");
+	return out->error ? -1 : 0;
+}
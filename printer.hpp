@@ -1,41 +1,86 @@
 // author: Marek Kozumplik, xkozum08
 #pragma once
 #include "dns.hpp"
+#include "parser.hpp"
+#include "resolver.hpp"
+#include <charconv>
 
-/// @brief Prints domain at the pointer
-/// @param buf_pointer
-void print_domain(unsigned char buf[65536], unsigned char *buf_pointer);
+// --format of the results
+#define FORMAT_TEXT 0  // sections like the single query
+#define FORMAT_JSONL 1 // one JSON object per query
+#define FORMAT_CSV 2   // one row per record
 
-/// @brief prints the ip6 address at the pointer
-/// @param buf_pointer
-void print_ip6(unsigned char *buf_pointer);
+#define OUTPUT_BUFFER_SIZE (1 << 20) // results are written to stdout in blocks of this size
+#define CSV_HEADER "query,qtype,status,section,name,type,class,ttl,data\n"
 
-/// @brief prints the ip4 address at the pointer
-/// @param buf_pointer
-void print_ip4(unsigned char *buf_pointer);
+// formatted results, full buffer is written to fd. With fd -1 the buffer grows and its owner takes the data
+struct output_buffer
+{
+	char *data;
+	size_t len;
+	size_t cap;
+	int fd;
+	int error; // 1 - the buffer could not grow while formatting, the last result is incomplete
+};
+
+/// @brief parses name of the output format (text, jsonl, csv)
+/// @param name
+/// @return FORMAT_TEXT, FORMAT_JSONL, FORMAT_CSV or -1
+int parse_format(const char *name);
+
+/// @brief allocates empty buffer
+/// @param out
+/// @param cap
+/// @param fd descriptor the buffer is flushed to, -1 if the owner takes the data
+/// @return 0 on success, -1 if out of memory
+int output_init(struct output_buffer *out, size_t cap, int fd);
+
+/// @brief frees the buffer, the data are not flushed
+/// @param out
+void output_free(struct output_buffer *out);
+
+/// @brief writes the buffered data to the descriptor of the buffer
+/// @param out
+/// @return 0 on success, -1 on write error (the data are dropped)
+int output_flush(struct output_buffer *out);
 
 /// @brief prints answer error codes before exiting
 /// @param rcode
-void print_rcode(int rcode);
+/// @param out stream the output is written to
+void print_rcode(int rcode, std::ostream &out = std::cerr);
 
-/// @brief prints type of answer/question
-/// @param type
-void print_type(int type);
+/// @brief writes CSV header, nothing for the other formats
+/// @param out
+/// @param args
+/// @return 0 on success, -1 if out of memory
+int format_header(struct output_buffer *out, struct parsed_arguments *args);
 
-/// @brief prints the question section. Always only once because we can only ask 1 question
-/// @param buf
-/// @param offset
+/// @brief formats the parsed answer in args->format. Text has header flags and all sections, JSON Lines
+/// and CSV have also the query and the rcode (text is used only for rcode 0)
+/// @param out
+/// @param view parsed answer
 /// @param args
-void print_question_section(unsigned char buf[65536], int *offset, struct parsed_arguments *args);
+/// @param req the query
+/// @return 0 on success, -1 if out of memory (the result may be incomplete)
+int format_answer(struct output_buffer *out, const struct dns_message_view *view, struct parsed_arguments *args,
+				  const struct dns_query_request *req);
 
-/// @brief Prints the i-th answer/authority/additional section
-/// @param buf buffer with answer
-/// @param offset current offset (sum of data_len of previous sectoins)
+/// @brief formats answers of several types of one name as one result. Text merges the sections, JSON Lines
+/// has one object with all types in qtype and the first error rcode in status, CSV has the rows of every answer
+/// @param out
+/// @param views parsed answers in the order of the types
+/// @param view_cnt
 /// @param args
-/// @param i i-th section
-void print_answer_section(unsigned char buf[65536], int *offset, struct parsed_arguments *args, int i);
+/// @param req the query, its type is not used
+/// @return 0 on success, -1 if out of memory (the result may be incomplete)
+int format_merged(struct output_buffer *out, const struct dns_message_view *const *views, int view_cnt,
+				  struct parsed_arguments *args, const struct dns_query_request *req);
 
-/// @brief Prints all sections from Answer to Additional
-/// @param buf
+/// @brief formats JSON Lines or CSV record of the query which got no usable answer
+/// @param out
 /// @param args
-void print_all_sections(unsigned char buf[65536], struct parsed_arguments *args);
+/// @param req the query
+/// @param status TIMEOUT, MALFORMED, ...
+/// @return 0 on success, -1 if out of memory (the result may be incomplete)
+int format_failure(struct output_buffer *out, struct parsed_arguments *args, const struct dns_query_request *req,
+				   const char *status);
@@ -0,0 +1,1357 @@
+// author: Marek Kozumplik, xkozum08
+#include "resolver.hpp"
+#include "iterative.hpp"
+
+/// @brief returns monotonic time in milliseconds
+/// @return
+long long now_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/// @brief returns monotonic time in microseconds
+/// @return
+long long now_us()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/// @brief fills the socket address of the server
+/// @param addr
+/// @param server IPv4 or IPv6 address
+/// @param address_type TYPE_IP4 or TYPE_IP6
+/// @param port
+/// @return length of the address
+socklen_t fill_server_address(struct sockaddr_storage *addr, const char *server, int address_type, int port)
+{
+	std::memset(addr, 0, sizeof(*addr));
+	if (address_type == TYPE_IP4)
+	{
+		struct sockaddr_in *dest = (struct sockaddr_in *)addr;
+		dest->sin_family = AF_INET;
+		dest->sin_port = htons(port);
+		dest->sin_addr.s_addr = inet_addr(server);
+		return sizeof(struct sockaddr_in);
+	}
+	struct sockaddr_in6 *dest = (struct sockaddr_in6 *)addr;
+	dest->sin6_family = AF_INET6;
+	dest->sin6_port = htons(port);
+	inet_pton(AF_INET6, server, &dest->sin6_addr);
+	return sizeof(struct sockaddr_in6);
+}
+
+/// @brief creates connected non-blocking socket for the upstream
+/// @param up
+/// @param rx_slot_size max size of received datagram
+/// @param timestamps 1 - datagrams get kernel receive timestamps
+/// @return 0 on success, -1 on error
+static int upstream_open(struct upstream *up, int rx_slot_size, int timestamps)
+{
+	up->sock = socket(up->addr.ss_family, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_UDP);
+	if (up->sock < 0)
+	{
+		perror("Error creating socket");
+		return -1;
+	}
+	// connected socket, kernel drops datagrams from other sources
+	if (connect(up->sock, (struct sockaddr *)&up->addr, up->addr_len) < 0)
+	{
+		perror("Error connecting socket");
+		close(up->sock);
+		return -1;
+	}
+	// bursts of responses must not overflow the default receive buffer
+	int rcvbuf = 4 * 1024 * 1024;
+	setsockopt(up->sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	if (dgram_init(&up->io, up->sock, rx_slot_size) < 0)
+	{
+		std::cerr << "Error: Out of memory" << std::endl;
+		close(up->sock);
+		return -1;
+	}
+	if (timestamps)
+	{
+		dgram_enable_timestamps(&up->io); // without them the time of reading is used
+	}
+	stream_init(&up->tcp);
+	up->tcp_events = 0;
+	up->udp_token.up = up;
+	up->udp_token.transport = TRANSPORT_UDP;
+	up->tcp_token.up = up;
+	up->tcp_token.transport = TRANSPORT_TCP;
+	up->queries = 0;
+	up->answered = 0;
+	up->timeouts = 0;
+	up->retransmits = 0;
+	up->tcp_queries = 0;
+	up->truncated = 0;
+	up->srtt_us = 0;
+	up->rttvar_us = 0;
+	up->rto_ms = RTO_INITIAL_MS;
+	up->fails = 0;
+	up->backoffs = 0;
+	up->down_until_ms = 0;
+	up->rtt_sample_cnt = 0;
+	up->hedge_ms = 0;
+	up->pending = 0;
+	up->last_used_ms = 0;
+	return 0;
+}
+
+/// @brief closes sockets of the first cnt upstreams and frees the upstream array
+/// @param res
+/// @param cnt
+static void close_upstreams(struct resolver *res, int cnt)
+{
+	for (int i = 0; i < cnt; i++)
+	{
+		dgram_free(&res->servers[i].io);
+		stream_free(&res->servers[i].tcp);
+		if (res->servers[i].sock >= 0)
+		{
+			close(res->servers[i].sock);
+		}
+	}
+	free(res->servers);
+	res->servers = NULL;
+}
+
+/// @brief creates non-blocking UDP socket for every server from args and allocates the in-flight table.
+/// TCP connections are opened when they are needed
+/// @param res
+/// @param args
+/// @param callback
+/// @param ctx
+/// @return 0 on success, -1 on error
+int resolver_init(struct resolver *res, struct parsed_arguments *args, query_callback callback, void *ctx)
+{
+	// tokens in the event loop point to the upstreams, so the array is allocated once
+	res->server_cap = args->iterative ? ITERATIVE_MAX_SERVERS : args->server_cnt;
+	res->servers = (struct upstream *)calloc(res->server_cap, sizeof(struct upstream));
+	if (res->servers == NULL)
+	{
+		std::cerr << "Error: Out of memory" << std::endl;
+		return -1;
+	}
+	if (loop_init(&res->loop, args->backend) < 0)
+	{
+		free(res->servers);
+		return -1;
+	}
+	res->server_cnt = 0;
+	res->next_server = 0;
+	res->picks = 0;
+	res->draining = NULL;
+	// with EDNS0 the server may send datagrams up to the advertised size, never larger
+	res->rx_slot_size = (args->edns > 0) ? args->edns : DGRAM_RX_SLOT;
+	for (int i = 0; i < args->server_cnt; i++)
+	{
+		struct upstream *up = &res->servers[i];
+		up->addr_len = fill_server_address(&up->addr, args->servers[i], args->server_types[i], args->port);
+		if (upstream_open(up, res->rx_slot_size, args->stats) < 0)
+		{
+			close_upstreams(res, i);
+			loop_free(&res->loop);
+			return -1;
+		}
+		res->server_cnt++;
+		loop_add(&res->loop, up->sock, &up->udp_token);
+	}
+
+	res->recursion = args->recursion;
+	res->tcp = args->tcp;
+	res->edns = args->edns;
+	res->hedge = (res->server_cnt > 1) ? args->hedge : 0; // one server cannot be hedged
+	res->window = args->window;
+	// every name in iterative mode may wait for lookups of its name server addresses. Slots are limited by
+	// the transaction ids, iterative_init makes one task per slot, so the tasks never run out of slots
+	res->slot_cnt = args->iterative ? std::min(res->window * (ITER_MAX_DEPTH + 1), MAX_SLOTS) : res->window;
+	res->slots = (struct inflight_query *)calloc(res->slot_cnt, sizeof(struct inflight_query));
+	res->free_slots = (int *)malloc(res->slot_cnt * sizeof(int));
+	// buckets are at least twice the slots, so the chains stay short
+	res->name_mask = 1;
+	while (res->name_mask < 2 * (unsigned)res->slot_cnt)
+	{
+		res->name_mask <<= 1;
+	}
+	res->name_buckets = (int *)malloc(res->name_mask * sizeof(int));
+	res->name_mask--;
+	res->waiters = (struct coalesced_request *)malloc(res->window * sizeof(struct coalesced_request));
+	res->free_waiters = (int *)malloc(res->window * sizeof(int));
+	res->view = (struct dns_message_view *)malloc(sizeof(struct dns_message_view));
+	if (res->slots == NULL || res->free_slots == NULL || res->name_buckets == NULL || res->waiters == NULL ||
+		res->free_waiters == NULL || res->view == NULL || timer_init(&res->timers) < 0)
+	{
+		std::cerr << "Error: Out of memory" << std::endl;
+		free(res->slots);
+		free(res->free_slots);
+		free(res->name_buckets);
+		free(res->waiters);
+		free(res->free_waiters);
+		free(res->view);
+		close_upstreams(res, res->server_cnt);
+		loop_free(&res->loop);
+		return -1;
+	}
+	res->free_cnt = 0;
+	for (int i = res->slot_cnt - 1; i >= 0; i--)
+	{
+		res->free_slots[res->free_cnt++] = i;
+	}
+	for (int i = 0; i < 65536; i++)
+	{
+		res->id_to_slot[i] = -1;
+	}
+	for (unsigned i = 0; i <= res->name_mask; i++)
+	{
+		res->name_buckets[i] = -1;
+	}
+	res->free_waiter_cnt = 0;
+	for (int i = res->window - 1; i >= 0; i--)
+	{
+		res->free_waiters[res->free_waiter_cnt++] = i;
+	}
+	res->next_id = (unsigned short)(getpid() ^ now_ms());
+	res->callback = callback;
+	res->ctx = ctx;
+	res->cache = NULL;
+	res->cache_result = NULL;
+	res->cache_view = NULL;
+	res->table = NULL;
+	res->table_result = NULL;
+	res->table_view = NULL;
+	res->table_hits = 0;
+	res->timeouts = 0;
+	res->retransmits = 0;
+	res->submitted = 0;
+	res->coalesced = 0;
+	res->hedged = 0;
+	res->hedge_wins = 0;
+	std::memset(res->rcodes, 0, sizeof(res->rcodes));
+	res->iter = NULL;
+	res->capture.fd = -1;
+	res->latency = NULL;
+	if (args->stats)
+	{
+		// servers of iterative mode are not the ones from args, they get no histogram of their own
+		res->latency = (struct latency_stats *)malloc(sizeof(struct latency_stats));
+		if (res->latency == NULL || latency_init(res->latency, args->iterative ? 0 : res->server_cnt) < 0)
+		{
+			std::cerr << "Error: Out of memory" << std::endl;
+			free(res->latency);
+			res->latency = NULL;
+			resolver_free(res);
+			return -1;
+		}
+	}
+	if (args->table[0] != '\0')
+	{
+		// every resolver maps the file, the pages are shared
+		res->table = (struct dns_table *)malloc(sizeof(struct dns_table));
+		res->table_result = (unsigned char *)malloc(TABLE_MAX_ANSWER);
+		res->table_view = (struct dns_message_view *)malloc(sizeof(struct dns_message_view));
+		if (res->table == NULL || res->table_result == NULL || res->table_view == NULL || table_open(res->table, args->table) < 0)
+		{
+			free(res->table);
+			res->table = NULL;
+			resolver_free(res);
+			return -1;
+		}
+	}
+	if (args->record[0] != '\0' && capture_open(&res->capture, args->record) < 0)
+	{
+		res->capture.fd = -1;
+		resolver_free(res);
+		return -1;
+	}
+	if (args->iterative && iterative_init(res, args) < 0)
+	{
+		resolver_free(res);
+		return -1;
+	}
+	return 0;
+}
+
+/// @brief frees the resolver, queries in flight are dropped without callback
+/// @param res
+void resolver_free(struct resolver *res)
+{
+	iterative_free(res);
+	close_upstreams(res, res->server_cnt);
+	loop_free(&res->loop);
+	timer_free(&res->timers);
+	free(res->slots);
+	free(res->free_slots);
+	free(res->name_buckets);
+	free(res->waiters);
+	free(res->free_waiters);
+	free(res->view);
+	free(res->cache_result);
+	free(res->cache_view);
+	if (res->table != NULL)
+	{
+		table_close(res->table);
+		free(res->table);
+	}
+	free(res->table_result);
+	free(res->table_view);
+	if (res->capture.fd >= 0)
+	{
+		capture_close(&res->capture);
+	}
+	if (res->latency != NULL)
+	{
+		latency_free(res->latency);
+		free(res->latency);
+	}
+}
+
+/// @brief returns number of requests waiting for response, coalesced ones included
+/// @param res
+/// @return
+int resolver_inflight(struct resolver *res)
+{
+	if (res->iter != NULL)
+	{
+		return iterative_inflight(res);
+	}
+	return res->slot_cnt - res->free_cnt + res->window - res->free_waiter_cnt;
+}
+
+/// @brief returns unused transaction id. Odd step walks through all 65536 ids before repeating one, there are at
+/// most MAX_SLOTS queries in flight, so a free one is always found
+/// @param res
+/// @return id in network byte order
+static unsigned short allocate_id(struct resolver *res)
+{
+	do
+	{
+		res->next_id += 40503;
+	} while (res->id_to_slot[res->next_id] != -1);
+	return htons(res->next_id);
+}
+
+/// @brief returns the slot back to the free stack
+/// @param res
+/// @param slot
+static void release_slot(struct resolver *res, int slot)
+{
+	if (res->slots[slot].pinned)
+	{
+		res->servers[res->slots[slot].server].pending--;
+	}
+	res->id_to_slot[ntohs(res->slots[slot].id)] = -1;
+	res->slots[slot].used = 0;
+	res->free_slots[res->free_cnt++] = slot;
+}
+
+/// @brief finds coalescing query in flight with the same question as the encoded query
+/// @param res
+/// @param q encoded query
+/// @param hash hash of its question
+/// @return slot of the query, -1 if there is none
+static int find_same_question(struct resolver *res, struct inflight_query *q, uint32_t hash)
+{
+	for (int slot = res->name_buckets[hash & res->name_mask]; slot != -1; slot = res->slots[slot].name_next)
+	{
+		struct inflight_query *other = &res->slots[slot];
+		if (other->name_hash == hash && other->question_len == q->question_len &&
+			std::memcmp(&other->query[sizeof(struct dns_header)], &q->query[sizeof(struct dns_header)],
+						q->question_len - sizeof(struct dns_header)) == 0)
+		{
+			return slot;
+		}
+	}
+	return -1;
+}
+
+/// @brief calls the callback of the query and of all requests coalesced with it, then releases the slot
+/// @param res
+/// @param slot
+/// @param status
+/// @param msg
+/// @param msg_len
+/// @param view parsed msg, NULL without response
+/// @return number of finished requests
+static int finish_query(struct resolver *res, int slot, int status, unsigned char *msg, int msg_len,
+						const struct dns_message_view *view)
+{
+	struct inflight_query *q = &res->slots[slot];
+	if (q->coalescing)
+	{
+		// requests submitted by the callbacks start a new query
+		int *link = &res->name_buckets[q->name_hash & res->name_mask];
+		while (*link != slot)
+		{
+			link = &res->slots[*link].name_next;
+		}
+		*link = q->name_next;
+		q->coalescing = 0;
+	}
+	q->callback(q->ctx, &q->req, status, msg, msg_len, view);
+	int finished = 1;
+	int waiter = q->waiters;
+	while (waiter != -1)
+	{
+		struct dns_query_request req = res->waiters[waiter].req;
+		int next = res->waiters[waiter].next;
+		res->free_waiters[res->free_waiter_cnt++] = waiter;
+		q->callback(q->ctx, &req, status, msg, msg_len, view);
+		finished++;
+		waiter = next;
+	}
+	q->waiters = -1;
+	release_slot(res, slot);
+	return finished;
+}
+
+/// @brief compares servers for the next query: healthy before skipped, not tried by the query before tried,
+/// then lower smoothed RTT
+/// @param a
+/// @param a_tried
+/// @param b
+/// @param b_tried
+/// @param now
+/// @return true if a should be used rather than b
+static bool server_better(struct upstream *a, bool a_tried, struct upstream *b, bool b_tried, long long now)
+{
+	bool a_up = a->down_until_ms <= now;
+	bool b_up = b->down_until_ms <= now;
+	if (a_up != b_up)
+	{
+		return a_up;
+	}
+	if (!a_up)
+	{
+		return a->down_until_ms < b->down_until_ms; // all are skipped, the one that comes back first
+	}
+	if (a_tried != b_tried)
+	{
+		return b_tried;
+	}
+	return a->srtt_us < b->srtt_us; // server without RTT sample (0) is tried first
+}
+
+/// @brief selects the fastest healthy server, every SERVER_PROBE_INTERVAL-th query goes round robin
+/// @param res
+/// @param now
+/// @param tried mask of servers the query was already sent to, others are preferred
+/// @return index of the server
+static int pick_server(struct resolver *res, long long now, unsigned long long tried)
+{
+	if (res->server_cnt == 1)
+	{
+		return 0;
+	}
+	if (++res->picks % SERVER_PROBE_INTERVAL == 0)
+	{
+		for (int k = 0; k < res->server_cnt; k++)
+		{
+			int i = res->next_server;
+			res->next_server = (i + 1) % res->server_cnt;
+			if (res->servers[i].down_until_ms <= now)
+			{
+				return i;
+			}
+		}
+	}
+	int best = 0;
+	for (int i = 1; i < res->server_cnt; i++)
+	{
+		if (server_better(&res->servers[i], tried & (1ULL << i), &res->servers[best], tried & (1ULL << best), now))
+		{
+			best = i;
+		}
+	}
+	return best;
+}
+
+/// @brief updates smoothed RTT, its variance and the retransmission timeout of the server (RFC 6298)
+/// @param up
+/// @param rtt_us
+static void update_rtt(struct upstream *up, long long rtt_us)
+{
+	rtt_us = std::max(rtt_us, 1LL);
+	if (up->srtt_us == 0)
+	{
+		up->srtt_us = rtt_us;
+		up->rttvar_us = rtt_us / 2;
+	}
+	else
+	{
+		up->rttvar_us = (3 * up->rttvar_us + std::llabs(up->srtt_us - rtt_us)) / 4;
+		up->srtt_us = (7 * up->srtt_us + rtt_us) / 8;
+	}
+	long long rto_ms = (up->srtt_us + 4 * up->rttvar_us + 999) / 1000;
+	up->rto_ms = (int)std::min(std::max(rto_ms, (long long)RTO_MIN_MS), (long long)RTO_MAX_MS);
+}
+
+/// @brief stores the RTT to the ring of recent samples and computes the hedge threshold again every
+/// HEDGE_UPDATE_INTERVAL samples
+/// @param res
+/// @param up
+/// @param rtt_us
+static void record_rtt_sample(struct resolver *res, struct upstream *up, long long rtt_us)
+{
+	up->rtt_samples[up->rtt_sample_cnt % HEDGE_SAMPLES] = (int)std::min(rtt_us, (long long)INT_MAX);
+	up->rtt_sample_cnt++;
+	if (up->rtt_sample_cnt < HEDGE_MIN_SAMPLES || up->rtt_sample_cnt % HEDGE_UPDATE_INTERVAL != 0)
+	{
+		return;
+	}
+	int cnt = (int)std::min(up->rtt_sample_cnt, (unsigned long)HEDGE_SAMPLES);
+	int sorted[HEDGE_SAMPLES];
+	std::memcpy(sorted, up->rtt_samples, cnt * sizeof(int));
+	int k = (cnt - 1) * res->hedge / 100;
+	std::nth_element(sorted, sorted + k, sorted + cnt);
+	up->hedge_ms = std::max(1, (sorted[k] + 999) / 1000);
+}
+
+/// @brief counts the timeout and starts backoff of the server after SERVER_MAX_FAILS timeouts in a row
+/// @param up
+/// @param now
+static void server_timed_out(struct upstream *up, long long now)
+{
+	up->timeouts++;
+	// timeouts of queries sent before the backoff started do not extend it
+	if (++up->fails >= SERVER_MAX_FAILS && up->down_until_ms <= now)
+	{
+		long long backoff = (long long)BACKOFF_MIN_MS << std::min(up->backoffs, 16);
+		up->down_until_ms = now + std::min(backoff, (long long)BACKOFF_MAX_MS);
+		up->backoffs++;
+	}
+}
+
+/// @brief pushes the timer of the query at its hedge time, retransmission deadline or final deadline, older timers become stale
+/// @param res
+/// @param slot
+static void arm_timer(struct resolver *res, int slot)
+{
+	struct inflight_query *q = &res->slots[slot];
+	q->seq++;
+	timer_push(&res->timers, std::min(std::min(q->retry_ms, q->deadline_ms), q->hedge_ms), slot, q->seq);
+}
+
+/// @brief queues the query on the TCP connection to the upstream, the connection is opened if there is none
+/// @param res
+/// @param up
+/// @param q
+/// @return 0 on success, -1 if the connection cannot be opened
+static int tcp_queue(struct resolver *res, struct upstream *up, struct inflight_query *q)
+{
+	if (up->tcp.sock < 0)
+	{
+		if (stream_connect(&up->tcp, &up->addr, up->addr_len) < 0)
+		{
+			return -1;
+		}
+		if (loop_add(&res->loop, up->tcp.sock, &up->tcp_token) < 0)
+		{
+			stream_close(&up->tcp);
+			return -1;
+		}
+		up->tcp_events = POLLIN;
+	}
+	if (stream_queue(&up->tcp, q->query, q->query_len) < 0)
+	{
+		return -1;
+	}
+	q->transport = TRANSPORT_TCP;
+	up->tcp_queries++;
+	return 0;
+}
+
+/// @brief watches the TCP socket for writability only while it has unsent data
+/// @param res
+/// @param up
+static void tcp_update_events(struct resolver *res, struct upstream *up)
+{
+	unsigned events = stream_wants_write(&up->tcp) ? POLLIN | POLLOUT : POLLIN;
+	if (up->tcp.sock >= 0 && events != up->tcp_events)
+	{
+		loop_modify(&res->loop, up->tcp.sock, events);
+		up->tcp_events = events;
+	}
+}
+
+/// @brief encodes the request into the slot with new transaction id, OPT record is appended with EDNS0
+/// @param res
+/// @param q
+/// @param req
+/// @return length of the query, -1 if the name cannot be encoded
+static int encode_query(struct resolver *res, struct inflight_query *q, struct dns_query_request *req)
+{
+	q->id = allocate_id(res);
+	if (req->qname_len > 0)
+	{
+		q->query_len = build_dns_query_wire(q->query, req->qname, req->qname_len, req->qtype, res->recursion, q->id);
+	}
+	else
+	{
+		q->query_len = build_dns_query(q->query, req->name, req->reverse, req->qtype, res->recursion, q->id);
+	}
+	if (q->query_len < 0)
+	{
+		return -1;
+	}
+	q->question_len = q->query_len;
+	if (res->edns > 0)
+	{
+		q->query_len = append_edns_opt(q->query, q->query_len, res->edns);
+	}
+	return q->query_len;
+}
+
+/// @brief queues the encoded query to the upstream over TCP with --tcp, over UDP otherwise
+/// @param res
+/// @param up
+/// @param q
+/// @return 0 on success, -1 if the TCP connection cannot be opened
+static int transmit_query(struct resolver *res, struct upstream *up, struct inflight_query *q)
+{
+	if (res->tcp)
+	{
+		if (tcp_queue(res, up, q) < 0)
+		{
+			return -1;
+		}
+	}
+	else
+	{
+		std::memcpy(dgram_tx_slot(&up->io), q->query, q->query_len);
+		dgram_tx_commit(&up->io, q->query_len);
+		q->transport = TRANSPORT_UDP;
+	}
+	up->queries++;
+	return 0;
+}
+
+/// @brief takes the slot from the free stack and fills state of the query sent for the first time
+/// @param res
+/// @param slot
+/// @param server
+/// @param req
+/// @param now
+static void commit_query(struct resolver *res, int slot, int server, struct dns_query_request *req, long long now)
+{
+	struct inflight_query *q = &res->slots[slot];
+	res->submitted++;
+	res->free_cnt--;
+	q->used = 1;
+	q->server = server;
+	q->tcp_attempts = 0;
+	q->attempts = 1;
+	q->resend = 0;
+	q->tried = 1ULL << server;
+	q->req = *req;
+	q->sent_us = now_us();
+	q->deadline_ms = now + QUERY_TIMEOUT_MS;
+	q->hedge_server = -1;
+	q->coalescing = 0;
+	q->waiters = -1;
+	res->id_to_slot[ntohs(q->id)] = slot;
+}
+
+/// @brief answers the request from the static table before any packet is built, reverse names are not looked up
+/// @param res
+/// @param req
+/// @return true if the name is in the table and the callback was called
+static bool table_submit(struct resolver *res, struct dns_query_request *req)
+{
+	unsigned char wire[NAME_WIRE_BUF];
+	const unsigned char *name = req->qname;
+	int name_len = req->qname_len;
+	if (name_len == 0)
+	{
+		name_len = convert_domain_to_dns(req->name, wire);
+		name = wire;
+	}
+	const struct table_entry *entry = (name_len > 0) ? table_lookup(res->table, name, name_len) : NULL;
+	if (entry == NULL)
+	{
+		return false;
+	}
+	int len = table_answer(res->table, entry, name, name_len, req->qtype, res->recursion, res->table_result);
+	res->table_hits++;
+	parse_dns_message(res->table_result, len, res->table_view);
+	res->callback(res->ctx, req, QUERY_OK, res->table_result, len, res->table_view);
+	return true;
+}
+
+/// @brief encodes the query into the transmit queue (UDP or TCP), it is sent by the next resolver_flush or resolver_poll.
+/// Request for a question which is already in flight is attached to that query and gets its answer.
+/// Callback is called directly when the query cannot be encoded
+/// @param res
+/// @param req
+/// @return 0 if the query is in flight, 1 if it was answered from cache or table, -1 if it already finished with error,
+/// -2 if the window is full
+int resolver_submit(struct resolver *res, struct dns_query_request *req)
+{
+	if (res->table != NULL && !req->reverse && table_submit(res, req))
+	{
+		return 1;
+	}
+	if (res->iter != NULL)
+	{
+		return iterative_submit(res, req);
+	}
+	if (res->free_cnt == 0)
+	{
+		return -2;
+	}
+	long long now = now_ms();
+	int server = pick_server(res, now, 0);
+	struct upstream *up = &res->servers[server];
+	if (!res->tcp && dgram_tx_slot(&up->io) == NULL)
+	{
+		return -2;
+	}
+	int slot = res->free_slots[res->free_cnt - 1];
+	struct inflight_query *q = &res->slots[slot];
+
+	if (encode_query(res, q, req) < 0)
+	{
+		res->callback(res->ctx, req, QUERY_BAD_NAME, NULL, 0, NULL);
+		return -1;
+	}
+	if (res->cache != NULL)
+	{
+		// query is not committed, the slot and id stay free
+		int len = cache_lookup(res->cache, res->cache_shard, q->query, q->query_len, res->cache_result, res->cache_view);
+		if (len > 0)
+		{
+			res->callback(res->ctx, req, QUERY_OK, res->cache_result, len, res->cache_view);
+			return 1;
+		}
+	}
+	uint32_t hash = key_hash(&q->query[sizeof(struct dns_header)], q->question_len - sizeof(struct dns_header));
+	int same = find_same_question(res, q, hash);
+	if (same >= 0)
+	{
+		if (res->free_waiter_cnt == 0)
+		{
+			return -2;
+		}
+		int waiter = res->free_waiters[--res->free_waiter_cnt];
+		res->waiters[waiter].req = *req;
+		res->waiters[waiter].next = -1;
+		struct inflight_query *leader = &res->slots[same];
+		if (leader->waiters == -1)
+		{
+			leader->waiters = waiter;
+		}
+		else
+		{
+			res->waiters[leader->waiters_tail].next = waiter;
+		}
+		leader->waiters_tail = waiter;
+		res->coalesced++;
+		return 0;
+	}
+	if (transmit_query(res, up, q) < 0)
+	{
+		res->callback(res->ctx, req, QUERY_CONNECTION_FAILED, NULL, 0, NULL);
+		return -1;
+	}
+	commit_query(res, slot, server, req, now);
+	q->pinned = 0;
+	q->callback = res->callback;
+	q->ctx = res->ctx;
+	q->coalescing = 1;
+	q->name_hash = hash;
+	q->name_next = res->name_buckets[hash & res->name_mask];
+	res->name_buckets[hash & res->name_mask] = slot;
+	// TCP is reliable, the query is not retransmitted
+	q->retry_ms = (q->transport == TRANSPORT_UDP) ? now + up->rto_ms : q->deadline_ms;
+	q->hedge_ms = (res->hedge > 0 && q->transport == TRANSPORT_UDP && up->hedge_ms > 0) ? now + up->hedge_ms : LLONG_MAX;
+	arm_timer(res, slot);
+	return 0;
+}
+
+/// @brief sends the query only to the given server, without cache, retransmission or hedging. It fails with
+/// QUERY_TIMEOUT when the server does not answer in its RTO, truncated answer is still retried over TCP
+/// @param res
+/// @param req
+/// @param server index of the upstream
+/// @param callback called instead of the resolver callback
+/// @param ctx
+/// @return 0 if the query is in flight, -1 if it already finished with error, -2 if no slot is free
+int resolver_submit_to(struct resolver *res, struct dns_query_request *req, int server, query_callback callback, void *ctx)
+{
+	struct upstream *up = &res->servers[server];
+	if (res->free_cnt == 0 || (!res->tcp && dgram_tx_slot(&up->io) == NULL))
+	{
+		return -2;
+	}
+	long long now = now_ms();
+	int slot = res->free_slots[res->free_cnt - 1];
+	struct inflight_query *q = &res->slots[slot];
+	if (encode_query(res, q, req) < 0)
+	{
+		callback(ctx, req, QUERY_BAD_NAME, NULL, 0, NULL);
+		return -1;
+	}
+	if (transmit_query(res, up, q) < 0)
+	{
+		callback(ctx, req, QUERY_CONNECTION_FAILED, NULL, 0, NULL);
+		return -1;
+	}
+	commit_query(res, slot, server, req, now);
+	q->pinned = 1;
+	q->callback = callback;
+	q->ctx = ctx;
+	if (q->transport == TRANSPORT_UDP)
+	{
+		q->deadline_ms = now + up->rto_ms;
+	}
+	q->retry_ms = q->deadline_ms;
+	q->hedge_ms = LLONG_MAX;
+	up->pending++;
+	up->last_used_ms = now;
+	arm_timer(res, slot);
+	return 0;
+}
+
+/// @brief returns true if both addresses have the same family, address and port
+/// @param a
+/// @param b
+/// @return
+static bool same_address(struct sockaddr_storage *a, struct sockaddr_storage *b)
+{
+	if (a->ss_family != b->ss_family)
+	{
+		return false;
+	}
+	if (a->ss_family == AF_INET)
+	{
+		struct sockaddr_in *a4 = (struct sockaddr_in *)a;
+		struct sockaddr_in *b4 = (struct sockaddr_in *)b;
+		return a4->sin_port == b4->sin_port && a4->sin_addr.s_addr == b4->sin_addr.s_addr;
+	}
+	struct sockaddr_in6 *a6 = (struct sockaddr_in6 *)a;
+	struct sockaddr_in6 *b6 = (struct sockaddr_in6 *)b;
+	return a6->sin6_port == b6->sin6_port && std::memcmp(&a6->sin6_addr, &b6->sin6_addr, sizeof(a6->sin6_addr)) == 0;
+}
+
+/// @brief returns upstream for the address, it is opened when the resolver has none for it yet.
+/// Idle upstream used least recently is closed when all are open
+/// @param res
+/// @param addr
+/// @param addr_len
+/// @return index of the upstream, -1 if no upstream can be opened
+int resolver_server_for(struct resolver *res, struct sockaddr_storage *addr, socklen_t addr_len)
+{
+	int victim = -1;
+	for (int i = 0; i < res->server_cnt; i++)
+	{
+		struct upstream *up = &res->servers[i];
+		if (up->sock >= 0 && same_address(&up->addr, addr))
+		{
+			return i;
+		}
+		if (up->pending == 0 && up != res->draining &&
+			(victim < 0 || up->sock < 0 || up->last_used_ms < res->servers[victim].last_used_ms))
+		{
+			victim = i;
+		}
+	}
+	int server = res->server_cnt;
+	if (server == res->server_cap)
+	{
+		if (victim < 0)
+		{
+			return -1;
+		}
+		// RTT of the closed server is forgotten, addresses which are not used are not worth the memory
+		server = victim;
+		struct upstream *up = &res->servers[server];
+		if (up->sock >= 0)
+		{
+			loop_remove(&res->loop, up->sock);
+			close(up->sock);
+		}
+		if (up->tcp.sock >= 0)
+		{
+			loop_remove(&res->loop, up->tcp.sock);
+		}
+		dgram_free(&up->io);
+		stream_free(&up->tcp);
+		std::memset(up, 0, sizeof(*up));
+		up->sock = -1;
+	}
+	struct upstream *up = &res->servers[server];
+	std::memcpy(&up->addr, addr, addr_len);
+	up->addr_len = addr_len;
+	if (upstream_open(up, res->rx_slot_size, res->latency != NULL) < 0)
+	{
+		up->sock = -1;
+		std::memset(&up->io, 0, sizeof(up->io));
+		stream_init(&up->tcp);
+		return -1;
+	}
+	if (server == res->server_cnt)
+	{
+		res->server_cnt++;
+	}
+	loop_add(&res->loop, up->sock, &up->udp_token);
+	return server;
+}
+
+/// @brief adds the descriptor (for example listening socket) to the event loop of the resolver, resolver_poll
+/// calls the handler of the token when it is readable
+/// @param res
+/// @param fd
+/// @param token TRANSPORT_EXTERNAL with handler, must stay valid until resolver_unwatch
+/// @return 0 on success, -1 if the loop is full
+int resolver_watch(struct resolver *res, int fd, struct io_token *token)
+{
+	return loop_add(&res->loop, fd, token);
+}
+
+/// @brief changes the events the descriptor added by resolver_watch is watched for
+/// @param res
+/// @param fd
+/// @param events POLLIN, POLLOUT
+void resolver_watch_events(struct resolver *res, int fd, unsigned events)
+{
+	loop_modify(&res->loop, fd, events);
+}
+
+/// @brief removes the descriptor added by resolver_watch from the event loop, it is not closed
+/// @param res
+/// @param fd
+void resolver_unwatch(struct resolver *res, int fd)
+{
+	loop_remove(&res->loop, fd);
+}
+
+/// @brief sends all queued queries
+/// @param res
+void resolver_flush(struct resolver *res)
+{
+	for (int i = 0; i < res->server_cnt; i++)
+	{
+		struct upstream *up = &res->servers[i];
+		if (up->io.tx_cnt > 0)
+		{
+			dgram_flush(&up->io);
+		}
+		if (up->tcp.sock >= 0)
+		{
+			// failed connection is reported by the event loop and handled in drain_stream
+			stream_flush(&up->tcp);
+			tcp_update_events(res, up);
+		}
+	}
+}
+
+/// @brief answers queries from the cache shard and stores responses to it
+/// @param res
+/// @param cache
+/// @param shard
+/// @return 0 on success, -1 if out of memory
+int resolver_set_cache(struct resolver *res, struct dns_cache *cache, int shard)
+{
+	res->cache_result = (unsigned char *)malloc(65536);
+	res->cache_view = (struct dns_message_view *)malloc(sizeof(struct dns_message_view));
+	if (res->cache_result == NULL || res->cache_view == NULL)
+	{
+		return -1;
+	}
+	res->cache = cache;
+	res->cache_shard = shard;
+	return 0;
+}
+
+/// @brief compares question of the response with the question of the query, names are case insensitive,
+/// qtype and qclass must be equal
+/// @param q
+/// @param msg
+/// @param msg_len
+/// @return true if the response answers the query
+static bool question_matches(struct inflight_query *q, unsigned char *msg, int msg_len)
+{
+	struct dns_header *dns = (struct dns_header *)msg;
+	if (!dns->qr || ntohs(dns->q_count) != 1 || msg_len < q->question_len)
+	{
+		return false;
+	}
+	int name_end = q->question_len - sizeof(struct dns_question);
+	for (int i = sizeof(struct dns_header); i < name_end; i++)
+	{
+		if (tolower(msg[i]) != tolower(q->query[i]))
+		{
+			return false;
+		}
+	}
+	// qtype and qclass are numbers, they must be the same
+	return std::memcmp(&msg[name_end], &q->query[name_end], sizeof(struct dns_question)) == 0;
+}
+
+/// @brief sends the query again over TCP with the same id, it gets a new deadline
+/// @param res
+/// @param slot
+/// @return 0 on success, -1 if the connection cannot be opened
+static int retry_over_tcp(struct resolver *res, int slot)
+{
+	struct inflight_query *q = &res->slots[slot];
+	if (tcp_queue(res, &res->servers[q->server], q) < 0)
+	{
+		return -1;
+	}
+	q->deadline_ms = now_ms() + QUERY_TIMEOUT_MS;
+	q->retry_ms = q->deadline_ms;
+	q->hedge_ms = LLONG_MAX;
+	arm_timer(res, slot);
+	return 0;
+}
+
+/// @brief matches received message to the query in flight and finishes it. Truncated UDP answer is retried over TCP
+/// @param res
+/// @param server index of the upstream which sent the message
+/// @param transport TRANSPORT_UDP or TRANSPORT_TCP
+/// @param msg
+/// @param msg_len
+/// @param rx_us time the message was received
+/// @param kernel 1 if rx_us is the kernel timestamp
+/// @return number of finished requests, coalesced ones included
+static int handle_response(struct resolver *res, int server, int transport, unsigned char *msg, int msg_len,
+						   long long rx_us, int kernel)
+{
+	if (msg_len < (int)sizeof(struct dns_header))
+	{
+		return 0;
+	}
+	struct dns_header *dns = (struct dns_header *)msg;
+	int slot = res->id_to_slot[ntohs(dns->id)];
+	if (slot == -1 || !(res->slots[slot].tried & (1ULL << server)) || res->slots[slot].transport != transport ||
+		!question_matches(&res->slots[slot], msg, msg_len))
+	{
+		// late response to timed out query, UDP answer of query already retried over TCP or spoofed datagram
+		return 0;
+	}
+	struct inflight_query *q = &res->slots[slot];
+	struct upstream *up = &res->servers[server];
+	// answer of retransmitted, hedged or reconnected query may belong to any transmission (Karn)
+	bool rtt_sample = q->attempts == 1 && q->hedge_server < 0 && q->tcp_attempts == 0;
+	if (transport == TRANSPORT_UDP && rtt_sample)
+	{
+		long long rtt_us = rx_us - q->sent_us;
+		update_rtt(up, rtt_us);
+		if (res->hedge > 0)
+		{
+			record_rtt_sample(res, up, rtt_us);
+		}
+	}
+	if (q->hedge_server == server)
+	{
+		res->hedge_wins++;
+	}
+	up->fails = 0;
+	up->backoffs = 0;
+	up->down_until_ms = 0;
+	up->last_used_ms = now_ms();
+	q->server = server;
+	if (dns->tc && transport == TRANSPORT_UDP)
+	{
+		res->servers[server].truncated++;
+		if (retry_over_tcp(res, slot) == 0)
+		{
+			return 0;
+		}
+		// without TCP the truncated answer is better than nothing
+	}
+	res->servers[server].answered++;
+	res->rcodes[dns->rcode]++;
+	// the latency, the cache and every callback use this one parse of the response
+	parse_dns_message(msg, msg_len, res->view);
+	if (res->latency != NULL)
+	{
+		// coalesced requests share the answer, only the query itself is a sample. The time from the first
+		// transmission is charged to the answering server only when it is its RTT
+		latency_record(res->latency, rtt_sample ? server : -1, q->req.reverse ? QTYPE_PTR : q->req.qtype, res->view->rcode,
+					   rx_us - q->sent_us, kernel);
+	}
+	if (res->capture.fd >= 0)
+	{
+		capture_write(&res->capture, CAPTURE_QUERY, q->transport, q->query, q->query_len);
+		capture_write(&res->capture, CAPTURE_RESPONSE, transport, msg, msg_len);
+	}
+	if (res->cache != NULL && !dns->tc)
+	{
+		cache_store(res->cache, res->cache_shard, res->slots[slot].query, res->slots[slot].query_len, res->view);
+	}
+	return finish_query(res, slot, QUERY_OK, msg, msg_len, res->view);
+}
+
+/// @brief reads all datagrams waiting on the upstream socket
+/// @param res
+/// @param up
+/// @return number of finished queries
+static int drain_upstream(struct resolver *res, struct upstream *up)
+{
+	int server = up - res->servers;
+	int finished = 0;
+	int cnt;
+	do
+	{
+		cnt = dgram_receive(&up->io);
+		long long read_us = (cnt > 0) ? now_us() : 0;
+		for (int i = 0; i < cnt; i++)
+		{
+			int len;
+			unsigned char *msg = dgram_rx_msg(&up->io, i, &len);
+			long long rx_us = dgram_rx_time(&up->io, i);
+			if (len > 0)
+			{
+				finished += handle_response(res, server, TRANSPORT_UDP, msg, len, (rx_us > 0) ? rx_us : read_us, rx_us > 0);
+			}
+		}
+	} while (cnt == DGRAM_BATCH);
+	return finished;
+}
+
+/// @brief closes the lost TCP connection, queries pending on it are sent once more on a new connection, then they fail
+/// @param res
+/// @param up
+/// @return number of finished queries
+static int tcp_lost(struct resolver *res, struct upstream *up)
+{
+	int server = up - res->servers;
+	loop_remove(&res->loop, up->tcp.sock);
+	stream_close(&up->tcp);
+	up->tcp_events = 0;
+
+	int finished = 0;
+	for (int slot = 0; slot < res->slot_cnt; slot++)
+	{
+		struct inflight_query *q = &res->slots[slot];
+		if (!q->used || q->server != server || q->transport != TRANSPORT_TCP)
+		{
+			continue;
+		}
+		if (q->tcp_attempts++ == 0 && tcp_queue(res, up, q) == 0)
+		{
+			continue;
+		}
+		finished += finish_query(res, slot, QUERY_CONNECTION_FAILED, NULL, 0, NULL);
+	}
+	return finished;
+}
+
+/// @brief sends queued data and reads all messages waiting on the TCP connection to the upstream
+/// @param res
+/// @param up
+/// @return number of finished queries
+static int drain_stream(struct resolver *res, struct upstream *up)
+{
+	if (up->tcp.sock < 0)
+	{
+		return 0; // closed by earlier event of the same wait
+	}
+	if (stream_flush(&up->tcp) < 0)
+	{
+		return tcp_lost(res, up);
+	}
+	int server = up - res->servers;
+	int finished = 0;
+	int status = stream_receive(&up->tcp);
+	int len;
+	unsigned char *msg;
+	long long read_us = now_us();
+	while ((msg = stream_next_msg(&up->tcp, &len)) != NULL)
+	{
+		finished += handle_response(res, server, TRANSPORT_TCP, msg, len, read_us, 0);
+	}
+	if (status < 0)
+	{
+		return finished + tcp_lost(res, up);
+	}
+	tcp_update_events(res, up);
+	return finished;
+}
+
+/// @brief sends the UDP query again with the same id to the best server after its retransmission timeout
+/// @param res
+/// @param slot
+/// @param now
+static void retransmit(struct resolver *res, int slot, long long now)
+{
+	struct inflight_query *q = &res->slots[slot];
+	int server = pick_server(res, now, q->tried);
+	struct upstream *up = &res->servers[server];
+	unsigned char *tx = dgram_tx_slot(&up->io);
+	if (tx == NULL)
+	{
+		// socket buffer is full even after flush, nothing is sent or counted and the query is queued again soon
+		q->resend = 1;
+		q->retry_ms = now + RTO_MIN_MS;
+		q->hedge_ms = LLONG_MAX;
+		arm_timer(res, slot);
+		return;
+	}
+	std::memcpy(tx, q->query, q->query_len);
+	dgram_tx_commit(&up->io, q->query_len);
+	q->resend = 0;
+	q->server = server;
+	q->tried |= 1ULL << server;
+	q->attempts++;
+	// RTO of the server is doubled for every transmission of this query only, many queries time out together
+	// when one burst of packets is lost and the RTO of the server must not grow with all of them
+	q->retry_ms = now + std::min((long long)up->rto_ms << std::min(q->attempts - 1, 16), (long long)RTO_MAX_MS);
+	q->hedge_ms = LLONG_MAX;
+	up->retransmits++;
+	res->retransmits++;
+	arm_timer(res, slot);
+}
+
+/// @brief sends the query also to another server when it is not answered in the hedge threshold of its server.
+/// Nothing is sent when the hedge budget is used up or all healthy servers already have the query
+/// @param res
+/// @param slot
+/// @param now
+static void hedge(struct resolver *res, int slot, long long now)
+{
+	struct inflight_query *q = &res->slots[slot];
+	q->hedge_ms = LLONG_MAX;
+	if (res->hedged * 100 < res->submitted * HEDGE_BUDGET_PERCENT)
+	{
+		int server = pick_server(res, now, q->tried);
+		unsigned char *tx = (q->tried & (1ULL << server)) ? NULL : dgram_tx_slot(&res->servers[server].io);
+		if (tx != NULL)
+		{
+			std::memcpy(tx, q->query, q->query_len);
+			dgram_tx_commit(&res->servers[server].io, q->query_len);
+			q->tried |= 1ULL << server;
+			q->hedge_server = server;
+			res->hedged++;
+		}
+	}
+	arm_timer(res, slot);
+}
+
+/// @brief retransmits queries whose retransmission timeout passed and finishes queries whose deadline passed
+/// @param res
+/// @return number of finished queries
+static int expire_queries(struct resolver *res)
+{
+	int finished = 0;
+	long long now = now_ms();
+	struct timer_entry *top;
+	while ((top = timer_top(&res->timers)) != NULL && top->deadline_ms <= now)
+	{
+		int slot = top->slot;
+		struct inflight_query *q = &res->slots[slot];
+		bool expired = q->used && q->seq == top->seq;
+		timer_pop(&res->timers);
+		if (!expired)
+		{
+			continue;
+		}
+		if (q->hedge_ms <= now && now < q->retry_ms)
+		{
+			hedge(res, slot, now);
+			continue;
+		}
+		if (!q->resend)
+		{
+			server_timed_out(&res->servers[q->server], now);
+		}
+		if (now < q->deadline_ms && !q->pinned)
+		{
+			retransmit(res, slot, now);
+			continue;
+		}
+		res->timeouts++;
+		finished += finish_query(res, slot, QUERY_TIMEOUT, NULL, 0, NULL);
+	}
+	return finished;
+}
+
+/// @brief sends queued queries, waits at most timeout_ms for responses, matches them to queries and expires timed out queries
+/// @param res
+/// @param timeout_ms
+/// @return number of finished queries
+int resolver_poll(struct resolver *res, int timeout_ms)
+{
+	resolver_flush(res);
+
+	// skip entries of already finished queries so they do not shorten the wait
+	struct timer_entry *top;
+	while ((top = timer_top(&res->timers)) != NULL && (!res->slots[top->slot].used || res->slots[top->slot].seq != top->seq))
+	{
+		timer_pop(&res->timers);
+	}
+	if (top != NULL)
+	{
+		long long wait = std::max(0LL, top->deadline_ms - now_ms());
+		if (timeout_ms < 0 || wait < timeout_ms)
+		{
+			timeout_ms = wait;
+		}
+	}
+
+	int finished = 0;
+	void *ready[LOOP_MAX_FDS];
+	int cnt = loop_wait(&res->loop, timeout_ms, ready, LOOP_MAX_FDS);
+	for (int i = 0; i < cnt; i++)
+	{
+		struct io_token *token = (struct io_token *)ready[i];
+		res->draining = token->up;
+		if (token->transport == TRANSPORT_EXTERNAL)
+		{
+			token->handler(token->ctx, token);
+		}
+		else if (token->transport == TRANSPORT_TCP)
+		{
+			finished += drain_stream(res, token->up);
+		}
+		else
+		{
+			finished += drain_upstream(res, token->up);
+		}
+	}
+	res->draining = NULL;
+	return finished + expire_queries(res);
+}
+
+/// @brief sums counters of all upstreams
+/// @param res
+/// @param sent datagrams
+/// @param received datagrams
+/// @param syscalls socket and event loop syscalls
+void resolver_io_stats(struct resolver *res, unsigned long *sent, unsigned long *received, unsigned long *syscalls)
+{
+	*sent = 0;
+	*received = 0;
+	*syscalls = res->loop.syscalls;
+	for (int i = 0; i < res->server_cnt; i++)
+	{
+		*sent += res->servers[i].io.sent;
+		*received += res->servers[i].io.received;
+		*syscalls += res->servers[i].io.syscalls + res->servers[i].tcp.syscalls;
+	}
+}
+
+/// @brief sums TCP counters of all upstreams
+/// @param res
+/// @param queries queries sent over TCP
+/// @param truncated UDP answers retried over TCP
+/// @param connects opened connections
+void resolver_tcp_stats(struct resolver *res, unsigned long *queries, unsigned long *truncated, unsigned long *connects)
+{
+	*queries = 0;
+	*truncated = 0;
+	*connects = 0;
+	for (int i = 0; i < res->server_cnt; i++)
+	{
+		*queries += res->servers[i].tcp_queries;
+		*truncated += res->servers[i].truncated;
+		*connects += res->servers[i].tcp.connects;
+	}
+}
@@ -0,0 +1,330 @@
+// author: Marek Kozumplik, xkozum08
+#pragma once
+#include "dns.hpp"
+#include "encoder.hpp"
+#include "mmsg.hpp"
+#include "stream.hpp"
+#include "event_loop.hpp"
+#include "cache.hpp"
+#include "capture.hpp"
+#include "latency.hpp"
+#include "table.hpp"
+#include <time.h>
+#include <climits>
+#include <algorithm>
+
+#define QUERY_TIMEOUT_MS 5000 // query fails when no server answers it in this time, retransmissions included
+
+// retransmission timeout of the server (RFC 6298 with shorter bounds, DNS answers come in milliseconds),
+// doubled for every retransmission of the query
+#define RTO_INITIAL_MS 400 // before the first RTT sample
+#define RTO_MIN_MS 20
+#define RTO_MAX_MS 2000
+
+// server which does not answer SERVER_MAX_FAILS queries in a row is skipped for its backoff time
+#define SERVER_MAX_FAILS 3
+#define BACKOFF_MIN_MS 500
+#define BACKOFF_MAX_MS 30000
+#define SERVER_PROBE_INTERVAL 32 // every n-th query goes round robin, so RTT of slower servers stays known
+
+// hedging: query which is not answered in the percentile of recent RTTs of its server goes also to another server
+#define HEDGE_DEFAULT_PERCENTILE 95
+#define HEDGE_SAMPLES 256		// recent RTTs kept for every server
+#define HEDGE_MIN_SAMPLES 32	// no hedging before the server has so many samples
+#define HEDGE_UPDATE_INTERVAL 32 // threshold is computed again after so many new samples
+#define HEDGE_BUDGET_PERCENT 10	// at most this part of the queries is hedged
+#define MAX_QUERY_LEN 512
+#define MAX_SLOTS 65536 // queries in flight, every one has its own transaction id
+#define ITERATIVE_MAX_SERVERS 48 // upstreams opened for authoritative servers in iterative mode, least recently used is reused
+
+// status of finished query passed to the callback
+#define QUERY_OK 0
+#define QUERY_TIMEOUT 1
+#define QUERY_BAD_NAME 2
+#define QUERY_CONNECTION_FAILED 3
+#define QUERY_ITERATION_FAILED 4 // iterative resolution found no server which answers the name
+
+// transport the query was sent over
+#define TRANSPORT_UDP 0
+#define TRANSPORT_TCP 1
+#define TRANSPORT_EXTERNAL 2 // descriptor added by resolver_watch, handled by the handler of its token
+
+struct dns_query_request
+{
+	char name[256];		// domain name or IP address for reverse query
+	int qtype;			// type of the query, ignored for reverse query
+	int reverse;		// 1 - PTR query for IP address
+	unsigned long tag;	// number of the request in the input, not used by the resolver
+	unsigned char qname[256]; // name already in dns format, used instead of name when qname_len > 0
+	int qname_len;
+};
+
+/// @brief called once for every submitted query
+/// @param ctx user pointer given to resolver_init
+/// @param req the request
+/// @param status QUERY_OK, QUERY_TIMEOUT, ...
+/// @param msg response (only for QUERY_OK)
+/// @param msg_len
+/// @param view msg parsed by the resolver (only for QUERY_OK), view->parse_error is set if it is malformed
+typedef void (*query_callback)(void *ctx, struct dns_query_request *req, int status, unsigned char *msg, int msg_len,
+							   const struct dns_message_view *view);
+
+struct inflight_query
+{
+	int used;
+	unsigned int seq;  // incremented on every use of the slot, see timer_entry
+	unsigned short id; // transaction id in network byte order
+	int server;		   // index of the upstream the query was sent to last
+	int transport;	   // TRANSPORT_UDP or TRANSPORT_TCP
+	int tcp_attempts;  // TCP connections lost while the query was pending on them
+	int attempts;	   // UDP transmissions, RTT is measured only when the query was sent once (Karn)
+	int resend;		   // retransmission found the socket buffer full, its timer only queues it again
+	unsigned long long tried; // bit mask of servers the query was sent to, answer from any of them is accepted
+	int pinned;		   // sent only to one server by resolver_submit_to, not retransmitted or hedged
+	long long sent_us; // time of the first transmission (when it was queued), RTT and latency are measured from it
+	long long retry_ms; // retransmission deadline
+	long long hedge_ms; // time the query goes also to second server, LLONG_MAX if it is not hedged
+	int hedge_server;	// server the hedged query was sent to, -1 if not hedged yet
+	long long deadline_ms; // the query fails at this time
+	struct dns_query_request req;
+	unsigned char query[MAX_QUERY_LEN]; // encoded query, question is compared with the response
+	int query_len;
+	int question_len; // header and question, the OPT record follows
+	query_callback callback; // callback of the resolver or of resolver_submit_to
+	void *ctx;
+	int coalescing;		// in name_buckets, later requests with the same question wait for its answer
+	uint32_t name_hash; // hash of the question
+	int name_next;		// next query in the same bucket of name_buckets, -1 at the end
+	int waiters;		// first request coalesced with this query, -1 if none
+	int waiters_tail;
+};
+
+// request attached to the query in flight with the same question, it gets the same answer
+struct coalesced_request
+{
+	struct dns_query_request req;
+	int next; // next request waiting for the same query, -1 at the end
+};
+
+struct upstream;
+struct io_token;
+
+/// @brief called by resolver_poll when the descriptor added by resolver_watch is ready
+/// @param ctx
+/// @param token
+typedef void (*io_handler)(void *ctx, struct io_token *token);
+
+// data of the descriptors in the event loop, tells which socket of the upstream is ready
+struct io_token
+{
+	struct upstream *up; // NULL for TRANSPORT_EXTERNAL
+	int transport;
+	io_handler handler; // only for TRANSPORT_EXTERNAL
+	void *ctx;
+};
+
+struct upstream
+{
+	int sock; // connected non-blocking UDP socket
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	struct dgram_engine io; // queries are sent and received in batches
+	struct stream_conn tcp; // opened by the first TCP query, reused by the next ones
+	unsigned tcp_events;	// events the TCP socket is watched for
+	struct io_token udp_token;
+	struct io_token tcp_token;
+	unsigned long queries;
+	unsigned long answered;
+	unsigned long timeouts;	   // transmissions without answer in RTO
+	unsigned long retransmits; // queries sent again to this server after timeout on any server
+	unsigned long tcp_queries; // queries sent over TCP, also retries of truncated answers
+	unsigned long truncated;   // UDP answers with TC flag
+
+	// RTT estimate (RFC 6298), servers are ranked by srtt
+	long long srtt_us; // 0 until the first sample
+	long long rttvar_us;
+	int rto_ms;
+	int fails;				// timeouts since the last answer
+	int backoffs;			// backoff periods since the last answer, each one is twice as long
+	long long down_until_ms; // server is skipped until then after SERVER_MAX_FAILS timeouts
+
+	// recent RTTs in a ring, their percentile is the hedge threshold
+	int rtt_samples[HEDGE_SAMPLES]; // microseconds
+	unsigned long rtt_sample_cnt;
+	int hedge_ms; // 0 until HEDGE_MIN_SAMPLES samples
+
+	int pending;			// pinned queries in flight, upstream with none can be reused for another address
+	long long last_used_ms; // last pinned query or answer
+};
+
+struct iterative_state;
+
+struct resolver
+{
+	struct upstream *servers; // servers from args, authoritative servers in iterative mode
+	int server_cnt;
+	int server_cap;
+	struct upstream *draining; // upstream whose messages are being handled, it must not be reused
+	int next_server;	 // round robin position of probes
+	unsigned long picks; // number of server selections, every SERVER_PROBE_INTERVAL-th is a probe
+
+	struct event_loop loop;
+	struct timer_heap timers; // deadlines of queries in flight
+	int recursion;
+	int tcp;  // all queries go over TCP
+	int edns; // UDP payload size advertised in queries, 0 - no OPT record
+	int rx_slot_size; // max size of received datagram
+	int hedge; // RTT percentile for hedging, 0 - no hedging
+
+	int window;						 // max number of queries (names in iterative mode) in flight
+	int slot_cnt;					 // size of slots, iterative queries need more than one slot
+	struct inflight_query *slots;	 // queries waiting for response
+	int *free_slots;				 // stack of unused slot indexes
+	int free_cnt;
+	int id_to_slot[65536];			 // -1 if id is not in flight
+	unsigned short next_id;
+
+	// single flight: request for a question already in flight waits for its answer instead of a new query
+	int *name_buckets;					 // slots of coalescing queries by hash of the question, -1 if empty
+	unsigned name_mask;
+	struct coalesced_request *waiters;	 // window entries
+	int *free_waiters;					 // stack of unused waiter indexes
+	int free_waiter_cnt;
+
+	query_callback callback;
+	void *ctx;
+	struct dns_message_view *view; // parsed response, shared by the latency, the cache and the callbacks
+
+	struct dns_cache *cache; // NULL if answers are not cached
+	int cache_shard;		 // shard of the cache owned by this resolver
+	unsigned char *cache_result;
+	struct dns_message_view *cache_view; // parsed cache_result
+
+	struct dns_table *table;	 // --table, NULL if names are not looked up in a static table
+	unsigned char *table_result; // answer built from the table
+	struct dns_message_view *table_view; // parsed table_result
+	unsigned long table_hits;	 // requests answered from the table, nothing was sent for them
+
+	struct capture_writer capture; // --record, fd -1 if queries are not captured
+	struct latency_stats *latency; // --stats, RTTs of answered queries, NULL if they are not recorded
+
+	struct iterative_state *iter; // NULL unless --iterative, submitted names are resolved from root hints
+
+	unsigned long timeouts;	   // queries which failed without answer
+	unsigned long retransmits; // transmissions after RTO
+	unsigned long submitted;   // queries sent to servers
+	unsigned long coalesced;   // requests answered by a query already in flight, nothing was sent for them
+	unsigned long hedged;	   // queries sent also to second server
+	unsigned long hedge_wins;  // hedged queries answered first by the second server
+	unsigned long rcodes[16];  // answers by the 4 bit rcode of the header
+};
+
+/// @brief returns monotonic time in milliseconds
+/// @return
+long long now_ms();
+
+/// @brief returns monotonic time in microseconds
+/// @return
+long long now_us();
+
+/// @brief fills the socket address of the server
+/// @param addr
+/// @param server IPv4 or IPv6 address
+/// @param address_type TYPE_IP4 or TYPE_IP6
+/// @param port
+/// @return length of the address
+socklen_t fill_server_address(struct sockaddr_storage *addr, const char *server, int address_type, int port);
+
+/// @brief creates non-blocking UDP socket for every server from args and allocates the in-flight table.
+/// TCP connections are opened when they are needed
+/// @param res
+/// @param args
+/// @param callback
+/// @param ctx
+/// @return 0 on success, -1 on error
+int resolver_init(struct resolver *res, struct parsed_arguments *args, query_callback callback, void *ctx);
+
+/// @brief frees the resolver, queries in flight are dropped without callback
+/// @param res
+void resolver_free(struct resolver *res);
+
+/// @brief returns number of queries waiting for response
+/// @param res
+/// @return
+int resolver_inflight(struct resolver *res);
+
+/// @brief encodes the query into the transmit queue (UDP or TCP), it is sent by the next resolver_flush or resolver_poll.
+/// Callback is called directly when the query cannot be encoded
+/// @param res
+/// @param req
+/// @return 0 if the query is in flight, 1 if it was answered from cache, -1 if it already finished with error,
+/// -2 if the window is full
+int resolver_submit(struct resolver *res, struct dns_query_request *req);
+
+/// @brief returns upstream for the address, it is opened when the resolver has none for it yet.
+/// Idle upstream used least recently is closed when all are open
+/// @param res
+/// @param addr
+/// @param addr_len
+/// @return index of the upstream, -1 if no upstream can be opened
+int resolver_server_for(struct resolver *res, struct sockaddr_storage *addr, socklen_t addr_len);
+
+/// @brief sends the query only to the given server, without cache, retransmission or hedging. It fails with
+/// QUERY_TIMEOUT when the server does not answer in its RTO, truncated answer is still retried over TCP
+/// @param res
+/// @param req
+/// @param server index of the upstream
+/// @param callback called instead of the resolver callback
+/// @param ctx
+/// @return 0 if the query is in flight, -1 if it already finished with error, -2 if no slot is free
+int resolver_submit_to(struct resolver *res, struct dns_query_request *req, int server, query_callback callback, void *ctx);
+
+/// @brief adds the descriptor (for example listening socket) to the event loop of the resolver, resolver_poll
+/// calls the handler of the token when it is readable
+/// @param res
+/// @param fd
+/// @param token TRANSPORT_EXTERNAL with handler, must stay valid until resolver_unwatch
+/// @return 0 on success, -1 if the loop is full
+int resolver_watch(struct resolver *res, int fd, struct io_token *token);
+
+/// @brief changes the events the descriptor added by resolver_watch is watched for
+/// @param res
+/// @param fd
+/// @param events POLLIN, POLLOUT
+void resolver_watch_events(struct resolver *res, int fd, unsigned events);
+
+/// @brief removes the descriptor added by resolver_watch from the event loop, it is not closed
+/// @param res
+/// @param fd
+void resolver_unwatch(struct resolver *res, int fd);
+
+/// @brief sends all queued queries
+/// @param res
+void resolver_flush(struct resolver *res);
+
+/// @brief answers queries from the cache shard and stores responses to it
+/// @param res
+/// @param cache
+/// @param shard
+/// @return 0 on success, -1 if out of memory
+int resolver_set_cache(struct resolver *res, struct dns_cache *cache, int shard);
+
+/// @brief sends queued queries, waits at most timeout_ms for responses, matches them to queries and expires timed out queries
+/// @param res
+/// @param timeout_ms
+/// @return number of finished queries
+int resolver_poll(struct resolver *res, int timeout_ms);
+
+/// @brief sums counters of all upstreams
+/// @param res
+/// @param sent datagrams
+/// @param received datagrams
+/// @param syscalls socket and event loop syscalls
+void resolver_io_stats(struct resolver *res, unsigned long *sent, unsigned long *received, unsigned long *syscalls);
+
+/// @brief sums TCP counters of all upstreams
+/// @param res
+/// @param queries queries sent over TCP
+/// @param truncated UDP answers retried over TCP
+/// @param connects opened connections
+void resolver_tcp_stats(struct resolver *res, unsigned long *queries, unsigned long *truncated, unsigned long *connects);
@@ -0,0 +1,1111 @@
+// author: Marek Kozumplik, xkozum08
+// Loopback mock DNS server for load tests, answers from a zone file with injected delay, loss, truncation and
+// rcodes. Built with make responder
+#include "encoder.hpp"
+#include "parser.hpp"
+#include "stream.hpp"
+#include "forwarder.hpp"
+#include <unordered_map>
+#include <thread>
+#include <vector>
+#include <string>
+#include <queue>
+#include <fstream>
+#include <sstream>
+
+#define MOCK_BATCH 64			// datagrams received or sent by one syscall
+#define MOCK_UDP_SLOT 4096		// max size of UDP query and answer
+#define MOCK_TCP_MAX 65535		// max size of TCP answer
+#define MOCK_MAX_TCP_CLIENTS 64 // more connections are closed right after accept
+#define MOCK_POLL_MS 100		// longest wait of the loops, the stop flag is checked after it
+#define MOCK_MAX_CHAIN 8		// CNAME records followed inside the zone
+#define MOCK_DEFAULT_THREADS 2
+#define MOCK_PPM 1000000		// rates are kept in parts per million
+
+static volatile sig_atomic_t mock_stop = 0;
+
+// record of the zone, data are in wire format
+struct mock_record
+{
+	uint16_t type;
+	uint32_t ttl;
+	std::string rdata;
+};
+
+struct mock_config
+{
+	std::unordered_map<std::string, std::vector<struct mock_record>> zone; // by lower case wire name
+	std::vector<struct mock_record> wildcard; // records of "*", answered for every name missing in the zone
+	std::string soa_name;					  // owner of the first SOA, sent in authority of NXDOMAIN and NODATA
+	struct mock_record soa;
+	bool has_soa;
+	bool has_cuts; // NS records of names other than the owner of the SOA, names below them get referrals
+
+	long long delay_us;	 // every answer is sent after delay +- jitter
+	long long jitter_us;
+	unsigned drop_ppm;	 // queries without answer
+	unsigned tc_ppm;	 // UDP answers with TC and no records, the client retries over TCP
+	unsigned rcode_ppm;	 // answers with the injected rcode
+	int rcode;
+
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+};
+
+// answer waiting for its delay
+struct mock_delayed
+{
+	long long due_us;
+	int client; // TCP client, -1 for UDP
+	unsigned gen;
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	std::string msg;
+
+	bool operator<(const struct mock_delayed &other) const
+	{
+		return due_us > other.due_us; // earliest on the top of the heap
+	}
+};
+
+// counters of one thread, summed at exit
+struct mock_stats
+{
+	unsigned long queries;
+	unsigned long answered;
+	unsigned long dropped;
+	unsigned long truncated; // injected and too large for the client
+	unsigned long rcodes;	 // injected rcodes
+	unsigned long nxdomain;
+	unsigned long formerr;
+	unsigned long referrals;
+};
+
+struct mock_tcp_client
+{
+	int used;
+	unsigned gen;
+	struct stream_conn conn;
+};
+
+// UDP thread (all share one socket, so queries of one client are spread over them) or the TCP listener with its clients
+struct mock_worker
+{
+	struct mock_config *cfg;
+	int sock;
+	int tcp; // 1 - sock is the TCP listener
+	uint64_t random;
+	struct mock_stats stats;
+	std::priority_queue<struct mock_delayed> delayed;
+	std::string key; // lookup key, reused so lookups do not allocate
+	std::string cut; // name of the zone cut, reused like key
+
+	// UDP batches, slot i is at rx_slots[i * MOCK_UDP_SLOT]
+	unsigned char *rx_slots;
+	unsigned char *tx_slots;
+	struct mmsghdr rx_msgs[MOCK_BATCH];
+	struct mmsghdr tx_msgs[MOCK_BATCH];
+	struct iovec rx_iov[MOCK_BATCH];
+	struct iovec tx_iov[MOCK_BATCH];
+	struct sockaddr_storage rx_addr[MOCK_BATCH];
+	struct sockaddr_storage tx_addr[MOCK_BATCH];
+	int tx_cnt;
+
+	struct mock_tcp_client clients[MOCK_MAX_TCP_CLIENTS];
+};
+
+/// @brief signal handler of SIGINT and SIGTERM
+/// @param sig
+static void stop_mock(int sig)
+{
+	(void)sig;
+	mock_stop = 1;
+}
+
+/// @brief returns next pseudo random number of the worker (xorshift64)
+/// @param w
+/// @return
+static uint64_t next_random(struct mock_worker *w)
+{
+	w->random ^= w->random << 13;
+	w->random ^= w->random >> 7;
+	w->random ^= w->random << 17;
+	return w->random;
+}
+
+/// @brief returns true with probability ppm / MOCK_PPM
+/// @param w
+/// @param ppm
+/// @return
+static bool chance(struct mock_worker *w, unsigned ppm)
+{
+	return ppm > 0 && next_random(w) % MOCK_PPM < ppm;
+}
+
+/// @brief converts the name to lower case wire format, trailing dot is optional, "." is the root
+/// @param text
+/// @param wire
+/// @return length of the name, -1 if it is invalid
+static int mock_name_to_wire(const char *text, std::string &wire)
+{
+	wire.clear();
+	const char *p = text;
+	while (*p != '\0' && !(p[0] == '.' && p[1] == '\0' && p == text))
+	{
+		const char *end = strchr(p, '.');
+		int len = (end == NULL) ? strlen(p) : end - p;
+		if (len == 0 || len > 63)
+		{
+			return -1;
+		}
+		wire += (char)len;
+		for (int i = 0; i < len; i++)
+		{
+			wire += (char)tolower((unsigned char)p[i]);
+		}
+		p += len;
+		if (*p == '.')
+		{
+			p++;
+		}
+	}
+	wire += '\0';
+	return (wire.size() > 255) ? -1 : (int)wire.size();
+}
+
+/// @brief appends big endian 16 bit number
+/// @param out
+/// @param value
+static void put_u16(std::string &out, unsigned value)
+{
+	out += (char)(value >> 8);
+	out += (char)value;
+}
+
+/// @brief appends big endian 32 bit number
+/// @param out
+/// @param value
+static void put_u32(std::string &out, uint32_t value)
+{
+	put_u16(out, value >> 16);
+	put_u16(out, value & 0xffff);
+}
+
+/// @brief encodes data of the zone line in wire format
+/// @param type
+/// @param data the rest of the line
+/// @param rdata
+/// @return 0 on success, -1 if the data are invalid
+static int encode_rdata(int type, const std::string &data, std::string &rdata)
+{
+	std::istringstream in(data);
+	std::string a;
+	std::string b;
+	std::string name;
+	unsigned char addr[16];
+	rdata.clear();
+	switch (type)
+	{
+	case QTYPE_A:
+	case QTYPE_AAAA:
+		if (!(in >> a) || inet_pton(type == QTYPE_A ? AF_INET : AF_INET6, a.c_str(), addr) != 1)
+		{
+			return -1;
+		}
+		rdata.assign((char *)addr, type == QTYPE_A ? 4 : 16);
+		return 0;
+	case QTYPE_NS:
+	case QTYPE_CNAME:
+	case QTYPE_PTR:
+		if (!(in >> a) || mock_name_to_wire(a.c_str(), rdata) < 0)
+		{
+			return -1;
+		}
+		return 0;
+	case QTYPE_MX:
+	{
+		unsigned preference;
+		if (!(in >> preference >> a) || preference > 65535 || mock_name_to_wire(a.c_str(), name) < 0)
+		{
+			return -1;
+		}
+		put_u16(rdata, preference);
+		rdata += name;
+		return 0;
+	}
+	case QTYPE_SOA:
+	{
+		uint32_t numbers[5];
+		if (!(in >> a >> b >> numbers[0] >> numbers[1] >> numbers[2] >> numbers[3] >> numbers[4]) ||
+			mock_name_to_wire(a.c_str(), rdata) < 0 || mock_name_to_wire(b.c_str(), name) < 0)
+		{
+			return -1;
+		}
+		rdata += name;
+		for (uint32_t n : numbers)
+		{
+			put_u32(rdata, n);
+		}
+		return 0;
+	}
+	case QTYPE_TXT:
+	{
+		// quoted strings or words, longer ones are split into 255 byte strings
+		size_t i = 0;
+		while (i < data.size())
+		{
+			if (isspace((unsigned char)data[i]))
+			{
+				i++;
+				continue;
+			}
+			std::string text;
+			if (data[i] == '"')
+			{
+				size_t end = data.find('"', i + 1);
+				if (end == std::string::npos)
+				{
+					return -1;
+				}
+				text = data.substr(i + 1, end - i - 1);
+				i = end + 1;
+			}
+			else
+			{
+				size_t end = i;
+				while (end < data.size() && !isspace((unsigned char)data[end]))
+				{
+					end++;
+				}
+				text = data.substr(i, end - i);
+				i = end;
+			}
+			do
+			{
+				size_t len = std::min(text.size(), (size_t)255);
+				rdata += (char)len;
+				rdata += text.substr(0, len);
+				text.erase(0, len);
+			} while (!text.empty());
+		}
+		return rdata.empty() ? -1 : 0;
+	}
+	default:
+	{
+		// other types in the generic form of RFC 3597: \# length hex
+		unsigned len;
+		if (!(in >> a) || a != "\\#" || !(in >> len) || len > 65535)
+		{
+			return -1;
+		}
+		std::string hex;
+		while (in >> b)
+		{
+			hex += b;
+		}
+		if (hex.size() != 2 * len)
+		{
+			return -1;
+		}
+		for (size_t i = 0; i < hex.size(); i += 2)
+		{
+			if (!isxdigit((unsigned char)hex[i]) || !isxdigit((unsigned char)hex[i + 1]))
+			{
+				return -1;
+			}
+			rdata += (char)std::stoi(hex.substr(i, 2), NULL, 16);
+		}
+		return 0;
+	}
+	}
+}
+
+/// @brief loads the zone file. Lines are "name [ttl] type data", ';' and '#' (except \#) start comments, name "*" answers
+/// every name which is not in the zone
+/// @param cfg
+/// @param path
+/// @return 0 on success, -1 on error (error is printed)
+static int load_zone(struct mock_config *cfg, const char *path)
+{
+	std::ifstream file(path);
+	if (!file)
+	{
+		std::cerr << "Error: Cannot open zone file " << path << std::endl;
+		return -1;
+	}
+	std::string line;
+	unsigned long line_no = 0;
+	while (std::getline(file, line))
+	{
+		line_no++;
+		bool quoted = false;
+		for (size_t i = 0; i < line.size(); i++)
+		{
+			quoted ^= (line[i] == '"');
+			// \# is the generic rdata of RFC 3597, not a comment
+			if (!quoted && (line[i] == ';' || (line[i] == '#' && (i == 0 || line[i - 1] != '\\'))))
+			{
+				line.erase(i);
+				break;
+			}
+		}
+		std::istringstream in(line);
+		std::string owner;
+		std::string token;
+		if (!(in >> owner))
+		{
+			continue;
+		}
+		struct mock_record rr;
+		rr.ttl = 300;
+		if (!(in >> token))
+		{
+			std::cerr << "Error: " << path << ":" << line_no << ": missing type" << std::endl;
+			return -1;
+		}
+		if (isdigit((unsigned char)token[0]))
+		{
+			rr.ttl = strtoul(token.c_str(), NULL, 10);
+			in >> token;
+		}
+		int type = parse_qtype(token.c_str());
+		std::string data;
+		std::getline(in, data);
+		std::string wire;
+		if (type < 0 || encode_rdata(type, data, rr.rdata) < 0 ||
+			(owner != "*" && mock_name_to_wire(owner.c_str(), wire) < 0))
+		{
+			std::cerr << "Error: " << path << ":" << line_no << ": invalid record" << std::endl;
+			return -1;
+		}
+		rr.type = type;
+		if (owner == "*")
+		{
+			cfg->wildcard.push_back(rr);
+			continue;
+		}
+		if (type == QTYPE_SOA && !cfg->has_soa)
+		{
+			cfg->soa_name = wire;
+			cfg->soa = rr;
+			cfg->has_soa = true;
+		}
+		cfg->zone[wire].push_back(rr);
+	}
+	// SOA may follow the NS records of the zone cuts
+	for (const auto &entry : cfg->zone)
+	{
+		for (const struct mock_record &rr : entry.second)
+		{
+			cfg->has_cuts = cfg->has_cuts || (rr.type == QTYPE_NS && !(cfg->has_soa && entry.first == cfg->soa_name));
+		}
+	}
+	return 0;
+}
+
+/// @brief appends the record, owner is the name in wire format or the compression pointer to the question
+/// @param out
+/// @param owner
+/// @param rr
+static void put_record(std::string &out, const std::string &owner, const struct mock_record &rr)
+{
+	out += owner;
+	put_u16(out, rr.type);
+	put_u16(out, 1); // IN
+	put_u32(out, rr.ttl);
+	put_u16(out, rr.rdata.size());
+	out += rr.rdata;
+}
+
+/// @brief finds the zone cut of the name: the closest name at or above it with NS records, up to the owner of
+/// the SOA (the apex of the zone is not a cut)
+/// @param cfg
+/// @param name lower case wire name
+/// @param cut the name of the cut
+/// @return NS records of the cut, NULL if the name is not delegated
+static const std::vector<struct mock_record> *find_cut(struct mock_config *cfg, const std::string &name, std::string &cut)
+{
+	for (size_t off = 0; name[off] != '\0'; off += (unsigned char)name[off] + 1)
+	{
+		cut.assign(name, off, std::string::npos);
+		if (cfg->has_soa && cut == cfg->soa_name)
+		{
+			return NULL;
+		}
+		auto it = cfg->zone.find(cut);
+		if (it == cfg->zone.end())
+		{
+			continue;
+		}
+		for (const struct mock_record &rr : it->second)
+		{
+			if (rr.type == QTYPE_NS)
+			{
+				return &it->second;
+			}
+		}
+	}
+	return NULL;
+}
+
+/// @brief appends the referral: NS records of the cut and A and AAAA glue of the name servers found in the zone
+/// @param cfg
+/// @param cut
+/// @param rrs records of the cut
+/// @param body
+/// @param nscount
+/// @param arcount
+static void put_referral(struct mock_config *cfg, const std::string &cut, const std::vector<struct mock_record> &rrs,
+						 std::string &body, int *nscount, int *arcount)
+{
+	for (const struct mock_record &rr : rrs)
+	{
+		if (rr.type == QTYPE_NS)
+		{
+			put_record(body, cut, rr);
+			(*nscount)++;
+		}
+	}
+	for (const struct mock_record &rr : rrs)
+	{
+		auto glue = (rr.type == QTYPE_NS) ? cfg->zone.find(rr.rdata) : cfg->zone.end();
+		if (glue == cfg->zone.end())
+		{
+			continue;
+		}
+		for (const struct mock_record &addr : glue->second)
+		{
+			if (addr.type == QTYPE_A || addr.type == QTYPE_AAAA)
+			{
+				put_record(body, rr.rdata, addr);
+				(*arcount)++;
+			}
+		}
+	}
+}
+
+/// @brief builds the answer to the query with the injected faults
+/// @param w
+/// @param query
+/// @param len
+/// @param tcp 1 if the query came over TCP (never truncated)
+/// @param out the answer
+/// @return false if the query is dropped
+static bool mock_answer(struct mock_worker *w, const unsigned char *query, int len, int tcp, std::string &out)
+{
+	static thread_local struct dns_message_view view;
+	struct mock_config *cfg = w->cfg;
+	w->stats.queries++;
+	if (len < (int)sizeof(struct dns_header) || (query[2] & 0x80) || chance(w, cfg->drop_ppm))
+	{
+		w->stats.dropped++;
+		return false;
+	}
+	// header: id, opcode and RD of the query, QR and AA set, RA copies RD like recursive server
+	out.assign((const char *)query, 4);
+	out[2] = (char)(0x80 | (query[2] & 0x79) | 0x04);
+	out[3] = (char)((query[2] & 0x01) ? 0x80 : 0);
+	std::string body;
+	int ancount = 0;
+	int nscount = 0;
+	int arcount = 0;
+	int rcode = 0;
+	int question_len = 0;
+	bool edns = false;
+	int max_len = tcp ? MOCK_TCP_MAX : 512;
+
+	if (parse_dns_message(query, len, &view) != PARSE_OK)
+	{
+		rcode = 1; // FORMERR
+		w->stats.formerr++;
+	}
+	else
+	{
+		question_len = view.qname_len + 4;
+		edns = view.opt_index >= 0;
+		if (edns && !tcp)
+		{
+			max_len = std::min(std::max((int)view.udp_size, 512), MOCK_UDP_SLOT);
+		}
+		if (view.opcode != 0)
+		{
+			rcode = 4; // NOTIMP
+		}
+		else if (view.qclass != 1)
+		{
+			rcode = 5; // REFUSED
+		}
+		else if (chance(w, cfg->rcode_ppm))
+		{
+			rcode = cfg->rcode;
+			w->stats.rcodes++;
+		}
+		else if (!tcp && chance(w, cfg->tc_ppm))
+		{
+			out[2] |= 0x02;
+			w->stats.truncated++;
+		}
+		else
+		{
+			unsigned char wire[256];
+			int wire_len = dns_name_to_wire(query, len, view.qname_off, wire);
+			w->key.assign((const char *)wire, wire_len);
+			std::string owner("\xc0\x0c", 2);
+			const std::vector<struct mock_record> *rrs = NULL;
+			const std::vector<struct mock_record> *cut_rrs = cfg->has_cuts ? find_cut(cfg, w->key, w->cut) : NULL;
+			auto it = cfg->zone.find(w->key);
+			if (cut_rrs != NULL)
+			{
+				// the name is delegated: referral without AA, the records of the cut and below are not answered
+				out[2] &= ~0x04;
+				put_referral(cfg, w->cut, *cut_rrs, body, &nscount, &arcount);
+				w->stats.referrals++;
+			}
+			else if (it != cfg->zone.end())
+			{
+				rrs = &it->second;
+			}
+			else if (!cfg->wildcard.empty())
+			{
+				rrs = &cfg->wildcard;
+			}
+			// records of the type, CNAME is followed inside the zone
+			for (int hop = 0; rrs != NULL && hop < MOCK_MAX_CHAIN; hop++)
+			{
+				const struct mock_record *cname = NULL;
+				for (const struct mock_record &rr : *rrs)
+				{
+					if (rr.type == view.qtype)
+					{
+						put_record(body, owner, rr);
+						ancount++;
+					}
+					else if (rr.type == QTYPE_CNAME)
+					{
+						cname = &rr;
+					}
+				}
+				if (ancount > 0 || cname == NULL)
+				{
+					break;
+				}
+				put_record(body, owner, *cname);
+				ancount++;
+				owner = cname->rdata;
+				it = cfg->zone.find(owner);
+				rrs = (it == cfg->zone.end()) ? NULL : &it->second;
+			}
+			if (cut_rrs == NULL && it == cfg->zone.end() && cfg->wildcard.empty())
+			{
+				rcode = 3; // NXDOMAIN
+				w->stats.nxdomain++;
+			}
+			if (cut_rrs == NULL && (rcode == 3 || ancount == 0) && cfg->has_soa)
+			{
+				put_record(body, cfg->soa_name, cfg->soa);
+				nscount = 1;
+			}
+		}
+	}
+
+	out[3] = (char)(out[3] | rcode);
+	put_u16(out, question_len > 0 ? 1 : 0);
+	int records_len = body.size();
+	bool fits = sizeof(struct dns_header) + question_len + records_len + (edns ? EDNS_OPT_LEN : 0) <= (size_t)max_len;
+	if (!fits)
+	{
+		out[2] |= 0x02; // TC, the client retries over TCP
+		w->stats.truncated++;
+		ancount = 0;
+		nscount = 0;
+		arcount = 0;
+	}
+	put_u16(out, ancount);
+	put_u16(out, nscount);
+	put_u16(out, arcount + (edns ? 1 : 0));
+	out.append((const char *)&query[sizeof(struct dns_header)], question_len);
+	if (fits)
+	{
+		out += body;
+	}
+	if (edns)
+	{
+		unsigned char opt[EDNS_OPT_LEN] = {0, 0, QTYPE_OPT, EDNS_DEFAULT_SIZE >> 8, EDNS_DEFAULT_SIZE & 0xff, 0, 0, 0, 0, 0, 0};
+		out.append((const char *)opt, sizeof(opt));
+	}
+	w->stats.answered++;
+	return true;
+}
+
+/// @brief returns delay of the next answer with jitter
+/// @param w
+/// @return microseconds, 0 if the answer is sent at once
+static long long answer_delay(struct mock_worker *w)
+{
+	long long delay = w->cfg->delay_us;
+	if (w->cfg->jitter_us > 0)
+	{
+		delay += (long long)(next_random(w) % (2 * w->cfg->jitter_us + 1)) - w->cfg->jitter_us;
+	}
+	return std::max(delay, 0LL);
+}
+
+/// @brief sends queued UDP answers with sendmmsg, answers the full socket does not take are dropped
+/// @param w
+static void flush_udp(struct mock_worker *w)
+{
+	int total = 0;
+	while (total < w->tx_cnt)
+	{
+		int sent = sendmmsg(w->sock, &w->tx_msgs[total], w->tx_cnt - total, 0);
+		if (sent < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			break;
+		}
+		total += sent;
+	}
+	w->tx_cnt = 0;
+}
+
+/// @brief queues the UDP answer
+/// @param w
+/// @param addr
+/// @param addr_len
+/// @param msg
+static void udp_send(struct mock_worker *w, const struct sockaddr_storage *addr, socklen_t addr_len, const std::string &msg)
+{
+	if (w->tx_cnt == MOCK_BATCH)
+	{
+		flush_udp(w);
+	}
+	int i = w->tx_cnt++;
+	std::memcpy(&w->tx_slots[i * MOCK_UDP_SLOT], msg.data(), msg.size());
+	w->tx_iov[i].iov_len = msg.size();
+	std::memcpy(&w->tx_addr[i], addr, addr_len);
+	w->tx_msgs[i].msg_hdr.msg_namelen = addr_len;
+}
+
+/// @brief writes the answer to the TCP client, client which cannot take it is closed
+/// @param w
+/// @param i
+/// @param msg
+static void tcp_send(struct mock_worker *w, int i, const std::string &msg)
+{
+	struct mock_tcp_client *c = &w->clients[i];
+	if (stream_queue(&c->conn, (const unsigned char *)msg.data(), msg.size()) < 0 || stream_flush(&c->conn) < 0)
+	{
+		stream_close(&c->conn);
+		c->used = 0;
+		c->gen++;
+	}
+}
+
+/// @brief answers the query at once or after the delay
+/// @param w
+/// @param query
+/// @param len
+/// @param client TCP client, -1 for UDP
+/// @param addr UDP client
+/// @param addr_len
+static void handle_query(struct mock_worker *w, const unsigned char *query, int len, int client,
+						 const struct sockaddr_storage *addr, socklen_t addr_len)
+{
+	static thread_local std::string answer;
+	if (!mock_answer(w, query, len, client >= 0, answer))
+	{
+		return;
+	}
+	long long delay = answer_delay(w);
+	if (delay > 0)
+	{
+		struct mock_delayed d;
+		d.due_us = now_us() + delay;
+		d.client = client;
+		d.gen = (client >= 0) ? w->clients[client].gen : 0;
+		if (addr != NULL)
+		{
+			std::memcpy(&d.addr, addr, addr_len);
+		}
+		d.addr_len = addr_len;
+		d.msg = answer;
+		w->delayed.push(d);
+	}
+	else if (client >= 0)
+	{
+		tcp_send(w, client, answer);
+	}
+	else
+	{
+		udp_send(w, addr, addr_len, answer);
+	}
+}
+
+/// @brief sends delayed answers whose time has come
+/// @param w
+/// @return milliseconds until the next delayed answer, MOCK_POLL_MS if there is none
+static int send_delayed(struct mock_worker *w)
+{
+	long long now = now_us();
+	while (!w->delayed.empty() && w->delayed.top().due_us <= now)
+	{
+		const struct mock_delayed &d = w->delayed.top();
+		if (d.client < 0)
+		{
+			udp_send(w, &d.addr, d.addr_len, d.msg);
+		}
+		else if (w->clients[d.client].used && w->clients[d.client].gen == d.gen)
+		{
+			tcp_send(w, d.client, d.msg);
+		}
+		w->delayed.pop();
+	}
+	if (w->delayed.empty())
+	{
+		return MOCK_POLL_MS;
+	}
+	return std::min((long long)MOCK_POLL_MS, (w->delayed.top().due_us - now + 999) / 1000);
+}
+
+/// @brief answers UDP queries until the stop signal, runs in its own thread
+/// @param w
+static void run_udp_worker(struct mock_worker *w)
+{
+	for (int i = 0; i < MOCK_BATCH; i++)
+	{
+		w->rx_iov[i] = {&w->rx_slots[i * MOCK_UDP_SLOT], MOCK_UDP_SLOT};
+		w->tx_iov[i] = {&w->tx_slots[i * MOCK_UDP_SLOT], 0};
+		std::memset(&w->rx_msgs[i], 0, sizeof(w->rx_msgs[i]));
+		std::memset(&w->tx_msgs[i], 0, sizeof(w->tx_msgs[i]));
+		w->rx_msgs[i].msg_hdr.msg_name = &w->rx_addr[i];
+		w->rx_msgs[i].msg_hdr.msg_iov = &w->rx_iov[i];
+		w->rx_msgs[i].msg_hdr.msg_iovlen = 1;
+		w->tx_msgs[i].msg_hdr.msg_name = &w->tx_addr[i];
+		w->tx_msgs[i].msg_hdr.msg_iov = &w->tx_iov[i];
+		w->tx_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	int timeout = MOCK_POLL_MS;
+	while (!mock_stop)
+	{
+		struct pollfd pfd = {w->sock, POLLIN, 0};
+		poll(&pfd, 1, timeout);
+		int cnt;
+		do
+		{
+			for (int i = 0; i < MOCK_BATCH; i++)
+			{
+				w->rx_msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+			}
+			cnt = recvmmsg(w->sock, w->rx_msgs, MOCK_BATCH, MSG_DONTWAIT, NULL);
+			for (int i = 0; i < cnt; i++)
+			{
+				if (!(w->rx_msgs[i].msg_hdr.msg_flags & MSG_TRUNC))
+				{
+					handle_query(w, &w->rx_slots[i * MOCK_UDP_SLOT], w->rx_msgs[i].msg_len, -1, &w->rx_addr[i],
+								 w->rx_msgs[i].msg_hdr.msg_namelen);
+				}
+			}
+			flush_udp(w);
+		} while (cnt == MOCK_BATCH);
+		timeout = send_delayed(w);
+		flush_udp(w);
+	}
+}
+
+/// @brief accepts TCP clients and answers their pipelined queries until the stop signal, runs in its own thread
+/// @param w
+static void run_tcp_worker(struct mock_worker *w)
+{
+	struct pollfd pfds[MOCK_MAX_TCP_CLIENTS + 1];
+	int timeout = MOCK_POLL_MS;
+	while (!mock_stop)
+	{
+		pfds[0] = {w->sock, POLLIN, 0};
+		for (int i = 0; i < MOCK_MAX_TCP_CLIENTS; i++)
+		{
+			struct mock_tcp_client *c = &w->clients[i];
+			pfds[i + 1] = {c->used ? c->conn.sock : -1, (short)(POLLIN | (stream_wants_write(&c->conn) ? POLLOUT : 0)), 0};
+		}
+		poll(pfds, MOCK_MAX_TCP_CLIENTS + 1, timeout);
+		int sock;
+		while ((sock = accept4(w->sock, NULL, NULL, SOCK_NONBLOCK)) >= 0)
+		{
+			int i = 0;
+			while (i < MOCK_MAX_TCP_CLIENTS && w->clients[i].used)
+			{
+				i++;
+			}
+			if (i == MOCK_MAX_TCP_CLIENTS || stream_accept(&w->clients[i].conn, sock) < 0)
+			{
+				close(sock);
+				continue;
+			}
+			w->clients[i].used = 1;
+		}
+		for (int i = 0; i < MOCK_MAX_TCP_CLIENTS; i++)
+		{
+			struct mock_tcp_client *c = &w->clients[i];
+			if (!c->used || pfds[i + 1].revents == 0 || pfds[i + 1].fd != c->conn.sock)
+			{
+				continue;
+			}
+			int status = (stream_flush(&c->conn) < 0) ? -1 : stream_receive(&c->conn);
+			int len;
+			unsigned char *msg;
+			while (c->used && (msg = stream_next_msg(&c->conn, &len)) != NULL)
+			{
+				handle_query(w, msg, len, i, NULL, 0);
+			}
+			if (c->used && status < 0)
+			{
+				// delayed answers of the closed client are dropped by the generation
+				stream_close(&c->conn);
+				c->used = 0;
+				c->gen++;
+			}
+		}
+		timeout = send_delayed(w);
+	}
+}
+
+/// @brief parses percentage of the option
+/// @param text
+/// @param ppm
+/// @return 0 on success, -1 if it is not a number from 0 to 100
+static int parse_rate(const char *text, unsigned *ppm)
+{
+	char *end;
+	double percent = strtod(text, &end);
+	if (end == text || (*end != '\0' && *end != ':') || percent < 0 || percent > 100)
+	{
+		return -1;
+	}
+	*ppm = (unsigned)(percent * (MOCK_PPM / 100));
+	return 0;
+}
+
+/// @brief parses rcode name (SERVFAIL, REFUSED, ...) or number
+/// @param text
+/// @return rcode, -1 if unknown
+static int parse_rcode_name(const char *text)
+{
+	static const char *names[] = {"NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED"};
+	for (int i = 0; i < 6; i++)
+	{
+		if (strcasecmp(text, names[i]) == 0)
+		{
+			return i;
+		}
+	}
+	char *end;
+	long rcode = strtol(text, &end, 10);
+	return (*text != '\0' && *end == '\0' && rcode >= 0 && rcode <= 15) ? (int)rcode : -1;
+}
+
+/// @brief creates non-blocking socket bound to the address, TCP socket also listens
+/// @param cfg
+/// @param type SOCK_DGRAM or SOCK_STREAM
+/// @return the socket, -1 on error
+static int open_mock_socket(struct mock_config *cfg, int type)
+{
+	int sock = socket(cfg->addr.ss_family, type | SOCK_NONBLOCK, 0);
+	int one = 1;
+	int rcvbuf = 4 * 1024 * 1024;
+	if (sock < 0)
+	{
+		perror("Error creating socket");
+		return -1;
+	}
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	if (bind(sock, (struct sockaddr *)&cfg->addr, cfg->addr_len) < 0 || (type == SOCK_STREAM && listen(sock, SOMAXCONN) < 0))
+	{
+		perror("Error binding socket");
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+/// @brief prints usage of the responder
+static void print_usage()
+{
+	std::cerr << "Usage: responder [-l [address:]port] [-z zone] [-j threads] [-d delay_ms[:jitter_ms]] [-D drop%] [-t tc%] "
+				 "[-e rcode%[:rcode]]"
+			  << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+	struct mock_config *cfg = new mock_config();
+	const char *listen_text = "5300";
+	const char *zone_file = NULL;
+	int threads = MOCK_DEFAULT_THREADS;
+	cfg->has_soa = false;
+	cfg->has_cuts = false;
+	cfg->delay_us = 0;
+	cfg->jitter_us = 0;
+	cfg->drop_ppm = 0;
+	cfg->tc_ppm = 0;
+	cfg->rcode_ppm = 0;
+	cfg->rcode = 2; // SERVFAIL
+	int opt;
+	while ((opt = getopt(argc, argv, "l:z:j:d:D:t:e:h")) != -1)
+	{
+		const char *colon = (optarg != NULL) ? strchr(optarg, ':') : NULL;
+		bool ok = true;
+		switch (opt)
+		{
+		case 'l':
+			listen_text = optarg;
+			break;
+		case 'z':
+			zone_file = optarg;
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			ok = threads >= 1 && threads <= 64;
+			break;
+		case 'd':
+			cfg->delay_us = (long long)(atof(optarg) * 1000);
+			cfg->jitter_us = (colon != NULL) ? (long long)(atof(colon + 1) * 1000) : 0;
+			ok = cfg->delay_us >= 0 && cfg->jitter_us >= 0;
+			break;
+		case 'D':
+			ok = parse_rate(optarg, &cfg->drop_ppm) == 0;
+			break;
+		case 't':
+			ok = parse_rate(optarg, &cfg->tc_ppm) == 0;
+			break;
+		case 'e':
+			ok = parse_rate(optarg, &cfg->rcode_ppm) == 0;
+			if (ok && colon != NULL)
+			{
+				cfg->rcode = parse_rcode_name(colon + 1);
+				ok = cfg->rcode >= 0;
+			}
+			break;
+		default:
+			print_usage();
+			delete cfg;
+			return opt == 'h' ? 0 : 1;
+		}
+		if (!ok)
+		{
+			std::cerr << "Invalid value of -" << (char)opt << ": " << optarg << std::endl;
+			print_usage();
+			delete cfg;
+			return 1;
+		}
+	}
+	cfg->addr_len = parse_listen_address(listen_text, &cfg->addr);
+	if (cfg->addr_len == 0)
+	{
+		std::cerr << "Invalid listen address " << listen_text << std::endl;
+		delete cfg;
+		return 1;
+	}
+	if (zone_file != NULL && load_zone(cfg, zone_file) < 0)
+	{
+		delete cfg;
+		return 1;
+	}
+	if (zone_file == NULL)
+	{
+		// without zone every name has loopback addresses
+		struct mock_record rr;
+		rr.ttl = 300;
+		rr.type = QTYPE_A;
+		encode_rdata(QTYPE_A, "127.0.0.1", rr.rdata);
+		cfg->wildcard.push_back(rr);
+		rr.type = QTYPE_AAAA;
+		encode_rdata(QTYPE_AAAA, "::1", rr.rdata);
+		cfg->wildcard.push_back(rr);
+	}
+
+	// threads UDP workers and one TCP worker
+	int udp_sock = open_mock_socket(cfg, SOCK_DGRAM);
+	int tcp_sock = (udp_sock < 0) ? -1 : open_mock_socket(cfg, SOCK_STREAM);
+	mock_stop = (tcp_sock < 0);
+	std::vector<struct mock_worker *> workers;
+	for (int i = 0; i <= threads && !mock_stop; i++)
+	{
+		struct mock_worker *w = new mock_worker();
+		w->cfg = cfg;
+		w->tcp = (i == threads);
+		w->random = 0x9e3779b97f4a7c15ULL ^ ((uint64_t)now_us() << 8) ^ i;
+		w->stats = {};
+		w->tx_cnt = 0;
+		w->rx_slots = w->tcp ? NULL : (unsigned char *)malloc(MOCK_BATCH * MOCK_UDP_SLOT);
+		w->tx_slots = w->tcp ? NULL : (unsigned char *)malloc(MOCK_BATCH * MOCK_UDP_SLOT);
+		for (int c = 0; c < MOCK_MAX_TCP_CLIENTS; c++)
+		{
+			w->clients[c].used = 0;
+			w->clients[c].gen = 0;
+			stream_init(&w->clients[c].conn);
+		}
+		w->sock = w->tcp ? tcp_sock : udp_sock;
+		workers.push_back(w);
+		if (!w->tcp && (w->rx_slots == NULL || w->tx_slots == NULL))
+		{
+			std::cerr << "Error: Out of memory" << std::endl;
+			mock_stop = 1;
+		}
+	}
+
+	signal(SIGINT, stop_mock);
+	signal(SIGTERM, stop_mock);
+	signal(SIGPIPE, SIG_IGN);
+	std::vector<std::thread> running;
+	if (!mock_stop)
+	{
+		for (struct mock_worker *w : workers)
+		{
+			running.emplace_back(w->tcp ? run_tcp_worker : run_udp_worker, w);
+		}
+		std::cerr << "Responder on " << listen_text << ": " << threads << " UDP threads, TCP, "
+				  << cfg->zone.size() << " names" << (cfg->wildcard.empty() ? "" : " and wildcard") << std::endl;
+	}
+	for (std::thread &t : running)
+	{
+		t.join();
+	}
+
+	struct mock_stats total = {};
+	for (struct mock_worker *w : workers)
+	{
+		total.queries += w->stats.queries;
+		total.answered += w->stats.answered;
+		total.dropped += w->stats.dropped;
+		total.truncated += w->stats.truncated;
+		total.rcodes += w->stats.rcodes;
+		total.nxdomain += w->stats.nxdomain;
+		total.formerr += w->stats.formerr;
+		total.referrals += w->stats.referrals;
+		for (int c = 0; c < MOCK_MAX_TCP_CLIENTS; c++)
+		{
+			stream_free(&w->clients[c].conn);
+		}
+		free(w->rx_slots);
+		free(w->tx_slots);
+		delete w;
+	}
+	if (udp_sock >= 0)
+	{
+		close(udp_sock);
+	}
+	if (tcp_sock >= 0)
+	{
+		close(tcp_sock);
+	}
+	bool failed = running.empty();
+	std::cerr << "Queries: " << total.queries << ", Answered: " << total.answered << ", Dropped: " << total.dropped
+			  << ", Truncated: " << total.truncated << ", Injected rcodes: " << total.rcodes
+			  << ", NXDOMAIN: " << total.nxdomain << ", FORMERR: " << total.formerr << ", Referrals: " << total.referrals
+			  << std::endl;
+	delete cfg;
+	return failed ? 1 : 0;
+}
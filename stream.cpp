@@ -0,0 +1,239 @@
+// author: Marek Kozumplik, xkozum08
+#include "stream.hpp"
+
+/// @brief initializes closed connection, buffers are allocated by the first stream_connect
+/// @param conn
+void stream_init(struct stream_conn *conn)
+{
+	std::memset(conn, 0, sizeof(*conn));
+	conn->sock = -1;
+}
+
+/// @brief closes the connection and frees the buffers
+/// @param conn
+void stream_free(struct stream_conn *conn)
+{
+	stream_close(conn);
+	free(conn->tx);
+	free(conn->rx);
+	conn->tx = NULL;
+	conn->rx = NULL;
+}
+
+/// @brief allocates the buffers when the connection is used for the first time, they are kept for the next ones
+/// @param conn
+/// @return 0 on success, -1 if out of memory
+static int stream_alloc(struct stream_conn *conn)
+{
+	if (conn->tx == NULL)
+	{
+		conn->tx = (unsigned char *)malloc(STREAM_TX_BUF);
+		conn->rx = (unsigned char *)malloc(STREAM_RX_BUF);
+		conn->tx_cap = STREAM_TX_BUF;
+		if (conn->tx == NULL || conn->rx == NULL)
+		{
+			std::cerr << "Error: Out of memory" << std::endl;
+			free(conn->tx);
+			free(conn->rx);
+			conn->tx = NULL;
+			conn->rx = NULL;
+			return -1;
+		}
+	}
+	conn->tx_len = 0;
+	conn->tx_sent = 0;
+	conn->rx_len = 0;
+	conn->rx_off = 0;
+	return 0;
+}
+
+/// @brief starts non-blocking connect to the server, queued messages are sent when it finishes
+/// @param conn
+/// @param addr
+/// @param addr_len
+/// @return 0 on success, -1 on error
+int stream_connect(struct stream_conn *conn, struct sockaddr_storage *addr, socklen_t addr_len)
+{
+	if (stream_alloc(conn) < 0)
+	{
+		return -1;
+	}
+	conn->sock = socket(addr->ss_family, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP);
+	if (conn->sock < 0)
+	{
+		perror("Error creating socket");
+		return -1;
+	}
+	// queries are small and must not wait for Nagle's algorithm
+	int one = 1;
+	setsockopt(conn->sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	conn->syscalls++;
+	conn->connects++;
+	if (connect(conn->sock, (struct sockaddr *)addr, addr_len) < 0 && errno != EINPROGRESS)
+	{
+		close(conn->sock);
+		conn->sock = -1;
+		return -1;
+	}
+	conn->connecting = 1;
+	return 0;
+}
+
+/// @brief takes over accepted non-blocking socket of a client, messages are read and written like on connection to a server
+/// @param conn closed connection
+/// @param sock
+/// @return 0 on success, -1 if out of memory (the socket is not closed)
+int stream_accept(struct stream_conn *conn, int sock)
+{
+	if (stream_alloc(conn) < 0)
+	{
+		return -1;
+	}
+	int one = 1;
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	conn->sock = sock;
+	conn->connecting = 0;
+	conn->connects++;
+	return 0;
+}
+
+/// @brief closes the socket and drops queued and partly received messages
+/// @param conn
+void stream_close(struct stream_conn *conn)
+{
+	if (conn->sock >= 0)
+	{
+		close(conn->sock);
+	}
+	conn->sock = -1;
+	conn->connecting = 0;
+	conn->tx_len = 0;
+	conn->tx_sent = 0;
+	conn->rx_len = 0;
+	conn->rx_off = 0;
+}
+
+/// @brief appends the message with its length prefix to the send buffer
+/// @param conn
+/// @param msg
+/// @param len
+/// @return 0 on success, -1 if out of memory
+int stream_queue(struct stream_conn *conn, const unsigned char *msg, int len)
+{
+	if (conn->tx_sent == conn->tx_len)
+	{
+		conn->tx_len = 0;
+		conn->tx_sent = 0;
+	}
+	if (conn->tx_len + 2 + len > conn->tx_cap)
+	{
+		int cap = std::max(2 * conn->tx_cap, conn->tx_len + 2 + len);
+		unsigned char *bigger = (unsigned char *)realloc(conn->tx, cap);
+		if (bigger == NULL)
+		{
+			return -1;
+		}
+		conn->tx = bigger;
+		conn->tx_cap = cap;
+	}
+	conn->tx[conn->tx_len] = len >> 8;
+	conn->tx[conn->tx_len + 1] = len & 0xFF;
+	std::memcpy(&conn->tx[conn->tx_len + 2], msg, len);
+	conn->tx_len += 2 + len;
+	conn->sent++;
+	return 0;
+}
+
+/// @brief writes as much of the send buffer as the socket accepts
+/// @param conn
+/// @return 0 on success (also when the socket is full or still connecting), -1 if the connection failed
+int stream_flush(struct stream_conn *conn)
+{
+	while (conn->sock >= 0 && conn->tx_sent < conn->tx_len)
+	{
+		conn->syscalls++;
+		ssize_t n = send(conn->sock, &conn->tx[conn->tx_sent], conn->tx_len - conn->tx_sent, MSG_NOSIGNAL);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			// send waits for the connect to finish, it fails with EAGAIN on non-blocking socket
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+		}
+		conn->connecting = 0;
+		conn->tx_sent += n;
+	}
+	if (conn->tx_sent == conn->tx_len)
+	{
+		conn->tx_len = 0;
+		conn->tx_sent = 0;
+	}
+	return (conn->sock >= 0) ? 0 : -1;
+}
+
+/// @brief reads all bytes waiting on the socket into the receive buffer
+/// @param conn
+/// @return 0 on success, -1 if the connection was closed or failed
+int stream_receive(struct stream_conn *conn)
+{
+	// messages taken by stream_next_msg are dropped from the buffer
+	if (conn->rx_off > 0)
+	{
+		std::memmove(conn->rx, &conn->rx[conn->rx_off], conn->rx_len - conn->rx_off);
+		conn->rx_len -= conn->rx_off;
+		conn->rx_off = 0;
+	}
+	while (conn->rx_len < STREAM_RX_BUF)
+	{
+		conn->syscalls++;
+		ssize_t n = recv(conn->sock, &conn->rx[conn->rx_len], STREAM_RX_BUF - conn->rx_len, 0);
+		if (n == 0)
+		{
+			return -1; // closed by the server
+		}
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+		}
+		conn->connecting = 0;
+		conn->rx_len += n;
+	}
+	return 0;
+}
+
+/// @brief returns the next whole received message
+/// @param conn
+/// @param len length of the message
+/// @return pointer to the message (valid until the next stream_receive) or NULL
+unsigned char *stream_next_msg(struct stream_conn *conn, int *len)
+{
+	int available = conn->rx_len - conn->rx_off;
+	if (available < 2)
+	{
+		return NULL;
+	}
+	*len = (conn->rx[conn->rx_off] << 8) | conn->rx[conn->rx_off + 1];
+	if (available < 2 + *len)
+	{
+		return NULL;
+	}
+	unsigned char *msg = &conn->rx[conn->rx_off + 2];
+	conn->rx_off += 2 + *len;
+	conn->received++;
+	return msg;
+}
+
+/// @brief returns true if the socket should be watched for writability
+/// @param conn
+/// @return
+bool stream_wants_write(struct stream_conn *conn)
+{
+	return conn->sock >= 0 && (conn->connecting || conn->tx_sent < conn->tx_len);
+}
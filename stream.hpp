@@ -0,0 +1,84 @@
+// author: Marek Kozumplik, xkozum08
+#pragma once
+#include "dns.hpp"
+#include <netinet/tcp.h>
+
+#define STREAM_RX_BUF (2 * (65535 + 2)) // at least one whole message behind a partly read one
+#define STREAM_TX_BUF 16384				 // initial size of the send buffer, it grows when needed
+
+/*
+	TCP connection to one server (RFC 7766). Every message is prefixed by its length (2 bytes), queries
+	are pipelined without waiting for responses and responses may come in any order.
+*/
+struct stream_conn
+{
+	int sock;		// -1 if not connected
+	int connecting; // 1 until the non-blocking connect finishes
+
+	unsigned char *tx; // queued messages with length prefix
+	int tx_len;
+	int tx_sent; // bytes of tx already written to the socket
+	int tx_cap;
+
+	unsigned char *rx; // received bytes, messages are taken from rx_off
+	int rx_len;
+	int rx_off;
+
+	unsigned long syscalls; // connect, send and recv calls
+	unsigned long sent;		// messages
+	unsigned long received; // messages
+	unsigned long connects;
+};
+
+/// @brief initializes closed connection, buffers are allocated by the first stream_connect
+/// @param conn
+void stream_init(struct stream_conn *conn);
+
+/// @brief closes the connection and frees the buffers
+/// @param conn
+void stream_free(struct stream_conn *conn);
+
+/// @brief starts non-blocking connect to the server, queued messages are sent when it finishes
+/// @param conn
+/// @param addr
+/// @param addr_len
+/// @return 0 on success, -1 on error
+int stream_connect(struct stream_conn *conn, struct sockaddr_storage *addr, socklen_t addr_len);
+
+/// @brief takes over accepted non-blocking socket of a client, messages are read and written like on connection to a server
+/// @param conn closed connection
+/// @param sock
+/// @return 0 on success, -1 if out of memory (the socket is not closed)
+int stream_accept(struct stream_conn *conn, int sock);
+
+/// @brief closes the socket and drops queued and partly received messages
+/// @param conn
+void stream_close(struct stream_conn *conn);
+
+/// @brief appends the message with its length prefix to the send buffer
+/// @param conn
+/// @param msg
+/// @param len
+/// @return 0 on success, -1 if out of memory
+int stream_queue(struct stream_conn *conn, const unsigned char *msg, int len);
+
+/// @brief writes as much of the send buffer as the socket accepts
+/// @param conn
+/// @return 0 on success (also when the socket is full or still connecting), -1 if the connection failed
+int stream_flush(struct stream_conn *conn);
+
+/// @brief reads all bytes waiting on the socket into the receive buffer
+/// @param conn
+/// @return 0 on success, -1 if the connection was closed or failed
+int stream_receive(struct stream_conn *conn);
+
+/// @brief returns the next whole received message
+/// @param conn
+/// @param len length of the message
+/// @return pointer to the message (valid until the next stream_receive) or NULL
+unsigned char *stream_next_msg(struct stream_conn *conn, int *len);
+
+/// @brief returns true if the socket should be watched for writability
+/// @param conn
+/// @return
+bool stream_wants_write(struct stream_conn *conn);
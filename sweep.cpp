@@ -0,0 +1,162 @@
+// author: Marek Kozumplik, xkozum08
+#include "sweep.hpp"
+
+/// @brief writes text of the label (decimal octet or hex nibble) to digits
+/// @param sweep
+/// @param label
+/// @param digits buffer of 3 characters
+/// @return length of the label
+static int label_digits(struct reverse_sweep *sweep, int label, char *digits)
+{
+	if (sweep->family == AF_INET)
+	{
+		unsigned char octet = sweep->addr[3 - label];
+		int len = (octet >= 100) ? 3 : (octet >= 10) ? 2 : 1;
+		for (int i = len - 1; i >= 0; i--)
+		{
+			digits[i] = '0' + octet % 10;
+			octet /= 10;
+		}
+		return len;
+	}
+	unsigned char byte = sweep->addr[15 - label / 2];
+	digits[0] = "0123456789abcdef"[(label & 1) ? byte >> 4 : byte & 0x0F];
+	return 1;
+}
+
+/// @brief writes labels 0 to last again, right to left in front of label last + 1
+/// @param sweep
+/// @param last highest label which changed
+static void write_labels(struct reverse_sweep *sweep, int last)
+{
+	int wire_pos = sweep->wire_label[last + 1];
+	int text_pos = sweep->text_label[last + 1];
+	for (int i = last; i >= 0; i--)
+	{
+		char digits[3];
+		int len = label_digits(sweep, i, digits);
+		wire_pos -= len + 1;
+		sweep->wire[wire_pos] = len;
+		std::memcpy(&sweep->wire[wire_pos + 1], digits, len);
+		text_pos -= len + 1;
+		std::memcpy(&sweep->text[text_pos], digits, len);
+		sweep->text[text_pos + len] = '.';
+		sweep->wire_label[i] = wire_pos;
+		sweep->text_label[i] = text_pos;
+	}
+}
+
+/// @brief increments the address
+/// @param sweep
+/// @return highest label which changed
+static int increment_address(struct reverse_sweep *sweep)
+{
+	int bytes = (sweep->family == AF_INET) ? 4 : 16;
+	for (int i = bytes - 1; i >= 0; i--)
+	{
+		sweep->addr[i]++;
+		if (sweep->addr[i] != 0)
+		{
+			int byte_label = bytes - 1 - i;
+			if (sweep->family == AF_INET)
+			{
+				return byte_label;
+			}
+			// the high nibble changed only if the low nibble overflowed
+			return ((sweep->addr[i] & 0x0F) == 0) ? 2 * byte_label + 1 : 2 * byte_label;
+		}
+	}
+	return sweep->labels - 1;
+}
+
+/// @brief parses the prefix (address/length, any inet_pton form) and prepares the name of the first address
+/// @param sweep
+/// @param cidr
+/// @return 0 on success, -1 if the prefix is invalid or too large (error is printed)
+int sweep_init(struct reverse_sweep *sweep, const char *cidr)
+{
+	char address[INET6_ADDRSTRLEN];
+	const char *slash = strchr(cidr, '/');
+	if (slash == NULL || slash - cidr >= (long)sizeof(address))
+	{
+		std::cerr << "Error: Invalid prefix " << cidr << std::endl;
+		return -1;
+	}
+	std::memcpy(address, cidr, slash - cidr);
+	address[slash - cidr] = '\0';
+
+	int bits;
+	std::memset(sweep->addr, 0, sizeof(sweep->addr));
+	if (inet_pton(AF_INET, address, sweep->addr) == 1)
+	{
+		sweep->family = AF_INET;
+		sweep->labels = 4;
+		bits = 32;
+	}
+	else if (inet_pton(AF_INET6, address, sweep->addr) == 1)
+	{
+		sweep->family = AF_INET6;
+		sweep->labels = 32;
+		bits = 128;
+	}
+	else
+	{
+		std::cerr << "Error: Invalid address of prefix " << cidr << std::endl;
+		return -1;
+	}
+
+	char *end;
+	long prefix = strtol(slash + 1, &end, 10);
+	if (slash[1] == '\0' || *end != '\0' || prefix < 0 || prefix > bits)
+	{
+		std::cerr << "Error: Invalid prefix length " << cidr << std::endl;
+		return -1;
+	}
+	if (bits - prefix > SWEEP_MAX_HOST_BITS)
+	{
+		std::cerr << "Error: Prefix " << cidr << " is too large, at most 2^" << SWEEP_MAX_HOST_BITS << " addresses can be swept" << std::endl;
+		return -1;
+	}
+	// start at the network address
+	for (int bit = prefix; bit < bits; bit++)
+	{
+		sweep->addr[bit / 8] &= ~(0x80 >> (bit % 8));
+	}
+	sweep->remaining = 1ULL << (bits - prefix);
+	sweep->generated = 0;
+
+	const char *wire_suffix = (sweep->family == AF_INET) ? "\7in-addr\4arpa" : "\3ip6\4arpa";
+	const char *text_suffix = (sweep->family == AF_INET) ? "in-addr.arpa" : "ip6.arpa";
+	int wire_len = strlen(wire_suffix) + 1;
+	int text_len = strlen(text_suffix) + 1;
+	std::memcpy(&sweep->wire[SWEEP_BUF - wire_len], wire_suffix, wire_len);
+	std::memcpy(&sweep->text[SWEEP_BUF - text_len], text_suffix, text_len);
+	sweep->wire_label[sweep->labels] = SWEEP_BUF - wire_len;
+	sweep->text_label[sweep->labels] = SWEEP_BUF - text_len;
+	write_labels(sweep, sweep->labels - 1);
+	return 0;
+}
+
+/// @brief fills the request with the reverse name of the next address of the prefix
+/// @param sweep
+/// @param req
+/// @return 1 if the request was filled, 0 if all addresses were generated
+int sweep_next(struct reverse_sweep *sweep, struct dns_query_request *req)
+{
+	if (sweep->remaining == 0)
+	{
+		return 0;
+	}
+	req->qname_len = SWEEP_BUF - sweep->wire_label[0];
+	std::memcpy(req->qname, &sweep->wire[sweep->wire_label[0]], req->qname_len);
+	std::memcpy(req->name, &sweep->text[sweep->text_label[0]], SWEEP_BUF - sweep->text_label[0]);
+	req->qtype = QTYPE_PTR;
+	req->reverse = 1;
+	req->tag = ++sweep->generated;
+
+	if (--sweep->remaining > 0)
+	{
+		write_labels(sweep, increment_address(sweep));
+	}
+	return 1;
+}
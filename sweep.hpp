@@ -0,0 +1,41 @@
+// author: Marek Kozumplik, xkozum08
+#pragma once
+#include "dns.hpp"
+#include "resolver.hpp"
+
+#define SWEEP_MAX_HOST_BITS 32 // at most 2^32 addresses in one sweep
+#define SWEEP_BUF 128			// longest reverse name (ip6, 73 characters) fits
+
+/*
+	Reverse names of the prefix are generated from the lowest address to the highest. The name is kept
+	right aligned in the buffer, so when the lowest labels change (also to a different length) only they
+	are written again, the rest of the name and the suffix stay in place.
+
+	wire:  ... | 1 '5' | 1 '1' | 1 '0' | 2 '10' | 7 'in-addr' | 4 'arpa' | 0 |
+	             ^ start                                                       ^ SWEEP_BUF - 1
+*/
+struct reverse_sweep
+{
+	int family; // AF_INET or AF_INET6
+	int labels; // 4 for ip4 (one for every octet), 32 for ip6 (one for every nibble)
+	unsigned char addr[16];
+	unsigned long long remaining; // addresses not yet generated
+	unsigned long long generated;
+
+	unsigned char wire[SWEEP_BUF]; // name in dns format, starts at wire_label[0]
+	char text[SWEEP_BUF];		   // same name as text, starts at text_label[0], without dot at the end
+	int wire_label[33];			   // offset of the label, label 0 is the lowest octet/nibble, [labels] is the suffix
+	int text_label[33];
+};
+
+/// @brief parses the prefix (address/length, any inet_pton form) and prepares the name of the first address
+/// @param sweep
+/// @param cidr
+/// @return 0 on success, -1 if the prefix is invalid or too large (error is printed)
+int sweep_init(struct reverse_sweep *sweep, const char *cidr);
+
+/// @brief fills the request with the reverse name of the next address of the prefix
+/// @param sweep
+/// @param req
+/// @return 1 if the request was filled, 0 if all addresses were generated
+int sweep_next(struct reverse_sweep *sweep, struct dns_query_request *req);
@@ -0,0 +1,566 @@
+// author: Marek Kozumplik, xkozum08
+#include "table.hpp"
+#include "encoder.hpp"
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <algorithm>
+
+#define TABLE_LOAD_PERCENT 80	// entries per slot
+#define TABLE_BUCKET_SIZE 4		// average entries per bucket
+#define TABLE_MAX_DISP (1 << 20) // displacements tried for one bucket before the seed is changed
+#define TABLE_MAX_SEEDS 32
+
+/// @brief finalizer of splitmix64, spreads the bits of the hash
+/// @param x
+/// @return
+static inline uint64_t mix64(uint64_t x)
+{
+	x ^= x >> 31;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 29;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 32;
+	return x;
+}
+
+/// @brief FNV-1a hash of the name in dns format, case insensitive
+/// @param name
+/// @param name_len
+/// @param seed
+/// @param suffix
+/// @return
+static inline uint64_t name_hash(const unsigned char *name, int name_len, uint32_t seed, int suffix)
+{
+	uint64_t h = 0xcbf29ce484222325ULL ^ seed;
+	for (int i = 0; i < name_len; i++)
+	{
+		// length bytes are below 64, so they are not changed
+		unsigned char c = name[i];
+		h ^= (c >= 'A' && c <= 'Z') ? c + 32 : c;
+		h *= 0x100000001b3ULL;
+	}
+	return mix64(h ^ (suffix ? TABLE_SUFFIX_SALT : 0));
+}
+
+/// @brief returns bucket of the hash
+/// @param h
+/// @param bucket_cnt
+/// @return
+static inline uint32_t bucket_of(uint64_t h, uint32_t bucket_cnt)
+{
+	return ((h >> 32) * bucket_cnt) >> 32;
+}
+
+/// @brief returns slot of the hash in the bucket with the displacement
+/// @param h
+/// @param disp
+/// @param slot_cnt
+/// @return
+static inline uint32_t slot_of(uint64_t h, uint32_t disp, uint32_t slot_cnt)
+{
+	return ((mix64(h + disp * 0x9e3779b97f4a7c15ULL) & 0xffffffff) * slot_cnt) >> 32;
+}
+
+// name from the input files while the table is compiled
+struct table_source
+{
+	std::string name; // dns format, lower case
+	uint8_t action;
+	uint8_t suffix;
+	std::string a; // addresses in network byte order
+	std::string aaaa;
+	uint64_t hash;
+};
+
+/// @brief adds the address to the list unless it is already there or the list is full
+/// @param list
+/// @param addr
+/// @param size 4 or 16
+static void add_address(std::string &list, const unsigned char *addr, size_t size)
+{
+	if (list.size() / size >= TABLE_MAX_ADDRESSES)
+	{
+		return;
+	}
+	for (size_t off = 0; off < list.size(); off += size)
+	{
+		if (std::memcmp(&list[off], addr, size) == 0)
+		{
+			return;
+		}
+	}
+	list.append((const char *)addr, size);
+}
+
+/// @brief adds the name of the input to the sources, blocking wins over addresses of the same name
+/// @param sources
+/// @param index sources by name and suffix flag
+/// @param text name, *.name for subdomains
+/// @param addr NULL - blocked name
+/// @param addr_size 4 or 16
+/// @return 0 on success, -1 if the name is invalid
+static int add_source(std::vector<struct table_source> &sources, std::unordered_map<std::string, size_t> &index, std::string text,
+					  const unsigned char *addr, size_t addr_size)
+{
+	uint8_t suffix = 0;
+	if (text.compare(0, 2, "*.") == 0)
+	{
+		suffix = 1;
+		text.erase(0, 2);
+	}
+	if (!text.empty() && text.back() == '.')
+	{
+		text.pop_back();
+	}
+	unsigned char wire[NAME_WIRE_BUF];
+	int len = convert_domain_to_dns(text.c_str(), wire);
+	if (len <= 0)
+	{
+		return -1;
+	}
+	std::string key((const char *)wire, len);
+	key += (char)suffix;
+	auto found = index.find(key);
+	struct table_source *source;
+	if (found == index.end())
+	{
+		index.emplace(key, sources.size());
+		sources.emplace_back();
+		source = &sources.back();
+		source->name.assign((const char *)wire, len);
+		source->suffix = suffix;
+		source->action = (addr == NULL) ? TABLE_BLOCK : TABLE_ANSWER;
+	}
+	else
+	{
+		source = &sources[found->second];
+	}
+	if (addr == NULL)
+	{
+		source->action = TABLE_BLOCK;
+		source->a.clear();
+		source->aaaa.clear();
+	}
+	else if (source->action == TABLE_ANSWER)
+	{
+		add_address((addr_size == 4) ? source->a : source->aaaa, addr, addr_size);
+	}
+	return 0;
+}
+
+/// @brief reads one input file, lines are "address name..." (static answer), "name..." (blocked) or comments after #
+/// @param path
+/// @param sources
+/// @param index
+/// @param stats
+/// @return 0 on success, -1 if the file cannot be read
+static int read_source_file(const std::string &path, std::vector<struct table_source> &sources,
+							std::unordered_map<std::string, size_t> &index, struct table_compile_stats *stats)
+{
+	std::ifstream file(path);
+	if (!file)
+	{
+		std::cerr << "Error: Cannot open " << path << std::endl;
+		return -1;
+	}
+	std::string line;
+	while (std::getline(file, line))
+	{
+		stats->lines++;
+		size_t comment = line.find('#');
+		if (comment != std::string::npos)
+		{
+			line.erase(comment);
+		}
+		std::istringstream tokens(line);
+		std::string first;
+		if (!(tokens >> first))
+		{
+			continue;
+		}
+		unsigned char addr[16];
+		size_t addr_size = 0;
+		if (inet_pton(AF_INET, first.c_str(), addr) == 1)
+		{
+			addr_size = 4;
+		}
+		else if (inet_pton(AF_INET6, first.c_str(), addr) == 1)
+		{
+			addr_size = 16;
+		}
+		else if (add_source(sources, index, first, NULL, 0) < 0)
+		{
+			stats->skipped++;
+		}
+		std::string name;
+		while (tokens >> name)
+		{
+			if (add_source(sources, index, name, (addr_size > 0) ? addr : NULL, addr_size) < 0)
+			{
+				stats->skipped++;
+			}
+		}
+	}
+	return 0;
+}
+
+/// @brief finds displacement of every bucket, so every source gets its own slot
+/// @param sources hashes are computed with the seed
+/// @param seed
+/// @param bucket_cnt
+/// @param slot_cnt
+/// @param disp
+/// @param slots source of every slot, -1 if empty
+/// @return true on success, false if some bucket has no displacement with this seed
+static bool place_sources(std::vector<struct table_source> &sources, uint32_t seed, uint32_t bucket_cnt, uint32_t slot_cnt,
+						  std::vector<uint32_t> &disp, std::vector<int64_t> &slots)
+{
+	// sources sorted by bucket, the largest buckets are placed first while the slots are still free
+	std::vector<uint32_t> start(bucket_cnt + 1, 0);
+	for (struct table_source &source : sources)
+	{
+		source.hash = name_hash((const unsigned char *)source.name.data(), source.name.size(), seed, source.suffix);
+		start[bucket_of(source.hash, bucket_cnt) + 1]++;
+	}
+	for (uint32_t b = 0; b < bucket_cnt; b++)
+	{
+		start[b + 1] += start[b];
+	}
+	std::vector<uint32_t> members(sources.size());
+	std::vector<uint32_t> fill(start.begin(), start.end() - 1);
+	for (size_t i = 0; i < sources.size(); i++)
+	{
+		members[fill[bucket_of(sources[i].hash, bucket_cnt)]++] = i;
+	}
+	std::vector<uint32_t> order(bucket_cnt);
+	for (uint32_t b = 0; b < bucket_cnt; b++)
+	{
+		order[b] = b;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t x, uint32_t y)
+					 { return start[x + 1] - start[x] > start[y + 1] - start[y]; });
+
+	disp.assign(bucket_cnt, 0);
+	slots.assign(slot_cnt, -1);
+	std::vector<uint32_t> taken;
+	for (uint32_t b : order)
+	{
+		uint32_t size = start[b + 1] - start[b];
+		if (size == 0)
+		{
+			break;
+		}
+		uint32_t d = 0;
+		for (; d < TABLE_MAX_DISP; d++)
+		{
+			taken.clear();
+			for (uint32_t m = start[b]; m < start[b + 1]; m++)
+			{
+				uint32_t slot = slot_of(sources[members[m]].hash, d, slot_cnt);
+				if (slots[slot] >= 0 || std::find(taken.begin(), taken.end(), slot) != taken.end())
+				{
+					break;
+				}
+				taken.push_back(slot);
+			}
+			if (taken.size() == size)
+			{
+				break;
+			}
+		}
+		if (d == TABLE_MAX_DISP)
+		{
+			return false;
+		}
+		disp[b] = d;
+		for (uint32_t m = start[b]; m < start[b + 1]; m++)
+		{
+			slots[taken[m - start[b]]] = members[m];
+		}
+	}
+	return true;
+}
+
+/// @brief compiles hosts files ("address name...") and block lists ("name" or "*.name") into the table file
+/// @param inputs
+/// @param ttl of the answers
+/// @param path written to a temporary file and renamed, running resolvers keep the old mapping
+/// @param stats
+/// @return 0 on success, -1 on error (printed)
+int table_compile(const std::vector<std::string> &inputs, int ttl, const char *path, struct table_compile_stats *stats)
+{
+	std::memset(stats, 0, sizeof(*stats));
+	std::vector<struct table_source> sources;
+	std::unordered_map<std::string, size_t> index;
+	for (const std::string &input : inputs)
+	{
+		if (read_source_file(input, sources, index, stats) < 0)
+		{
+			return -1;
+		}
+	}
+	index.clear();
+	for (const struct table_source &source : sources)
+	{
+		stats->blocked += source.action == TABLE_BLOCK;
+		stats->answered += source.action == TABLE_ANSWER;
+		stats->suffixes += source.suffix;
+	}
+
+	uint32_t bucket_cnt = sources.size() / TABLE_BUCKET_SIZE + 1;
+	uint32_t slot_cnt = sources.size() * 100 / TABLE_LOAD_PERCENT + 1;
+	uint32_t seed = 0;
+	std::vector<uint32_t> disp;
+	std::vector<int64_t> slots;
+	do
+	{
+		seed = mix64(++stats->attempts);
+		if (stats->attempts > TABLE_MAX_SEEDS)
+		{
+			std::cerr << "Error: No perfect hash found for the table" << std::endl;
+			return -1;
+		}
+	} while (!place_sources(sources, seed, bucket_cnt, slot_cnt, disp, slots));
+
+	// names and addresses of the entries in slot order
+	std::vector<struct table_entry> entries(slot_cnt);
+	std::string data;
+	for (uint32_t s = 0; s < slot_cnt; s++)
+	{
+		struct table_entry *entry = &entries[s];
+		std::memset(entry, 0, sizeof(*entry));
+		if (slots[s] < 0)
+		{
+			continue;
+		}
+		const struct table_source *source = &sources[slots[s]];
+		entry->name_off = data.size();
+		entry->name_len = source->name.size();
+		entry->action = source->action;
+		entry->suffix = source->suffix;
+		data += source->name;
+		entry->a_cnt = source->a.size() / 4;
+		entry->aaaa_cnt = source->aaaa.size() / 16;
+		entry->addr_off = data.size();
+		data += source->a;
+		data += source->aaaa;
+	}
+
+	struct table_header header;
+	std::memset(&header, 0, sizeof(header));
+	header.magic = TABLE_MAGIC;
+	header.version = TABLE_VERSION;
+	header.entry_cnt = sources.size();
+	header.bucket_cnt = bucket_cnt;
+	header.slot_cnt = slot_cnt;
+	header.suffix_cnt = stats->suffixes;
+	header.ttl = ttl;
+	header.seed = seed;
+	header.disp_off = sizeof(header);
+	header.entries_off = header.disp_off + bucket_cnt * sizeof(uint32_t);
+	uint64_t data_off = header.entries_off + (uint64_t)slot_cnt * sizeof(struct table_entry);
+	header.size = data_off + data.size();
+	if (header.size > UINT32_MAX)
+	{
+		std::cerr << "Error: Table is larger than 4 GiB" << std::endl;
+		return -1;
+	}
+	header.data_off = data_off;
+	header.created = time(NULL);
+	stats->size = header.size;
+
+	// write to temporary file and rename, the old table may still be mapped
+	std::string tmp = std::string(path) + ".tmp";
+	FILE *file = fopen(tmp.c_str(), "wb");
+	if (file == NULL)
+	{
+		perror("Error writing table");
+		return -1;
+	}
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	ok = ok && fwrite(disp.data(), sizeof(uint32_t), bucket_cnt, file) == bucket_cnt;
+	ok = ok && fwrite(entries.data(), sizeof(struct table_entry), slot_cnt, file) == slot_cnt;
+	ok = ok && fwrite(data.data(), 1, data.size(), file) == data.size();
+	ok = (fclose(file) == 0) && ok;
+	if (!ok || rename(tmp.c_str(), path) < 0)
+	{
+		perror("Error writing table");
+		unlink(tmp.c_str());
+		return -1;
+	}
+	return 0;
+}
+
+/// @brief maps the table file, only the header is checked
+/// @param table
+/// @param path
+/// @return 0 on success, -1 on error (printed)
+int table_open(struct dns_table *table, const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		perror("Error opening table");
+		return -1;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct table_header))
+	{
+		std::cerr << "Error: Invalid table " << path << std::endl;
+		close(fd);
+		return -1;
+	}
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+	{
+		perror("Error mapping table");
+		return -1;
+	}
+
+	const struct table_header *header = (const struct table_header *)map;
+	if (header->magic != TABLE_MAGIC || header->version != TABLE_VERSION || header->size != (uint64_t)st.st_size ||
+		header->bucket_cnt == 0 || header->slot_cnt == 0 || header->disp_off < sizeof(struct table_header) ||
+		header->disp_off + (uint64_t)header->bucket_cnt * sizeof(uint32_t) > header->entries_off || header->entries_off % 4 != 0 ||
+		header->entries_off + (uint64_t)header->slot_cnt * sizeof(struct table_entry) > header->data_off ||
+		header->data_off > header->size)
+	{
+		std::cerr << "Error: Invalid table " << path << std::endl;
+		munmap(map, st.st_size);
+		return -1;
+	}
+	table->map = (const unsigned char *)map;
+	table->size = st.st_size;
+	table->header = header;
+	table->disp = (const uint32_t *)(table->map + header->disp_off);
+	table->entries = (const struct table_entry *)(table->map + header->entries_off);
+	table->data = table->map + header->data_off;
+	return 0;
+}
+
+/// @brief unmaps the table file
+/// @param table
+void table_close(struct dns_table *table)
+{
+	munmap((void *)table->map, table->size);
+}
+
+/// @brief finds the entry of exactly this name
+/// @param table
+/// @param name
+/// @param name_len
+/// @param suffix
+/// @return entry or NULL, also for entries pointing outside of the file
+static const struct table_entry *table_find(const struct dns_table *table, const unsigned char *name, int name_len, int suffix)
+{
+	const struct table_header *header = table->header;
+	uint64_t h = name_hash(name, name_len, header->seed, suffix);
+	uint32_t disp = table->disp[bucket_of(h, header->bucket_cnt)];
+	const struct table_entry *entry = &table->entries[slot_of(h, disp, header->slot_cnt)];
+	size_t data_size = table->size - header->data_off;
+	if (entry->name_len != name_len || entry->suffix != suffix || (size_t)entry->name_off + name_len > data_size ||
+		(size_t)entry->addr_off + entry->a_cnt * 4 + entry->aaaa_cnt * 16 > data_size)
+	{
+		return NULL;
+	}
+	const unsigned char *stored = table->data + entry->name_off;
+	for (int i = 0; i < name_len; i++)
+	{
+		unsigned char c = name[i];
+		if (((c >= 'A' && c <= 'Z') ? c + 32 : c) != stored[i])
+		{
+			return NULL;
+		}
+	}
+	return entry;
+}
+
+/// @brief finds the name, then its parent names in suffix rules, the longest first
+/// @param table
+/// @param name in dns format, any case
+/// @param name_len
+/// @return entry or NULL
+const struct table_entry *table_lookup(const struct dns_table *table, const unsigned char *name, int name_len)
+{
+	const struct table_entry *entry = table_find(table, name, name_len, 0);
+	if (entry != NULL || table->header->suffix_cnt == 0)
+	{
+		return entry;
+	}
+	// parent names without the root
+	for (int off = name[0] + 1; off < name_len && name[off] != 0; off += name[off] + 1)
+	{
+		entry = table_find(table, name + off, name_len - off, 1);
+		if (entry != NULL)
+		{
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+/// @brief writes big endian 16 bit number
+/// @param p
+/// @param value
+static inline void put_u16(unsigned char *p, unsigned value)
+{
+	p[0] = value >> 8;
+	p[1] = value;
+}
+
+/// @brief builds the response of the entry: NXDOMAIN for blocked names, addresses of the type or NODATA otherwise
+/// @param table
+/// @param entry
+/// @param name question name in dns format, copied to the response as it is
+/// @param name_len
+/// @param qtype
+/// @param recursion RD flag of the query
+/// @param result buffer of TABLE_MAX_ANSWER bytes
+/// @return length of the response
+int table_answer(const struct dns_table *table, const struct table_entry *entry, const unsigned char *name, int name_len,
+				 int qtype, int recursion, unsigned char *result)
+{
+	struct dns_header *dns = (struct dns_header *)result;
+	fill_dns_header(dns, recursion, 0);
+	dns->qr = 1;
+	dns->aa = 1;
+	dns->ra = 1;
+	dns->rcode = (entry->action == TABLE_BLOCK) ? 3 : 0;
+	int len = sizeof(struct dns_header);
+	std::memcpy(&result[len], name, name_len);
+	len += name_len;
+	put_u16(&result[len], qtype);
+	put_u16(&result[len + 2], QCLASS_IN);
+	len += 4;
+
+	int cnt = 0;
+	int rdlen = 0;
+	const unsigned char *addr = table->data + entry->addr_off;
+	if (entry->action == TABLE_ANSWER && qtype == QTYPE_A)
+	{
+		cnt = entry->a_cnt;
+		rdlen = 4;
+	}
+	else if (entry->action == TABLE_ANSWER && qtype == QTYPE_AAAA)
+	{
+		cnt = entry->aaaa_cnt;
+		rdlen = 16;
+		addr += entry->a_cnt * 4;
+	}
+	uint32_t ttl = table->header->ttl;
+	for (int i = 0; i < cnt; i++)
+	{
+		// owner is the question name
+		put_u16(&result[len], 0xc00c);
+		put_u16(&result[len + 2], qtype);
+		put_u16(&result[len + 4], QCLASS_IN);
+		put_u16(&result[len + 6], ttl >> 16);
+		put_u16(&result[len + 8], ttl & 0xffff);
+		put_u16(&result[len + 10], rdlen);
+		std::memcpy(&result[len + 12], addr + i * rdlen, rdlen);
+		len += 12 + rdlen;
+	}
+	dns->ans_count = htons(cnt);
+	return len;
+}
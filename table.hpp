@@ -0,0 +1,125 @@
+// author: Marek Kozumplik, xkozum08
+#pragma once
+#include "dns.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+#include <string>
+
+#define TABLE_MAGIC 0x42544e44 // "DNTB"
+#define TABLE_VERSION 1
+#define TABLE_DEFAULT_TTL 3600	 // TTL of the static answers
+#define TABLE_MAX_ADDRESSES 16	 // addresses of one type kept for one name, the rest is dropped
+#define TABLE_MAX_ANSWER 1024	 // size of the answer buffer, question and TABLE_MAX_ADDRESSES records fit in
+#define TABLE_SUFFIX_SALT 0x9e3779b97f4a7c15ULL // mixed into the hash of suffix rules, so *.name and name differ
+
+// action of the entry
+#define TABLE_BLOCK 1  // answered with NXDOMAIN
+#define TABLE_ANSWER 2 // answered with its addresses, other types with NODATA
+
+/*
+	Table file made by dnstable from hosts files and block lists, all numbers in host byte order
+
+	+------------------------------------------+
+	| table_header                             |
+	+------------------------------------------+
+	| uint32_t disp[bucket_cnt]                |  displacement of the bucket
+	+------------------------------------------+
+	| table_entry entries[slot_cnt]            |  name_len 0 - empty slot
+	+------------------------------------------+
+	| names in dns format and addresses        |
+	+------------------------------------------+
+
+	Names are placed by a minimal perfect hash (hash and displace): hash of the name selects the bucket and the
+	displacement of the bucket selects the slot, so a lookup reads one displacement and one entry whatever the
+	size of the table. The file is mmap'd read only, loading checks only the header.
+*/
+struct table_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t size; // of the whole file
+	uint32_t entry_cnt;
+	uint32_t bucket_cnt;
+	uint32_t slot_cnt;
+	uint32_t suffix_cnt; // entries which match also subdomains, lookups of parent names are skipped without them
+	uint32_t ttl;
+	uint32_t seed; // of the hash, the compiler changes it when no displacements are found
+	uint32_t disp_off;
+	uint32_t entries_off;
+	uint32_t data_off;
+	uint32_t reserved;
+	int64_t created;
+};
+
+struct table_entry
+{
+	uint32_t name_off; // from data_off, lower case
+	uint16_t name_len;
+	uint8_t action;	   // TABLE_BLOCK or TABLE_ANSWER
+	uint8_t suffix;	   // 1 - matches subdomains of the name (*.name in the list), not the name itself
+	uint8_t a_cnt;
+	uint8_t aaaa_cnt;
+	uint16_t reserved;
+	uint32_t addr_off; // from data_off, a_cnt IPv4 addresses followed by aaaa_cnt IPv6 addresses
+};
+
+struct dns_table
+{
+	const unsigned char *map; // read only mapping of the file
+	size_t size;
+	const struct table_header *header;
+	const uint32_t *disp;
+	const struct table_entry *entries;
+	const unsigned char *data;
+};
+
+// result of table_compile
+struct table_compile_stats
+{
+	unsigned long lines;
+	unsigned long skipped; // invalid names and addresses
+	unsigned long blocked;
+	unsigned long answered;
+	unsigned long suffixes;
+	unsigned long attempts; // seeds tried
+	size_t size;
+};
+
+/// @brief compiles hosts files ("address name...") and block lists ("name" or "*.name") into the table file
+/// @param inputs
+/// @param ttl of the answers
+/// @param path written to a temporary file and renamed, running resolvers keep the old mapping
+/// @param stats
+/// @return 0 on success, -1 on error (printed)
+int table_compile(const std::vector<std::string> &inputs, int ttl, const char *path, struct table_compile_stats *stats);
+
+/// @brief maps the table file, only the header is checked
+/// @param table
+/// @param path
+/// @return 0 on success, -1 on error (printed)
+int table_open(struct dns_table *table, const char *path);
+
+/// @brief unmaps the table file
+/// @param table
+void table_close(struct dns_table *table);
+
+/// @brief finds the name, then its parent names in suffix rules, the longest first
+/// @param table
+/// @param name in dns format, any case
+/// @param name_len
+/// @return entry or NULL
+const struct table_entry *table_lookup(const struct dns_table *table, const unsigned char *name, int name_len);
+
+/// @brief builds the response of the entry: NXDOMAIN for blocked names, addresses of the type or NODATA otherwise
+/// @param table
+/// @param entry
+/// @param name question name in dns format, copied to the response as it is
+/// @param name_len
+/// @param qtype
+/// @param recursion RD flag of the query
+/// @param result buffer of TABLE_MAX_ANSWER bytes
+/// @return length of the response
+int table_answer(const struct dns_table *table, const struct table_entry *entry, const unsigned char *name, int name_len,
+				 int qtype, int recursion, unsigned char *result);
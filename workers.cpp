@@ -0,0 +1,423 @@
+// author: Marek Kozumplik, xkozum08
+#include "workers.hpp"
+
+/// @brief pushes the request to the queue
+/// @param queue
+/// @param req
+/// @return false if the queue is full
+bool request_queue_push(struct request_queue *queue, struct dns_query_request *req)
+{
+	unsigned tail = queue->tail.load(std::memory_order_relaxed);
+	if (tail - queue->head.load(std::memory_order_acquire) == WORKER_INPUT_QUEUE)
+	{
+		return false;
+	}
+	queue->items[tail & (WORKER_INPUT_QUEUE - 1)] = *req;
+	queue->tail.store(tail + 1, std::memory_order_release);
+	return true;
+}
+
+/// @brief pops request from the queue
+/// @param queue
+/// @param req
+/// @return false if the queue is empty
+bool request_queue_pop(struct request_queue *queue, struct dns_query_request *req)
+{
+	unsigned head = queue->head.load(std::memory_order_relaxed);
+	if (head == queue->tail.load(std::memory_order_acquire))
+	{
+		return false;
+	}
+	*req = queue->items[head & (WORKER_INPUT_QUEUE - 1)];
+	queue->head.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+/// @brief copies len bytes to the ring at position pos, the copy may wrap around the end
+/// @param ring
+/// @param pos
+/// @param data
+/// @param len
+static void ring_copy_in(struct output_ring *ring, unsigned pos, const void *data, size_t len)
+{
+	size_t start = pos & (WORKER_OUTPUT_RING - 1);
+	size_t first = std::min(len, WORKER_OUTPUT_RING - start);
+	std::memcpy(&ring->buf[start], data, first);
+	std::memcpy(ring->buf, (const unsigned char *)data + first, len - first);
+}
+
+/// @brief copies len bytes from the ring at position pos, the copy may wrap around the end
+/// @param ring
+/// @param pos
+/// @param data
+/// @param len
+static void ring_copy_out(struct output_ring *ring, unsigned pos, void *data, size_t len)
+{
+	size_t start = pos & (WORKER_OUTPUT_RING - 1);
+	size_t first = std::min(len, WORKER_OUTPUT_RING - start);
+	std::memcpy(data, &ring->buf[start], first);
+	std::memcpy((unsigned char *)data + first, ring->buf, len - first);
+}
+
+/// @brief writes text to the output ring, waits while the ring is full
+/// @param ring
+/// @param text
+/// @param len
+/// @param to_stderr
+void output_ring_write(struct output_ring *ring, const char *text, size_t len, bool to_stderr)
+{
+	while (len > 0)
+	{
+		uint32_t chunk = std::min(len, (size_t)OUTPUT_CHUNK);
+		unsigned tail = ring->tail.load(std::memory_order_relaxed);
+		while (WORKER_OUTPUT_RING - (tail - ring->head.load(std::memory_order_acquire)) < chunk + sizeof(uint32_t))
+		{
+			sched_yield(); // main thread is behind with writing
+		}
+		uint32_t header = chunk | (to_stderr ? OUTPUT_STDERR_FLAG : 0);
+		ring_copy_in(ring, tail, &header, sizeof(header));
+		ring_copy_in(ring, tail + sizeof(header), text, chunk);
+		ring->tail.store(tail + sizeof(header) + chunk, std::memory_order_release);
+		text += chunk;
+		len -= chunk;
+	}
+}
+
+/// @brief writes all records from the ring to stdout and stderr
+/// @param ring
+/// @return number of drained bytes
+size_t output_ring_drain(struct output_ring *ring)
+{
+	static char chunk[OUTPUT_CHUNK];
+	unsigned head = ring->head.load(std::memory_order_relaxed);
+	unsigned tail = ring->tail.load(std::memory_order_acquire);
+	size_t drained = tail - head;
+	while (head != tail)
+	{
+		uint32_t header;
+		ring_copy_out(ring, head, &header, sizeof(header));
+		uint32_t len = header & ~OUTPUT_STDERR_FLAG;
+		ring_copy_out(ring, head + sizeof(header), chunk, len);
+		fwrite(chunk, 1, len, (header & OUTPUT_STDERR_FLAG) ? stderr : stdout);
+		head += sizeof(header) + len;
+	}
+	ring->head.store(head, std::memory_order_release);
+	return drained;
+}
+
+/// @brief returns index of the worker which resolves the name, same names always go to the same worker
+/// @param name
+/// @param threads
+/// @return
+int shard_of(const char *name, int threads)
+{
+	// FNV-1a of the lower case name
+	uint32_t hash = 2166136261u;
+	for (int i = 0; name[i] != '\0'; i++)
+	{
+		hash = (hash ^ (unsigned char)tolower(name[i])) * 16777619u;
+	}
+	return hash % threads;
+}
+
+/// @brief moves text formatted by the callbacks to the output ring
+/// @param w
+static void flush_worker_output(struct worker *w)
+{
+	if (w->out.len > 0)
+	{
+		output_ring_write(&w->output, w->out.data, w->out.len, false);
+		w->out.len = 0;
+	}
+	if (w->err.tellp() > 0)
+	{
+		std::string text = w->err.str();
+		output_ring_write(&w->output, text.data(), text.size(), true);
+		w->err.str("");
+	}
+}
+
+/// @brief wakes the worker if it sleeps, called by the main thread after it pushed requests or set input_done
+/// @param w
+static void wake_worker(struct worker *w)
+{
+	// pairs with the fence in worker_sleep, either the worker sees the request or the main thread sees it sleeping
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (w->sleeping.load(std::memory_order_relaxed))
+	{
+		uint64_t one = 1;
+		if (write(w->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		{
+			perror("write");
+		}
+	}
+}
+
+/// @brief waits until the main thread pushes a request or sets input_done
+/// @param w
+static void worker_sleep(struct worker *w)
+{
+	w->sleeping.store(1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (w->input.head.load(std::memory_order_relaxed) == w->input.tail.load(std::memory_order_acquire) &&
+		!w->input_done.load(std::memory_order_acquire))
+	{
+		struct pollfd pfd = {w->wake_fd, POLLIN, 0};
+		if (poll(&pfd, 1, -1) > 0)
+		{
+			uint64_t count;
+			if (read(w->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+			{
+				perror("read");
+			}
+		}
+	}
+	w->sleeping.store(0, std::memory_order_relaxed);
+}
+
+/// @brief main function of the worker thread
+/// @param arg struct worker
+/// @return
+void *worker_main(void *arg)
+{
+	struct worker *w = (struct worker *)arg;
+	struct resolver *res = w->res;
+	struct dns_query_request req;
+	struct latency_report report;
+	latency_report_init(&report, w->args->stats_interval);
+	char label[32];
+	snprintf(label, sizeof(label), "Thread %d: ", w->index);
+	bool held = false; // req was refused by the full resolver, it is submitted again after the poll
+	while (true)
+	{
+		if (res->latency != NULL)
+		{
+			latency_report_tick(&report, res->latency, w->batch.answered + w->batch.failed, label, w->err);
+		}
+		while (resolver_inflight(res) < res->window && (held || request_queue_pop(&w->input, &req)))
+		{
+			// -2: transmit queue or waiters are full
+			held = resolver_submit(res, &req) == -2;
+			if (held)
+			{
+				break;
+			}
+		}
+		if (resolver_inflight(res) == 0)
+		{
+			flush_worker_output(w);
+			if (held)
+			{
+				resolver_flush(res);
+				continue;
+			}
+			if (w->input_done.load(std::memory_order_acquire) && w->input.head.load() == w->input.tail.load())
+			{
+				break;
+			}
+			resolver_flush(res);
+			worker_sleep(w);
+			continue;
+		}
+		// short wait while more input may come, so the window stays full
+		bool more_input = held || (resolver_inflight(res) < res->window && !w->input_done.load(std::memory_order_acquire));
+		resolver_poll(res, more_input ? 1 : QUERY_TIMEOUT_MS);
+		flush_worker_output(w);
+		if (w->counters != NULL)
+		{
+			counters_publish(w->counters, res, w->batch.answered, w->batch.failed);
+		}
+	}
+	if (w->counters != NULL)
+	{
+		counters_publish(w->counters, res, w->batch.answered, w->batch.failed);
+	}
+	w->finished.store(1, std::memory_order_release);
+	return NULL;
+}
+
+/// @brief frees the first cnt workers
+/// @param workers
+/// @param cnt
+static void free_workers(struct worker *workers, int cnt)
+{
+	for (int i = 0; i < cnt; i++)
+	{
+		resolver_free(workers[i].res);
+		free(workers[i].res);
+		free(workers[i].input.items);
+		free(workers[i].output.buf);
+		output_free(&workers[i].out);
+		close(workers[i].wake_fd);
+	}
+	delete[] workers;
+}
+
+/// @brief writes output of all workers
+/// @param workers
+/// @param cnt
+/// @return number of drained bytes
+static size_t drain_workers(struct worker *workers, int cnt)
+{
+	size_t drained = 0;
+	for (int i = 0; i < cnt; i++)
+	{
+		drained += output_ring_drain(&workers[i].output);
+	}
+	return drained;
+}
+
+/// @brief resolves names from args->batch_file (or the -x prefix) with args->threads worker threads pinned to cores
+/// @param args
+/// @return 0 if all queries were answered, 1 otherwise
+int run_threaded_batch(struct parsed_arguments *args)
+{
+	struct query_source *src = (struct query_source *)malloc(sizeof(struct query_source));
+	if (src == NULL || source_open(src, args) < 0)
+	{
+		free(src);
+		return 1;
+	}
+
+	int threads = args->threads;
+	struct counters_segment counters;
+	counters.header = NULL;
+	if (args->counters[0] != '\0' && counters_create(&counters, args, threads, COUNTERS_BATCH) < 0)
+	{
+		source_close(src);
+		free(src);
+		return 1;
+	}
+	struct dns_cache *cache = cache_open(args, threads); // worker i uses only shard i
+	struct worker *workers = new worker[threads];
+	for (int i = 0; i < threads; i++)
+	{
+		struct worker *w = &workers[i];
+		w->index = i;
+		w->args = args;
+		w->batch.args = args;
+		w->batch.out = &w->out;
+		w->batch.err = &w->err;
+		w->batch.answered = 0;
+		w->batch.failed = 0;
+		w->counters = (counters.header != NULL) ? &counters.slots[i] : NULL;
+		w->input.items = (struct dns_query_request *)malloc(WORKER_INPUT_QUEUE * sizeof(struct dns_query_request));
+		w->input.head.store(0);
+		w->input.tail.store(0);
+		w->output.buf = (unsigned char *)malloc(WORKER_OUTPUT_RING);
+		output_init(&w->out, OUTPUT_CHUNK, -1);
+		w->output.head.store(0);
+		w->output.tail.store(0);
+		w->input_done.store(0);
+		w->finished.store(0);
+		w->sleeping.store(0);
+		w->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (w->wake_fd < 0)
+		{
+			perror("eventfd");
+		}
+		w->res = (struct resolver *)malloc(sizeof(struct resolver));
+		if (w->input.items == NULL || w->output.buf == NULL || w->out.data == NULL || w->wake_fd < 0 ||
+			w->res == NULL || resolver_init(w->res, args, print_batch_result, &w->batch) < 0)
+		{
+			free(w->input.items);
+			free(w->output.buf);
+			output_free(&w->out);
+			if (w->wake_fd >= 0)
+			{
+				close(w->wake_fd);
+			}
+			free(w->res);
+			free_workers(workers, i);
+			counters_close(&counters);
+			cache_close(cache, args);
+			source_close(src);
+			free(src);
+			return 1;
+		}
+		if (cache != NULL)
+		{
+			resolver_set_cache(w->res, cache, i);
+		}
+	}
+
+	if (args->format == FORMAT_CSV)
+	{
+		fputs(CSV_HEADER, stdout); // the rows come from all workers
+	}
+
+	long long start_us = now_us();
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	for (int i = 0; i < threads; i++)
+	{
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		cpu_set_t cpu;
+		CPU_ZERO(&cpu);
+		CPU_SET(i % cpus, &cpu);
+		pthread_attr_setaffinity_np(&attr, sizeof(cpu), &cpu);
+		pthread_create(&workers[i].thread, &attr, worker_main, &workers[i]);
+		pthread_attr_destroy(&attr);
+	}
+
+	unsigned long count = 0;
+	struct dns_query_request req;
+	while (source_next(src, &req, args))
+	{
+		struct worker *w = &workers[shard_of(req.name, threads)];
+		while (!request_queue_push(&w->input, &req))
+		{
+			if (drain_workers(workers, threads) == 0)
+			{
+				sched_yield();
+			}
+		}
+		wake_worker(w);
+		if ((++count & 255) == 0)
+		{
+			drain_workers(workers, threads);
+		}
+	}
+	for (int i = 0; i < threads; i++)
+	{
+		workers[i].input_done.store(1, std::memory_order_release);
+		wake_worker(&workers[i]);
+	}
+
+	int running = threads;
+	while (running > 0)
+	{
+		running = 0;
+		for (int i = 0; i < threads; i++)
+		{
+			running += !workers[i].finished.load(std::memory_order_acquire);
+		}
+		if (drain_workers(workers, threads) == 0 && running > 0)
+		{
+			usleep(100);
+		}
+	}
+	drain_workers(workers, threads);
+	fflush(stdout);
+
+	struct batch_stats stats;
+	std::memset(&stats, 0, sizeof(stats));
+	for (int i = 0; i < threads; i++)
+	{
+		pthread_join(workers[i].thread, NULL);
+		collect_batch_stats(&stats, &workers[i].batch, workers[i].res);
+	}
+	if (args->stats)
+	{
+		stats.elapsed_us = now_us() - start_us;
+		print_batch_stats(&stats, args);
+	}
+	latency_free(&stats.latency);
+
+	counters_close(&counters);
+	free_workers(workers, threads);
+	cache_close(cache, args);
+	source_close(src);
+	free(src);
+	return (stats.failed == 0) ? 0 : 1;
+}
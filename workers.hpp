@@ -0,0 +1,92 @@
+// author: Marek Kozumplik, xkozum08
+#pragma once
+#include "dns.hpp"
+#include "batch.hpp"
+#include <atomic>
+#include <sstream>
+#include <pthread.h>
+#include <sched.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+#define MAX_THREADS 256
+#define WORKER_INPUT_QUEUE 4096		 // requests, power of two
+#define WORKER_OUTPUT_RING (1 << 22) // bytes, power of two
+#define OUTPUT_CHUNK 65536			 // max size of one record in the output ring
+#define OUTPUT_STDERR_FLAG 0x80000000u
+
+// single producer single consumer ring of requests, main thread -> worker
+struct request_queue
+{
+	struct dns_query_request *items;
+	alignas(64) std::atomic<unsigned> head; // next item to pop, written by the worker
+	alignas(64) std::atomic<unsigned> tail; // next free item, written by the main thread
+};
+
+// single producer single consumer ring of formatted output, worker -> main thread.
+// Every record starts with 4 byte length, OUTPUT_STDERR_FLAG is set for stderr records
+struct output_ring
+{
+	unsigned char *buf;
+	alignas(64) std::atomic<unsigned> head; // written by the main thread
+	alignas(64) std::atomic<unsigned> tail; // written by the worker
+};
+
+struct worker
+{
+	pthread_t thread;
+	int index;
+	struct parsed_arguments *args;
+	struct resolver *res; // own sockets, transmit slots and receive ring
+	struct batch_context batch;
+	struct counters_slot *counters; // slot of the worker in the --counters segment, NULL if off
+	struct output_buffer out; // results formatted by the callbacks, moved to the output ring after every poll
+	std::ostringstream err;
+
+	struct request_queue input;
+	struct output_ring output;
+	std::atomic<int> input_done; // main thread pushed all requests
+	std::atomic<int> finished;	 // worker pushed all output, stats can be read
+	std::atomic<int> sleeping;	 // worker has no queries and waits for wake_fd
+	int wake_fd;				 // eventfd, the main thread writes it when it pushes to a sleeping worker
+};
+
+/// @brief pushes the request to the queue
+/// @param queue
+/// @param req
+/// @return false if the queue is full
+bool request_queue_push(struct request_queue *queue, struct dns_query_request *req);
+
+/// @brief pops request from the queue
+/// @param queue
+/// @param req
+/// @return false if the queue is empty
+bool request_queue_pop(struct request_queue *queue, struct dns_query_request *req);
+
+/// @brief writes text to the output ring, waits while the ring is full
+/// @param ring
+/// @param text
+/// @param len
+/// @param to_stderr
+void output_ring_write(struct output_ring *ring, const char *text, size_t len, bool to_stderr);
+
+/// @brief writes all records from the ring to stdout and stderr
+/// @param ring
+/// @return number of drained bytes
+size_t output_ring_drain(struct output_ring *ring);
+
+/// @brief returns index of the worker which resolves the name, same names always go to the same worker
+/// @param name
+/// @param threads
+/// @return
+int shard_of(const char *name, int threads);
+
+/// @brief main function of the worker thread
+/// @param arg struct worker
+/// @return
+void *worker_main(void *arg);
+
+/// @brief resolves names from args->batch_file (or the -x prefix) with args->threads worker threads pinned to cores
+/// @param args
+/// @return 0 if all queries were answered, 1 otherwise
+int run_threaded_batch(struct parsed_arguments *args);